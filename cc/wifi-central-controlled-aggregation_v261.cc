@@ -161,6 +161,49 @@ Two possibilities:
 // see https://www.nsnam.org/docs/release/3.7/tutorial/tutorial_21.html
 // see https://www.nsnam.org/docs/tutorial/html/tweaking.html#usinglogging
 
+// Scenario files
+//  Instead of writing all the parameters in the command line, they can be written in a file (see the format
+//  in wifi-scenario-file.h), one per line ("numberTCPdownload = 3"), with comments and includes:
+//
+// ns-3.30.1$ ./waf --run "scratch/wifi-central-controlled-aggregation_v261 --scenarioFile=test_lvap_016.scenario"
+//
+//  The parameters of the command line have priority over the ones of the file. If the file has sweeps
+//  ("sweep numberTCPdownload = 1:6"), they are run by wifi-sweep-runner.cc. A single run only accepts it if
+//  the swept parameters are also in the command line
+
+// Replications in the same process
+//  Instead of running the program once per seed, a number of replications can be run one after the other
+//  in the same process, with --replications=file. Each line of the file has the parameters of a replication,
+//  as in the command line (e.g. "--RngRun=3 --outputFileSurname=seed-3", or "--scenarioFile=run3.scenario").
+//  The parameters of the command line are used in all of them. The state of the controller and of ns-3 is
+//  built again for each replication (see ControllerState and ReplicationContext). The streams of the random
+//  variables are not reset, so a replication is statistically independent, but it does not get exactly the
+//  same results as a separate process with the same RngRun
+
+// Warm start of a number of variants of the controller
+//  If the same scenario has to be run with different parameters of the controller, the part before the
+//  controller starts working (the topology, the association of the STAs) can be simulated only once. With
+//  --warmStartVariants=file, the simulation runs until all the active STAs are associated, and then the
+//  process forks a child per line of the file. Each child continues the simulation with the parameters of its
+//  line, and the children share the memory pages of the common part (copy-on-write). At most one child per
+//  core runs at the same time (--warmStartJobs=N changes it); the rest wait for a free one. Example of a line:
+//
+//    --outputFileSurname=budget-60ms --latencyBudget=0.060 --stepAdjustAmpdu=2000
+//
+//  Only these parameters can be set in a variant: outputFileSurname (mandatory, a different one per line),
+//  latencyBudget, methodAdjustAmpdu, stepAdjustAmpdu and latencyPercentileAmpdu, and they are checked as the
+//  ones of the command line. The output files of each child have its own surname, and include the results of
+//  the common part. The process that forks does not leave any output file. The common part finishes, at the
+//  latest, just before the controller is called for the first time (INITIALTIMEINTERVAL + timeMonitorKPIs), so
+//  each variant is the same as a complete run
+
+// Initial interval
+//  The applications start after an initial interval (1 s by default), so the STAs have time to scan and
+//  associate, and the same time is added at the end. The STAs usually associate well before, so the interval
+//  can be shortened with --initialTimeInterval=0.3, and each run simulates less time. With verboseLevel > 0,
+//  the time when all the active STAs have associated is printed. If they have not associated when the
+//  applications start, a warning is printed
+
 // Output files
 //  You can establish a 'name' and a 'surname' for the output files, using the parameters:
 //    --outputFileName=name --outputFileSurname=seed-1
@@ -180,6 +223,26 @@ Two possibilities:
 //    - name_seed-1_KPIs.txt                        text file reporting periodically the KPIs (generated if aggregationDynamicAlgorithm==1)
 //    - name_seed-1_positions.txt                   text file reporting periodically the positions of the STAs
 //    - name_seed-1_AMPDUvalues.txt                 text file reporting periodically the AMPDU values (generated if aggregationDynamicAlgorithm==1)
+//    - name_seed-1_latencyAPs.txt                  text file reporting periodically the percentiles of the delay in each AP
+//    - name_seed-1_progress.txt                    speed of the simulator, peak memory and ETA, every 'printSeconds' (generated if saveProgress==1)
+//
+//  With --binaryOutputFiles=1, the periodic files (KPIs, positions, AMPDUvalues, latencyAPs) are written
+//  in a binary columnar format, with the extension .bin instead of .txt (see TraceWriter)
+//
+//  With --resultStore=1, all the results of the run are written as tables of a single binary file instead:
+//    - name_seed-1_results.bin                     tables "run", "positions", "KPIs", "latencyAPs", "AMPDUvalues",
+//                                                  "flows" and "histograms" (they replace _flows.txt and the
+//                                                  histogram files). _average.txt is still written.
+//  The program wifi-results-reader.cc maps many of these files and obtains the lines of _average.txt
+//
+//  With --averageShardDirectory=dir, nothing is appended to name_average.txt. Each run writes its line to its
+//  own file instead, so a number of runs with the same name can be executed at the same time:
+//    - dir/name_seed-1_average.txt                 it appears complete when the run finishes (it is written to
+//                                                  a temporary file, which is then renamed). It is not written
+//                                                  if the run fails
+//  The lines of all the runs are then merged with
+//    ./wifi-results-reader --average=name_average.txt dir/name_*_average.txt
+//  The file _results.bin of the result store is also written to a temporary file and renamed at the end
 //    - name_seed-1_flowmonitor.xml
 //    - name_seed-1_AP-0.2.pcap                     pcap file of the device 2 of AP #0
 //    - name_seed-1_server-2-1.pcap                 pcap file of the device 1 of server #2
@@ -204,8 +267,21 @@ Two possibilities:
 #include "ns3/random-variable-stream.h"
 #include "ns3/ht-configuration.h"
 #include "ns3/he-configuration.h"
+#include "wifi-scenario-file.h"     // it has to be in the same directory as this file
 #include <sstream>
 #include <iomanip>
+#include <set>
+#include <unordered_map>
+#include <functional>
+#include <cmath>
+#include <map>
+#include <algorithm>
+#include <limits>
+#include <chrono>
+#include <cstdio>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
 
 //#include "ns3/arp-cache.h"  // If you want to do things with the ARPs
 //#include "ns3/arp-header.h"
@@ -252,7 +328,11 @@ using namespace ns3;
 
 #define MTU 1500    // The value of the MTU of the packets
 
-#define INITIALTIMEINTERVAL 1.0 // time before the applications start (seconds). The same amount of time is added at the end
+#define INITIALTIMEINTERVALDEFAULT 1.0 // time before the applications start (seconds). The same amount of time is added at the end
+double initialTimeInterval = INITIALTIMEINTERVALDEFAULT;  // it can be shortened with --initialTimeInterval
+#define INITIALTIMEINTERVAL initialTimeInterval
+
+#define WARMSTART_CHECK_PERIOD 0.1 // with warm start, the association of the STAs is checked with this period (seconds)
 
 #define HANDOFFMETHOD 0     // 1 - ns3 is in charge of the channel switch of the STA for performing handoffs 
                             // 0 - the handoff method is implemented in this script
@@ -260,35 +340,95 @@ using namespace ns3;
 // Define a log component
 NS_LOG_COMPONENT_DEFINE ("SimpleMpduAggregation");
 
-std::string getWirelessBandOfChannel(uint8_t channel) {
-  // see https://en.wikipedia.org/wiki/List_of_WLAN_channels#2.4_GHz_(802.11b/g/n/ax)
-  if (channel <= 14 ) {
-    return "2.4 GHz";
-  }
-  else {
-    return "5 GHz";
-  }
+// frequency bands. It is a bitmask, so a dual AP or STA is BAND_24GHZ | BAND_5GHZ = BAND_BOTH
+enum wifiBand : uint8_t {
+  BAND_NONE   = 0,
+  BAND_24GHZ  = 1,
+  BAND_5GHZ   = 2,
+  BAND_BOTH   = 3
+};
+
+// bands are printed as they were when they were strings, so the output files do not change
+std::ostream& operator<< (std::ostream& os, wifiBand band) {
+  if (band == BAND_24GHZ)
+    os << "2.4 GHz";
+  else if (band == BAND_5GHZ)
+    os << "5 GHz";
+  else if (band == BAND_BOTH)
+    os << "both";
+  else
+    os << "none";
+  return os;
 }
 
-std::string getWirelessBandOfStandard(enum ns3::WifiPhyStandard standard) {
+//the list of channels is here: https://www.nsnam.org/docs/models/html/wifi-user.html
+// see https://en.wikipedia.org/wiki/List_of_WLAN_channels
+
+//constexpr uint8_t availableChannels24GHz20MHz[NUM_CHANNELS_24GHZ] = {1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12};
+constexpr uint8_t availableChannels24GHz20MHz[NUM_CHANNELS_24GHZ] = {1, 6, 11};
+
+constexpr uint8_t availableChannels20MHz[NUM_CHANNELS_5GHZ_20MHZ] = {36, 40, 44, 48, 52, 56, 60, 64, 100, 104, 108, 112,
+                                                                    116, 120, 124, 128, 132, 136, 140, 144, 149, 153, 157, 
+                                                                    161, 165, 169, 173, 184, 188, 192, 196, 8, 12, 16};
+
+constexpr uint8_t availableChannels40MHz[NUM_CHANNELS_5GHZ_40MHZ] = {38, 46, 54, 62, 102, 110, 118, 126, 134, 142, 151, 159}; 
+
+constexpr uint8_t availableChannels80MHz[NUM_CHANNELS_5GHZ_80MHZ] = {42, 58, 106, 122, 138, 155}; 
+
+constexpr uint8_t availableChannels160MHz[NUM_CHANNELS_5GHZ_160MHZ] = {50, 114};
+
+// true if 'channel' is one of the first 'n' elements of 'channels'
+constexpr bool channelInSet (uint8_t channel, const uint8_t* channels, uint32_t n) {
+  return (n > 0) && ((channels[n - 1] == channel) || channelInSet (channel, channels, n - 1));
+}
+
+// band of a channel, checking the sets of channels above. Note that channels 8, 12 and 16
+//are 5 GHz channels in those sets, so the channel number is not enough
+// Other channels (including 0, used for inactive APs) follow the usual numbering:
+//see https://en.wikipedia.org/wiki/List_of_WLAN_channels#2.4_GHz_(802.11b/g/n/ax)
+constexpr wifiBand bandOfChannelNumber (uint8_t channel) {
+  return channelInSet (channel, availableChannels24GHz20MHz, NUM_CHANNELS_24GHZ) ? BAND_24GHZ :
+         ( channelInSet (channel, availableChannels20MHz, NUM_CHANNELS_5GHZ_20MHZ) ||
+           channelInSet (channel, availableChannels40MHz, NUM_CHANNELS_5GHZ_40MHZ) ||
+           channelInSet (channel, availableChannels80MHz, NUM_CHANNELS_5GHZ_80MHZ) ||
+           channelInSet (channel, availableChannels160MHz, NUM_CHANNELS_5GHZ_160MHZ) ) ? BAND_5GHZ :
+         (channel <= 14) ? BAND_24GHZ : BAND_5GHZ;
+}
+
+// table with the band of each channel number, filled at compile time
+#define BAND_OF_4_CHANNELS(c)   bandOfChannelNumber(c), bandOfChannelNumber(c + 1), bandOfChannelNumber(c + 2), bandOfChannelNumber(c + 3)
+#define BAND_OF_16_CHANNELS(c)  BAND_OF_4_CHANNELS(c), BAND_OF_4_CHANNELS(c + 4), BAND_OF_4_CHANNELS(c + 8), BAND_OF_4_CHANNELS(c + 12)
+#define BAND_OF_64_CHANNELS(c)  BAND_OF_16_CHANNELS(c), BAND_OF_16_CHANNELS(c + 16), BAND_OF_16_CHANNELS(c + 32), BAND_OF_16_CHANNELS(c + 48)
+
+constexpr wifiBand bandOfChannel[256] = { BAND_OF_64_CHANNELS(0), BAND_OF_64_CHANNELS(64), BAND_OF_64_CHANNELS(128), BAND_OF_64_CHANNELS(192) };
+
+static_assert (bandOfChannel[6] == BAND_24GHZ, "channel 6 must be in the 2.4 GHz band");
+static_assert (bandOfChannel[12] == BAND_5GHZ, "channel 12 is used as a 5 GHz channel");
+static_assert (bandOfChannel[155] == BAND_5GHZ, "channel 155 must be in the 5 GHz band");
+
+wifiBand getWirelessBandOfChannel(uint8_t channel) {
+  return bandOfChannel[channel];
+}
+
+wifiBand getWirelessBandOfStandard(enum ns3::WifiPhyStandard standard) {
   // see https://en.wikipedia.org/wiki/List_of_WLAN_channels#2.4_GHz_(802.11b/g/n/ax)
   if (standard == WIFI_PHY_STANDARD_80211a ) {
-    return "5 GHz"; // 5GHz
+    return BAND_5GHZ; // 5GHz
   }
   else if (standard == WIFI_PHY_STANDARD_80211b ) {
-    return "2.4 GHz";
+    return BAND_24GHZ;
   }
   else if (standard == WIFI_PHY_STANDARD_80211g ) {
-    return "2.4 GHz";
+    return BAND_24GHZ;
   }
   else if (standard == WIFI_PHY_STANDARD_80211n_2_4GHZ  ) {
-    return "2.4 GHz";
+    return BAND_24GHZ;
   }
   else if (standard == WIFI_PHY_STANDARD_80211n_5GHZ  ) {
-    return "5 GHz";
+    return BAND_5GHZ;
   }
   else if (standard == WIFI_PHY_STANDARD_80211ac ) {
-    return "5 GHz";
+    return BAND_5GHZ;
   }
   // if I am here, it means I have asked for an unsupported standard (unsupported by this program so far)
   NS_ASSERT(false);
@@ -318,88 +458,88 @@ ns3::WifiPhyStandard convertVersionToStandard (std::string my_version80211) {
 // 0  both bands are supported
 // 2  2.4GHz band is supported
 // 5  5GHz band is supported
-std::string bandsSupportedByTheAPs(int numberAPsSamePlace, std::string version80211primary, std::string version80211secondary) {
+wifiBand bandsSupportedByTheAPs(int numberAPsSamePlace, std::string version80211primary, std::string version80211secondary) {
   if (numberAPsSamePlace == 1) {
     // single WiFi card
     return getWirelessBandOfStandard(convertVersionToStandard(version80211primary));
   }
   else if (numberAPsSamePlace == 2) {
     // two WiFi cards
-    if (getWirelessBandOfStandard(convertVersionToStandard(version80211primary)) == "5 GHz" ) {
-      if (getWirelessBandOfStandard(convertVersionToStandard(version80211secondary)) == "2.4 GHz" ) {
-        return "both"; // both bands are supported by the AP
+    if (getWirelessBandOfStandard(convertVersionToStandard(version80211primary)) == BAND_5GHZ ) {
+      if (getWirelessBandOfStandard(convertVersionToStandard(version80211secondary)) == BAND_24GHZ ) {
+        return BAND_BOTH; // both bands are supported by the AP
       }
-      else if (getWirelessBandOfStandard(convertVersionToStandard(version80211secondary)) == "5 GHz" ) {
+      else if (getWirelessBandOfStandard(convertVersionToStandard(version80211secondary)) == BAND_5GHZ ) {
         std::cout << "ERROR: both interfaces of the AP are in the same band - "
                   << "FINISHING SIMULATION"
                   << std::endl;
         NS_ASSERT(false); // both interfaces of the AP are in the same band
-        return "";
+        return BAND_NONE;
       }
     }
-    else if (getWirelessBandOfStandard(convertVersionToStandard(version80211primary)) == "2.4 GHz" ) {
-      if (getWirelessBandOfStandard(convertVersionToStandard(version80211secondary)) == "5 GHz" ) {
-        return "both"; // both bands are supported by the AP
+    else if (getWirelessBandOfStandard(convertVersionToStandard(version80211primary)) == BAND_24GHZ ) {
+      if (getWirelessBandOfStandard(convertVersionToStandard(version80211secondary)) == BAND_5GHZ ) {
+        return BAND_BOTH; // both bands are supported by the AP
       }
-      else if (getWirelessBandOfStandard(convertVersionToStandard(version80211secondary)) == "2.4 GHz" ) {
+      else if (getWirelessBandOfStandard(convertVersionToStandard(version80211secondary)) == BAND_24GHZ ) {
         std::cout << "ERROR: both interfaces of the AP are in the same band - "
                   << "FINISHING SIMULATION"
                   << std::endl;
         NS_ASSERT(false); // both interfaces of the AP are in the same band
-        return "";
+        return BAND_NONE;
       }
     }
   }
   else {
     // only 2 wireless cards are supported so far
     NS_ASSERT(false);
-    return "";
+    return BAND_NONE;
   }
-  return "";
+  return BAND_NONE;
 }
 
 // returns
 // 0  both bands are supported
 // 2  2.4GHz band is supported
 // 5  5GHz band is supported
-std::string bandsSupportedByTheSTAs(int numberSTAsSamePlace, std::string version80211primary, std::string version80211secondary) {
+wifiBand bandsSupportedByTheSTAs(int numberSTAsSamePlace, std::string version80211primary, std::string version80211secondary) {
   if (numberSTAsSamePlace == 1) {
     // single WiFi card
     return getWirelessBandOfStandard(convertVersionToStandard(version80211primary));
   }
   else if (numberSTAsSamePlace == 2) {
     // two WiFi cards
-    if (getWirelessBandOfStandard(convertVersionToStandard(version80211primary)) == "5 GHz" ) {
-      if (getWirelessBandOfStandard(convertVersionToStandard(version80211secondary)) == "2.4 GHz" ) {
-        return "both"; // both bands are supported by the STA
+    if (getWirelessBandOfStandard(convertVersionToStandard(version80211primary)) == BAND_5GHZ ) {
+      if (getWirelessBandOfStandard(convertVersionToStandard(version80211secondary)) == BAND_24GHZ ) {
+        return BAND_BOTH; // both bands are supported by the STA
       }
-      else if (getWirelessBandOfStandard(convertVersionToStandard(version80211secondary)) == "5 GHz" ) {
+      else if (getWirelessBandOfStandard(convertVersionToStandard(version80211secondary)) == BAND_5GHZ ) {
         std::cout << "ERROR: both interfaces of the STA are in the same band - "
                   << "FINISHING SIMULATION"
                   << std::endl;
         NS_ASSERT(false); // both interfaces of the STA are in the same band
-        return "";
+        return BAND_NONE;
       }
     }
-    else if (getWirelessBandOfStandard(convertVersionToStandard(version80211primary)) == "2.4 GHz" ) {
-      if (getWirelessBandOfStandard(convertVersionToStandard(version80211secondary)) == "5 GHz" ) {
-        return "both"; // both bands are supported by the STA
+    else if (getWirelessBandOfStandard(convertVersionToStandard(version80211primary)) == BAND_24GHZ ) {
+      if (getWirelessBandOfStandard(convertVersionToStandard(version80211secondary)) == BAND_5GHZ ) {
+        return BAND_BOTH; // both bands are supported by the STA
       }
-      else if (getWirelessBandOfStandard(convertVersionToStandard(version80211secondary)) == "2.4 GHz" ) {
+      else if (getWirelessBandOfStandard(convertVersionToStandard(version80211secondary)) == BAND_24GHZ ) {
         std::cout << "ERROR: both interfaces of the STA are in the same band - "
                   << "FINISHING SIMULATION"
                   << std::endl;
         NS_ASSERT(false); // both interfaces of the STA are in the same band
-        return "";
+        return BAND_NONE;
       }
     }
   }
   else {
     // only 2 bands are supported
     NS_ASSERT(false);
-    return "";
+    return BAND_NONE;
   }
-  return "";
+  return BAND_NONE;
 }
 
 /*  this works, but it is not needed
@@ -1266,47 +1406,76 @@ void PopulateArpCache (uint32_t nodenumber, Ptr <Node> mynode)
 /************* END of the ARP part (not used) *************/
 
 
-// Modify the max AMPDU value of a node
-void ModifyAmpdu (uint32_t nodeNumber, uint32_t ampduValue, uint32_t myverbose)
+// This class stores, for each node, pointers to the RegularWifiMac of all its WifiNetDevices.
+// They are resolved the first time a node is used, so the AMPDU can later be modified
+//without building a Config path and walking the object graph each time
+// There are 4 queues: VI, VO, BE and BK
+// These are the attributes of regular-wifi-mac: https://www.nsnam.org/doxygen/regular-wifi-mac_8cc_source.html
+class AmpduController
 {
-  // These are the attributes of regular-wifi-mac: https://www.nsnam.org/doxygen/regular-wifi-mac_8cc_source.html
-  // You have to build a line like this (e.g. for node 0):
-  // Config::Set("/NodeList/0/DeviceList/*/$ns3::WifiNetDevice/Mac/$ns3::RegularWifiMac/BE_MaxAmpduSize", UintegerValue(ampduValue));
-  // There are 4 queues: VI, VO, BE and BK
-
-  // FIXME: Check if I only have to modify the parameters of all the devices (*), or only some of them.
+  public:
+    void SetMaxAmpduSize (uint32_t nodeNumber, uint32_t ampduValue);
+  private:
+    const std::vector<Ptr<RegularWifiMac> >& GetMacs (uint32_t nodeNumber);
+    std::vector<std::vector<Ptr<RegularWifiMac> > > macsOfNode;  // indexed by node id
+    std::vector<bool> resolved;                                  // indexed by node id. True if macsOfNode is already filled
+};
 
-  // I use an auxiliar string for creating the first argument of Config::Set
-  std::ostringstream auxString;
+const std::vector<Ptr<RegularWifiMac> >&
+AmpduController::GetMacs (uint32_t nodeNumber)
+{
+  if (nodeNumber >= resolved.size ()) {
+    macsOfNode.resize (nodeNumber + 1);
+    resolved.resize (nodeNumber + 1, false);
+  }
 
-  // VI queue
-  auxString << "/NodeList/" << nodeNumber << "/DeviceList/*/$ns3::WifiNetDevice/Mac/$ns3::RegularWifiMac/VI_MaxAmpduSize";
-  // std::cout << auxString.str() << '\n';
-  Config::Set(auxString.str(),  UintegerValue(ampduValue));
+  if (!resolved[nodeNumber]) {
+    // this is equivalent to "/NodeList/<nodeNumber>/DeviceList/*/$ns3::WifiNetDevice/Mac/$ns3::RegularWifiMac"
+    Ptr<Node> myNode = NodeList::GetNode (nodeNumber);
+    for (uint32_t i = 0; i < myNode->GetNDevices (); i++) {
+      Ptr<WifiNetDevice> myDevice = DynamicCast<WifiNetDevice> (myNode->GetDevice (i));
+      if (myDevice != 0) {
+        Ptr<RegularWifiMac> myMac = DynamicCast<RegularWifiMac> (myDevice->GetMac ());
+        if (myMac != 0)
+          macsOfNode[nodeNumber].push_back (myMac);
+      }
+    }
+    resolved[nodeNumber] = true;
+  }
+  return macsOfNode[nodeNumber];
+}
 
-  // clean the string
-  auxString.str(std::string());
+void
+AmpduController::SetMaxAmpduSize (uint32_t nodeNumber, uint32_t ampduValue)
+{
+  // FIXME: Check if I only have to modify the parameters of all the devices (*), or only some of them.
+  const std::vector<Ptr<RegularWifiMac> >& myMacs = GetMacs (nodeNumber);
+  UintegerValue myValue (ampduValue);
 
-  // VO queue
-  auxString << "/NodeList/" << nodeNumber << "/DeviceList/*/$ns3::WifiNetDevice/Mac/$ns3::RegularWifiMac/VO_MaxAmpduSize"; 
-  // std::cout << auxString.str() << '\n';
-  Config::Set(auxString.str(),  UintegerValue(ampduValue));
+  for (std::vector<Ptr<RegularWifiMac> >::const_iterator index = myMacs.begin (); index != myMacs.end (); index++) {
+    (*index)->SetAttribute ("VI_MaxAmpduSize", myValue);
+    (*index)->SetAttribute ("VO_MaxAmpduSize", myValue);
+    (*index)->SetAttribute ("BE_MaxAmpduSize", myValue);
+    (*index)->SetAttribute ("BK_MaxAmpduSize", myValue);
+  }
+}
 
-  // clean the string
-  auxString.str(std::string());
+// a member of the state of the replication, like the rest of the state of the controller (see ControllerState)
+extern AmpduController& ampduController;
 
-  // BE queue
-  auxString << "/NodeList/" << nodeNumber << "/DeviceList/*/$ns3::WifiNetDevice/Mac/$ns3::RegularWifiMac/BE_MaxAmpduSize"; 
-  // std::cout << auxString.str() << '\n';
-  Config::Set(auxString.str(),  UintegerValue(ampduValue));
+// a pending modification of the AMPDU of a node
+struct AmpduUpdate
+{
+  uint32_t nodeNumber;
+  uint32_t ampduValue;
+};
 
-  // clean the string
-  auxString.str(std::string());
+typedef std::vector<AmpduUpdate> AmpduUpdateVector;
 
-  // BK queue
-  auxString << "/NodeList/" << nodeNumber << "/DeviceList/*/$ns3::WifiNetDevice/Mac/$ns3::RegularWifiMac/BK_MaxAmpduSize"; 
-  //std::cout << auxString.str() << '\n';
-  Config::Set(auxString.str(),  UintegerValue(ampduValue));  
+// Modify the max AMPDU value of a node
+void ModifyAmpdu (uint32_t nodeNumber, uint32_t ampduValue, uint32_t myverbose)
+{
+  ampduController.SetMaxAmpduSize (nodeNumber, ampduValue);
 
   if ( myverbose > 1 )
     std::cout << Simulator::Now().GetSeconds()
@@ -1315,6 +1484,13 @@ void ModifyAmpdu (uint32_t nodeNumber, uint32_t ampduValue, uint32_t myverbose)
               << std::endl;
 }
 
+// Modify the max AMPDU value of a number of nodes at the same time
+void ModifyAmpduBatch (const AmpduUpdateVector &updates, uint32_t myverbose)
+{
+  for (AmpduUpdateVector::const_iterator index = updates.begin (); index != updates.end (); index++)
+    ModifyAmpdu (index->nodeNumber, index->ampduValue, myverbose);
+}
+
 
 /*
 // Not used
@@ -1338,15 +1514,145 @@ GetPosition (Ptr<Node> node)
 }
 
 
-// Print the simulation time to std::cout
-static void printTime (double period, std::string myoutputFileName, std::string myoutputFileSurname)
+// Wall-clock time spent in the functions of the controller that are called by the simulator (the scheduled
+//functions and the trace sinks), so it can be compared with the time of the simulator itself. Each of these
+//functions creates a CallbackTimer when it starts. The times are inclusive: if a measured function calls
+//another one (e.g. KPIScheduler::Run calls adjustAMPDU), the time of the second is also in the first. Only the
+//functions that are not called by another measured one are added to the total of the controller
+class CallbackProfiler
 {
-  std::cout << Simulator::Now().GetSeconds() << "\t" 
-            << myoutputFileName << "_" 
-            << myoutputFileSurname << '\n';
+  public:
+    CallbackProfiler ();
+    void Enable (bool enable);
+    bool IsEnabled ();
+    void Start ();
+    void Stop (const char* functionName, double wallSeconds);
+    void Print (double runWallSeconds);
+  private:
+    struct callbackStatistics {
+      uint64_t calls;
+      double totalSeconds;
+      double maxSeconds;
+    };
+    bool enabled;
+    uint32_t depth;                   // number of measured functions that are running (one inside the other)
+    double topLevelSeconds;           // time of the functions that are not called by another measured one
+    std::map<std::string, callbackStatistics> statistics;
+};
 
-  // re-schedule 
-  Simulator::Schedule (Seconds (period), &printTime, period, myoutputFileName, myoutputFileSurname);
+CallbackProfiler::CallbackProfiler ()
+{
+  enabled = false;
+  depth = 0;
+  topLevelSeconds = 0.0;
+}
+
+void
+CallbackProfiler::Enable (bool enable)
+{
+  enabled = enable;
+}
+
+bool
+CallbackProfiler::IsEnabled ()
+{
+  return enabled;
+}
+
+// called when a measured function starts
+void
+CallbackProfiler::Start ()
+{
+  depth++;
+}
+
+// called when a measured function finishes
+void
+CallbackProfiler::Stop (const char* functionName, double wallSeconds)
+{
+  NS_ASSERT (depth > 0);
+  depth--;
+  if (depth == 0)
+    topLevelSeconds += wallSeconds;
+
+  std::map<std::string, callbackStatistics>::iterator found = statistics.find (functionName);
+  if (found == statistics.end ()) {
+    callbackStatistics newStatistics = {0, 0.0, 0.0};
+    found = statistics.insert (std::make_pair (std::string (functionName), newStatistics)).first;
+  }
+  found->second.calls++;
+  found->second.totalSeconds += wallSeconds;
+  found->second.maxSeconds = std::max (found->second.maxSeconds, wallSeconds);
+}
+
+// a table with a row per function, from the highest total time to the lowest
+void
+CallbackProfiler::Print (double runWallSeconds)
+{
+  std::vector<std::pair<double, std::string> > order;
+  for (std::map<std::string, callbackStatistics>::iterator i = statistics.begin (); i != statistics.end (); ++i)
+    order.push_back (std::make_pair (i->second.totalSeconds, i->first));
+  std::sort (order.rbegin (), order.rend ());
+
+  // the format of std::cout is restored at the end, so the output that comes later is not changed
+  std::ios::fmtflags flags = std::cout.flags ();
+  std::streamsize precision = std::cout.precision ();
+
+  std::cout << "\n"
+            << "Wall-clock time of the functions of the controller (inclusive):\n"
+            << std::left << std::setw (28) << "function" << std::right
+            << std::setw (12) << "calls"
+            << std::setw (14) << "total [s]"
+            << std::setw (14) << "mean [us]"
+            << std::setw (14) << "max [us]"
+            << std::setw (14) << "% of the run" << '\n';
+
+  for (uint32_t i = 0; i < order.size (); i++) {
+    const callbackStatistics& row = statistics[order[i].second];
+    std::cout << std::left << std::setw (28) << order[i].second << std::right
+              << std::setw (12) << row.calls
+              << std::setw (14) << std::fixed << std::setprecision (3) << row.totalSeconds
+              << std::setw (14) << std::setprecision (1) << row.totalSeconds * 1000000.0 / row.calls
+              << std::setw (14) << row.maxSeconds * 1000000.0
+              << std::setw (14) << std::setprecision (2) << (runWallSeconds > 0.0 ? 100.0 * row.totalSeconds / runWallSeconds : 0.0)
+              << '\n';
+  }
+
+  std::cout << "Simulation run: " << std::setprecision (3) << runWallSeconds << " s. "
+            << "Functions of the controller: " << topLevelSeconds << " s. "
+            << "Simulator and the rest: " << runWallSeconds - topLevelSeconds << " s\n";
+  std::cout.flags (flags);
+  std::cout.precision (precision);
+}
+
+extern CallbackProfiler& callbackProfiler;
+
+// measures the wall-clock time from its creation until the end of the function where it is declared
+class CallbackTimer
+{
+  public:
+    CallbackTimer (const char* functionName);
+    ~CallbackTimer ();
+  private:
+    const char* name;
+    bool measuring;
+    std::chrono::steady_clock::time_point start;
+};
+
+CallbackTimer::CallbackTimer (const char* functionName)
+{
+  name = functionName;
+  measuring = callbackProfiler.IsEnabled ();
+  if (measuring) {
+    callbackProfiler.Start ();
+    start = std::chrono::steady_clock::now ();
+  }
+}
+
+CallbackTimer::~CallbackTimer ()
+{
+  if (measuring)
+    callbackProfiler.Stop (name, std::chrono::duration<double> (std::chrono::steady_clock::now () - start).count ());
 }
 
 
@@ -1542,36 +1848,31 @@ class AP_record
 {
   public:
     AP_record ();
-    //void SetApRecord (uint16_t thisId, Mac48Address thisMac);
-    void SetApRecord (uint16_t thisId, std::string thisMac, uint32_t thisMaxSizeAmpdu);
-    //uint16_t GetApid (Mac48Address thisMac);
+    void SetApRecord (uint16_t thisId, Mac48Address thisMac, uint32_t thisMaxSizeAmpdu);
     uint16_t GetApid ();
-    //Mac48Address GetMac (uint16_t thisId);
-    std::string GetMac ();
+    Mac48Address GetMac ();
     uint32_t GetMaxSizeAmpdu ();
     uint8_t GetWirelessChannel();
     void setWirelessChannel(uint8_t thisWirelessChannel);
   private:
     uint16_t apId;
-    //Mac48Address apMac;
-    std::string apMac;
+    Mac48Address apMac;
     uint32_t apMaxSizeAmpdu;
     uint8_t apWirelessChannel; // if the channel is '0' it means that the AP is NOT active
 };
 
 typedef std::vector <AP_record * > AP_recordVector;
-AP_recordVector AP_vector;
+extern AP_recordVector& AP_vector;
 
 AP_record::AP_record ()
 {
   apId = 0;
-  apMac = "02-06-00:00:00:00:00:00";
+  apMac = "00:00:00:00:00:00";
   apMaxSizeAmpdu = 0;
 }
 
 void
-//AP_record::SetApRecord (uint16_t thisId, Mac48Address thisMac)
-AP_record::SetApRecord (uint16_t thisId, std::string thisMac, uint32_t thisMaxSizeAmpdu)
+AP_record::SetApRecord (uint16_t thisId, Mac48Address thisMac, uint32_t thisMaxSizeAmpdu)
 {
   apId = thisId;
   apMac = thisMac;
@@ -1580,14 +1881,12 @@ AP_record::SetApRecord (uint16_t thisId, std::string thisMac, uint32_t thisMaxSi
 
 
 uint16_t
-//AP_record::GetApid (Mac48Address thisMac)
 AP_record::GetApid ()
 {
   return apId;
 }
 
-//Mac48Address
-std::string
+Mac48Address
 AP_record::GetMac ()
 {
   return apMac;
@@ -1605,18 +1904,248 @@ AP_record::setWirelessChannel(uint8_t thisWirelessChannel)
   apWirelessChannel = thisWirelessChannel;
 }
 
+// Uniform grid over the positions of the active APs, with a separate grid for each band.
+// APs do not move and their channels are set at the beginning, so it is built once, after
+//setting the channel of every AP. Then the nearest AP, or the APs that may cover a STA, can be
+//found by looking only at the cells around the STA, instead of checking all the APs
+class AP_spatial_index
+{
+  public:
+    AP_spatial_index ();
+    void Build (NodeContainer APs, double cellSize);
+    bool IsBuilt ();
+    Ptr<Node> GetNearestAP (Vector pos, wifiBand frequencyBand);
+    void GetAPsWithinRange (Vector pos, double range, wifiBand frequencyBand, std::vector<uint16_t> &result);
+  private:
+    struct indexedAP {
+      uint16_t apId;
+      Ptr<Node> node;
+      double x;
+      double y;
+    };
+    struct bandGrid {
+      double minX;
+      double minY;
+      int32_t numCellsX;
+      int32_t numCellsY;
+      std::vector<std::vector<indexedAP> > cells;  // the index of a cell is x + y * numCellsX
+    };
+    void BuildGrid (bandGrid &grid, const std::vector<indexedAP> &myAPs);
+    int32_t GetCell (double coordinate, double minCoordinate, int32_t numCells);
+    void NearestInGrid (const bandGrid &grid, Vector pos, const indexedAP* &best, double &bestDistance);
+    void WithinRangeInGrid (const bandGrid &grid, Vector pos, double range, std::vector<uint16_t> &result);
+    bool built;
+    double indexCellSize;
+    bandGrid grid24GHz;
+    bandGrid grid5GHz;
+};
+
+AP_spatial_index::AP_spatial_index ()
+{
+  built = false;
+  indexCellSize = 1.0;
+}
+
+bool
+AP_spatial_index::IsBuilt ()
+{
+  return built;
+}
+
+// 'APs' must contain all the APs, ordered by id (as 'AP_vector')
+void
+AP_spatial_index::Build (NodeContainer APs, double cellSize)
+{
+  NS_ASSERT(APs.GetN() == AP_vector.size());
+
+  if (cellSize > 0.0)
+    indexCellSize = cellSize;
+
+  std::vector<indexedAP> APs24GHz;
+  std::vector<indexedAP> APs5GHz;
+
+  for (NodeContainer::Iterator i = APs.Begin (); i != APs.End (); ++i) {
+    uint8_t channelThisAP = AP_vector[(*i)->GetId()]->GetWirelessChannel();
+
+    // inactive APs are not indexed
+    if (channelThisAP != 0) {
+      Vector posAp = GetPosition (*i);
+      indexedAP thisAP = { (uint16_t)(*i)->GetId(), *i, posAp.x, posAp.y };
+
+      if (getWirelessBandOfChannel(channelThisAP) == BAND_24GHZ)
+        APs24GHz.push_back (thisAP);
+      else
+        APs5GHz.push_back (thisAP);
+    }
+  }
+
+  BuildGrid (grid24GHz, APs24GHz);
+  BuildGrid (grid5GHz, APs5GHz);
+  built = true;
+
+  if (VERBOSE_FOR_DEBUG > 0)
+    std::cout << Simulator::Now().GetSeconds()
+              << "\t[AP_spatial_index] Index built. Cell size " << indexCellSize
+              << " m. APs in 2.4 GHz: " << APs24GHz.size()
+              << ". APs in 5 GHz: " << APs5GHz.size()
+              << std::endl;
+}
+
+void
+AP_spatial_index::BuildGrid (bandGrid &grid, const std::vector<indexedAP> &myAPs)
+{
+  grid.cells.clear ();
+  grid.numCellsX = 0;
+  grid.numCellsY = 0;
+
+  if (myAPs.empty ())
+    return;
+
+  double maxX = myAPs[0].x;
+  double maxY = myAPs[0].y;
+  grid.minX = myAPs[0].x;
+  grid.minY = myAPs[0].y;
+  for (std::vector<indexedAP>::const_iterator index = myAPs.begin (); index != myAPs.end (); index++) {
+    grid.minX = std::min (grid.minX, index->x);
+    grid.minY = std::min (grid.minY, index->y);
+    maxX = std::max (maxX, index->x);
+    maxY = std::max (maxY, index->y);
+  }
+
+  grid.numCellsX = int32_t ((maxX - grid.minX) / indexCellSize) + 1;
+  grid.numCellsY = int32_t ((maxY - grid.minY) / indexCellSize) + 1;
+  grid.cells.resize (grid.numCellsX * grid.numCellsY);
+
+  // the APs are added in order of id, so each cell is also ordered by id
+  for (std::vector<indexedAP>::const_iterator index = myAPs.begin (); index != myAPs.end (); index++) {
+    int32_t cellX = GetCell (index->x, grid.minX, grid.numCellsX);
+    int32_t cellY = GetCell (index->y, grid.minY, grid.numCellsY);
+    grid.cells[cellX + cellY * grid.numCellsX].push_back (*index);
+  }
+}
+
+// returns the cell of a coordinate. Positions outside the grid go to the nearest cell
+int32_t
+AP_spatial_index::GetCell (double coordinate, double minCoordinate, int32_t numCells)
+{
+  double cell = floor ((coordinate - minCoordinate) / indexCellSize);
+  if (cell < 0.0)
+    return 0;
+  if (cell > numCells - 1)
+    return numCells - 1;
+  return int32_t (cell);
+}
+
+// explores the grid in rings of cells around the position. Once the best distance found is
+//below the distance to the next ring, no AP in the following rings can be nearer
+void
+AP_spatial_index::NearestInGrid (const bandGrid &grid, Vector pos, const indexedAP* &best, double &bestDistance)
+{
+  if (grid.cells.empty ())
+    return;
+
+  int32_t centerX = GetCell (pos.x, grid.minX, grid.numCellsX);
+  int32_t centerY = GetCell (pos.y, grid.minY, grid.numCellsY);
+  int32_t maxRing = std::max (grid.numCellsX, grid.numCellsY);
+
+  for (int32_t ring = 0; ring <= maxRing; ring++) {
+    for (int32_t cellY = centerY - ring; cellY <= centerY + ring; cellY++) {
+      if ((cellY < 0) || (cellY >= grid.numCellsY))
+        continue;
+
+      // in the first and last rows of the ring I check all the cells. In the others, only the two ends
+      int32_t step = ((cellY == centerY - ring) || (cellY == centerY + ring)) ? 1 : std::max (2 * ring, 1);
+
+      for (int32_t cellX = centerX - ring; cellX <= centerX + ring; cellX += step) {
+        if ((cellX < 0) || (cellX >= grid.numCellsX))
+          continue;
+
+        const std::vector<indexedAP> &thisCell = grid.cells[cellX + cellY * grid.numCellsX];
+        for (std::vector<indexedAP>::const_iterator index = thisCell.begin (); index != thisCell.end (); index++) {
+          double distance = sqrt ( ( (pos.x - index->x)*(pos.x - index->x) ) + ( (pos.y - index->y)*(pos.y - index->y) ) );
+
+          // in case of a tie, the AP with the lowest id is selected (as when all the APs are checked in order)
+          if ((best == NULL) || (distance < bestDistance) || ((distance == bestDistance) && (index->apId < best->apId))) {
+            best = &(*index);
+            bestDistance = distance;
+          }
+        }
+      }
+    }
+    if ((best != NULL) && (bestDistance <= ring * indexCellSize))
+      return;
+  }
+}
+
+Ptr<Node>
+AP_spatial_index::GetNearestAP (Vector pos, wifiBand frequencyBand)
+{
+  NS_ASSERT(built);
+
+  const indexedAP* best = NULL;
+  double bestDistance = 0.0;
+
+  if (frequencyBand & BAND_24GHZ)
+    NearestInGrid (grid24GHz, pos, best, bestDistance);
+  if (frequencyBand & BAND_5GHZ)
+    NearestInGrid (grid5GHz, pos, best, bestDistance);
+
+  if (best == NULL)
+    return 0;
+  return best->node;
+}
+
+void
+AP_spatial_index::WithinRangeInGrid (const bandGrid &grid, Vector pos, double range, std::vector<uint16_t> &result)
+{
+  if (grid.cells.empty ())
+    return;
+
+  // only the cells overlapping the square around the position have to be checked
+  int32_t firstX = GetCell (pos.x - range, grid.minX, grid.numCellsX);
+  int32_t lastX = GetCell (pos.x + range, grid.minX, grid.numCellsX);
+  int32_t firstY = GetCell (pos.y - range, grid.minY, grid.numCellsY);
+  int32_t lastY = GetCell (pos.y + range, grid.minY, grid.numCellsY);
+
+  for (int32_t cellY = firstY; cellY <= lastY; cellY++) {
+    for (int32_t cellX = firstX; cellX <= lastX; cellX++) {
+      const std::vector<indexedAP> &thisCell = grid.cells[cellX + cellY * grid.numCellsX];
+      for (std::vector<indexedAP>::const_iterator index = thisCell.begin (); index != thisCell.end (); index++) {
+        double distance = sqrt ( ( (pos.x - index->x)*(pos.x - index->x) ) + ( (pos.y - index->y)*(pos.y - index->y) ) );
+        if (distance < range)
+          result.push_back (index->apId);
+      }
+    }
+  }
+}
+
+// adds to 'result' the id of the active APs of a band (BAND_24GHZ, BAND_5GHZ or BAND_BOTH)
+//which are at a distance below 'range' (e.g. coverage_24GHz or coverage_5GHz)
+void
+AP_spatial_index::GetAPsWithinRange (Vector pos, double range, wifiBand frequencyBand, std::vector<uint16_t> &result)
+{
+  NS_ASSERT(built);
+
+  if (frequencyBand & BAND_24GHZ)
+    WithinRangeInGrid (grid24GHz, pos, range, result);
+  if (frequencyBand & BAND_5GHZ)
+    WithinRangeInGrid (grid5GHz, pos, range, result);
+}
+
+extern AP_spatial_index& apSpatialIndex;
+
 // obtain the nearest AP of a STA, in a certain frequency band (2.4 or 5 GHz)
-// if 'frequencyBand == 0', the nearest AP will be searched in both bands
+// if 'frequencyBand == BAND_BOTH', the nearest AP will be searched in both bands
 static Ptr<Node>
-nearestAp (NodeContainer APs, Ptr<Node> mySTA, int myverbose, std::string frequencyBand)
+nearestAp (NodeContainer APs, Ptr<Node> mySTA, int myverbose, wifiBand frequencyBand)
 {
-  // the frequency band MUST be "2.4 GHz" or "5 GHz". It can also be "both", meaning both bands
-  NS_ASSERT (( frequencyBand == "2.4 GHz" ) || (frequencyBand == "5 GHz" ) || (frequencyBand == "both" ));
+  // the frequency band MUST be BAND_24GHZ or BAND_5GHZ. It can also be BAND_BOTH, meaning both bands
+  NS_ASSERT (( frequencyBand == BAND_24GHZ ) || (frequencyBand == BAND_5GHZ ) || (frequencyBand == BAND_BOTH ));
 
   // vector with the position of the STA
   Vector posSta = GetPosition (mySTA);
 
-  if (frequencyBand != "both") {
+  if (frequencyBand != BAND_BOTH) {
     if (VERBOSE_FOR_DEBUG > 0)
       std::cout << "\n"
                 << Simulator::Now().GetSeconds() 
@@ -1646,63 +2175,71 @@ nearestAp (NodeContainer APs, Ptr<Node> mySTA, int myverbose, std::string freque
   // vector with the position of the AP
   Vector posAp;
 
-  // Check all the APs to find the nearest one
-  // go through the AP record vector
-  AP_recordVector::const_iterator indexAP = AP_vector.begin ();
-
-  // go through the nodeContainer of APs at the same time
-  NodeContainer::Iterator i; 
-  for (i = APs.Begin (); i != APs.End (); ++i) {
-    //(*i)->method ();  // some Node method
+  // if the spatial index is available, only the APs around the STA are checked
+  if (apSpatialIndex.IsBuilt () && (APs.GetN () == AP_vector.size ())) {
+    nearest = apSpatialIndex.GetNearestAP (posSta, frequencyBand);
+    if (nearest != 0)
+      channelNearestAP = AP_vector[nearest->GetId()]->GetWirelessChannel();
+  }
+  else {
+    // Check all the APs to find the nearest one
+    // go through the AP record vector
+    AP_recordVector::const_iterator indexAP = AP_vector.begin ();
 
-    // find the frequency band of this AP
-    uint8_t channelThisAP = (*indexAP)->GetWirelessChannel();
-    if (channelThisAP != 0) {
-      std::string frequencyBandThisAP = getWirelessBandOfChannel(channelThisAP);
+    // go through the nodeContainer of APs at the same time
+    NodeContainer::Iterator i; 
+    for (i = APs.Begin (); i != APs.End (); ++i) {
+      //(*i)->method ();  // some Node method
 
-      if (VERBOSE_FOR_DEBUG > 0)
-        std::cout << Simulator::Now().GetSeconds() 
-                  << "\t[nearestAp]\tAP #" << (*i)->GetId()
-                  <<  ", channel: "  << (uint16_t)channelThisAP 
-                  << ", frequency band: " << frequencyBandThisAP << std::endl;
+      // find the frequency band of this AP
+      uint8_t channelThisAP = (*indexAP)->GetWirelessChannel();
+      if (channelThisAP != 0) {
+        wifiBand frequencyBandThisAP = getWirelessBandOfChannel(channelThisAP);
 
-      // only look for APs in the specified frequency band
-      if ((frequencyBand == frequencyBandThisAP ) || (frequencyBand == "both") ) {
         if (VERBOSE_FOR_DEBUG > 0)
-          std::cout << "\t\t\t is in the correct band" << std::endl;
-
-        posAp = GetPosition((*i));
-        double distance = sqrt ( ( (posSta.x - posAp.x)*(posSta.x - posAp.x) ) + ( (posSta.y - posAp.y)*(posSta.y - posAp.y) ) );
-        if (distance < mimimumDistance ) {
-          mimimumDistance = distance;
-          nearest = *i;
-          channelNearestAP = channelThisAP;
+          std::cout << Simulator::Now().GetSeconds() 
+                    << "\t[nearestAp]\tAP #" << (*i)->GetId()
+                    <<  ", channel: "  << (uint16_t)channelThisAP 
+                    << ", frequency band: " << frequencyBandThisAP << std::endl;
 
+        // only look for APs in the specified frequency band
+        if (frequencyBand & frequencyBandThisAP) {
           if (VERBOSE_FOR_DEBUG > 0)
-            std::cout << "\t\t\t and it is the nearest one so far (distance " << distance << " m)" << std::endl;
+            std::cout << "\t\t\t is in the correct band" << std::endl;
+
+          posAp = GetPosition((*i));
+          double distance = sqrt ( ( (posSta.x - posAp.x)*(posSta.x - posAp.x) ) + ( (posSta.y - posAp.y)*(posSta.y - posAp.y) ) );
+          if (distance < mimimumDistance ) {
+            mimimumDistance = distance;
+            nearest = *i;
+            channelNearestAP = channelThisAP;
+
+            if (VERBOSE_FOR_DEBUG > 0)
+              std::cout << "\t\t\t and it is the nearest one so far (distance " << distance << " m)" << std::endl;
+          }
+          else {
+            if (VERBOSE_FOR_DEBUG > 0)
+              std::cout << "\t\t\t but it is not the nearest one (distance " << distance << " m)" << std::endl;
+          }
         }
         else {
           if (VERBOSE_FOR_DEBUG > 0)
-            std::cout << "\t\t\t but it is not the nearest one (distance " << distance << " m)" << std::endl;
+            std::cout << "\t\t\t is not in the correct band" << std::endl;      
         }
       }
       else {
         if (VERBOSE_FOR_DEBUG > 0)
-          std::cout << "\t\t\t is not in the correct band" << std::endl;      
+          std::cout << Simulator::Now().GetSeconds() 
+                    << "\t[nearestAp]\tAP #" << (*i)->GetId()        
+                    << "\t\t\t is not active" << std::endl;        
       }
+      indexAP++;
     }
-    else {
-      if (VERBOSE_FOR_DEBUG > 0)
-        std::cout << Simulator::Now().GetSeconds() 
-                  << "\t[nearestAp]\tAP #" << (*i)->GetId()        
-                  << "\t\t\t is not active" << std::endl;        
-    }
-    indexAP++;
   }
 
   if(nearest!=NULL) {
     NS_ASSERT(channelNearestAP!=0);
-    if (frequencyBand != "both") {
+    if (frequencyBand != BAND_BOTH) {
       if (VERBOSE_FOR_DEBUG > 0)
       std::cout << Simulator::Now().GetSeconds()
                 << "\t[nearestAp] Result: The nearest AP in the " << frequencyBand << " band "
@@ -1726,7 +2263,7 @@ nearestAp (NodeContainer APs, Ptr<Node> mySTA, int myverbose, std::string freque
     }
   }
   else {
-    if (frequencyBand != "both") {
+    if (frequencyBand != BAND_BOTH) {
       // if an AP in the same band cannot be found, finish the simulation
       std::cout << Simulator::Now().GetSeconds()
                 << "\t[nearestAp] ERROR: There is no AP in the " << frequencyBand << " band, but STAs have been defined in that band "
@@ -1756,73 +2293,654 @@ AP_record::GetMaxSizeAmpdu ()
   return apMaxSizeAmpdu;
 }
 
+
+// The registry keeps some indexes of AP_vector and sta_vector, so the controller
+//does not have to walk the vectors every time it has to find an AP or a STA:
+// - the records of the APs and the STAs, indexed by node id
+// - the records of the APs, indexed by MAC
+// - the set of STAs associated to each AP, and the number of them running each application
+// AP_vector and sta_vector are still the owners of the records. They are filled in 'main'
+class STA_record;
+
+#define NUMBER_OF_APPLICATION_TYPES 6 // 0 no application; 1 VoIP upload; 2 VoIP download; 3 TCP upload; 4 TCP download; 5 Video download
+
+class AP_STA_registry
+{
+  public:
+    AP_STA_registry ();
+    void AddAP (AP_record* thisAP);
+    void AddSTA (STA_record* thisSTA, uint16_t thisSTAid);
+    AP_record* GetAP (uint16_t thisAPid);
+    AP_record* GetAPbyMac (Mac48Address thisMac);
+    STA_record* GetSTA (uint16_t thisSTAid);
+    void Associate (uint16_t thisSTAid, uint16_t thisAPid, uint32_t typeofapplication);
+    void Deassociate (uint16_t thisSTAid, uint32_t typeofapplication);
+    const std::set<uint16_t>& GetSTAsOfAP (uint16_t thisAPid);
+    int32_t GetAPofSTA (uint16_t thisSTAid);
+    uint32_t GetNumberSTAsOfAP_app (uint16_t thisAPid, uint32_t typeofapplication);
+    uint32_t GetNumberAssociatedSTAs ();
+  private:
+    std::vector<AP_record*> apById;                           // indexed by node id. NULL if the node is not an AP
+    std::unordered_map<uint64_t, AP_record*> apByMac;         // the key is the MAC packed in an integer (see MacToKey)
+    std::vector<STA_record*> staById;                         // indexed by node id. NULL if the node is not a STA
+    std::vector<int32_t> apOfSTA;                             // indexed by node id. -1 if the STA is not associated
+    std::vector<std::set<uint16_t> > stasOfAP;                // indexed by AP id. Ordered by STA id, as sta_vector
+    std::vector<std::vector<uint32_t> > numberSTAsOfAP_app;   // indexed by AP id and type of application
+    uint32_t numberAssociatedSTAs;
+};
+
+// packs a MAC address in a 64-bit integer, so it can be used as the key of a hash table
+static uint64_t
+MacToKey (Mac48Address thisMac)
+{
+  uint8_t buffer[6];
+  thisMac.CopyTo (buffer);
+
+  uint64_t key = 0;
+  for (uint32_t i = 0; i < 6; i++)
+    key = (key << 8) | buffer[i];
+
+  return key;
+}
+
+AP_STA_registry::AP_STA_registry ()
+{
+  numberAssociatedSTAs = 0;
+}
+
 void
-Modify_AP_Record (uint16_t thisId, std::string thisMac, uint32_t thisMaxSizeAmpdu) // FIXME: Can this be done just with Set_AP_Record?
+AP_STA_registry::AddAP (AP_record* thisAP)
 {
-  for (AP_recordVector::const_iterator index = AP_vector.begin (); index != AP_vector.end (); index++) {
-    //std::cout << Simulator::Now ().GetSeconds() << " ********************** AP with ID " << (*index)->GetApid() << " has MAC: " << (*index)->GetMac() << " *****" << std::endl;
+  uint16_t id = thisAP->GetApid ();
 
-    if ( (*index)->GetMac () == thisMac ) {
-      (*index)->SetApRecord (thisId, thisMac, thisMaxSizeAmpdu);
-      //std::cout << Simulator::Now ().GetSeconds() << "\t[GetAnAP_Id] AP #" << (*index)->GetApid() << " has MAC: " << (*index)->GetMac() << "" << std::endl;
-    }
+  if (id >= apById.size ()) {
+    apById.resize (id + 1, NULL);
+    stasOfAP.resize (id + 1);
+    numberSTAsOfAP_app.resize (id + 1, std::vector<uint32_t> (NUMBER_OF_APPLICATION_TYPES, 0));
   }
+  apById[id] = thisAP;
+
+  // inactive APs do not have a real MAC, so they are not indexed by MAC
+  if (thisAP->GetWirelessChannel () != 0)
+    apByMac[MacToKey (thisAP->GetMac ())] = thisAP;
 }
 
-uint32_t
-CountAPs ()
+void
+AP_STA_registry::AddSTA (STA_record* thisSTA, uint16_t thisSTAid)
 {
-  uint32_t number = 0;
-  for (AP_recordVector::const_iterator index = AP_vector.begin (); index != AP_vector.end (); index++) {
-    number ++;
+  if (thisSTAid >= staById.size ()) {
+    staById.resize (thisSTAid + 1, NULL);
+    apOfSTA.resize (thisSTAid + 1, -1);
   }
-  return number;
+  staById[thisSTAid] = thisSTA;
 }
 
-uint32_t
-CountAPs (uint32_t myverbose)
-// counts all the APs with their id, mac and current value of MaxAmpdu
+AP_record*
+AP_STA_registry::GetAP (uint16_t thisAPid)
 {
-  uint32_t number = 0;
+  if (thisAPid >= apById.size ())
+    return NULL;
+  return apById[thisAPid];
+}
 
-  for (AP_recordVector::const_iterator index = AP_vector.begin (); index != AP_vector.end (); index++) {
-    number ++;
-  }
+AP_record*
+AP_STA_registry::GetAPbyMac (Mac48Address thisMac)
+{
+  std::unordered_map<uint64_t, AP_record*>::const_iterator found = apByMac.find (MacToKey (thisMac));
+  if (found == apByMac.end ())
+    return NULL;
+  return found->second;
+}
 
-  if (myverbose > 2)
-    std::cout << "\n" << Simulator::Now ().GetSeconds() << "\t[CountAPs] Total APs: " << number
-              << std::endl;
+STA_record*
+AP_STA_registry::GetSTA (uint16_t thisSTAid)
+{
+  if (thisSTAid >= staById.size ())
+    return NULL;
+  return staById[thisSTAid];
+}
 
-  return number;
+// this has to be called every time a STA associates to an AP
+void
+AP_STA_registry::Associate (uint16_t thisSTAid, uint16_t thisAPid, uint32_t typeofapplication)
+{
+  NS_ASSERT (thisSTAid < apOfSTA.size ());
+  NS_ASSERT (thisAPid < stasOfAP.size ());
+  NS_ASSERT (typeofapplication < NUMBER_OF_APPLICATION_TYPES);
+
+  // if the STA was still in the list of another AP, remove it first
+  if (apOfSTA[thisSTAid] >= 0)
+    Deassociate (thisSTAid, typeofapplication);
+
+  apOfSTA[thisSTAid] = thisAPid;
+  stasOfAP[thisAPid].insert (thisSTAid);
+  numberSTAsOfAP_app[thisAPid][typeofapplication] ++;
+  numberAssociatedSTAs ++;
 }
 
-uint16_t
-GetAnAP_Id (std::string thisMac)
-// lists all the STAs associated to an AP, with the MAC of the AP
+// this has to be called every time a STA de-associates from an AP
+void
+AP_STA_registry::Deassociate (uint16_t thisSTAid, uint32_t typeofapplication)
 {
-  if (VERBOSE_FOR_DEBUG > 0)
-    std::cout << Simulator::Now ().GetSeconds() << "\t[GetAnAP_Id] Looking for MAC " << thisMac << std::endl;
+  NS_ASSERT (thisSTAid < apOfSTA.size ());
+  NS_ASSERT (typeofapplication < NUMBER_OF_APPLICATION_TYPES);
+
+  if (apOfSTA[thisSTAid] < 0)
+    return; // the STA was not associated
+
+  uint16_t thisAPid = apOfSTA[thisSTAid];
+  stasOfAP[thisAPid].erase (thisSTAid);
+  NS_ASSERT (numberSTAsOfAP_app[thisAPid][typeofapplication] > 0);
+  numberSTAsOfAP_app[thisAPid][typeofapplication] --;
+  numberAssociatedSTAs --;
+  apOfSTA[thisSTAid] = -1;
+}
 
-  bool macFound = false;
+// returns the ids of the STAs associated to an AP
+const std::set<uint16_t>&
+AP_STA_registry::GetSTAsOfAP (uint16_t thisAPid)
+{
+  NS_ASSERT (thisAPid < stasOfAP.size ());
+  return stasOfAP[thisAPid];
+}
 
-  uint16_t APid;
+// returns -1 if the STA is not associated
+int32_t
+AP_STA_registry::GetAPofSTA (uint16_t thisSTAid)
+{
+  if (thisSTAid >= apOfSTA.size ())
+    return -1;
+  return apOfSTA[thisSTAid];
+}
 
-  uint32_t numberAPs = CountAPs();
-  if (VERBOSE_FOR_DEBUG > 0)
-    std::cout << Simulator::Now ().GetSeconds() << "\t[GetAnAP_Id] Number of APs: " << (unsigned int)numberAPs << "\n";
-  //std::cout << Simulator::Now ().GetSeconds() << " *** Number of STA associated: " << Get_STA_record_num() << " *****" << std::endl;
+// returns the number of STAs associated to an AP, running a type of application
+uint32_t
+AP_STA_registry::GetNumberSTAsOfAP_app (uint16_t thisAPid, uint32_t typeofapplication)
+{
+  if ((thisAPid >= numberSTAsOfAP_app.size ()) || (typeofapplication >= NUMBER_OF_APPLICATION_TYPES))
+    return 0;
+  return numberSTAsOfAP_app[thisAPid][typeofapplication];
+}
 
-  for (AP_recordVector::const_iterator index = AP_vector.begin (); index != AP_vector.end (); index++) {
+uint32_t
+AP_STA_registry::GetNumberAssociatedSTAs ()
+{
+  return numberAssociatedSTAs;
+}
+
+extern AP_STA_registry& registry;
+
+
+// information used by algorithmLoadBalancing about each pair of STAs (the primary one and its peer)
+struct infoAboutEachSTApair {
+  uint16_t STAid;
+  uint16_t peerSTAid;
+  bool STAenabled;
+  bool peerSTAenabled;
+  uint8_t channelSTA;
+  uint8_t channelPeerSTA;
+  Ptr<Node> pointerToMainSTA;
+  Ptr<Node> pointerToPeerSTA;
+  uint16_t APiDwhereThisSTAisAssociated;
+  uint16_t APiDwhereThePeerSTAisAssociated;
+  bool STAassociated;
+  bool peerSTAassociated;
+};
+
+// information used by algorithmLoadBalancing about each pair of APs (the primary one and its peer)
+struct infoAboutEachAPpair {
+  uint16_t APid;
+  uint16_t peerAPid;
+  uint8_t channelAP;
+  uint8_t channelPeerAP;
+  //Ptr<Node> pointerToMainAP;
+  //Ptr<Node> pointerToPeerAP;
+  wifiBand APband;
+  wifiBand peerAPband;
+  wifiBand APbandsActive; //must be BAND_NONE, BAND_BOTH, BAND_24GHZ, BAND_5GHZ
+};
+
+// this class keeps the tables of algorithmLoadBalancing between calls, so they are not
+//created in the stack each time. The row of a STA pair is only filled again if one of its STAs
+//has been associated or de-associated since the last time
+// The coverage table is kept up to date by 'coverageTracker'  
+class LoadBalancerState
+{
+  public:
+    // the coverage table is stored in a single array, row after row (one row per STA pair)
+    //so coverage[i][j] can still be used
+    class coverageTable
+    {
+      public:
+        char* operator[] (uint32_t STApairIndex) { return &cells[STApairIndex * numberColumns]; }
+        void Resize (uint32_t rows, uint32_t columns) { numberColumns = columns; cells.assign (rows * columns, 'n'); }
+      private:
+        std::vector<char> cells;
+        uint32_t numberColumns;
+    };
+
+    LoadBalancerState ();
+    void Init (uint16_t myfirstSTAid, uint16_t mynumberSTApairs, uint16_t mynumberAPpairs);
+    bool IsInitialized ();
+    void MarkSTAChanged (uint16_t thisSTAid);
+    bool RowNeedsUpdate (uint32_t STApairIndex);
+    std::vector<infoAboutEachSTApair>& GetInfoSTAs ();
+    std::vector<infoAboutEachAPpair>& GetInfoAPs ();
+    coverageTable& GetCoverage ();
+    void SetMultiSwap (bool mymultiSwap, uint32_t mymaxChannelSwitches);
+    bool MultiSwapEnabled ();
+    void SetLoadAware (bool myloadAware);
+    bool LoadAwareEnabled ();
+    bool ChannelSwitchAllowed (uint32_t channelSwitchesDone);
+  private:
+    bool initialized;
+    bool multiSwap;                               // compute all the exchanges of a period at once
+    uint32_t maxChannelSwitches;                  // maximum number of STAs switched in a period (0 means no limit)
+    bool loadAware;                               // move STAs from saturated 2.4 GHz APs to idle 5 GHz APs
+    uint16_t firstSTAid;
+    uint16_t numberSTApairs;
+    std::vector<infoAboutEachSTApair> infoSTAs;   // indexed by STA pair
+    std::vector<infoAboutEachAPpair> infoAPs;     // indexed by AP pair
+    coverageTable coverageAPinfo;                 // [STA pair][AP pair]
+    std::vector<bool> rowChanged;                 // indexed by STA pair
+};
+
+LoadBalancerState::LoadBalancerState ()
+{
+  initialized = false;
+  multiSwap = false;
+  maxChannelSwitches = 0;
+  loadAware = false;
+  firstSTAid = 0;
+  numberSTApairs = 0;
+}
+
+void
+LoadBalancerState::Init (uint16_t myfirstSTAid, uint16_t mynumberSTApairs, uint16_t mynumberAPpairs)
+{
+  firstSTAid = myfirstSTAid;
+  numberSTApairs = mynumberSTApairs;
+  infoSTAs.resize (mynumberSTApairs);
+  infoAPs.resize (mynumberAPpairs);
+  coverageAPinfo.Resize (mynumberSTApairs, mynumberAPpairs);
+  rowChanged.assign (mynumberSTApairs, true);
+  initialized = true;
+}
+
+bool
+LoadBalancerState::IsInitialized ()
+{
+  return initialized;
+}
+
+// called when a STA (primary or peer) is associated or de-associated
+void
+LoadBalancerState::MarkSTAChanged (uint16_t thisSTAid)
+{
+  // before the first run of the algorithm all the rows will be filled anyway
+  if (!initialized || (thisSTAid < firstSTAid))
+    return;
+
+  rowChanged[(thisSTAid - firstSTAid) % numberSTApairs] = true;
+}
+
+// returns true if the row has to be filled again, and considers it updated from now on
+bool
+LoadBalancerState::RowNeedsUpdate (uint32_t STApairIndex)
+{
+  if (!rowChanged[STApairIndex])
+    return false;
+
+  rowChanged[STApairIndex] = false;
+  return true;
+}
+
+std::vector<infoAboutEachSTApair>&
+LoadBalancerState::GetInfoSTAs ()
+{
+  return infoSTAs;
+}
+
+std::vector<infoAboutEachAPpair>&
+LoadBalancerState::GetInfoAPs ()
+{
+  return infoAPs;
+}
+
+LoadBalancerState::coverageTable&
+LoadBalancerState::GetCoverage ()
+{
+  return coverageAPinfo;
+}
+
+void
+LoadBalancerState::SetMultiSwap (bool mymultiSwap, uint32_t mymaxChannelSwitches)
+{
+  multiSwap = mymultiSwap;
+  maxChannelSwitches = mymaxChannelSwitches;
+}
+
+bool
+LoadBalancerState::MultiSwapEnabled ()
+{
+  return multiSwap;
+}
+
+void
+LoadBalancerState::SetLoadAware (bool myloadAware)
+{
+  loadAware = myloadAware;
+}
+
+bool
+LoadBalancerState::LoadAwareEnabled ()
+{
+  return loadAware;
+}
+
+// returns true if another STA can be switched to a new channel in this period
+bool
+LoadBalancerState::ChannelSwitchAllowed (uint32_t channelSwitchesDone)
+{
+  return (maxChannelSwitches == 0) || (channelSwitchesDone < maxChannelSwitches);
+}
+
+extern LoadBalancerState& loadBalancerState;
+
+
+// estimated coverage of an AP in each band
+struct coverages {
+  double coverage_24GHz;
+  double coverage_5GHz;
+};
+
+// returns the coverage of a STA by a pair of APs: '2' (2.4 GHz), '5' (5 GHz), 'b' (both) or 'n' (none)
+// 'distance' is the distance between the STA and the APs. A channel is 0 if the AP is not active
+char
+coverageOfAPpair (double distance, uint8_t APchannel, uint8_t peerAPchannel, coverages coverage)
+{
+  bool underCoverage24GHz = distance < coverage.coverage_24GHz;
+  bool underCoverage5GHz = distance < coverage.coverage_5GHz;
+
+  if ((APchannel == 0) && (peerAPchannel == 0)) {
+    // both APs are disabled. There is no coverage
+    return 'n';
+  }
+  else if ((APchannel != 0) && (peerAPchannel != 0)) {
+    // dual AP
+    if (underCoverage24GHz && underCoverage5GHz)
+      return 'b';
+    else if (underCoverage24GHz)
+      return '2';
+    else if (underCoverage5GHz)
+      return '5';
+    return 'n';
+  }
+  else {
+    // only one of the APs is active
+    wifiBand activeBand = getWirelessBandOfChannel ((APchannel != 0) ? APchannel : peerAPchannel);
+    if ((activeBand == BAND_24GHZ) && underCoverage24GHz)
+      return '2';
+    else if ((activeBand == BAND_5GHZ) && underCoverage5GHz)
+      return '5';
+    return 'n';
+  }
+}
+
+// I add this to the predicted crossing time, so the STA is already at the other side of the circle
+#define COVERAGECROSSINGMARGIN 0.000001
+
+// the crossings are only predicted for this time [s], so only the APs that the STA can reach in it are
+//checked. If there is no crossing before, the coverage is calculated again at the end of this time
+#define COVERAGEPREDICTIONHORIZON 10.0
+
+// This class keeps the coverage table of 'loadBalancerState' up to date.
+// Between two course changes a STA moves with constant velocity, so I can calculate when it will
+//cross the coverage circle (coverage_24GHz or coverage_5GHz) of any AP. The coverage of the STA
+//is calculated again at each course change and at that moment, and nothing is done in between.
+//Only the APs that the STA can reach within COVERAGEPREDICTIONHORIZON are checked (see 'apSpatialIndex')
+class CoverageTracker
+{
+  public:
+    CoverageTracker ();
+    void Init (NodeContainer myapNodes, NodeContainer mystaNodes, coverages mycoverage, uint32_t myverbose);
+    bool IsInitialized ();
+    void CourseChange (uint16_t thisSTAid);
+  private:
+    void UpdateRow (uint32_t STApairIndex);
+    double TimeToNextCrossing (Vector pos, Vector vel);
+    bool initialized;
+    NodeContainer staNodes;
+    coverages coverage;
+    uint32_t verboseLevel;
+    uint16_t firstSTAid;
+    uint16_t numberSTApairs;
+    uint16_t numberAPpairs;
+    std::vector<Vector> APpositions;      // indexed by AP pair
+    std::vector<EventId> nextCrossing;    // indexed by STA pair
+};
+
+CoverageTracker::CoverageTracker ()
+{
+  initialized = false;
+  verboseLevel = 0;
+  firstSTAid = 0;
+  numberSTApairs = 0;
+  numberAPpairs = 0;
+}
+
+bool
+CoverageTracker::IsInitialized ()
+{
+  return initialized;
+}
+
+// it has to be called after setting the positions and the channels of the APs,
+//and after building 'apSpatialIndex'
+void
+CoverageTracker::Init (NodeContainer myapNodes, NodeContainer mystaNodes, coverages mycoverage, uint32_t myverbose)
+{
+  staNodes = mystaNodes;
+  coverage = mycoverage;
+  verboseLevel = myverbose;
+  firstSTAid = mystaNodes.Get(0)->GetId();
+  numberSTApairs = mystaNodes.GetN() / 2;
+  numberAPpairs = myapNodes.GetN() / 2;
+
+  // the coverage table belongs to 'loadBalancerState'
+  if (!loadBalancerState.IsInitialized ())
+    loadBalancerState.Init (firstSTAid, numberSTApairs, numberAPpairs);
+
+  // the APs of a pair are in the same place
+  APpositions.resize (numberAPpairs);
+  for (uint16_t APindex = 0; APindex < numberAPpairs; APindex++)
+    APpositions[APindex] = GetPosition (myapNodes.Get(APindex));
+
+  nextCrossing.resize (numberSTApairs);
+  initialized = true;
+
+  for (uint32_t STApairIndex = 0; STApairIndex < numberSTApairs; STApairIndex++)
+    UpdateRow (STApairIndex);
+}
+
+// called each time a primary STA changes its course
+void
+CoverageTracker::CourseChange (uint16_t thisSTAid)
+{
+  if (!initialized || (thisSTAid < firstSTAid) || (thisSTAid - firstSTAid >= numberSTApairs))
+    return;
+
+  UpdateRow (thisSTAid - firstSTAid);
+}
+
+// calculate the coverage of a STA pair by all the AP pairs, and schedule the next calculation
+//when the STA will cross the next coverage circle
+void
+CoverageTracker::UpdateRow (uint32_t STApairIndex)
+{
+  CallbackTimer callbackTimer ("CoverageTracker::UpdateRow");
+  Ptr<Node> mySTA = staNodes.Get(STApairIndex);
+  Vector posSTA = GetPosition (mySTA);
+  char* myRow = loadBalancerState.GetCoverage ()[STApairIndex];
+
+  // by default, the STA is not under coverage of any AP
+  for (uint16_t APindex = 0; APindex < numberAPpairs; APindex++)
+    myRow[APindex] = 'n';
+
+  // only the APs near the STA may cover it, so I ask the spatial index for them
+  // as the APs are in pairs, I use the index of the first AP of each pair
+  std::vector<uint16_t> APsNearThisSTA;
+  apSpatialIndex.GetAPsWithinRange (posSTA, std::max(coverage.coverage_24GHz, coverage.coverage_5GHz), BAND_BOTH, APsNearThisSTA);
+
+  for (std::vector<uint16_t>::const_iterator indexNear = APsNearThisSTA.begin (); indexNear != APsNearThisSTA.end (); indexNear++) {
+    uint16_t APindex = *indexNear % numberAPpairs;
+    double distance = sqrt ( ( (posSTA.x - APpositions[APindex].x)*(posSTA.x - APpositions[APindex].x) ) + ( (posSTA.y - APpositions[APindex].y)*(posSTA.y - APpositions[APindex].y) ) );
+    myRow[APindex] = coverageOfAPpair (distance,
+                                       AP_vector[APindex]->GetWirelessChannel(),
+                                       AP_vector[APindex + numberAPpairs]->GetWirelessChannel(),
+                                       coverage);
+  }
+
+  // the previous prediction is not valid anymore
+  nextCrossing[STApairIndex].Cancel ();
+
+  Vector velSTA = mySTA->GetObject<MobilityModel> ()->GetVelocity ();
+  double timeToCrossing = TimeToNextCrossing (posSTA, velSTA);
+
+  if (timeToCrossing >= 0.0)
+    nextCrossing[STApairIndex] = Simulator::Schedule (Seconds (timeToCrossing + COVERAGECROSSINGMARGIN), &CoverageTracker::UpdateRow, this, STApairIndex);
+  else if ((velSTA.x != 0.0) || (velSTA.y != 0.0))
+    // the APs that are further have not been checked
+    nextCrossing[STApairIndex] = Simulator::Schedule (Seconds (COVERAGEPREDICTIONHORIZON), &CoverageTracker::UpdateRow, this, STApairIndex);
+
+  if (verboseLevel >= 2) {
+    std::cout << Simulator::Now ().GetSeconds()
+              << "\t[CoverageTracker] STA #" << mySTA->GetId()
+              << " coverage: ";
+    for (uint16_t APindex = 0; APindex < numberAPpairs; APindex++)
+      std::cout << myRow[APindex];
+    if (timeToCrossing >= 0.0)
+      std::cout << ". Next crossing in " << timeToCrossing << " s";
+    else
+      std::cout << ". No crossing expected in " << COVERAGEPREDICTIONHORIZON << " s";
+    std::cout << std::endl;
+  }
+}
+
+// returns the time until the STA, moving from 'pos' with velocity 'vel', enters or leaves the
+//coverage circle of an active AP. It returns -1 if this will not happen before COVERAGEPREDICTIONHORIZON
+double
+CoverageTracker::TimeToNextCrossing (Vector pos, Vector vel)
+{
+  double a = (vel.x * vel.x) + (vel.y * vel.y);
+  if (a == 0.0)
+    return -1.0;
+
+  // a circle can only be crossed before the horizon if its AP is nearer than the radius plus the distance
+  //travelled. As the APs are in pairs, I use the index of the first AP of each pair
+  double maxRadius = std::max (coverage.coverage_24GHz, coverage.coverage_5GHz);
+  std::vector<uint16_t> APsNearThisSTA;
+  apSpatialIndex.GetAPsWithinRange (pos, maxRadius + sqrt (a) * COVERAGEPREDICTIONHORIZON, BAND_BOTH, APsNearThisSTA);
+  for (uint32_t i = 0; i < APsNearThisSTA.size (); i++)
+    APsNearThisSTA[i] = APsNearThisSTA[i] % numberAPpairs;
+  std::sort (APsNearThisSTA.begin (), APsNearThisSTA.end ());
+  APsNearThisSTA.erase (std::unique (APsNearThisSTA.begin (), APsNearThisSTA.end ()), APsNearThisSTA.end ());
+
+  double earliest = -1.0;
+
+  for (std::vector<uint16_t>::const_iterator indexNear = APsNearThisSTA.begin (); indexNear != APsNearThisSTA.end (); indexNear++) {
+    uint16_t APindex = *indexNear;
+    uint8_t APchannel = AP_vector[APindex]->GetWirelessChannel();
+    uint8_t peerAPchannel = AP_vector[APindex + numberAPpairs]->GetWirelessChannel();
+
+    // only the circles of the active bands, as in coverageOfAPpair: both of them if the two APs are active
+    std::vector<double> radius;
+    if ((APchannel != 0) && (peerAPchannel != 0)) {
+      radius.push_back (coverage.coverage_24GHz);
+      radius.push_back (coverage.coverage_5GHz);
+    }
+    else if ((APchannel != 0) || (peerAPchannel != 0)) {
+      wifiBand activeBand = getWirelessBandOfChannel ((APchannel != 0) ? APchannel : peerAPchannel);
+      if (activeBand == BAND_24GHZ)
+        radius.push_back (coverage.coverage_24GHz);
+      else if (activeBand == BAND_5GHZ)
+        radius.push_back (coverage.coverage_5GHz);
+    }
+
+    double dx = pos.x - APpositions[APindex].x;
+    double dy = pos.y - APpositions[APindex].y;
+    double b = 2.0 * ((vel.x * dx) + (vel.y * dy));
+
+    // solve |pos + vel * t - posAP| = radius
+    for (uint32_t i = 0; i < radius.size (); i++) {
+      double c = (dx * dx) + (dy * dy) - (radius[i] * radius[i]);
+      double discriminant = (b * b) - (4.0 * a * c);
+      if (discriminant < 0.0)
+        continue;
+
+      double root1 = (-b - sqrt (discriminant)) / (2.0 * a);
+      double root2 = (-b + sqrt (discriminant)) / (2.0 * a);
+
+      // a root of (almost) 0 is the crossing that has just happened
+      double t = (root1 > COVERAGECROSSINGMARGIN) ? root1 : root2;
+      if ((t > COVERAGECROSSINGMARGIN) && (t <= COVERAGEPREDICTIONHORIZON) && ((earliest < 0.0) || (t < earliest)))
+        earliest = t;
+    }
+  }
+  return earliest;
+}
+
+extern CoverageTracker& coverageTracker;
+
+void
+Modify_AP_Record (uint16_t thisId, Mac48Address thisMac, uint32_t thisMaxSizeAmpdu) // FIXME: Can this be done just with Set_AP_Record?
+{
+  AP_record* myAP = registry.GetAPbyMac (thisMac);
+
+  if (myAP != NULL) {
+    myAP->SetApRecord (thisId, thisMac, thisMaxSizeAmpdu);
+    //std::cout << Simulator::Now ().GetSeconds() << "\t[GetAnAP_Id] AP #" << myAP->GetApid() << " has MAC: " << myAP->GetMac() << "" << std::endl;
+  }
+}
+
+uint32_t
+CountAPs ()
+{
+  return AP_vector.size ();
+}
+
+uint32_t
+CountAPs (uint32_t myverbose)
+// counts all the APs with their id, mac and current value of MaxAmpdu
+{
+  uint32_t number = AP_vector.size ();
+
+  if (myverbose > 2)
+    std::cout << "\n" << Simulator::Now ().GetSeconds() << "\t[CountAPs] Total APs: " << number
+              << std::endl;
+
+  return number;
+}
+
+uint16_t
+GetAnAP_Id (Mac48Address thisMac)
+// lists all the STAs associated to an AP, with the MAC of the AP
+{
+  if (VERBOSE_FOR_DEBUG > 0)
+    std::cout << Simulator::Now ().GetSeconds() << "\t[GetAnAP_Id] Looking for MAC " << thisMac << std::endl;
+
+  bool macFound = false;
+
+  uint16_t APid = 0;
+
+  // look for the MAC in the index of the registry
+  AP_record* myAP = registry.GetAPbyMac (thisMac);
+
+  if (myAP != NULL) {
+    APid = myAP->GetApid ();
+    macFound = true;
     if (VERBOSE_FOR_DEBUG > 0)
-      std::cout << Simulator::Now ().GetSeconds() << "\t[GetAnAP_Id]   AP with ID " << (*index)->GetApid() << " has MAC:   " << (*index)->GetMac() << std::endl;
-    
-    if ( (*index)->GetMac () == thisMac ) {
-      // check the primary MAC address of each AP
-      APid = (*index)->GetApid ();
-      macFound = true;
-      if (VERBOSE_FOR_DEBUG > 0)
-        std::cout << Simulator::Now ().GetSeconds() << "\t[GetAnAP_Id] FOUND: AP #" << (*index)->GetApid() << " has MAC: " << (*index)->GetMac() << "" << std::endl;
-    }
+      std::cout << Simulator::Now ().GetSeconds() << "\t[GetAnAP_Id] FOUND: AP #" << myAP->GetApid() << " has MAC: " << myAP->GetMac() << "" << std::endl;
   }
 
   // make sure that an AP with 'thisMac' exists
@@ -1843,18 +2961,16 @@ GetAP_MaxSizeAmpdu (uint16_t thisAPid, uint32_t myverbose)
 // returns the max size of the Ampdu of an AP
 {
   uint32_t APMaxSizeAmpdu = 0;
-  //std::cout << Simulator::Now ().GetSeconds() << " *** Number of STA associated: " << Get_STA_record_num() << " *****" << std::endl;
 
-  for (AP_recordVector::const_iterator index = AP_vector.begin (); index != AP_vector.end (); index++) {
+  AP_record* myAP = registry.GetAP (thisAPid);
 
-    if ( (*index)->GetApid () == thisAPid ) {
-      APMaxSizeAmpdu = (*index)->GetMaxSizeAmpdu ();
-      if ( myverbose > 2 )
-        std::cout << Simulator::Now ().GetSeconds() 
-                  << "\t[GetAP_MaxSizeAmpdu] AP #" << (*index)->GetApid() 
-                  << " has AMDPU: " << (*index)->GetMaxSizeAmpdu() 
-                  << "" << std::endl;
-    }
+  if (myAP != NULL) {
+    APMaxSizeAmpdu = myAP->GetMaxSizeAmpdu ();
+    if ( myverbose > 2 )
+      std::cout << Simulator::Now ().GetSeconds() 
+                << "\t[GetAP_MaxSizeAmpdu] AP #" << myAP->GetApid() 
+                << " has AMDPU: " << myAP->GetMaxSizeAmpdu() 
+                << "" << std::endl;
   }
   return APMaxSizeAmpdu;
 }
@@ -1864,18 +2980,16 @@ GetAP_WirelessChannel (uint16_t thisAPid, uint32_t myverbose)
 // returns the wireless channel of an AP
 {
   uint8_t APWirelessChannel = 0;
-  //std::cout << Simulator::Now ().GetSeconds() << " *** Number of STA associated: " << Get_STA_record_num() << " *****" << std::endl;
 
-  for (AP_recordVector::const_iterator index = AP_vector.begin (); index != AP_vector.end (); index++) {
+  AP_record* myAP = registry.GetAP (thisAPid);
 
-    if ( (*index)->GetApid () == thisAPid ) {
-      APWirelessChannel = (*index)->GetWirelessChannel();
-      if ( myverbose > 2 )
-        std::cout << Simulator::Now ().GetSeconds() 
-                  << "\t[GetAP_WirelessChannel] AP #" << (*index)->GetApid() 
-                  << " has channel: " << uint16_t((*index)->GetWirelessChannel())
-                  << "" << std::endl;
-    }
+  if (myAP != NULL) {
+    APWirelessChannel = myAP->GetWirelessChannel();
+    if ( myverbose > 2 )
+      std::cout << Simulator::Now ().GetSeconds() 
+                << "\t[GetAP_WirelessChannel] AP #" << myAP->GetApid() 
+                << " has channel: " << uint16_t(myAP->GetWirelessChannel())
+                << "" << std::endl;
   }
   return APWirelessChannel;
 }
@@ -1923,6 +3037,7 @@ class STA_record
     bool GetDisabledPermanently ();
     uint16_t GetpeerStaid ();
     uint32_t GetWifiModel ();
+    Ptr<Node> GetNode ();
     void StaCourseChange (std::string context, Ptr<const ns3::MobilityModel>);
     void SetAssoc (std::string context, Mac48Address AP_MAC_address);
     void UnsetAssoc (std::string context, Mac48Address AP_MAC_address);
@@ -1940,6 +3055,8 @@ class STA_record
     void SetAmpduSize (uint32_t myAmpduSize);
     void SetmaxAmpduSizeWhenAggregationLimited (uint32_t mymaxAmpduSizeWhenAggregationLimited);
     void SetWifiModel (uint32_t mywifiModel);
+    void SetNodePointers (Ptr<Node> myNode, Ptr<Node> myPeerNode);
+    void SetAPNodes (NodeContainer myAPNodes);
     void PrintAllVariables ();
   private:
     bool assoc;
@@ -1959,6 +3076,13 @@ class STA_record
     uint32_t staRecordMaxAmpduSize;
     uint32_t staRecordmaxAmpduSizeWhenAggregationLimited;
     uint32_t staRecordwifiModel;
+
+    // pointers resolved once at setup, so I do not have to look for the nodes in the NodeList
+    Ptr<Node> staNode;
+    Ptr<ConstantVelocityMobilityModel> staMobility;     // NULL if the STA does not use ConstantVelocity (e.g. RandomWalk2d)
+    Ptr<Node> peerStaNode;                              // NULL if there is no peer STA
+    Ptr<ConstantVelocityMobilityModel> peerStaMobility;
+    NodeContainer staRecordAPNodes;                     // all the APs, used for finding the nearest one
 };
 
 // this is the constructor. Set the default parameters
@@ -1988,8 +3112,34 @@ STA_record::setstaid (uint16_t id)
   staid = id;
 }
 
+// store the pointers to the node of this STA and to the node of its peer STA (if any),
+//and also to their mobility models
+void
+STA_record::SetNodePointers (Ptr<Node> myNode, Ptr<Node> myPeerNode)
+{
+  NS_ASSERT(myNode != 0);
+  staNode = myNode;
+  staMobility = myNode->GetObject<ConstantVelocityMobilityModel>();
+
+  peerStaNode = myPeerNode;
+  if (myPeerNode != 0)
+    peerStaMobility = myPeerNode->GetObject<ConstantVelocityMobilityModel>();
+}
+
+void
+STA_record::SetAPNodes (NodeContainer myAPNodes)
+{
+  staRecordAPNodes = myAPNodes;
+}
+
+Ptr<Node>
+STA_record::GetNode ()
+{
+  return staNode;
+}
+
 typedef std::vector <STA_record * > STA_recordVector;
-STA_recordVector sta_vector;
+extern STA_recordVector& sta_vector;
 
 /*
 STA_record
@@ -2011,13 +3161,7 @@ uint32_t
 Get_STA_record_num ()
 // counts the number or STAs associated
 {
-  uint32_t AssocNum = 0;
-  for (STA_recordVector::const_iterator index = sta_vector.begin (); index != sta_vector.end (); index++) {
-    if ((*index)->GetAssoc ()) {
-      AssocNum++;
-    }
-  }
-  return AssocNum;
+  return registry.GetNumberAssociatedSTAs ();
 }
 
 Mac48Address
@@ -2031,34 +3175,28 @@ GetAPMACOfAnAssociatedSTA (uint16_t id)
 
   Mac48Address desiredMAC;
 
-  for (STA_recordVector::const_iterator index = sta_vector.begin (); index != sta_vector.end (); index++) {
-    if ((*index)->GetStaid () == id) {
-
-      Mac48Address nullMAC = "00:00:00:00:00:00";
+  STA_record* mySTA = registry.GetSTA (id);
 
-      if ((*index)->GetMacOfitsAP() == nullMAC) {
-        if (VERBOSE_FOR_DEBUG > 0)
-            std::cout << Simulator::Now().GetSeconds()
-                      << "\t[GetAPMACOfAnAssociatedSTA] STA#" << (*index)->GetStaid ()
-                      << " nas no associated AP"
-                      << std::endl;
-      }
-      else {
-        // auxiliar string
-        std::ostringstream auxString;
-        // create a string with the MAC
-        auxString << "02-06-" << (*index)->GetMacOfitsAP();
-        std::string myaddress = auxString.str();
+  if (mySTA != NULL) {
 
-        desiredMAC = Mac48Address::ConvertFrom((*index)->GetMacOfitsAP());
+    Mac48Address nullMAC = "00:00:00:00:00:00";
 
-        if (VERBOSE_FOR_DEBUG > 0)
+    if (mySTA->GetMacOfitsAP() == nullMAC) {
+      if (VERBOSE_FOR_DEBUG > 0)
           std::cout << Simulator::Now().GetSeconds()
-                    << "\t[GetAPMACOfAnAssociatedSTA] STA#" << (*index)->GetStaid ()
-                    << " found"
-                    << ". MAC of its associated AP: " << myaddress
-                    << std::endl;   
-      }
+                    << "\t[GetAPMACOfAnAssociatedSTA] STA#" << mySTA->GetStaid ()
+                    << " nas no associated AP"
+                    << std::endl;
+    }
+    else {
+      desiredMAC = mySTA->GetMacOfitsAP();
+
+      if (VERBOSE_FOR_DEBUG > 0)
+        std::cout << Simulator::Now().GetSeconds()
+                  << "\t[GetAPMACOfAnAssociatedSTA] STA#" << mySTA->GetStaid ()
+                  << " found"
+                  << ". MAC of its associated AP: " << desiredMAC
+                  << std::endl;   
     }
   }
 
@@ -2075,41 +3213,35 @@ GetChannelOfAnAssociatedSTA (uint16_t id)
               << std::endl;
 
   uint8_t channel = 0;
-  for (STA_recordVector::const_iterator index = sta_vector.begin (); index != sta_vector.end (); index++) {
-    if ((*index)->GetStaid () == id) {
 
-      Mac48Address nullMAC = "00:00:00:00:00:00";
+  STA_record* mySTA = registry.GetSTA (id);
 
-      if ((*index)->GetMacOfitsAP() == nullMAC) {
-        if (VERBOSE_FOR_DEBUG > 0)
-            std::cout << Simulator::Now().GetSeconds()
-                      << "\t[GetChannelOfAnAssociatedSTA] STA#" << (*index)->GetStaid ()
-                      << " nas no associated AP"
-                      << std::endl;
-      }
-      else {
-        // auxiliar string
-        std::ostringstream auxString;
-        // create a string with the MAC
-        auxString << "02-06-" << (*index)->GetMacOfitsAP();
-        std::string myaddress = auxString.str();
+  if (mySTA != NULL) {
 
-        if (VERBOSE_FOR_DEBUG > 0)
-          std::cout << Simulator::Now().GetSeconds()
-                    << "\t[GetChannelOfAnAssociatedSTA] STA#" << (*index)->GetStaid ()
-                    << " found"
-                    << ". MAC of its associated AP: " << myaddress
-                    << std::endl; 
+    Mac48Address nullMAC = "00:00:00:00:00:00";
 
-        if (VERBOSE_FOR_DEBUG > 0)
+    if (mySTA->GetMacOfitsAP() == nullMAC) {
+      if (VERBOSE_FOR_DEBUG > 0)
           std::cout << Simulator::Now().GetSeconds()
-                    << "\t[GetChannelOfAnAssociatedSTA] Calling GetAnAP_Id()"
+                    << "\t[GetChannelOfAnAssociatedSTA] STA#" << mySTA->GetStaid ()
+                    << " nas no associated AP"
                     << std::endl;
+    }
+    else {
+      if (VERBOSE_FOR_DEBUG > 0)
+        std::cout << Simulator::Now().GetSeconds()
+                  << "\t[GetChannelOfAnAssociatedSTA] STA#" << mySTA->GetStaid ()
+                  << " found"
+                  << ". MAC of its associated AP: " << mySTA->GetMacOfitsAP()
+                  << std::endl; 
 
-        // Get the wireless channel of the AP with the corresponding address
-        NS_ASSERT(myaddress!="02-06-00:00:00:00:00:00");
-        channel = GetAP_WirelessChannel (GetAnAP_Id(myaddress), 0);      
-      }
+      if (VERBOSE_FOR_DEBUG > 0)
+        std::cout << Simulator::Now().GetSeconds()
+                  << "\t[GetChannelOfAnAssociatedSTA] Calling GetAnAP_Id()"
+                  << std::endl;
+
+      // Get the wireless channel of the AP with the corresponding address
+      channel = GetAP_WirelessChannel (GetAnAP_Id(mySTA->GetMacOfitsAP()), 0);      
     }
   }
   if (VERBOSE_FOR_DEBUG > 0)
@@ -2124,31 +3256,26 @@ GetChannelOfAnAssociatedSTA (uint16_t id)
 static void
 ReportChannel (double period, uint16_t id, int myverbose)
 {
+  CallbackTimer callbackTimer ("ReportChannel");
   if (myverbose > 2) {
     // Find the AP to which the STA is associated
-    for (STA_recordVector::const_iterator index = sta_vector.begin (); index != sta_vector.end (); index++) {
-      if ((*index)->GetStaid () == id) {
-        // auxiliar string
-        std::ostringstream auxString;
-        // create a string with the MAC
-        auxString << "02-06-" << (*index)->GetMacOfitsAP();
-        std::string myaddress = auxString.str();
-        NS_ASSERT(!myaddress.empty());
-
-        if (myaddress=="02-06-00:00:00:00:00:00") {
-          std::cout << Simulator::Now().GetSeconds()
-                    << "\t[ReportChannel] STA #" << id 
-                    << " Not associated to any AP"
-                    << std::endl;          
-        }
-        else {
-          NS_ASSERT(myaddress!="02-06-00:00:00:00:00:00");
-          std::cout << Simulator::Now().GetSeconds()
-                    << "\t[ReportChannel] STA #" << id 
-                    << " Associated to AP#" << GetAnAP_Id(myaddress)
-                    << ". Channel: " << uint16_t(GetChannelOfAnAssociatedSTA (id))
-                    << std::endl;          
-        }
+    STA_record* mySTA = registry.GetSTA (id);
+
+    if (mySTA != NULL) {
+      Mac48Address nullMAC = "00:00:00:00:00:00";
+
+      if (mySTA->GetMacOfitsAP() == nullMAC) {
+        std::cout << Simulator::Now().GetSeconds()
+                  << "\t[ReportChannel] STA #" << id 
+                  << " Not associated to any AP"
+                  << std::endl;          
+      }
+      else {
+        std::cout << Simulator::Now().GetSeconds()
+                  << "\t[ReportChannel] STA #" << id 
+                  << " Associated to AP#" << GetAnAP_Id(mySTA->GetMacOfitsAP())
+                  << ". Channel: " << uint16_t(GetChannelOfAnAssociatedSTA (id))
+                  << std::endl;          
       }
     }
   }
@@ -2166,13 +3293,6 @@ List_STA_record ()
   for (STA_recordVector::const_iterator index = sta_vector.begin (); index != sta_vector.end (); index++) {
     if ((*index)->GetAssoc ()) {
 
-      // auxiliar string
-      std::ostringstream auxString;
-      // create a string with the MAC
-      auxString << "02-06-" << (*index)->GetMacOfitsAP();
-      std::string myaddress = auxString.str();
-      NS_ASSERT(!myaddress.empty());
-
       if (VERBOSE_FOR_DEBUG > 0)
         std::cout << Simulator::Now().GetSeconds()
                   << "\t[List_STA_record] Calling GetAnAP_Id()"
@@ -2180,7 +3300,7 @@ List_STA_record ()
 
       std::cout //<< Simulator::Now ().GetSeconds() 
                 << "\t\t\t\tSTA #" << (*index)->GetStaid() 
-                << "\tassociated to AP #" << GetAnAP_Id(myaddress) 
+                << "\tassociated to AP #" << GetAnAP_Id((*index)->GetMacOfitsAP()) 
                 << "\twith MAC " << (*index)->GetMacOfitsAP() 
                 << "\ttype of application " << (*index)->Gettypeofapplication()
                 << "\tValue of Max AMPDU " << (*index)->GetMaxSizeAmpdu()
@@ -2198,6 +3318,7 @@ List_STA_record ()
 
 // This is called with a callback every time a STA changes its course
 void STA_record::StaCourseChange (std::string context, Ptr<const ns3::MobilityModel> mobility) {
+  CallbackTimer callbackTimer ("StaCourseChange");
   if(VERBOSE_FOR_DEBUG > 0)
     std::cout << "\t[StaCourseChange] context: " << context << std::endl;
 
@@ -2218,6 +3339,9 @@ void STA_record::StaCourseChange (std::string context, Ptr<const ns3::MobilityMo
               //<< ". staRecordNumberWiFiCards: " << staRecordNumberWiFiCards
               << std::endl;
 
+  // the coverage of the STA has to be calculated again with the new velocity
+  coverageTracker.CourseChange (staid);
+
   // check if this is a primary STA
   if (primarySTA == true) {
     // this is a primary STA
@@ -2226,26 +3350,19 @@ void STA_record::StaCourseChange (std::string context, Ptr<const ns3::MobilityMo
 
       // I have to move the associated secondary STA accordingly
 
-      // get a pointer to the associated STA
-      Ptr<Node> myAssociatedSTA;
-      for (NodeList::Iterator i = NodeList::Begin(); i != NodeList::End(); ++i) {
-        uint32_t identif = (*i)->GetId();
-        if ( identif == peerStaid) {
-          myAssociatedSTA = (*i);
-          if (VERBOSE_FOR_DEBUG > 0)
-            std::cout << Simulator::Now().GetSeconds()
-                      << "\t[StaCourseChange] Index of the associated STA: " << identif
-                      << std::endl;
-        }
-      }
+      // the pointer to the mobility model of the associated STA was stored at setup
+      NS_ASSERT(peerStaMobility != 0);
+      if (VERBOSE_FOR_DEBUG > 0)
+        std::cout << Simulator::Now().GetSeconds()
+                  << "\t[StaCourseChange] Index of the associated STA: " << peerStaNode->GetId()
+                  << std::endl;
+
       // set the position and velocity of the STA (they become the ones of the main STA)
-      Ptr<ConstantVelocityMobilityModel> poninterToMobilityModelSecondary = myAssociatedSTA->GetObject<ConstantVelocityMobilityModel>();
-      poninterToMobilityModelSecondary->SetPosition(pos);
-      poninterToMobilityModelSecondary->SetVelocity(vel);
+      peerStaMobility->SetPosition(pos);
+      peerStaMobility->SetVelocity(vel);
 
-      Ptr<MobilityModel> poninterToMobilityModel = myAssociatedSTA->GetObject<MobilityModel> ();
-      Vector posSecondary = poninterToMobilityModel->GetPosition ();
-      Vector velSecondary = poninterToMobilityModel->GetVelocity ();
+      Vector posSecondary = peerStaMobility->GetPosition ();
+      Vector velSecondary = peerStaMobility->GetVelocity ();
 
       if(staRecordVerboseLevel >= 1)
         std::cout << Simulator::Now ().GetSeconds()
@@ -2269,17 +3386,16 @@ void STA_record::StaCourseChange (std::string context, Ptr<const ns3::MobilityMo
 bool
 GetstaRecordDisabledPermanently (uint16_t thisSTAid, uint32_t myverbose)
 {
-  for (STA_recordVector::const_iterator index = sta_vector.begin (); index != sta_vector.end (); index++) {
+  STA_record* mySTA = registry.GetSTA (thisSTAid);
 
-    if ( (*index)->GetStaid () == thisSTAid ) {
-      if ( myverbose > 0 )
-        std::cout << Simulator::Now ().GetSeconds() 
-                  << "\t[GetstaRecordDisabledPermanently]\tSTA #" << thisSTAid 
-                  << " has 'disabledPermanently': " << (*index)->GetDisabledPermanently() 
-                  << std::endl;
+  if ( mySTA != NULL ) {
+    if ( myverbose > 0 )
+      std::cout << Simulator::Now ().GetSeconds() 
+                << "\t[GetstaRecordDisabledPermanently]\tSTA #" << thisSTAid 
+                << " has 'disabledPermanently': " << mySTA->GetDisabledPermanently() 
+                << std::endl;
 
-      return (*index)->GetDisabledPermanently();
-    }
+    return mySTA->GetDisabledPermanently();
   }
   // if I am here, I have not found the requested STA
   NS_ASSERT(false);
@@ -2289,14 +3405,9 @@ GetstaRecordDisabledPermanently (uint16_t thisSTAid, uint32_t myverbose)
 // get a pointer to a STA with an ID
 Ptr<Node> GetPointerToSTA(uint32_t staId)
 {
-  
-  Ptr<Node> mySTA;
-  for (NodeList::Iterator i = NodeList::Begin(); i != NodeList::End(); ++i) {
-    if ( (*i)->GetId() == staId) {
-      mySTA = (*i);
-    }
-  }
-  return mySTA;
+  STA_record* mySTArecord = registry.GetSTA (staId);
+  NS_ASSERT(mySTArecord != NULL);
+  return mySTArecord->GetNode ();
 }
 
 // returns the channel of a STA
@@ -2317,6 +3428,7 @@ uint8_t GetChannelOfaSTA (uint32_t staId, uint32_t mywifiModel, uint32_t myverbo
 void
 STA_record::SetAssoc (std::string context, Mac48Address AP_MAC_address)
 {
+  CallbackTimer callbackTimer ("SetAssoc");
   // 'context' is something like "/NodeList/9/DeviceList/1/$ns3::WifiNetDevice/Mac/$ns3::RegularWifiMac/$ns3::StaWifiMac/Assoc"
   if(VERBOSE_FOR_DEBUG > 0)
     std::cout << "\t[SetAssoc] context: " << context << std::endl;
@@ -2341,20 +3453,16 @@ STA_record::SetAssoc (std::string context, Mac48Address AP_MAC_address)
   //  typeofapplication
   //  staRecordMaxSizeAmpdu
 
-  // auxiliar string
-  std::ostringstream auxString;
-  // create a string with the MAC
-  auxString << "02-06-" << AP_MAC_address;
-  std::string myaddress = auxString.str();
-
-  NS_ASSERT(!myaddress.empty());
-
   if (VERBOSE_FOR_DEBUG > 0)
     std::cout << Simulator::Now().GetSeconds()
               << "\t[SetAssoc] Calling GetAnAP_Id()"
               << std::endl;
 
-  uint32_t apId = GetAnAP_Id(myaddress);
+  uint32_t apId = GetAnAP_Id(AP_MAC_address);
+
+  // add the STA to the list of STAs of this AP
+  registry.Associate (staid, apId, typeofapplication);
+  loadBalancerState.MarkSTAChanged (staid);
 
   uint8_t apChannel = GetAP_WirelessChannel ( apId, 0 /*staRecordVerboseLevel*/ );
 
@@ -2391,7 +3499,7 @@ STA_record::SetAssoc (std::string context, Mac48Address AP_MAC_address)
         // Modify the data in the table of APs
         //for (AP_recordVector::const_iterator index = AP_vector.begin (); index != AP_vector.end (); index++) {
           //if ( (*index)->GetMac () == myaddress ) {
-            Modify_AP_Record ( apId, myaddress, staRecordmaxAmpduSizeWhenAggregationLimited);
+            Modify_AP_Record ( apId, AP_MAC_address, staRecordmaxAmpduSizeWhenAggregationLimited);
             //std::cout << Simulator::Now ().GetSeconds() << "\t[GetAnAP_Id] AP #" << (*index)->GetApid() << " has MAC: " << (*index)->GetMac() << "" << std::endl;
         //  }
         //}
@@ -2399,34 +3507,29 @@ STA_record::SetAssoc (std::string context, Mac48Address AP_MAC_address)
         if (staRecordVerboseLevel > 0)
           std::cout << Simulator::Now ().GetSeconds() 
                     << "\t[SetAssoc] Aggregation in AP #" << apId 
-                    << "\twith MAC: " << myaddress 
+                    << "\twith MAC: " << AP_MAC_address 
                     << "\tset to " << staRecordmaxAmpduSizeWhenAggregationLimited 
                     << "\t(limited)" << std::endl;
 
         // disable aggregation in all the STAs associated to that AP
-        for (STA_recordVector::const_iterator index = sta_vector.begin (); index != sta_vector.end (); index++) {
+        const std::set<uint16_t>& stasOfThisAP = registry.GetSTAsOfAP (apId);
+        for (std::set<uint16_t>::const_iterator index = stasOfThisAP.begin (); index != stasOfThisAP.end (); index++) {
 
-          // I only have to disable aggregation for TCP STAs
-          if ((*index)->Gettypeofapplication () > 2) {
+          STA_record* associatedSTA = registry.GetSTA (*index);
 
-            // if the STA is associated
-            if ((*index)->GetAssoc ()) {
-
-              // if the STA is associated to this AP
-              if ((*index)->GetMacOfitsAP() == AP_MAC_address ) {
+          // I only have to disable aggregation for TCP STAs
+          if (associatedSTA->Gettypeofapplication () > 2) {
 
-                ModifyAmpdu ((*index)->GetStaid(), staRecordmaxAmpduSizeWhenAggregationLimited, 1);   // modify the AMPDU in the STA node
-                (*index)->SetMaxSizeAmpdu(staRecordmaxAmpduSizeWhenAggregationLimited);               // update the data in the STA_record structure
+            ModifyAmpdu (associatedSTA->GetStaid(), staRecordmaxAmpduSizeWhenAggregationLimited, 1);   // modify the AMPDU in the STA node
+            associatedSTA->SetMaxSizeAmpdu(staRecordmaxAmpduSizeWhenAggregationLimited);               // update the data in the STA_record structure
 
-                if (staRecordVerboseLevel > 0)
-                  std::cout << Simulator::Now ().GetSeconds() 
-                            << "\t[SetAssoc] Aggregation in STA #" << (*index)->GetStaid() 
-                            << ", associated to AP #" << apId
-                            << "\twith MAC " << (*index)->GetMacOfitsAP() 
-                            << "\tset to " << staRecordmaxAmpduSizeWhenAggregationLimited 
-                            << "\t(limited)" << std::endl;
-              }
-            }
+            if (staRecordVerboseLevel > 0)
+              std::cout << Simulator::Now ().GetSeconds() 
+                        << "\t[SetAssoc] Aggregation in STA #" << associatedSTA->GetStaid() 
+                        << ", associated to AP #" << apId
+                        << "\twith MAC " << associatedSTA->GetMacOfitsAP() 
+                        << "\tset to " << staRecordmaxAmpduSizeWhenAggregationLimited 
+                        << "\t(limited)" << std::endl;
           }
         }
       }
@@ -2544,7 +3647,8 @@ STA_record::SetAssoc (std::string context, Mac48Address AP_MAC_address)
                   << std::endl;    
 
       // get a pointer to the peer STA
-      Ptr<Node> myPeerSTA = GetPointerToSTA(peerStaid);
+      Ptr<Node> myPeerSTA = peerStaNode;
+      NS_ASSERT(myPeerSTA != 0);
 
       // create a device container including the device of the peer STA
       NetDeviceContainer thisDevice;
@@ -2609,6 +3713,7 @@ STA_record::SetAssoc (std::string context, Mac48Address AP_MAC_address)
 void
 STA_record::UnsetAssoc (std::string context, Mac48Address AP_MAC_address)
 {
+  CallbackTimer callbackTimer ("UnsetAssoc");
   // 'context' is something like "/NodeList/9/DeviceList/1/$ns3::WifiNetDevice/Mac/$ns3::RegularWifiMac/$ns3::StaWifiMac/Assoc"
 
   if (VERBOSE_FOR_DEBUG > 0)
@@ -2618,19 +3723,16 @@ STA_record::UnsetAssoc (std::string context, Mac48Address AP_MAC_address)
   assoc = false;
   apMac = "00:00:00:00:00:00";
    
-  // auxiliar string
-  std::ostringstream auxString;
-  // create a string with the MAC
-  auxString << "02-06-" << AP_MAC_address;
-  std::string myaddress = auxString.str();
-  NS_ASSERT(!myaddress.empty());
-
   if (VERBOSE_FOR_DEBUG > 0)
     std::cout << Simulator::Now().GetSeconds()
               << "\n\t[UnsetAssoc] Calling GetAnAP_Id() in order to get the Id of the AP from which the STA has deassociated"
               << std::endl;
 
-  uint32_t apId = GetAnAP_Id(myaddress);
+  uint32_t apId = GetAnAP_Id(AP_MAC_address);
+
+  // remove the STA from the list of STAs of this AP
+  registry.Deassociate (staid, typeofapplication);
+  loadBalancerState.MarkSTAChanged (staid);
 
   uint8_t apChannel = GetAP_WirelessChannel ( apId, 0 /*staRecordVerboseLevel*/ );
 
@@ -2647,7 +3749,7 @@ STA_record::UnsetAssoc (std::string context, Mac48Address AP_MAC_address)
   }
 
   // this is the frequency band where the STA can find an AP
-  std::string frequencybandsSupportedBySTA = getWirelessBandOfStandard(convertVersionToStandard(staRecordversion80211));
+  wifiBand frequencybandsSupportedBySTA = getWirelessBandOfStandard(convertVersionToStandard(staRecordversion80211));
 
   // This only runs if the aggregation algorithm is running
   if(staRecordaggregationDisableAlgorithm == 1) {
@@ -2665,64 +3767,46 @@ STA_record::UnsetAssoc (std::string context, Mac48Address AP_MAC_address)
                     << std::endl;*/
 
         // check if there is no STA running VoIP associated
+        // the one de-associating has already been removed from the registry
         bool anyStaWithVoIPAssociated = false;
 
-        // Check all the associated STAs, except the one de-associating
-        for (STA_recordVector::const_iterator index = sta_vector.begin (); index != sta_vector.end (); index++) {
-
-          // Only consider STAs associated to this AP
-          if ( (*index)->GetMacOfitsAP () == AP_MAC_address ) {
-
-            // Only consider VoIP STAs
-            if ( ( (*index)->Gettypeofapplication() == 1 ) || ( (*index)->Gettypeofapplication() == 2 ) ) {
-
-              // It cannot be the one being de-associated
-              if ( (*index)->GetStaid() != staid)
-
-                anyStaWithVoIPAssociated = true;
-            }
-          }
-        }
+        if ( registry.GetNumberSTAsOfAP_app (apId, 1) + registry.GetNumberSTAsOfAP_app (apId, 2) > 0 )
+          anyStaWithVoIPAssociated = true;
 
         // If there is no remaining STA running VoIP associated
         if ( anyStaWithVoIPAssociated == false ) {
           // enable aggregation in the AP
           // Modify the A-MPDU of this AP
           ModifyAmpdu (apId, staRecordMaxAmpduSize, 1);
-          Modify_AP_Record (apId, myaddress, staRecordMaxAmpduSize);
+          Modify_AP_Record (apId, AP_MAC_address, staRecordMaxAmpduSize);
 
           if (staRecordVerboseLevel > 0)
             std::cout << Simulator::Now ().GetSeconds() 
                       << "\t[UnsetAssoc]\tAggregation in AP #" << apId 
-                      << "\twith MAC: " << myaddress 
+                      << "\twith MAC: " << AP_MAC_address 
                       << "\tset to " << staRecordMaxAmpduSize 
                       << "\t(enabled)" << std::endl;
 
           // enable aggregation in all the STAs associated to that AP
-          for (STA_recordVector::const_iterator index = sta_vector.begin (); index != sta_vector.end (); index++) {
+          const std::set<uint16_t>& stasOfThisAP = registry.GetSTAsOfAP (apId);
+          for (std::set<uint16_t>::const_iterator index = stasOfThisAP.begin (); index != stasOfThisAP.end (); index++) {
 
-            // if the STA is associated
-            if ((*index)->GetAssoc()) {
+            STA_record* associatedSTA = registry.GetSTA (*index);
 
-              // if the STA is associated to this AP
-              if ( (*index)->GetMacOfitsAP() == AP_MAC_address ) {
+            // if the STA is not running VoIP. NOT NEEDED. IF I AM HERE IT MEANS THAT ALL THE STAs ARE TCP
+            //if (associatedSTA->Gettypeofapplication () > 2) {
 
-                // if the STA is not running VoIP. NOT NEEDED. IF I AM HERE IT MEANS THAT ALL THE STAs ARE TCP
-                //if ((*index)->Gettypeofapplication () > 2) {
+              ModifyAmpdu (associatedSTA->GetStaid(), staRecordMaxAmpduSize, 1);  // modify the AMPDU in the STA node
+              associatedSTA->SetMaxSizeAmpdu(staRecordMaxAmpduSize);// update the data in the STA_record structure
 
-                  ModifyAmpdu ((*index)->GetStaid(), staRecordMaxAmpduSize, 1);  // modify the AMPDU in the STA node
-                  (*index)->SetMaxSizeAmpdu(staRecordMaxAmpduSize);// update the data in the STA_record structure
-
-                  if (staRecordVerboseLevel > 0)  
-                    std::cout << Simulator::Now ().GetSeconds() 
-                              << "\t[UnsetAssoc] Aggregation in STA #" << (*index)->GetStaid() 
-                              << "\tassociated to AP #" << apId 
-                              << "\twith MAC " << (*index)->GetMacOfitsAP() 
-                              << "\tset to " << staRecordMaxAmpduSize 
-                              << "\t(enabled)" << std::endl;
-                //}
-              }
-            }
+              if (staRecordVerboseLevel > 0)  
+                std::cout << Simulator::Now ().GetSeconds() 
+                          << "\t[UnsetAssoc] Aggregation in STA #" << associatedSTA->GetStaid() 
+                          << "\tassociated to AP #" << apId 
+                          << "\twith MAC " << associatedSTA->GetMacOfitsAP() 
+                          << "\tset to " << staRecordMaxAmpduSize 
+                          << "\t(enabled)" << std::endl;
+            //}
           }
         }
         else {
@@ -2792,22 +3876,13 @@ STA_record::UnsetAssoc (std::string context, Mac48Address AP_MAC_address)
     if (staRecordnumOperationalChannels > 1) {
       // Only for wifiModel = 0. With WifiModel = 1 it is supposed to scan for other APs in other channels 
       //if (staRecordwifiModel == 0) {
-        // Put all the APs in a nodecontainer
-        // and get a pointer to the STA
-        Ptr<Node> mySTA;
-        NodeContainer APs;
+        // the container with all the APs, and the pointer to the STA, were stored at setup
+        Ptr<Node> mySTA = staNode;
+        NodeContainer APs = staRecordAPNodes;
+        // CountAPs is called outside the assert, so its output is the same in debug and optimized builds
         uint32_t numberAPs = CountAPs (staRecordVerboseLevel);
-
-        for (NodeList::Iterator i = NodeList::Begin(); i != NodeList::End(); ++i) {
-          uint32_t identif;
-          identif = (*i)->GetId();
-       
-          if ( (identif >= 0) && (identif < numberAPs) ) {
-            APs.Add(*i);
-          } else if ( identif == staid) {
-            mySTA = (*i);
-          }
-        }
+        NS_ASSERT(APs.GetN() == numberAPs);
+        NS_UNUSED (numberAPs);
 
 
         // Find the nearest AP (in order to switch the STA to the channel of the nearest AP)
@@ -2912,7 +3987,8 @@ STA_record::UnsetAssoc (std::string context, Mac48Address AP_MAC_address)
                   << std::endl;    
 
       // get a pointer to the peer STA
-      Ptr<Node> myPeerSTA = GetPointerToSTA(peerStaid);
+      Ptr<Node> myPeerSTA = peerStaNode;
+      NS_ASSERT(myPeerSTA != 0);
       uint8_t channelPeerSTA;
 
       // create a device container including the device of the peer STA
@@ -2964,18 +4040,14 @@ STA_record::UnsetAssoc (std::string context, Mac48Address AP_MAC_address)
       if (staRecordnumOperationalChannels > 1) {
         // Only for wifiModel = 0. With WifiModel = 1 it is supposed to scan for other APs in other channels 
 
-        // Put all the APs in a nodecontainer
-        NodeContainer APs;
+        // the container with all the APs was stored at setup
+        NodeContainer APs = staRecordAPNodes;
+        // CountAPs is called outside the assert, so its output is the same in debug and optimized builds
         uint32_t numberAPs = CountAPs (staRecordVerboseLevel);
-        for (NodeList::Iterator i = NodeList::Begin(); i != NodeList::End(); ++i) {
-          uint32_t identif;
-          identif = (*i)->GetId();
-          if ( (identif >= 0) && (identif < numberAPs) ) {
-            APs.Add(*i);
-          }
-        }
+        NS_ASSERT(APs.GetN() == numberAPs);
+        NS_UNUSED (numberAPs);
 
-        std::string bandPeerSTA = getWirelessBandOfChannel(channelPeerSTA);
+        wifiBand bandPeerSTA = getWirelessBandOfChannel(channelPeerSTA);
 
         // Find the nearest AP (in order to switch the STA to the channel of the nearest AP)
         Ptr<Node> nearest;
@@ -3187,13 +4259,11 @@ uint32_t
 Get_STA_record_num_AP_app (Mac48Address apMac, uint32_t typeofapplication)
 // counts the number or STAs associated to an AP, with a type of application
 {
-  uint32_t AssocNum = 0;
-  for (STA_recordVector::const_iterator index = sta_vector.begin (); index != sta_vector.end (); index++) {
-    if (((*index)->GetAssoc ()) && ((*index)->GetMacOfitsAP() == apMac) && ( (*index)->Gettypeofapplication()==typeofapplication) ) {
-      AssocNum++;
-    }
-  }
-  return AssocNum;
+  AP_record* myAP = registry.GetAPbyMac (apMac);
+  if (myAP == NULL)
+    return 0;
+
+  return registry.GetNumberSTAsOfAP_app (myAP->GetApid (), typeofapplication);
 }
 
 
@@ -3221,15 +4291,739 @@ GetstaRecordMaxSizeAmpdu (uint16_t thisSTAid, uint32_t myverbose)
 }
 */
 
+#define TRACEWRITER_BUFFER_SIZE 1048576   // [bytes] the rows are kept in memory until they reach this size
+#define TRACEWRITER_BINARY_MAGIC "WCCB"   // first bytes of the binary files
+#define TRACEWRITER_BINARY_VERSION 2
+
+// Output table written during the simulation (KPIs, positions, AMPDU values...). The file is opened once,
+//and the rows are kept in memory and written in large blocks.
+// - In text format, the values of a row are separated with tabs, and the first line has the names of the columns.
+// - In binary format, a file may have a number of tables (a single one, or all the tables of the run if the
+//   result store is used). After the file header, there is a sequence of records. The definition of a table
+//   goes before its blocks, and the blocks of different tables may be interleaved:
+//    file header:  "WCCB", uint32 version
+//    table record: uint8 'T', uint16 table id, uint16 length of the name, name of the table, uint32 number of
+//                  columns. For each column: uint8 type ('d' double, 'i' int64, 's' string), uint16 length
+//                  of the name, name
+//    block record: uint8 'B', uint16 table id, uint32 number of rows. For each column: uint64 number of bytes,
+//                  values of the column (a string is stored as uint16 length + characters)
+//   The byte order is the one of the machine. wifi-results-reader.cc reads these files
+class TraceWriter
+{
+  public:
+    TraceWriter (std::string fileName, std::string tableName, bool binaryFormat);
+    TraceWriter (std::ofstream* sharedStream, std::string tableName, uint16_t tableId);
+    ~TraceWriter ();
+    void AddColumn (std::string columnName, char type);
+    void AddDouble (double value);
+    void AddInteger (int64_t value);
+    void AddString (std::string value);
+    void AddEmpty ();
+    void EndRow ();
+    void Flush ();
+    void Sync ();
+    bool MoveTo (std::string newFileName);
+    std::string GetFileName ();
+    bool Close ();
+  private:
+    void WriteHeader ();
+    void NextColumn (char type);
+    std::ofstream* ofs;
+    bool ownStream;                           // false if the file is shared with other tables
+    std::string fileName;                     // empty if the file is shared with other tables
+    std::string name;
+    uint16_t id;
+    bool binary;
+    bool headerWritten;
+    std::vector<std::string> names;
+    std::vector<char> types;
+    uint32_t currentColumn;
+    std::string textBuffer;                   // text format
+    std::vector<std::string> columnBuffers;   // binary format, a buffer per column
+    uint32_t rowsInBlock;
+    size_t bytesInBlock;
+};
+
+// Write a file in a way that other processes never see it incomplete: it is written to a temporary file,
+//which is then renamed (the renaming is atomic if both files are in the same file system)
+static bool
+writeFileAtomically (std::string fileName, std::string content)
+{
+  std::ostringstream temporaryFileName;
+  temporaryFileName << fileName << ".tmp" << getpid ();
+
+  std::ofstream ofs;
+  ofs.open (temporaryFileName.str (), std::ofstream::out | std::ofstream::trunc | std::ofstream::binary);
+  ofs.write (content.data (), content.size ());
+  ofs.close ();
+  if (ofs.fail ()) {
+    std::cout << "ERROR: the output file " << temporaryFileName.str () << " cannot be written\n";
+    std::remove (temporaryFileName.str ().c_str ());
+    return false;
+  }
+
+  if (std::rename (temporaryFileName.str ().c_str (), fileName.c_str ()) != 0) {
+    std::cout << "ERROR: the output file " << temporaryFileName.str () << " cannot be renamed to " << fileName << "\n";
+    std::remove (temporaryFileName.str ().c_str ());
+    return false;
+  }
+  return true;
+}
+
+// copy a file that is being written (its rows have to be flushed first)
+static bool
+copyFile (std::string fromFileName, std::string toFileName)
+{
+  std::ifstream from (fromFileName, std::ifstream::in | std::ifstream::binary);
+  std::ofstream to (toFileName, std::ofstream::out | std::ofstream::trunc | std::ofstream::binary);
+  if (!from.is_open () || !to.is_open ())
+    return false;
+  // an empty file would set the failbit of 'to'
+  if (from.peek () != std::ifstream::traits_type::eof ())
+    to << from.rdbuf ();
+  to.close ();
+  return !to.fail ();
+}
+
+// writes the header of a binary file
+static void
+writeTraceFileHeader (std::ofstream* ofs)
+{
+  uint32_t version = TRACEWRITER_BINARY_VERSION;
+  ofs->write (TRACEWRITER_BINARY_MAGIC, 4);
+  ofs->write ((const char*) &version, sizeof (version));
+}
+
+// the table has its own file
+TraceWriter::TraceWriter (std::string fileName, std::string tableName, bool binaryFormat)
+{
+  binary = binaryFormat;
+  name = tableName;
+  id = 0;
+  headerWritten = false;
+  currentColumn = 0;
+  rowsInBlock = 0;
+  bytesInBlock = 0;
+
+  // with "trunc" Any contents that existed in the file before it is open are discarded
+  ofs = new std::ofstream (fileName, std::ofstream::out | std::ofstream::trunc | std::ofstream::binary);
+  ownStream = true;
+  this->fileName = fileName;
+  if (!ofs->is_open ())
+    std::cout << "ERROR: the output file " << fileName << " cannot be opened\n";
+  else if (binary)
+    writeTraceFileHeader (ofs);
+  textBuffer.reserve (TRACEWRITER_BUFFER_SIZE);
+}
+
+// the table is written in a binary file shared with other tables. The file is opened and closed by the caller
+TraceWriter::TraceWriter (std::ofstream* sharedStream, std::string tableName, uint16_t tableId)
+{
+  binary = true;
+  name = tableName;
+  id = tableId;
+  headerWritten = false;
+  currentColumn = 0;
+  rowsInBlock = 0;
+  bytesInBlock = 0;
+  ofs = sharedStream;
+  ownStream = false;
+}
+
+TraceWriter::~TraceWriter ()
+{
+  Close ();
+}
+
+// the columns have to be added before writing the first row
+void
+TraceWriter::AddColumn (std::string columnName, char type)
+{
+  NS_ASSERT (!headerWritten);
+  NS_ASSERT ((type == 'd') || (type == 'i') || (type == 's'));
+  names.push_back (columnName);
+  types.push_back (type);
+  columnBuffers.push_back (std::string ());
+}
+
+void
+TraceWriter::WriteHeader ()
+{
+  headerWritten = true;
+
+  if (!binary) {
+    for (uint32_t i = 0; i < names.size (); i++)
+      textBuffer += (i == 0 ? "" : "\t") + names[i];
+    textBuffer += '\n';
+    return;
+  }
+
+  uint8_t record = 'T';
+  uint16_t nameLength = name.size ();
+  uint32_t numberColumns = names.size ();
+  ofs->write ((const char*) &record, sizeof (record));
+  ofs->write ((const char*) &id, sizeof (id));
+  ofs->write ((const char*) &nameLength, sizeof (nameLength));
+  ofs->write (name.data (), nameLength);
+  ofs->write ((const char*) &numberColumns, sizeof (numberColumns));
+  for (uint32_t i = 0; i < numberColumns; i++) {
+    uint8_t type = types[i];
+    uint16_t length = names[i].size ();
+    ofs->write ((const char*) &type, sizeof (type));
+    ofs->write ((const char*) &length, sizeof (length));
+    ofs->write (names[i].data (), length);
+  }
+}
+
+// in text format, it writes the separator before the value
+void
+TraceWriter::NextColumn (char type)
+{
+  if (!headerWritten)
+    WriteHeader ();
+
+  NS_ASSERT (currentColumn < types.size ());
+  NS_ASSERT (types[currentColumn] == type);
+  if (!binary && (currentColumn > 0))
+    textBuffer += '\t';
+}
+
+void
+TraceWriter::AddDouble (double value)
+{
+  NextColumn ('d');
+  if (binary)
+    columnBuffers[currentColumn].append ((const char*) &value, sizeof (value));
+  else {
+    // the same format as std::ofstream by default
+    char text[32];
+    textBuffer.append (text, snprintf (text, sizeof (text), "%g", value));
+  }
+  currentColumn++;
+}
+
+void
+TraceWriter::AddInteger (int64_t value)
+{
+  NextColumn ('i');
+  if (binary)
+    columnBuffers[currentColumn].append ((const char*) &value, sizeof (value));
+  else {
+    char text[32];
+    textBuffer.append (text, snprintf (text, sizeof (text), "%lld", (long long) value));
+  }
+  currentColumn++;
+}
+
+void
+TraceWriter::AddString (std::string value)
+{
+  NextColumn ('s');
+  if (binary) {
+    uint16_t length = value.size ();
+    columnBuffers[currentColumn].append ((const char*) &length, sizeof (length));
+    columnBuffers[currentColumn].append (value.data (), length);
+  }
+  else
+    textBuffer += value;
+  currentColumn++;
+}
+
+// a value that is not defined (e.g. the AP of a STA that is not associated). In text format, the field is left
+//blank. In binary format, it is NaN, the lowest int64 or an empty string
+void
+TraceWriter::AddEmpty ()
+{
+  NS_ASSERT (currentColumn < types.size ());
+  if (!binary) {
+    NextColumn (types[currentColumn]);
+    currentColumn++;
+  }
+  else if (types[currentColumn] == 'd')
+    AddDouble (NAN);
+  else if (types[currentColumn] == 'i')
+    AddInteger (std::numeric_limits<int64_t>::min ());
+  else
+    AddString ("");
+}
+
+void
+TraceWriter::EndRow ()
+{
+  NS_ASSERT (currentColumn == types.size ());
+  currentColumn = 0;
+
+  if (binary) {
+    rowsInBlock++;
+    bytesInBlock = 0;
+    for (uint32_t i = 0; i < columnBuffers.size (); i++)
+      bytesInBlock += columnBuffers[i].size ();
+    if (bytesInBlock >= TRACEWRITER_BUFFER_SIZE)
+      Flush ();
+  }
+  else {
+    textBuffer += '\n';
+    if (textBuffer.size () >= TRACEWRITER_BUFFER_SIZE)
+      Flush ();
+  }
+}
+
+// writes the rows kept in memory. In binary format, each call writes a block
+void
+TraceWriter::Flush ()
+{
+  NS_ASSERT (currentColumn == 0);
+  if (!headerWritten)
+    WriteHeader ();
+
+  if (binary) {
+    if (rowsInBlock == 0)
+      return;
+    uint8_t record = 'B';
+    ofs->write ((const char*) &record, sizeof (record));
+    ofs->write ((const char*) &id, sizeof (id));
+    ofs->write ((const char*) &rowsInBlock, sizeof (rowsInBlock));
+    for (uint32_t i = 0; i < columnBuffers.size (); i++) {
+      uint64_t numberBytes = columnBuffers[i].size ();
+      ofs->write ((const char*) &numberBytes, sizeof (numberBytes));
+      ofs->write (columnBuffers[i].data (), numberBytes);
+      columnBuffers[i].clear ();
+    }
+    rowsInBlock = 0;
+    bytesInBlock = 0;
+  }
+  else {
+    ofs->write (textBuffer.data (), textBuffer.size ());
+    textBuffer.clear ();
+  }
+}
+
+// the rows kept in memory are written, and they are passed to the operating system. Used before fork (), so
+//the child does not write again the rows of its parent
+void
+TraceWriter::Sync ()
+{
+  if ((ofs == NULL) || !ofs->is_open ())
+    return;
+  Flush ();
+  ofs->flush ();
+}
+
+// the rest of the table is written to another file, which starts with a copy of what has been written so far
+//(used by the children of a warm start). The old file is not modified
+bool
+TraceWriter::MoveTo (std::string newFileName)
+{
+  NS_ASSERT (ownStream && (ofs != NULL));
+  Sync ();
+  ofs->close ();
+  bool copied = copyFile (fileName, newFileName);
+  fileName = newFileName;
+  ofs->clear ();
+  ofs->open (fileName, std::ofstream::out | std::ofstream::app | std::ofstream::binary);
+  return copied && ofs->is_open ();
+}
+
+std::string
+TraceWriter::GetFileName ()
+{
+  return fileName;
+}
+
+// it returns false if the file could not be written. A shared file is checked by TraceWriterRegistry
+bool
+TraceWriter::Close ()
+{
+  if (ofs == NULL)
+    return true;
+  if (ofs->is_open ())
+    Flush ();
+  bool written = true;
+  if (ownStream) {
+    ofs->close ();
+    written = !ofs->fail ();
+    delete ofs;
+  }
+  ofs = NULL;
+  return written;
+}
+
+
+// the output files that are written during the simulation. They are found by their name, and all of them are
+//closed at the end of the simulation. In binary format, the extension ".txt" is replaced by ".bin"
+// If the result store is used, no file is created for each table: all of them are written in the same binary file.
+//It is written to a temporary file, and renamed when it is closed, so an incomplete store is never found
+class TraceWriterRegistry
+{
+  public:
+    TraceWriterRegistry ();
+    void SetBinary (bool binaryFormat);
+    void SetResultStore (std::string fileName);
+    bool IsResultStore ();
+    TraceWriter* Open (std::string fileName, std::string tableName);
+    TraceWriter* Get (std::string fileName);
+    void SyncAll ();
+    bool MoveAll (std::string oldPrefix, std::string newPrefix);
+    void RemoveAll ();
+    bool CloseAll ();
+  private:
+    bool binary;
+    std::ofstream* store;     // NULL if each table has its own file
+    std::string storeFileName;
+    std::string storeTemporaryFileName;
+    uint16_t nextTableId;
+    std::map<std::string, TraceWriter*> writers;
+};
+
+TraceWriterRegistry::TraceWriterRegistry ()
+{
+  binary = false;
+  store = NULL;
+  nextTableId = 0;
+}
+
+void
+TraceWriterRegistry::SetBinary (bool binaryFormat)
+{
+  binary = binaryFormat;
+}
+
+// it has to be called before opening the first table
+void
+TraceWriterRegistry::SetResultStore (std::string fileName)
+{
+  NS_ASSERT (writers.empty () && (store == NULL));
+  binary = true;
+  storeFileName = fileName;
+
+  std::ostringstream temporaryFileName;
+  temporaryFileName << storeFileName << ".tmp" << getpid ();
+  storeTemporaryFileName = temporaryFileName.str ();
+  store = new std::ofstream (storeTemporaryFileName, std::ofstream::out | std::ofstream::trunc | std::ofstream::binary);
+  if (!store->is_open ())
+    std::cout << "ERROR: the output file " << storeTemporaryFileName << " cannot be opened\n";
+  else
+    writeTraceFileHeader (store);
+}
+
+bool
+TraceWriterRegistry::IsResultStore ()
+{
+  return store != NULL;
+}
+
+// 'fileName' identifies the table. 'tableName' is the name of the table inside a binary file
+TraceWriter*
+TraceWriterRegistry::Open (std::string fileName, std::string tableName)
+{
+  NS_ASSERT (writers.find (fileName) == writers.end ());
+
+  TraceWriter* writer;
+  if (store != NULL)
+    writer = new TraceWriter (store, tableName, nextTableId++);
+  else {
+    std::string actualFileName = fileName;
+    if (binary && (fileName.size () > 4) && (fileName.compare (fileName.size () - 4, 4, ".txt") == 0))
+      actualFileName = fileName.substr (0, fileName.size () - 4) + ".bin";
+    writer = new TraceWriter (actualFileName, tableName, binary);
+  }
+  writers[fileName] = writer;
+  return writer;
+}
+
+// returns NULL if the file has not been opened
+TraceWriter*
+TraceWriterRegistry::Get (std::string fileName)
+{
+  std::map<std::string, TraceWriter*>::iterator found = writers.find (fileName);
+  if (found == writers.end ())
+    return NULL;
+  return found->second;
+}
+
+void
+TraceWriterRegistry::SyncAll ()
+{
+  for (std::map<std::string, TraceWriter*>::iterator i = writers.begin (); i != writers.end (); ++i)
+    i->second->Sync ();
+  if (store != NULL)
+    store->flush ();
+}
+
+// the files whose name starts with 'oldPrefix' go on in a file that starts with 'newPrefix' (see
+//TraceWriter::MoveTo). The tables are still found with the old name. Used by the children of a warm start
+bool
+TraceWriterRegistry::MoveAll (std::string oldPrefix, std::string newPrefix)
+{
+  bool moved = true;
+  for (std::map<std::string, TraceWriter*>::iterator i = writers.begin (); i != writers.end (); ++i) {
+    std::string fileName = i->second->GetFileName ();
+    if ((fileName != "") && (fileName.compare (0, oldPrefix.size (), oldPrefix) == 0))
+      moved = i->second->MoveTo (newPrefix + fileName.substr (oldPrefix.size ())) && moved;
+  }
+
+  if ((store != NULL) && (storeFileName.compare (0, oldPrefix.size (), oldPrefix) == 0)) {
+    // the temporary file of the parent is left as it is. This process has its own one
+    store->flush ();
+    store->close ();
+    storeFileName = newPrefix + storeFileName.substr (oldPrefix.size ());
+    std::ostringstream temporaryFileName;
+    temporaryFileName << storeFileName << ".tmp" << getpid ();
+    moved = copyFile (storeTemporaryFileName, temporaryFileName.str ()) && moved;
+    storeTemporaryFileName = temporaryFileName.str ();
+    store->clear ();
+    store->open (storeTemporaryFileName, std::ofstream::out | std::ofstream::app | std::ofstream::binary);
+    moved = store->is_open () && moved;
+  }
+  return moved;
+}
+
+// the files are closed and deleted (the parent of a warm start does not leave any output)
+void
+TraceWriterRegistry::RemoveAll ()
+{
+  for (std::map<std::string, TraceWriter*>::iterator i = writers.begin (); i != writers.end (); ++i) {
+    std::string fileName = i->second->GetFileName ();
+    delete i->second;
+    if (fileName != "")
+      std::remove (fileName.c_str ());
+  }
+  writers.clear ();
+
+  if (store != NULL) {
+    store->close ();
+    delete store;
+    store = NULL;
+    std::remove (storeTemporaryFileName.c_str ());
+  }
+}
+
+// it returns false if any of the files could not be written
+bool
+TraceWriterRegistry::CloseAll ()
+{
+  bool closed = true;
+  for (std::map<std::string, TraceWriter*>::iterator i = writers.begin (); i != writers.end (); ++i) {
+    if (!i->second->Close ()) {
+      std::cout << "ERROR: the output file " << i->second->GetFileName () << " cannot be written\n";
+      closed = false;
+    }
+    delete i->second;
+  }
+  writers.clear ();
+
+  if (store != NULL) {
+    store->close ();
+    bool written = !store->fail ();
+    delete store;
+    store = NULL;
+
+    if (!written || (std::rename (storeTemporaryFileName.c_str (), storeFileName.c_str ()) != 0)) {
+      std::cout << "ERROR: the output file " << storeFileName << " cannot be written\n";
+      closed = false;
+    }
+  }
+  return closed;
+}
+
+extern TraceWriterRegistry& traceWriters;
+
+
+// Progress of the run, reported by printTime: speed of the simulator (events per wall-clock second), simulated
+//seconds per wall-clock second, peak memory of the process and expected end (ETA). The speeds are the ones of the
+//last interval, so a slow part of the run can be found. The ETA uses the average speed since the start, which
+//is more stable. The peak memory is the one of the whole process (ru_maxrss): with --replications it includes
+//the previous replications, so it only grows. With --saveProgress=1, the values are also written to _progress.txt
+class ProgressMonitor
+{
+  public:
+    ProgressMonitor ();
+    void Init (std::string myRunName, double myEndTime, std::string myFileName);
+    void SetRunName (std::string myRunName);
+    void Report ();
+  private:
+    std::string runName;
+    double endTime;                 // [s] simulation time when the run finishes
+    std::string fileName;           // it identifies the table in 'traceWriters'
+    bool started;
+    std::chrono::steady_clock::time_point startWallTime;
+    double startSimulationTime;
+    double lastWallTime;            // [s] since 'startWallTime'
+    double lastSimulationTime;
+    uint64_t lastEvents;
+};
+
+ProgressMonitor::ProgressMonitor ()
+{
+  endTime = 0.0;
+  started = false;
+  startSimulationTime = 0.0;
+  lastWallTime = 0.0;
+  lastSimulationTime = 0.0;
+  lastEvents = 0;
+}
+
+// the table has to be opened in 'traceWriters' before. With no table, the progress is only printed
+void
+ProgressMonitor::Init (std::string myRunName, double myEndTime, std::string myFileName)
+{
+  runName = myRunName;
+  endTime = myEndTime;
+  fileName = myFileName;
+}
+
+// a variant of a warm start has another name
+void
+ProgressMonitor::SetRunName (std::string myRunName)
+{
+  runName = myRunName;
+}
+
+void
+ProgressMonitor::Report ()
+{
+  double now = Simulator::Now ().GetSeconds ();
+  uint64_t events = Simulator::GetEventCount ();
+  std::chrono::steady_clock::time_point wallNow = std::chrono::steady_clock::now ();
+
+  if (!started) {
+    started = true;
+    startWallTime = wallNow;
+    startSimulationTime = now;
+    lastSimulationTime = now;
+    lastEvents = events;
+  }
+  double wallTime = std::chrono::duration<double> (wallNow - startWallTime).count ();
+  double intervalWallTime = wallTime - lastWallTime;
+
+  // peak resident memory of the process. In Linux, ru_maxrss is in kilobytes
+  struct rusage usage;
+  getrusage (RUSAGE_SELF, &usage);
+  int64_t peakRss = usage.ru_maxrss;
+
+  double eventsPerSecond = 0.0;
+  double simulationSpeed = 0.0;
+  double eta = -1.0;    // unknown
+  if (intervalWallTime > 0.0) {
+    eventsPerSecond = (events - lastEvents) / intervalWallTime;
+    simulationSpeed = (now - lastSimulationTime) / intervalWallTime;
+  }
+  if ((wallTime > 0.0) && (now > startSimulationTime))
+    eta = (endTime - now) * wallTime / (now - startSimulationTime);
+
+  std::cout << now << "\t"
+            << runName;
+  if (intervalWallTime > 0.0)
+    std::cout << "\t" << eventsPerSecond << " events/s"
+              << "\t" << simulationSpeed << " sim-s/wall-s"
+              << "\tpeak RSS " << peakRss / 1024 << " MB"
+              << "\tETA " << eta << " s";
+  std::cout << '\n';
+
+  TraceWriter* writer = traceWriters.Get (fileName);
+  if (writer != NULL) {
+    writer->AddDouble (now);
+    writer->AddDouble (wallTime);
+    writer->AddInteger (events);
+    if (intervalWallTime > 0.0) {
+      writer->AddDouble (eventsPerSecond);
+      writer->AddDouble (simulationSpeed);
+    }
+    else {
+      writer->AddEmpty ();
+      writer->AddEmpty ();
+    }
+    writer->AddInteger (peakRss);
+    if (eta >= 0.0)
+      writer->AddDouble (eta);
+    else
+      writer->AddEmpty ();
+    writer->EndRow ();
+  }
+
+  lastWallTime = wallTime;
+  lastSimulationTime = now;
+  lastEvents = events;
+}
+
+extern ProgressMonitor& progressMonitor;
+
+
+// Print the simulation time and the progress of the run to std::cout
+static void printTime (double period)
+{
+  CallbackTimer callbackTimer ("printTime");
+  progressMonitor.Report ();
+
+  // re-schedule 
+  Simulator::Schedule (Seconds (period), &printTime, period);
+}
+
+
+// Write the statistics of a flow to the tables of the result store. It replaces the file _flows.txt and the
+//files of the histograms. The sums of the delay and the jitter are stored, so the averages can be calculated later
+static void
+storeFlowStats (TraceWriter* writerFlows,
+                TraceWriter* writerHistograms,
+                FlowId flowId,
+                Ipv4FlowClassifier::FiveTuple t,
+                std::string proto,
+                std::string application,
+                const FlowMonitor::FlowStats& st,
+                double simulationTime)
+{
+  std::ostringstream sourceAddress, destinationAddress;
+  sourceAddress << t.sourceAddress;
+  destinationAddress << t.destinationAddress;
+
+  writerFlows->AddInteger (flowId);
+  writerFlows->AddString (proto);
+  writerFlows->AddString (sourceAddress.str ());
+  writerFlows->AddInteger (t.sourcePort);
+  writerFlows->AddString (destinationAddress.str ());
+  writerFlows->AddInteger (t.destinationPort);
+  writerFlows->AddString (application);
+  writerFlows->AddInteger (st.txPackets);
+  writerFlows->AddInteger (st.txBytes);
+  writerFlows->AddInteger (st.rxPackets);
+  writerFlows->AddInteger (st.rxBytes);
+  writerFlows->AddInteger ((int64_t) st.txPackets - (int64_t) st.rxPackets);
+  writerFlows->AddDouble (st.delaySum.GetSeconds ());
+  writerFlows->AddDouble (st.jitterSum.GetSeconds ());
+  writerFlows->AddInteger (st.timesForwarded);
+  writerFlows->AddDouble (simulationTime);
+  writerFlows->EndRow ();
+
+  if (writerHistograms == NULL)
+    return;
+
+  const Histogram* histograms[3] = { &st.delayHistogram, &st.jitterHistogram, &st.packetSizeHistogram };
+  const char* histogramNames[3] = { "delay", "jitter", "packetsize" };
+  for (uint32_t h = 0; h < 3; h++) {
+    for (uint32_t i = 0; i < histograms[h]->GetNBins (); i++) {
+      writerHistograms->AddInteger (flowId);
+      writerHistograms->AddString (histogramNames[h]);
+      writerHistograms->AddInteger (i);
+      writerHistograms->AddDouble (histograms[h]->GetBinStart (i));
+      writerHistograms->AddDouble (histograms[h]->GetBinEnd (i));
+      writerHistograms->AddInteger (histograms[h]->GetBinCount (i));
+      writerHistograms->EndRow ();
+    }
+  }
+}
+
+
 // Save the position of a STA in a file (to be performed periodically)
 static void
 SavePositionSTA (double period, Ptr<Node> node, NodeContainer myApNodes, uint16_t portNumber, std::string fileName)
 {
+  CallbackTimer callbackTimer ("SavePositionSTA");
   // print the results to a file (they are written at the end of the file)
   if ( fileName != "" ) {
 
-    std::ofstream ofs;
-    ofs.open ( fileName, std::ofstream::out | std::ofstream::app); // with "trunc" Any contents that existed in the file before it is open are discarded. with "app", all output operations happen at the end of the file, appending to its existing contents
+    // the file is kept open during the simulation
+    TraceWriter* writer = traceWriters.Get (fileName);
+    NS_ASSERT (writer != NULL);
 
     // Find the position of the STA
     Vector posSTA = GetPosition (node);
@@ -3242,7 +5036,7 @@ SavePositionSTA (double period, Ptr<Node> node, NodeContainer myApNodes, uint16_
                 << node->GetId()
                 << std::endl;
 
-    myNearestAP = nearestAp (myApNodes, node, 0, "both");
+    myNearestAP = nearestAp (myApNodes, node, 0, BAND_BOTH);
     if (VERBOSE_FOR_DEBUG > 0)
       std::cout << Simulator::Now ().GetSeconds()
                 << "\t[SavePositionSTA] the nearest AP has id "
@@ -3251,74 +5045,70 @@ SavePositionSTA (double period, Ptr<Node> node, NodeContainer myApNodes, uint16_
     Vector posMyNearestAP = GetPosition (myNearestAP);
     double distanceToNearestAP = sqrt ( ( (posSTA.x - posMyNearestAP.x)*(posSTA.x - posMyNearestAP.x) ) + ( (posSTA.y - posMyNearestAP.y)*(posSTA.y - posMyNearestAP.y) ) );
 
-    std::string MACaddressAP;
+    bool associated = false;
+    Mac48Address MACaddressAP;
 
     // find the AP to which the STA is associated
-    for (STA_recordVector::const_iterator index = sta_vector.begin (); index != sta_vector.end (); index++) {
-
-      if ((*index)->GetStaid () == node->GetId()) {
-        // if the STA is associated, find the MAC of the AP
-        if ((*index)->GetAssoc ()) {
-          // auxiliar string
-          std::ostringstream auxString;
-          // create a string with the MAC
-          auxString << "02-06-" << (*index)->GetMacOfitsAP();
-          MACaddressAP = auxString.str();
-          if (VERBOSE_FOR_DEBUG > 0)
-            std::cout << Simulator::Now ().GetSeconds() << "\t[SavePositionSTA] STA with id " << (*index)->GetStaid () << " is associated to the AP with MAC " << MACaddressAP << std::endl;
-        }
-        else {
-          if (VERBOSE_FOR_DEBUG > 0)
-            std::cout << Simulator::Now ().GetSeconds() << "\t[SavePositionSTA] STA with id " << (*index)->GetStaid () << " is not associated to any AP" << std::endl;
-        }
+    STA_record* mySTArecord = registry.GetSTA (node->GetId());
+
+    if (mySTArecord != NULL) {
+      // if the STA is associated, find the MAC of the AP
+      if (mySTArecord->GetAssoc ()) {
+        associated = true;
+        MACaddressAP = mySTArecord->GetMacOfitsAP();
+        if (VERBOSE_FOR_DEBUG > 0)
+          std::cout << Simulator::Now ().GetSeconds() << "\t[SavePositionSTA] STA with id " << mySTArecord->GetStaid () << " is associated to the AP with MAC " << MACaddressAP << std::endl;
+      }
+      else {
+        if (VERBOSE_FOR_DEBUG > 0)
+          std::cout << Simulator::Now ().GetSeconds() << "\t[SavePositionSTA] STA with id " << mySTArecord->GetStaid () << " is not associated to any AP" << std::endl;
       }
     }
 
-    if (!(MACaddressAP.empty())) {
+    if (associated) {
       // the STA is associated to an AP
 
       // Find the position and distance of the AP where this STA is associated
       Ptr<Node> myAP;
-
-      NS_ASSERT(!(MACaddressAP.empty()));
-      myAP = myApNodes.Get (GetAnAP_Id(MACaddressAP));
+      uint16_t myAPid = GetAnAP_Id(MACaddressAP);
+      myAP = myApNodes.Get (myAPid);
 
       Vector posMyAP = GetPosition (myAP);
       double distanceToMyAP = sqrt ( ( (posSTA.x - posMyAP.x)*(posSTA.x - posMyAP.x) ) + ( (posSTA.y - posMyAP.y)*(posSTA.y - posMyAP.y) ) );
 
       // print a line in the output file
-      ofs << Simulator::Now().GetSeconds() << "\t"
-          << (node)->GetId() << "\t"
-          << portNumber << "\t"
-          << posSTA.x << "\t"
-          << posSTA.y << "\t"
-          << (myNearestAP)->GetId() << "\t"
-          << posMyNearestAP.x << "\t"
-          << posMyNearestAP.y << "\t"
-          << distanceToNearestAP << "\t"
-          << GetAnAP_Id(MACaddressAP) << "\t"
-          << posMyAP.x << "\t"
-          << posMyAP.y << "\t"
-          << distanceToMyAP << "\t"
-          << std::endl;
+      writer->AddDouble (Simulator::Now().GetSeconds());
+      writer->AddInteger ((node)->GetId());
+      writer->AddInteger (portNumber);
+      writer->AddDouble (posSTA.x);
+      writer->AddDouble (posSTA.y);
+      writer->AddInteger ((myNearestAP)->GetId());
+      writer->AddDouble (posMyNearestAP.x);
+      writer->AddDouble (posMyNearestAP.y);
+      writer->AddDouble (distanceToNearestAP);
+      writer->AddInteger (myAPid);
+      writer->AddDouble (posMyAP.x);
+      writer->AddDouble (posMyAP.y);
+      writer->AddDouble (distanceToMyAP);
+      writer->EndRow ();
     }
     else {
       // the STA is NOT associated to any AP
       // print a line in the output file
-      ofs << Simulator::Now().GetSeconds() << "\t"
-          << (node)->GetId() << "\t"
-          << portNumber << "\t"
-          << posSTA.x << "\t"
-          << posSTA.y << "\t"
-          << (myNearestAP)->GetId() << "\t"
-          << posMyNearestAP.x << "\t"
-          << posMyNearestAP.y << "\t"
-          << distanceToNearestAP << "\t"
-          << "" << "\t"   // as it is not associated, leave this blank
-          << "" << "\t"   // as it is not associated, leave this blank
-          << "" << "\t"   // as it is not associated, leave this blank
-          << "" << "\t"   // as it is not associated, leave this blank
-          << std::endl;
+      writer->AddDouble (Simulator::Now().GetSeconds());
+      writer->AddInteger ((node)->GetId());
+      writer->AddInteger (portNumber);
+      writer->AddDouble (posSTA.x);
+      writer->AddDouble (posSTA.y);
+      writer->AddInteger ((myNearestAP)->GetId());
+      writer->AddDouble (posMyNearestAP.x);
+      writer->AddDouble (posMyNearestAP.y);
+      writer->AddDouble (distanceToNearestAP);
+      writer->AddEmpty ();   // as it is not associated, leave this blank
+      writer->AddEmpty ();   // as it is not associated, leave this blank
+      writer->AddEmpty ();   // as it is not associated, leave this blank
+      writer->AddEmpty ();   // as it is not associated, leave this blank
+      writer->EndRow ();
     }
     
     // re-schedule
@@ -3332,6 +5122,7 @@ SavePositionSTA (double period, Ptr<Node> node, NodeContainer myApNodes, uint16_
 static void
 ReportPosition (double period, Ptr<Node> node, int i, int type, int myverbose, NodeContainer myApNodes)
 {
+  CallbackTimer callbackTimer ("ReportPosition");
   Vector posSTA = GetPosition (node);
 
   if (myverbose > 2) {
@@ -3347,7 +5138,7 @@ ReportPosition (double period, Ptr<Node> node, int i, int type, int myverbose, N
     else {
       // Find the nearest AP
       Ptr<Node> myNearestAP;
-      myNearestAP = nearestAp (myApNodes, node, myverbose, "both");
+      myNearestAP = nearestAp (myApNodes, node, myverbose, BAND_BOTH);
       Vector posMyNearestAP = GetPosition (myNearestAP);
       double distance = sqrt ( ( (posSTA.x - posMyNearestAP.x)*(posSTA.x - posMyNearestAP.x) ) + ( (posSTA.y - posMyNearestAP.y)*(posSTA.y - posMyNearestAP.y) ) );
 
@@ -3365,11 +5156,740 @@ ReportPosition (double period, Ptr<Node> node, int i, int type, int myverbose, N
   Simulator::Schedule (Seconds (period), &ReportPosition, period, node, i, type, myverbose, myApNodes);
 }
 
+// Struct for storing the statistics of the VoIP flows
+#define NUMBER_OF_PERCENTILES 3   // percentiles of the delay and the jitter reported in each interval
+static const double reportedPercentiles[NUMBER_OF_PERCENTILES] = {50.0, 95.0, 99.0};
 
-struct coverages {
-  double coverage_24GHz;
-  double coverage_5GHz;
+struct FlowStatistics {
+  double acumDelay;
+  double acumJitter;
+  uint32_t acumRxPackets;
+  uint32_t acumLostPackets;
+  uint32_t acumRxBytes;
+  double lastIntervalDelay;
+  double lastIntervalJitter;
+  uint32_t lastIntervalRxPackets;
+  uint32_t lastIntervalLostPackets;
+  uint32_t lastIntervalRxBytes;
+  double lastIntervalDelayPercentile[NUMBER_OF_PERCENTILES];    // NaN if they are not available (only VoIP and video flows)
+  double lastIntervalJitterPercentile[NUMBER_OF_PERCENTILES];
+  uint16_t destinationPort;
+  uint16_t finalDestinationPort;
+};
+
+struct AllTheFlowStatistics {
+  uint32_t numberVoIPUploadFlows;
+  uint32_t numberVoIPDownloadFlows;
+  uint32_t numberTCPUploadFlows;
+  uint32_t numberTCPDownloadFlows;
+  uint32_t numberVideoDownloadFlows;
+  FlowStatistics* FlowStatisticsVoIPUpload;
+  FlowStatistics* FlowStatisticsVoIPDownload;
+  FlowStatistics* FlowStatisticsTCPUpload;
+  FlowStatistics* FlowStatisticsTCPDownload;
+  FlowStatistics* FlowStatisticsVideoDownload;
+};
+
+
+// classification of a flow. It is done only once, the first time the flow is seen
+struct FlowInfo {
+  bool classified;
+  uint32_t typeofapplication;   // as in STA_record: 0 unknown; 1 VoIP upload; 2 VoIP download; 3 TCP upload; 4 TCP download; 5 Video download
+  bool isAck;                   // flow of TCP ACKs (statistics are not stored for them)
+  bool uplink;                  // the STA is the source of the flow
+  uint16_t STAid;               // 65535 if the flow does not belong to a STA
+  uint32_t statisticsIndex;     // index in the FlowStatistics array of its type of application
+};
+
+// this class classifies each flow (type of application, STA, direction) the first time it is seen,
+//and stores the result in a table indexed by 'FlowId - 1'. It also keeps, for each STA, a pointer
+//to the statistics of its flow, so the KPI and AMPDU functions do not need to calculate the index
+class FlowRegistry
+{
+  public:
+    FlowRegistry ();
+    void Init (NodeContainer staNodes, AllTheFlowStatistics myAllTheFlowStatistics, uint16_t myTcpDownMultiConnection);
+    const FlowInfo& Classify (FlowId thisFlowId, Ptr<Ipv4FlowClassifier> classifier);
+    bool ClassifyPort (uint16_t applicationPort, uint32_t& typeofapplication, uint32_t& statisticsIndex);
+    FlowStatistics* GetStatisticsOfFlow (FlowId thisFlowId);
+    FlowStatistics* GetStatisticsOfSTA (uint16_t thisSTAid, uint32_t typeofapplication);
+    int32_t GetStatisticsIndexOfSTA (uint16_t thisSTAid, uint32_t typeofapplication);
+    int32_t GetAPofFlow (FlowId thisFlowId);
+  private:
+    FlowStatistics* GetStatistics (uint32_t typeofapplication, uint32_t statisticsIndex);
+    std::vector<FlowInfo> flows;                                  // indexed by 'FlowId - 1'
+    std::unordered_map<uint32_t, uint16_t> STAofAddress;          // IPv4 address of a STA -> STA id
+    std::vector<std::vector<FlowStatistics*> > statisticsOfSTA;   // indexed by STA id and type of application
+    std::vector<std::vector<int32_t> > statisticsIndexOfSTA;      // the same, with the index in the array of its type. -1 if not seen yet
+    AllTheFlowStatistics allTheFlowStatistics;
+    uint16_t TcpDownMultiConnection;
+};
+
+FlowRegistry::FlowRegistry ()
+{
+  TcpDownMultiConnection = 0;
+  allTheFlowStatistics.numberVoIPUploadFlows = 0;
+  allTheFlowStatistics.numberVoIPDownloadFlows = 0;
+  allTheFlowStatistics.numberTCPUploadFlows = 0;
+  allTheFlowStatistics.numberTCPDownloadFlows = 0;
+  allTheFlowStatistics.numberVideoDownloadFlows = 0;
+}
+
+// it has to be called after the IP addresses of the STAs have been assigned
+void
+FlowRegistry::Init (NodeContainer staNodes, AllTheFlowStatistics myAllTheFlowStatistics, uint16_t myTcpDownMultiConnection)
+{
+  allTheFlowStatistics = myAllTheFlowStatistics;
+  TcpDownMultiConnection = myTcpDownMultiConnection;
+
+  uint16_t highestSTAid = 0;
+  for (NodeContainer::Iterator i = staNodes.Begin (); i != staNodes.End (); ++i) {
+    Ptr<Ipv4> ipv4 = (*i)->GetObject<Ipv4> ();
+    if (ipv4 == 0)
+      continue;
+
+    // interface 0 is the loopback
+    for (uint32_t interface = 1; interface < ipv4->GetNInterfaces (); interface++)
+      for (uint32_t address = 0; address < ipv4->GetNAddresses (interface); address++)
+        STAofAddress[ipv4->GetAddress (interface, address).GetLocal ().Get ()] = (*i)->GetId ();
+
+    highestSTAid = std::max (highestSTAid, uint16_t ((*i)->GetId ()));
+  }
+  statisticsOfSTA.assign (highestSTAid + 1, std::vector<FlowStatistics*> (NUMBER_OF_APPLICATION_TYPES, (FlowStatistics*) NULL));
+  statisticsIndexOfSTA.assign (highestSTAid + 1, std::vector<int32_t> (NUMBER_OF_APPLICATION_TYPES, -1));
+}
+
+// returns the statistics of a type of application, or NULL if the index is out of the array
+FlowStatistics*
+FlowRegistry::GetStatistics (uint32_t typeofapplication, uint32_t statisticsIndex)
+{
+  if ((typeofapplication == 1) && (statisticsIndex < allTheFlowStatistics.numberVoIPUploadFlows))
+    return &allTheFlowStatistics.FlowStatisticsVoIPUpload[statisticsIndex];
+  else if ((typeofapplication == 2) && (statisticsIndex < allTheFlowStatistics.numberVoIPDownloadFlows))
+    return &allTheFlowStatistics.FlowStatisticsVoIPDownload[statisticsIndex];
+  else if ((typeofapplication == 3) && (statisticsIndex < allTheFlowStatistics.numberTCPUploadFlows))
+    return &allTheFlowStatistics.FlowStatisticsTCPUpload[statisticsIndex];
+  else if ((typeofapplication == 4) && (statisticsIndex < allTheFlowStatistics.numberTCPDownloadFlows))
+    return &allTheFlowStatistics.FlowStatisticsTCPDownload[statisticsIndex];
+  else if ((typeofapplication == 5) && (statisticsIndex < allTheFlowStatistics.numberVideoDownloadFlows))
+    return &allTheFlowStatistics.FlowStatisticsVideoDownload[statisticsIndex];
+  return NULL;
+}
+
+const FlowInfo&
+FlowRegistry::Classify (FlowId thisFlowId, Ptr<Ipv4FlowClassifier> classifier)
+{
+  if (thisFlowId > flows.size ()) {
+    FlowInfo notClassified = {false, 0, false, false, 65535, 0};
+    flows.resize (thisFlowId, notClassified);
+  }
+
+  FlowInfo& info = flows[thisFlowId - 1];
+  if (info.classified)
+    return info;
+
+  Ipv4FlowClassifier::FiveTuple t = classifier->FindFlow (thisFlowId);
+  info.classified = true;
+
+  // the ACKs of TCP go to the ephemeral port (49153, 49154...) of the sender of the data,
+  //so the port of the application is the source port
+  uint16_t applicationPort = t.destinationPort;
+  if (t.destinationPort / 1000 == 49) {
+    info.isAck = true;
+    applicationPort = t.sourcePort;
+  }
+
+  if (!ClassifyPort (applicationPort, info.typeofapplication, info.statisticsIndex)) {
+    // not one of the flows of the applications
+    info.typeofapplication = 0;
+    return info;
+  }
+
+  FlowStatistics* statistics = GetStatistics (info.typeofapplication, info.statisticsIndex);
+
+  // the data of VoIP upload and TCP upload go from the STA to the server
+  bool dataUplink = (info.typeofapplication == 1) || (info.typeofapplication == 3);
+  info.uplink = dataUplink != info.isAck;
+
+  std::unordered_map<uint32_t, uint16_t>::const_iterator found = STAofAddress.find (info.uplink ? t.sourceAddress.Get () : t.destinationAddress.Get ());
+  if (found != STAofAddress.end ()) {
+    info.STAid = found->second;
+    if (!info.isAck) {
+      statisticsOfSTA[info.STAid][info.typeofapplication] = statistics;
+      statisticsIndexOfSTA[info.STAid][info.typeofapplication] = info.statisticsIndex;
+    }
+  }
+
+  if (VERBOSE_FOR_DEBUG >= 1)
+    std::cout << Simulator::Now ().GetSeconds()
+              << "\t[FlowRegistry] flow #" << thisFlowId
+              << ". Application " << info.typeofapplication
+              << (info.isAck ? " (ACKs)" : "")
+              << ". STA #" << info.STAid
+              << ". Index " << info.statisticsIndex
+              << '\n';
+
+  return info;
+}
+
+// finds the type of application and the index of the statistics from the port of the application.
+//It returns false if the port does not belong to any of the applications
+bool
+FlowRegistry::ClassifyPort (uint16_t applicationPort, uint32_t& typeofapplication, uint32_t& statisticsIndex)
+{
+  typeofapplication = 0;
+  statisticsIndex = 0;
+
+  if (applicationPort / 1000 == INITIALPORT_TCP_UPLOAD / 1000) {
+    typeofapplication = 3;
+    statisticsIndex = applicationPort - INITIALPORT_TCP_UPLOAD;
+  }
+  else if (applicationPort / 10000 == INITIALPORT_VOIP_UPLOAD / 10000) {
+    typeofapplication = 1;
+    statisticsIndex = applicationPort - INITIALPORT_VOIP_UPLOAD;
+  }
+  else if (applicationPort / 10000 == INITIALPORT_VOIP_DOWNLOAD / 10000) {
+    typeofapplication = 2;
+    statisticsIndex = applicationPort - INITIALPORT_VOIP_DOWNLOAD;
+  }
+  else if (applicationPort / 10000 == INITIALPORT_TCP_DOWNLOAD / 10000) {
+    typeofapplication = 4;
+    // with multiple TCP connections, a STA uses 'TcpDownMultiConnection' consecutive ports
+    if (TcpDownMultiConnection == 0)
+      statisticsIndex = applicationPort - INITIALPORT_TCP_DOWNLOAD;
+    else
+      statisticsIndex = (applicationPort - INITIALPORT_TCP_DOWNLOAD) / TcpDownMultiConnection;
+  }
+  else if (applicationPort / 10000 == INITIALPORT_VIDEO_DOWNLOAD / 10000) {
+    typeofapplication = 5;
+    statisticsIndex = applicationPort - INITIALPORT_VIDEO_DOWNLOAD;
+  }
+
+  return GetStatistics (typeofapplication, statisticsIndex) != NULL;
+}
+
+// returns the statistics where a flow has to be stored, or NULL for the ACKs and the flows
+//that are not of the applications. The flow must have been classified
+FlowStatistics*
+FlowRegistry::GetStatisticsOfFlow (FlowId thisFlowId)
+{
+  if ((thisFlowId == 0) || (thisFlowId > flows.size ()))
+    return NULL;
+
+  const FlowInfo& info = flows[thisFlowId - 1];
+  if (!info.classified || info.isAck || (info.typeofapplication == 0))
+    return NULL;
+  return GetStatistics (info.typeofapplication, info.statisticsIndex);
+}
+
+// returns the statistics of the flow of a STA, or NULL if the flow has not been seen yet
+FlowStatistics*
+FlowRegistry::GetStatisticsOfSTA (uint16_t thisSTAid, uint32_t typeofapplication)
+{
+  if ((thisSTAid >= statisticsOfSTA.size ()) || (typeofapplication >= NUMBER_OF_APPLICATION_TYPES))
+    return NULL;
+  return statisticsOfSTA[thisSTAid][typeofapplication];
+}
+
+// returns -1 if the flow has not been seen yet
+int32_t
+FlowRegistry::GetStatisticsIndexOfSTA (uint16_t thisSTAid, uint32_t typeofapplication)
+{
+  if ((thisSTAid >= statisticsIndexOfSTA.size ()) || (typeofapplication >= NUMBER_OF_APPLICATION_TYPES))
+    return -1;
+  return statisticsIndexOfSTA[thisSTAid][typeofapplication];
+}
+
+// the AP is not stored in the table, because it changes with the handoffs. It returns -1 if the STA is not associated
+int32_t
+FlowRegistry::GetAPofFlow (FlowId thisFlowId)
+{
+  if ((thisFlowId == 0) || (thisFlowId > flows.size ()) || (flows[thisFlowId - 1].STAid == 65535))
+    return -1;
+  return registry.GetAPofSTA (flows[thisFlowId - 1].STAid);
+}
+
+extern FlowRegistry& flowRegistry;
+
+
+// load of each AP, measured with the KPIs of the last interval. It is used by the
+//load-aware mode of algorithmLoadBalancing
+class APLoadMonitor
+{
+  public:
+    APLoadMonitor ();
+    void SetSaturationThroughput (double mysaturationThroughput);
+    bool HasMeasurements ();
+    void Update (double latencyBudget, double timeInterval);
+    double GetThroughput (uint16_t thisAPid);
+    uint32_t GetDelayViolations (uint16_t thisAPid);
+    uint32_t GetNumberSTAs (uint16_t thisAPid);
+    uint32_t GetNumberSTAs_app (uint16_t thisAPid, uint32_t typeofapplication);
+    bool IsSaturated (uint16_t thisAPid);
+    bool IsLessLoaded (uint16_t thisAPid, uint16_t otherAPid);
+    void MoveSTA (uint16_t STApairIndex, uint32_t typeofapplication, uint16_t oldAPid, uint16_t newAPid);
+  private:
+    bool measured;
+    double saturationThroughput;                              // [bps]. 0 means that only the delay is considered
+    std::vector<double> throughput;                           // [bps] indexed by AP id
+    std::vector<uint32_t> delayViolations;                    // VoIP flows above the latency budget. Indexed by AP id
+    std::vector<std::vector<uint32_t> > numberSTAs_app;       // indexed by AP id and type of application
+    std::vector<double> throughputOfSTApair;                  // [bps] indexed by STA pair
+};
+
+APLoadMonitor::APLoadMonitor ()
+{
+  measured = false;
+  saturationThroughput = 0.0;
+}
+
+void
+APLoadMonitor::SetSaturationThroughput (double mysaturationThroughput)
+{
+  saturationThroughput = mysaturationThroughput;
+}
+
+bool
+APLoadMonitor::HasMeasurements ()
+{
+  return measured;
+}
+
+// fills the tables with the KPIs of the last interval. It has to be called after obtainKPIs
+void
+APLoadMonitor::Update (double latencyBudget, double timeInterval)
+{
+  uint32_t numberAPs = AP_vector.size ();
+  throughput.assign (numberAPs, 0.0);
+  delayViolations.assign (numberAPs, 0);
+  numberSTAs_app.assign (numberAPs, std::vector<uint32_t> (NUMBER_OF_APPLICATION_TYPES, 0));
+  throughputOfSTApair.assign (sta_vector.size () / 2, 0.0);
+
+  for (uint16_t APid = 0; APid < numberAPs; APid++) {
+
+    // only the STAs associated to this AP are considered
+    const std::set<uint16_t>& stasOfThisAP = registry.GetSTAsOfAP (APid);
+    for (std::set<uint16_t>::const_iterator indexSTA = stasOfThisAP.begin (); indexSTA != stasOfThisAP.end (); indexSTA++) {
+
+      STA_record* thisSTA = registry.GetSTA (*indexSTA);
+      uint32_t typeofapplication = thisSTA->Gettypeofapplication ();
+      numberSTAs_app[APid][typeofapplication]++;
+
+      FlowStatistics* statistics = flowRegistry.GetStatisticsOfSTA (*indexSTA, typeofapplication);
+      if (statistics == NULL)
+        continue;
+
+      double throughputThisSTA = statistics->lastIntervalRxBytes * 8.0 / timeInterval;
+      throughput[APid] = throughput[APid] + throughputThisSTA;
+      throughputOfSTApair[(*indexSTA - numberAPs) % throughputOfSTApair.size ()] = throughputThisSTA;
+
+      // as in adjustAMPDU, only the delay of the VoIP flows is compared with the budget
+      if (((typeofapplication == 1) || (typeofapplication == 2)) &&
+          (latencyBudget > 0.0) &&
+          !std::isnan (statistics->lastIntervalDelay) &&
+          (statistics->lastIntervalDelay > latencyBudget))
+        delayViolations[APid]++;
+    }
+  }
+  measured = true;
+}
+
+double
+APLoadMonitor::GetThroughput (uint16_t thisAPid)
+{
+  return throughput[thisAPid];
+}
+
+uint32_t
+APLoadMonitor::GetDelayViolations (uint16_t thisAPid)
+{
+  return delayViolations[thisAPid];
+}
+
+uint32_t
+APLoadMonitor::GetNumberSTAs (uint16_t thisAPid)
+{
+  uint32_t total = 0;
+  for (uint32_t typeofapplication = 0; typeofapplication < NUMBER_OF_APPLICATION_TYPES; typeofapplication++)
+    total = total + numberSTAs_app[thisAPid][typeofapplication];
+  return total;
+}
+
+uint32_t
+APLoadMonitor::GetNumberSTAs_app (uint16_t thisAPid, uint32_t typeofapplication)
+{
+  return numberSTAs_app[thisAPid][typeofapplication];
+}
+
+// an AP is saturated if a VoIP flow is above the latency budget, or if its throughput is above the limit
+bool
+APLoadMonitor::IsSaturated (uint16_t thisAPid)
+{
+  if (delayViolations[thisAPid] > 0)
+    return true;
+
+  return (saturationThroughput > 0.0) && (throughput[thisAPid] >= saturationThroughput);
+}
+
+// compares the delay violations first, then the throughput, and then the number of STAs
+bool
+APLoadMonitor::IsLessLoaded (uint16_t thisAPid, uint16_t otherAPid)
+{
+  if (delayViolations[thisAPid] != delayViolations[otherAPid])
+    return delayViolations[thisAPid] < delayViolations[otherAPid];
+
+  if (throughput[thisAPid] != throughput[otherAPid])
+    return throughput[thisAPid] < throughput[otherAPid];
+
+  return GetNumberSTAs (thisAPid) < GetNumberSTAs (otherAPid);
+}
+
+// a STA pair has been moved to another AP. Its load is now expected in the new AP
+//(until the next measurement), so a single idle AP does not get all the STAs in the same period
+void
+APLoadMonitor::MoveSTA (uint16_t STApairIndex, uint32_t typeofapplication, uint16_t oldAPid, uint16_t newAPid)
+{
+  throughput[oldAPid] = std::max (0.0, throughput[oldAPid] - throughputOfSTApair[STApairIndex]);
+  throughput[newAPid] = throughput[newAPid] + throughputOfSTApair[STApairIndex];
+
+  if (numberSTAs_app[oldAPid][typeofapplication] > 0)
+    numberSTAs_app[oldAPid][typeofapplication]--;
+  numberSTAs_app[newAPid][typeofapplication]++;
+}
+
+extern APLoadMonitor& apLoadMonitor;
+
+
+// updates 'apLoadMonitor' with the KPIs of the last interval. Called by 'kpiScheduler'
+void
+measureAPload ( double latencyBudget,
+                double timeInterval,
+                uint32_t myverbose)
+{
+  CallbackTimer callbackTimer ("measureAPload");
+  apLoadMonitor.Update (latencyBudget, timeInterval);
+
+  if (myverbose > 1) {
+    for (uint16_t APid = 0; APid < AP_vector.size (); APid++)
+      std::cout << Simulator::Now ().GetSeconds()
+                << "\t[measureAPload] AP #" << APid
+                << "\tThroughput: " << apLoadMonitor.GetThroughput (APid)
+                << " bps\tDelay budget violations: " << apLoadMonitor.GetDelayViolations (APid)
+                << "\tSTAs: " << apLoadMonitor.GetNumberSTAs (APid)
+                << " (VoIP up " << apLoadMonitor.GetNumberSTAs_app (APid, 1)
+                << ", VoIP down " << apLoadMonitor.GetNumberSTAs_app (APid, 2)
+                << ", TCP up " << apLoadMonitor.GetNumberSTAs_app (APid, 3)
+                << ", TCP down " << apLoadMonitor.GetNumberSTAs_app (APid, 4)
+                << ", video " << apLoadMonitor.GetNumberSTAs_app (APid, 5)
+                << ")" << (apLoadMonitor.IsSaturated (APid) ? " SATURATED" : "")
+                << '\n';
+  }
+}
+
+
+// a STA pair that can take part in an exchange of the multi-swap load balancing
+struct swapCandidate {
+  uint16_t STApairIndex;
+  uint16_t associatedSTAid;   // the STA of the pair that is associated (in 2.4 GHz)
+  uint16_t otherSTAid;        // the other STA of the pair (the 5 GHz interface of a dual STA)
+  uint16_t APpairIndex;       // the AP pair where it is associated
 };
+
+// tries to match the dual candidate 'dual' with a non-dual candidate. If all its non-dual
+//candidates are taken, it tries to move their dual STAs to other non-dual candidates (augmenting path)
+bool
+findSwapAugmentingPath (uint32_t dual,
+                        const std::vector< std::vector<uint32_t> >& edges,
+                        std::vector<bool>& visited,
+                        std::vector<int32_t>& dualMatchedTo,
+                        std::vector<int32_t>& nonDualMatchedTo)
+{
+  for (uint32_t k = 0; k < edges[dual].size (); k++) {
+    uint32_t nonDual = edges[dual][k];
+    if (visited[nonDual])
+      continue;
+    visited[nonDual] = true;
+
+    if ((nonDualMatchedTo[nonDual] == -1) || findSwapAugmentingPath (nonDualMatchedTo[nonDual], edges, visited, dualMatchedTo, nonDualMatchedTo)) {
+      dualMatchedTo[dual] = nonDual;
+      nonDualMatchedTo[nonDual] = dual;
+      return true;
+    }
+  }
+  return false;
+}
+
+// moves a STA to the channel 'channel'. If the STA is dual, the interface 'oldSTAid' (the associated one)
+//is disabled and 'newSTAid' is enabled. If it is non-dual, both are the same STA
+void
+switchSTAtoChannel (uint16_t oldSTAid,
+                    uint16_t newSTAid,
+                    uint8_t channel,
+                    NodeContainer staNodes,
+                    uint16_t firstSTAid,
+                    uint32_t myverbose)
+{
+  NS_ASSERT(registry.GetSTA (oldSTAid) != NULL);
+  uint32_t mywifiModel = registry.GetSTA (oldSTAid)->GetWifiModel ();
+
+  NetDeviceContainer newDevice;
+  newDevice.Add( (staNodes.Get(newSTAid - firstSTAid))->GetDevice(1) ); // It has to be device 1, not device 0
+
+  if (oldSTAid != newSTAid) {
+    NetDeviceContainer oldDevice;
+    oldDevice.Add( (staNodes.Get(oldSTAid - firstSTAid))->GetDevice(1) );
+
+    DisableNetworkDevice (oldDevice, mywifiModel, myverbose);
+    EnableNetworkDevice (newDevice, mywifiModel, myverbose);
+  }
+
+  ChangeFrequencyLocal (newDevice, channel, mywifiModel, myverbose);
+}
+
+// multi-swap load balancing. Instead of a single exchange per period, it finds all the pairs of
+// - a dual STA associated in 2.4 GHz to a 2.4 GHz-only AP, and under 5 GHz coverage of a dual AP
+// - a non-dual STA associated in 2.4 GHz to that dual AP, and under 2.4 GHz coverage of the first AP
+//and exchanges them. This is a maximum matching between dual and non-dual candidates, so each STA
+//is switched once at most. The number of STAs switched in a period is limited by 'loadBalancerState'
+// it returns the number of STAs switched
+uint32_t
+algorithmMultiSwap (NodeContainer apNodes,
+                    NodeContainer staNodes,
+                    std::vector<bool>& switchedSTApairs,
+                    uint32_t channelSwitchesDone,
+                    uint32_t myverbose)
+{
+  uint16_t numberAPpairs = apNodes.GetN() / 2;
+  uint16_t numberSTApairs = staNodes.GetN() / 2;
+  uint16_t firstSTAid = apNodes.GetN();
+
+  std::vector<infoAboutEachSTApair>& infoSTAs = loadBalancerState.GetInfoSTAs ();
+  std::vector<infoAboutEachAPpair>& infoAPs = loadBalancerState.GetInfoAPs ();
+  LoadBalancerState::coverageTable& coverageAPinfo = loadBalancerState.GetCoverage ();
+
+  // find the candidates. Only the STAs associated in 2.4 GHz are interesting
+  std::vector<swapCandidate> dualCandidates;
+  std::vector<swapCandidate> nonDualCandidates;
+
+  for (uint16_t STApairIndex = 0; STApairIndex < numberSTApairs; STApairIndex++) {
+    swapCandidate candidate;
+    candidate.STApairIndex = STApairIndex;
+
+    if (infoSTAs[STApairIndex].STAassociated && (getWirelessBandOfChannel(infoSTAs[STApairIndex].channelSTA) == BAND_24GHZ)) {
+      // the primary STA is associated (to the primary AP)
+      candidate.associatedSTAid = infoSTAs[STApairIndex].STAid;
+      candidate.otherSTAid = infoSTAs[STApairIndex].peerSTAid;
+      candidate.APpairIndex = infoSTAs[STApairIndex].APiDwhereThisSTAisAssociated;
+    }
+    else if (infoSTAs[STApairIndex].peerSTAassociated && (getWirelessBandOfChannel(infoSTAs[STApairIndex].channelPeerSTA) == BAND_24GHZ)) {
+      // the secondary STA is associated (to the secondary AP)
+      candidate.associatedSTAid = infoSTAs[STApairIndex].peerSTAid;
+      candidate.otherSTAid = infoSTAs[STApairIndex].STAid;
+      candidate.APpairIndex = infoSTAs[STApairIndex].APiDwhereThePeerSTAisAssociated - numberAPpairs;
+    }
+    else {
+      // not associated, or associated in 5 GHz
+      continue;
+    }
+
+    if (infoSTAs[STApairIndex].STAenabled && infoSTAs[STApairIndex].peerSTAenabled) {
+      // a dual STA is a candidate if its AP only works in 2.4 GHz
+      if (infoAPs[candidate.APpairIndex].APbandsActive == BAND_24GHZ)
+        dualCandidates.push_back (candidate);
+    }
+    else {
+      // a non-dual STA is a candidate if its AP is dual
+      if (infoAPs[candidate.APpairIndex].APbandsActive == BAND_BOTH)
+        nonDualCandidates.push_back (candidate);
+    }
+  }
+
+  // the dual candidate 'd' and the non-dual candidate 'n' can be exchanged if 'd' is under
+  //5 GHz coverage of the AP of 'n', and 'n' is under 2.4 GHz coverage of the AP of 'd'
+  std::vector< std::vector<uint32_t> > edges (dualCandidates.size ());
+  for (uint32_t d = 0; d < dualCandidates.size (); d++) {
+    for (uint32_t n = 0; n < nonDualCandidates.size (); n++) {
+      char coverageDual = coverageAPinfo[dualCandidates[d].STApairIndex][nonDualCandidates[n].APpairIndex];
+      char coverageNonDual = coverageAPinfo[nonDualCandidates[n].STApairIndex][dualCandidates[d].APpairIndex];
+
+      if (((coverageDual == '5') || (coverageDual == 'b')) && ((coverageNonDual == '2') || (coverageNonDual == 'b')))
+        edges[d].push_back (n);
+    }
+  }
+
+  // maximum matching. Each exchange switches two STAs, so I stop before exceeding the limit
+  std::vector<int32_t> dualMatchedTo (dualCandidates.size (), -1);
+  std::vector<int32_t> nonDualMatchedTo (nonDualCandidates.size (), -1);
+  uint32_t numberOfSwaps = 0;
+
+  for (uint32_t d = 0; d < dualCandidates.size (); d++) {
+    if (!loadBalancerState.ChannelSwitchAllowed (channelSwitchesDone + 2 * numberOfSwaps + 1))
+      break;
+
+    std::vector<bool> visited (nonDualCandidates.size (), false);
+    if (findSwapAugmentingPath (d, edges, visited, dualMatchedTo, nonDualMatchedTo))
+      numberOfSwaps++;
+  }
+
+  if (myverbose >= 2)
+    std::cout << Simulator::Now ().GetSeconds()
+              << "\t[algorithmMultiSwap] Dual candidates: " << dualCandidates.size ()
+              << ". Non-dual candidates: " << nonDualCandidates.size ()
+              << ". Exchanges: " << numberOfSwaps
+              << '\n';
+
+  // apply all the exchanges
+  uint32_t STAsSwitched = 0;
+  for (uint32_t d = 0; d < dualCandidates.size (); d++) {
+    if (dualMatchedTo[d] == -1)
+      continue;
+
+    swapCandidate& dual = dualCandidates[d];
+    swapCandidate& nonDual = nonDualCandidates[dualMatchedTo[d]];
+
+    // the dual STA goes to the 5 GHz AP of the pair where the non-dual STA is
+    infoAboutEachAPpair& APsOfNonDual = infoAPs[nonDual.APpairIndex];
+    uint8_t channelForDual = (APsOfNonDual.APband == BAND_5GHZ) ? APsOfNonDual.channelAP : APsOfNonDual.channelPeerAP;
+
+    // the non-dual STA goes to the 2.4 GHz AP of the pair where the dual STA is
+    infoAboutEachAPpair& APsOfDual = infoAPs[dual.APpairIndex];
+    uint8_t channelForNonDual = (APsOfDual.APband == BAND_24GHZ) ? APsOfDual.channelAP : APsOfDual.channelPeerAP;
+
+    NS_ASSERT(channelForDual != 0);
+    NS_ASSERT(channelForNonDual != 0);
+
+    switchSTAtoChannel (dual.associatedSTAid, dual.otherSTAid, channelForDual, staNodes, firstSTAid, 0 /*myverbose*/);
+    switchSTAtoChannel (nonDual.associatedSTAid, nonDual.associatedSTAid, channelForNonDual, staNodes, firstSTAid, 0 /*myverbose*/);
+
+    switchedSTApairs[dual.STApairIndex] = true;
+    switchedSTApairs[nonDual.STApairIndex] = true;
+    STAsSwitched = STAsSwitched + 2;
+
+    if (myverbose >= 1)
+      std::cout << Simulator::Now ().GetSeconds()
+                << "\t[algorithmMultiSwap] ***** Dual STA #" << dual.otherSTAid
+                << " switched to channel " << uint16_t (channelForDual)
+                << " (AP pair #" << nonDual.APpairIndex
+                << "). Non-dual STA #" << nonDual.associatedSTAid
+                << " switched to channel " << uint16_t (channelForNonDual)
+                << " (AP pair #" << dual.APpairIndex
+                << ") *****"
+                << '\n';
+  }
+
+  return STAsSwitched;
+}
+
+// load-aware load balancing: a dual STA associated to a saturated 2.4 GHz AP is moved to the least
+//loaded 5 GHz AP that gives it coverage, if that AP is not saturated and has less load than the current one
+// the load is the one measured by 'apLoadMonitor' in the last interval of the KPIs
+// it returns the number of STAs switched
+uint32_t
+algorithmLoadAware (NodeContainer apNodes,
+                    NodeContainer staNodes,
+                    std::vector<bool>& switchedSTApairs,
+                    uint32_t channelSwitchesDone,
+                    uint32_t myverbose)
+{
+  uint16_t numberAPpairs = apNodes.GetN() / 2;
+  uint16_t numberSTApairs = staNodes.GetN() / 2;
+  uint16_t firstSTAid = apNodes.GetN();
+
+  std::vector<infoAboutEachSTApair>& infoSTAs = loadBalancerState.GetInfoSTAs ();
+  std::vector<infoAboutEachAPpair>& infoAPs = loadBalancerState.GetInfoAPs ();
+  LoadBalancerState::coverageTable& coverageAPinfo = loadBalancerState.GetCoverage ();
+
+  uint32_t STAsSwitched = 0;
+
+  for (uint16_t STApairIndex = 0; STApairIndex < numberSTApairs; STApairIndex++) {
+
+    if (switchedSTApairs[STApairIndex] || !loadBalancerState.ChannelSwitchAllowed (channelSwitchesDone + STAsSwitched))
+      continue;
+
+    // only a dual STA can be moved to 5 GHz
+    if (!(infoSTAs[STApairIndex].STAenabled && infoSTAs[STApairIndex].peerSTAenabled))
+      continue;
+
+    uint16_t associatedSTAid, otherSTAid, currentAPid;
+
+    if (infoSTAs[STApairIndex].STAassociated && (getWirelessBandOfChannel(infoSTAs[STApairIndex].channelSTA) == BAND_24GHZ)) {
+      associatedSTAid = infoSTAs[STApairIndex].STAid;
+      otherSTAid = infoSTAs[STApairIndex].peerSTAid;
+      currentAPid = infoSTAs[STApairIndex].APiDwhereThisSTAisAssociated;
+    }
+    else if (infoSTAs[STApairIndex].peerSTAassociated && (getWirelessBandOfChannel(infoSTAs[STApairIndex].channelPeerSTA) == BAND_24GHZ)) {
+      associatedSTAid = infoSTAs[STApairIndex].peerSTAid;
+      otherSTAid = infoSTAs[STApairIndex].STAid;
+      currentAPid = infoSTAs[STApairIndex].APiDwhereThePeerSTAisAssociated;
+    }
+    else {
+      // not associated, or associated in 5 GHz
+      continue;
+    }
+
+    if (!apLoadMonitor.IsSaturated (currentAPid))
+      continue;
+
+    // find the least loaded 5 GHz AP that gives coverage to the STA
+    uint16_t newAPid = 65535;
+    uint8_t channelNewAP = 0;
+
+    for (uint16_t APpairIndex = 0; APpairIndex < numberAPpairs; APpairIndex++) {
+      if ((coverageAPinfo[STApairIndex][APpairIndex] != '5') && (coverageAPinfo[STApairIndex][APpairIndex] != 'b'))
+        continue;
+
+      uint16_t candidateAPid;
+      uint8_t channelCandidateAP;
+      if (infoAPs[APpairIndex].APband == BAND_5GHZ) {
+        candidateAPid = infoAPs[APpairIndex].APid;
+        channelCandidateAP = infoAPs[APpairIndex].channelAP;
+      }
+      else {
+        candidateAPid = infoAPs[APpairIndex].peerAPid;
+        channelCandidateAP = infoAPs[APpairIndex].channelPeerAP;
+      }
+
+      if (apLoadMonitor.IsSaturated (candidateAPid) || !apLoadMonitor.IsLessLoaded (candidateAPid, currentAPid))
+        continue;
+
+      if ((newAPid == 65535) || apLoadMonitor.IsLessLoaded (candidateAPid, newAPid)) {
+        newAPid = candidateAPid;
+        channelNewAP = channelCandidateAP;
+      }
+    }
+
+    if (newAPid == 65535) {
+      if (myverbose >= 2)
+        std::cout << Simulator::Now ().GetSeconds()
+                  << "\t[algorithmLoadAware] STA(#" << infoSTAs[STApairIndex].STAid
+                  << ",#" << infoSTAs[STApairIndex].peerSTAid
+                  << ") is in the saturated AP #" << currentAPid
+                  << ", but there is no idle 5 GHz AP under coverage"
+                  << '\n';
+      continue;
+    }
+
+    NS_ASSERT(channelNewAP != 0);
+
+    switchSTAtoChannel (associatedSTAid, otherSTAid, channelNewAP, staNodes, firstSTAid, 0 /*myverbose*/);
+    apLoadMonitor.MoveSTA (STApairIndex, registry.GetSTA (associatedSTAid)->Gettypeofapplication (), currentAPid, newAPid);
+
+    switchedSTApairs[STApairIndex] = true;
+    STAsSwitched++;
+
+    if (myverbose >= 1)
+      std::cout << Simulator::Now ().GetSeconds()
+                << "\t[algorithmLoadAware] ***** Dual STA #" << otherSTAid
+                << " moved from the saturated AP #" << currentAPid
+                << " to AP #" << newAPid
+                << " (channel " << uint16_t (channelNewAP)
+                << ") *****"
+                << '\n';
+  }
+
+  return STAsSwitched;
+}
+
 // performs a load balancing: if there is
 // - a dual STA connected to a non-dual AP
 // and
@@ -3385,29 +5905,20 @@ void algorithmLoadBalancing ( double period,
                               //double coverage_5GHz,
                               uint32_t myverbose )
 {
+  CallbackTimer callbackTimer ("algorithmLoadBalancing");
   uint16_t numberAPpairs = apNodes.GetN() / 2; // number of pairs of APs
   uint16_t numberSTApairs = staNodes.GetN() / 2; // number of pairs of APs
 
-  struct infoAboutEachSTApair {
-    uint16_t STAid;
-    uint16_t peerSTAid;
-    bool STAenabled;
-    bool peerSTAenabled;
-    uint8_t channelSTA;
-    uint8_t channelPeerSTA;
-    Ptr<Node> pointerToMainSTA;
-    Ptr<Node> pointerToPeerSTA;
-    uint16_t APiDwhereThisSTAisAssociated;
-    uint16_t APiDwhereThePeerSTAisAssociated;
-    bool STAassociated;
-    bool peerSTAassociated;
-  };
-  infoAboutEachSTApair infoSTAs[numberSTApairs];
+  // the tables are kept in 'loadBalancerState' between calls. They are created by 'coverageTracker'
+  NS_ASSERT(coverageTracker.IsInitialized ());
+  NS_ASSERT(loadBalancerState.IsInitialized ());
+
+  std::vector<infoAboutEachSTApair>& infoSTAs = loadBalancerState.GetInfoSTAs ();
 
   // this expresses if a STA pair is under coverage of an AP pair
-  // each element can be "2.4 GHz", "5 GHz" or "both"
+  // each element can be '2' (2.4 GHz), '5' (5 GHz), 'b' (both) or 'n' (none)
   //std::string coverageAPinfo[numberSTApairs][numberAPpairs];
-  char coverageAPinfo[numberSTApairs][numberAPpairs];
+  LoadBalancerState::coverageTable& coverageAPinfo = loadBalancerState.GetCoverage ();
 
   //myverbose = 2;  // FIXME: remove this
 
@@ -3426,6 +5937,18 @@ void algorithmLoadBalancing ( double period,
     // make sure I have not arrived to the end of the vector
     NS_ASSERT(index != sta_vector.end ());
 
+    // if the STAs of this pair have not been associated / de-associated,
+    //the information stored in the previous run is still valid
+    if (!loadBalancerState.RowNeedsUpdate (STApairIndex)) {
+      if (VERBOSE_FOR_DEBUG >= 1)
+        std::cout << Simulator::Now().GetSeconds()
+                  << "\t[algorithmLoadBalancing] STA #" << (*index)->GetStaid()
+                  << " has not changed. Using the stored information"
+                  << std::endl;
+      index++;
+      continue;
+    }
+
     infoSTAs[STApairIndex].STAid = (*index)->GetStaid();
 
     // Id of the AP where this STA is associated
@@ -3433,15 +5956,11 @@ void algorithmLoadBalancing ( double period,
     infoSTAs[STApairIndex].STAassociated = false;
     infoSTAs[STApairIndex].peerSTAassociated = false;
 
-    std::string APaddressWhereThisSTAisAssociated;
-    // auxiliar string
-    std::ostringstream auxString;
-    // create a string with the MAC
-    auxString << "02-06-" << (*index)->GetMacOfitsAP();
-    APaddressWhereThisSTAisAssociated = auxString.str();
+    Mac48Address nullMAC = "00:00:00:00:00:00";
+    Mac48Address APaddressWhereThisSTAisAssociated = (*index)->GetMacOfitsAP();
 
     // if the STA is associated, find the corresponding AP
-    if (APaddressWhereThisSTAisAssociated != "02-06-00:00:00:00:00:00") {
+    if (APaddressWhereThisSTAisAssociated != nullMAC) {
       infoSTAs[STApairIndex].APiDwhereThisSTAisAssociated = GetAnAP_Id (APaddressWhereThisSTAisAssociated);
       infoSTAs[STApairIndex].STAassociated = true;
     }
@@ -3546,8 +6065,8 @@ void algorithmLoadBalancing ( double period,
                   << std::endl;
 
       // check if the STA is associated to an AP
-      std::string STAband = "";
-      std::string peerSTAband = "";
+      wifiBand STAband = BAND_NONE;
+      wifiBand peerSTAband = BAND_NONE;
 
       if ((infoSTAs[STApairIndex].channelSTA == 0) && (infoSTAs[STApairIndex].channelPeerSTA == 0)) {
         // none of the two peered STAs is associated
@@ -3577,13 +6096,9 @@ void algorithmLoadBalancing ( double period,
         else { // if (channelPeerSTA != 0)
           // the main STA is not associated but the peer STA is associated
 
-          // auxiliar string
-          std::ostringstream auxString;
-          // create a string with the MAC
-          auxString << "02-06-" << GetAPMACOfAnAssociatedSTA (infoSTAs[STApairIndex].peerSTAid);
-          APaddressWhereThisSTAisAssociated = auxString.str();
+          APaddressWhereThisSTAisAssociated = GetAPMACOfAnAssociatedSTA (infoSTAs[STApairIndex].peerSTAid);
 
-          if (APaddressWhereThisSTAisAssociated != "02-06-00:00:00:00:00:00") {
+          if (APaddressWhereThisSTAisAssociated != nullMAC) {
             infoSTAs[STApairIndex].APiDwhereThePeerSTAisAssociated = GetAnAP_Id (APaddressWhereThisSTAisAssociated);
             infoSTAs[STApairIndex].peerSTAassociated = true;
           }
@@ -3607,189 +6122,15 @@ void algorithmLoadBalancing ( double period,
         NS_ASSERT(!((infoSTAs[STApairIndex].STAassociated == true) && (infoSTAs[STApairIndex].peerSTAassociated == true)));
 
         // make sure only one of the bands is active
-        if (STAband == "5 GHz") NS_ASSERT(peerSTAband == "");
-        if (STAband == "2.4 GHz") NS_ASSERT(peerSTAband == "");
-        if (peerSTAband == "5 GHz") NS_ASSERT(STAband == "");
-        if (peerSTAband == "2.4 GHz") NS_ASSERT(STAband == "");
-
-
-        // fill the coverage variable 'coverageAPinfo' for this STA
-        // check if the STA is under coverage of each AP on each band
-        uint16_t APindex = 0;
-        //uint16_t peerAPindex = 0;
-
-        for (AP_recordVector::const_iterator indexAP = AP_vector.begin (); indexAP != AP_vector.end (); indexAP++) {
-
-          // as the APs are in pairs, do this only with the first half of the APs
-          if ( APindex < numberAPpairs ) {
-            uint8_t APchannel = (*indexAP)->GetWirelessChannel();
-            std::string APband = getWirelessBandOfChannel(APchannel);
-            // calculate the distance of the STA to this AP
-            Ptr<Node> myAP = apNodes.Get(APindex);
-            Vector posMyAP = GetPosition (myAP);
-            double distance = sqrt ( ( (posSTA.x - posMyAP.x)*(posSTA.x - posMyAP.x) ) + ( (posSTA.y - posMyAP.y)*(posSTA.y - posMyAP.y) ) );
-
-            // obtain data of the peer AP
-            //peerAPindex = APindex + numberAPpairs;
-            AP_recordVector::const_iterator indexPeerAP = indexAP + numberAPpairs;
-            uint8_t peerAPchannel = (*indexPeerAP)->GetWirelessChannel();
-            std::string peerAPband = getWirelessBandOfChannel(peerAPchannel);
-
-            // default value
-            //coverageAPinfo[STApairIndex][APindex] = "none";
-            coverageAPinfo[STApairIndex][APindex] = 'n';
-
-            if ((APchannel == 0) && (peerAPchannel == 0)) {
-              // both APs are disabled. There is no coverage
-              //coverageAPinfo[STApairIndex][APindex] = "none";
-
-              if (myverbose >= 2)
-                std::cout << Simulator::Now ().GetSeconds()
-                          << "\t[algorithmLoadBalancing]     AP (#" << (*indexAP)->GetApid()
-                          << ", #" << (*indexPeerAP)->GetApid()
-                          << ") is not active"
-                          << std::endl;
-            }
-            else if ((APchannel != 0) && (peerAPchannel != 0)) {
-              // dual AP
-              if (myverbose >= 2)
-                std::cout << Simulator::Now ().GetSeconds()
-                          << "\t[algorithmLoadBalancing]     AP (#" << (*indexAP)->GetApid()
-                          << ", #" << (*indexPeerAP)->GetApid()
-                          << ") is dual."
-                          << " Channels " << uint16_t(APchannel)
-                          << ", " << uint16_t(peerAPchannel)
-                          << ". Distance to STA (#" << infoSTAs[STApairIndex].STAid
-                          << ", #" << infoSTAs[STApairIndex].peerSTAid
-                          << "): " << distance << " m"
-                          << std::endl;
-
-              if (VERBOSE_FOR_DEBUG >= 1)
-                std::cout << Simulator::Now ().GetSeconds()
-                          << "\t[algorithmLoadBalancing]     AP #" << (*indexAP)->GetApid() 
-                          << " with MAC " << (*indexAP)->GetMac()
-                          << " Channel " << uint16_t(APchannel)
-                          << " band " << APband
-                          << std::endl;
-
-              if (VERBOSE_FOR_DEBUG >= 1)
-                std::cout << Simulator::Now ().GetSeconds()
-                          << "\t[algorithmLoadBalancing]     peer AP #" << (*indexPeerAP)->GetApid() 
-                          << " with MAC " << (*indexPeerAP)->GetMac()
-                          << " Channel " << uint16_t(peerAPchannel)
-                          << " band " << peerAPband
-                          << std::endl;
-
-              if ( (distance < coverage.coverage_24GHz) && (distance < coverage.coverage_5GHz) ) {
-                // the STA is under coverage of this dual AP in both bands
-                //coverageAPinfo[STApairIndex][APindex] = "both";
-                coverageAPinfo[STApairIndex][APindex] = 'b';
-
-                if (myverbose >= 2)
-                  std::cout << Simulator::Now ().GetSeconds()
-                            << "\t[algorithmLoadBalancing]      The STA is under coverage of the AP in both bands: " << distance
-                            << " < " << coverage.coverage_24GHz
-                            << " m (2.4 GHz) & " << distance
-                            << " < " << coverage.coverage_5GHz
-                            << " m (5 GHz) "
-                            << std::endl;             
-              }
-              else if ( (distance < coverage.coverage_24GHz) && (distance >= coverage.coverage_5GHz) ) {
-                // the STA is under coverage of this dual AP in both bands
-                //coverageAPinfo[STApairIndex][APindex] = "2.4 GHz";
-                coverageAPinfo[STApairIndex][APindex] = '2';
-
-                if (myverbose >= 2)
-                  std::cout << Simulator::Now ().GetSeconds()
-                            << "\t[algorithmLoadBalancing]      The STA is under coverage of the AP in the 2.4 GHz band: " << distance
-                            << " < " << coverage.coverage_24GHz
-                            << " m"
-                            << std::endl;
-              }
-              else if ( (distance >= coverage.coverage_24GHz) && (distance < coverage.coverage_5GHz) ) {
-                // the STA is under coverage of this dual AP in both bands
-                //coverageAPinfo[STApairIndex][APindex] = "5 GHz";
-                coverageAPinfo[STApairIndex][APindex] = '5';
-
-                if (myverbose >= 2)
-                  std::cout << Simulator::Now ().GetSeconds()
-                            << "\t[algorithmLoadBalancing]      The STA is under coverage of the AP in the 5 GHz band: " << distance
-                            << " < " << coverage.coverage_5GHz
-                            << " m"
-                            << std::endl;             
-              }
-            }
-            else {
-              // only one of the APs is active
-
-              if ( ((APchannel != 0) && (APband == "2.4 GHz")) || ((peerAPchannel != 0) && (peerAPband == "2.4 GHz")) ) {
-                // the active interface is in 2.4 GHz
-                if (myverbose >= 2) {
-                  std::cout << Simulator::Now ().GetSeconds()
-                            << "\t[algorithmLoadBalancing]     AP (#" << (*indexAP)->GetApid()
-                            << ", #" << (*indexPeerAP)->GetApid()
-                            << ") is only active in 2.4 GHz.";
-                  if (APchannel != 0)
-                    std::cout << " Channel " << uint16_t(APchannel);
-                  else
-                    std::cout << " Channel " << uint16_t(peerAPchannel);
-
-                  std::cout << ". Distance to STA (#" << infoSTAs[STApairIndex].STAid
-                            << ", #" << infoSTAs[STApairIndex].peerSTAid
-                            << "): " << distance << " m"
-                            << std::endl;
-                }
-
-                if (distance < coverage.coverage_24GHz) {
-                  // the STA is under coverage of this dual AP in both bands
-                  //coverageAPinfo[STApairIndex][APindex] = "2.4 GHz";
-                  coverageAPinfo[STApairIndex][APindex] = '2';
-
-                  if (myverbose >= 2)
-                    std::cout << Simulator::Now ().GetSeconds()
-                              << "\t[algorithmLoadBalancing]      The STA is under coverage of the AP in the 2.4 GHz band: " << distance
-                              << " < " << coverage.coverage_24GHz
-                              << " m"
-                              << std::endl;
-                }
-              }
-              else if ( ((APchannel != 0) && (APband == "5 GHz")) || ((peerAPchannel != 0) && (peerAPband == "5 GHz")) ) {
-                // the active interface is in 5 GHz
-                if (myverbose >= 2) {
-                  std::cout << Simulator::Now ().GetSeconds()
-                            << "\t[algorithmLoadBalancing]     AP (#" << (*indexAP)->GetApid()
-                            << ", #" << (*indexPeerAP)->GetApid()
-                            << ") is only active in 5 GHz.";
-                  if (APchannel != 0)
-                    std::cout << " Channel " << uint16_t(APchannel);
-                  else
-                    std::cout << " Channel " << uint16_t(peerAPchannel);
-
-                  std::cout << ". Distance to STA (#" << infoSTAs[STApairIndex].STAid
-                            << ", #" << infoSTAs[STApairIndex].peerSTAid
-                            << "): " << distance << " m"
-                            << std::endl;
-                }
+        if (STAband == BAND_5GHZ) NS_ASSERT(peerSTAband == BAND_NONE);
+        if (STAband == BAND_24GHZ) NS_ASSERT(peerSTAband == BAND_NONE);
+        if (peerSTAband == BAND_5GHZ) NS_ASSERT(STAband == BAND_NONE);
+        if (peerSTAband == BAND_24GHZ) NS_ASSERT(STAband == BAND_NONE);
 
-                if (distance < coverage.coverage_5GHz) {
-                  // the STA is under coverage of this dual AP in both bands
-                  //coverageAPinfo[STApairIndex][APindex] = "5 GHz";
-                  coverageAPinfo[STApairIndex][APindex] = '5';
 
-                  if (myverbose >= 2)
-                    std::cout << Simulator::Now ().GetSeconds()
-                              << "\t[algorithmLoadBalancing]      The STA is under coverage of the AP in the 5 GHz band: " << distance
-                              << " < " << coverage.coverage_5GHz
-                              << " m"
-                              << std::endl;
-                }
-              }
-            }
-          }
-          APindex++;
-        }
-        // ensure I have checked all the AP nodes
-        NS_ASSERT (APindex == apNodes.GetN());
+        // the coverage of this STA pair by each AP pair ('coverageAPinfo') is not calculated here:
+        //it is kept up to date by 'coverageTracker', which recalculates it when the STA crosses
+        //the coverage circle of an AP
       }
     }
     index++;
@@ -3806,18 +6147,7 @@ void algorithmLoadBalancing ( double period,
   // fill a variale with the bands of the APs
   // fill the coverage variable 'infoAboutEachAPpair' for this STA
   // check if the STA is under coverage of each AP on each band
-  struct infoAboutEachAPpair {
-    uint16_t APid;
-    uint16_t peerAPid;
-    uint8_t channelAP;
-    uint8_t channelPeerAP;
-    //Ptr<Node> pointerToMainAP;
-    //Ptr<Node> pointerToPeerAP;
-    std::string APband;
-    std::string peerAPband;
-    std::string APbandsActive; //must be 'none', 'both', '2.4 GHz', '5 GHz'
-  };
-  infoAboutEachAPpair infoAPs[numberAPpairs];
+  std::vector<infoAboutEachAPpair>& infoAPs = loadBalancerState.GetInfoAPs ();
 
   if (myverbose >= 2)
     std::cout << Simulator::Now ().GetSeconds()
@@ -3844,83 +6174,83 @@ void algorithmLoadBalancing ( double period,
       //infoAPs[APindex].pointerToPeerAP = apNodes.Get(APindex + numberAPpairs);
 
       // obtain the bands
-      std::string APband = getWirelessBandOfChannel(infoAPs[APindex].channelAP);
-      std::string peerAPband = getWirelessBandOfChannel(infoAPs[APindex].channelPeerAP);
+      wifiBand APband = getWirelessBandOfChannel(infoAPs[APindex].channelAP);
+      wifiBand peerAPband = getWirelessBandOfChannel(infoAPs[APindex].channelPeerAP);
 
       // fill the 'APbandsActive' field
       if ((infoAPs[APindex].channelAP == 0) && (infoAPs[APindex].channelPeerAP == 0)) {
         // both APs are disabled. There is no coverage
-        infoAPs[APindex].APbandsActive = "none";
-        if ( APband == "2.4 GHz" ) {
-          infoAPs[APindex].APband = "2.4 GHz";
-          infoAPs[APindex].peerAPband = "5 GHz";
+        infoAPs[APindex].APbandsActive = BAND_NONE;
+        if ( APband == BAND_24GHZ ) {
+          infoAPs[APindex].APband = BAND_24GHZ;
+          infoAPs[APindex].peerAPband = BAND_5GHZ;
         }
         else {
-          infoAPs[APindex].APband = "5 GHz";
-          infoAPs[APindex].peerAPband = "2.4 GHz";          
+          infoAPs[APindex].APband = BAND_5GHZ;
+          infoAPs[APindex].peerAPband = BAND_24GHZ;          
         }
       }
       else if ((infoAPs[APindex].channelAP != 0) && (infoAPs[APindex].channelPeerAP != 0)) {
         // dual AP
-        infoAPs[APindex].APbandsActive = "both";
-        if ( APband == "2.4 GHz" ) {
-          infoAPs[APindex].APband = "2.4 GHz";
-          infoAPs[APindex].peerAPband = "5 GHz";
+        infoAPs[APindex].APbandsActive = BAND_BOTH;
+        if ( APband == BAND_24GHZ ) {
+          infoAPs[APindex].APband = BAND_24GHZ;
+          infoAPs[APindex].peerAPband = BAND_5GHZ;
         }
         else {
-          infoAPs[APindex].APband = "5 GHz";
-          infoAPs[APindex].peerAPband = "2.4 GHz";          
+          infoAPs[APindex].APband = BAND_5GHZ;
+          infoAPs[APindex].peerAPband = BAND_24GHZ;          
         }
       }
       else {
         // only one of the APs is active
-        if ( ((infoAPs[APindex].channelAP != 0) && (APband == "2.4 GHz")) || ((infoAPs[APindex].channelPeerAP != 0) && (peerAPband == "2.4 GHz")) ) {
+        if ( ((infoAPs[APindex].channelAP != 0) && (APband == BAND_24GHZ)) || ((infoAPs[APindex].channelPeerAP != 0) && (peerAPband == BAND_24GHZ)) ) {
           // the active interface is in 2.4 GHz
-          infoAPs[APindex].APbandsActive = "2.4 GHz";
+          infoAPs[APindex].APbandsActive = BAND_24GHZ;
           if (infoAPs[APindex].channelAP != 0) {
-            infoAPs[APindex].APband = "2.4 GHz";
-            infoAPs[APindex].peerAPband = "5 GHz";
+            infoAPs[APindex].APband = BAND_24GHZ;
+            infoAPs[APindex].peerAPband = BAND_5GHZ;
           }
           else {
-            infoAPs[APindex].APband = "5 GHz";
-            infoAPs[APindex].peerAPband = "2.4 GHz";
+            infoAPs[APindex].APband = BAND_5GHZ;
+            infoAPs[APindex].peerAPband = BAND_24GHZ;
           }
         }
-        else if ( ((infoAPs[APindex].channelAP != 0) && (APband == "5 GHz")) || ((infoAPs[APindex].channelPeerAP != 0) && (peerAPband == "5 GHz")) ) {
+        else if ( ((infoAPs[APindex].channelAP != 0) && (APband == BAND_5GHZ)) || ((infoAPs[APindex].channelPeerAP != 0) && (peerAPband == BAND_5GHZ)) ) {
           // the active interface is in 5 GHz
-          infoAPs[APindex].APbandsActive = "5 GHz";
+          infoAPs[APindex].APbandsActive = BAND_5GHZ;
           if (infoAPs[APindex].channelAP != 0) {
-            infoAPs[APindex].APband = "5 GHz";
-            infoAPs[APindex].peerAPband = "2.4 GHz";
+            infoAPs[APindex].APband = BAND_5GHZ;
+            infoAPs[APindex].peerAPband = BAND_24GHZ;
           }
           else {
-            infoAPs[APindex].APband = "2.4 GHz";
-            infoAPs[APindex].peerAPband = "5 GHz";
+            infoAPs[APindex].APband = BAND_24GHZ;
+            infoAPs[APindex].peerAPband = BAND_5GHZ;
           }
         }
       }
 
       // make sure these fields have been filled correctly
-      NS_ASSERT( (infoAPs[APindex].APband == "2.4 GHz" ) || (infoAPs[APindex].APband == "5 GHz" ) );
-      NS_ASSERT( (infoAPs[APindex].peerAPband == "2.4 GHz" ) || (infoAPs[APindex].peerAPband == "5 GHz" ) );
+      NS_ASSERT( (infoAPs[APindex].APband == BAND_24GHZ ) || (infoAPs[APindex].APband == BAND_5GHZ ) );
+      NS_ASSERT( (infoAPs[APindex].peerAPband == BAND_24GHZ ) || (infoAPs[APindex].peerAPband == BAND_5GHZ ) );
 
       if (myverbose >= 2) {
         std::cout << Simulator::Now ().GetSeconds()
                   << "\t[algorithmLoadBalancing]     AP (#" << infoAPs[APindex].APid
                   << ", #" << infoAPs[APindex].peerAPid
                   << "). Bands: " << infoAPs[APindex].APbandsActive;
-        if (infoAPs[APindex].APbandsActive == "both") {
+        if (infoAPs[APindex].APbandsActive == BAND_BOTH) {
           std::cout << ". Channels " << uint16_t(infoAPs[APindex].channelAP)
                     << "," << uint16_t(infoAPs[APindex].channelPeerAP);
         }
-        else if (infoAPs[APindex].APbandsActive == "5 GHz") {
-          if (infoAPs[APindex].APband == "5 GHz")
+        else if (infoAPs[APindex].APbandsActive == BAND_5GHZ) {
+          if (infoAPs[APindex].APband == BAND_5GHZ)
             std::cout << ". Channel " << uint16_t(infoAPs[APindex].channelAP);
           else
             std::cout << ". Channel " << uint16_t(infoAPs[APindex].channelPeerAP);
         }
-        else if (infoAPs[APindex].APbandsActive == "2.4 GHz") {
-          if (infoAPs[APindex].APband == "2.4 GHz")
+        else if (infoAPs[APindex].APbandsActive == BAND_24GHZ) {
+          if (infoAPs[APindex].APband == BAND_24GHZ)
             std::cout << ". Channel " << uint16_t(infoAPs[APindex].channelAP);
           else
             std::cout << ". Channel " << uint16_t(infoAPs[APindex].channelPeerAP);
@@ -4003,7 +6333,7 @@ void algorithmLoadBalancing ( double period,
                         << ", #" << peerAPwhereSTAisAssociated
                         << ")";
 
-            if (infoAPs[ APwhereSTAisAssociated ].APbandsActive == "2.4 GHz") {
+            if (infoAPs[ APwhereSTAisAssociated ].APbandsActive == BAND_24GHZ) {
               // 'APwhereSTAisAssociated' is a 2.4GHz AP
               if (myverbose >= 2)
                 std::cout << "(a 2.4 GHz only AP)\n";
@@ -4025,7 +6355,7 @@ void algorithmLoadBalancing ( double period,
                       // it is currently associated to a 2.4 GHz AP
                       // it has to be switched to a 5 GHz AP
 
-                      if (infoAPs[j].APband == "5 GHz") {
+                      if (infoAPs[j].APband == BAND_5GHZ) {
                         // the primary band is 5GHz
                         // the STA has to be switched there
                         candidateDualSTA = infoSTAs[i].STAid + numberSTApairs;
@@ -4036,7 +6366,7 @@ void algorithmLoadBalancing ( double period,
                         // and 2.4 GHz is the secondary band
                         currentAPCandidateDualSTA = APwhereSTAisAssociated + numberAPpairs;
                       }
-                      else if (infoAPs[j].peerAPband == "5 GHz") {
+                      else if (infoAPs[j].peerAPband == BAND_5GHZ) {
                         // the secondary AP is in 5GHz
                         // the STA has to be switched there
                         candidateDualSTA = infoSTAs[i].STAid;
@@ -4084,17 +6414,17 @@ void algorithmLoadBalancing ( double period,
                             << "\t[algorithmLoadBalancing]   Dual STA candidate not found ";
               }
             }
-            else if (infoAPs[ APwhereSTAisAssociated ].APbandsActive == "5 GHz") {
+            else if (infoAPs[ APwhereSTAisAssociated ].APbandsActive == BAND_5GHZ) {
               if (myverbose >= 2)
                 std::cout << "(a 5 GHz only AP). Not a candidate for switch";
             }
-            else if (infoAPs[ APwhereSTAisAssociated ].APbandsActive == "both") {
+            else if (infoAPs[ APwhereSTAisAssociated ].APbandsActive == BAND_BOTH) {
               if (myverbose >= 2)
                 std::cout << "(a dual AP). Not a candidate for switch";
             }
             else {
               std::cout << "\n" << infoAPs[ APwhereSTAisAssociated ].APbandsActive << "\n";
-              NS_ASSERT(infoAPs[ APwhereSTAisAssociated ].APbandsActive == "none");
+              NS_ASSERT(infoAPs[ APwhereSTAisAssociated ].APbandsActive == BAND_NONE);
               if (myverbose >= 2)
                 std::cout << "(an inactive AP). Not a candidate for switch";
             }
@@ -4132,16 +6462,16 @@ void algorithmLoadBalancing ( double period,
           else if ((infoSTAs[i].STAassociated) != (infoSTAs[i].peerSTAassociated)) { // note: '!=' means XOR
             // one of the paired STAs is associated
 
-            if (((infoSTAs[i].STAassociated) && (getWirelessBandOfChannel(infoSTAs[i].channelSTA) == "5 GHz")) || 
-                ((infoSTAs[i].peerSTAassociated) && (getWirelessBandOfChannel(infoSTAs[i].channelPeerSTA) == "5 GHz"))) {
+            if (((infoSTAs[i].STAassociated) && (getWirelessBandOfChannel(infoSTAs[i].channelSTA) == BAND_5GHZ)) || 
+                ((infoSTAs[i].peerSTAassociated) && (getWirelessBandOfChannel(infoSTAs[i].channelPeerSTA) == BAND_5GHZ))) {
                 // one of the paired STAs is associated in 5GHz
                 // this is not relevant for the algorithm
                 if (myverbose >= 2)
                   std::cout << " but is is already associated in 5 GHz. Not a candidate for switch";
             }
 
-            else if (((infoSTAs[i].STAassociated) && (getWirelessBandOfChannel(infoSTAs[i].channelSTA) == "2.4 GHz")) || 
-                      ((infoSTAs[i].peerSTAassociated) && (getWirelessBandOfChannel(infoSTAs[i].channelPeerSTA) == "2.4 GHz"))) {
+            else if (((infoSTAs[i].STAassociated) && (getWirelessBandOfChannel(infoSTAs[i].channelSTA) == BAND_24GHZ)) || 
+                      ((infoSTAs[i].peerSTAassociated) && (getWirelessBandOfChannel(infoSTAs[i].channelPeerSTA) == BAND_24GHZ))) {
 
               // one of the paired STAs is associated in 2.4GHZ
 
@@ -4166,7 +6496,7 @@ void algorithmLoadBalancing ( double period,
                           << ",#" << peerAPwhereSTAisAssociated
                           << ")";
 
-              if (infoAPs[ APwhereSTAisAssociated ].APbandsActive == "both") {
+              if (infoAPs[ APwhereSTAisAssociated ].APbandsActive == BAND_BOTH) {
                 // 'APwhereSTAisAssociated' is a dual AP
                 if (myverbose >= 2)
                   std::cout << "(a dual AP)\n";
@@ -4187,7 +6517,7 @@ void algorithmLoadBalancing ( double period,
                         // I also store the AP to which it can be switched
                         // it is currently associated to a 2.4 GHz AP
                         // it has to be switched to a 2.4 GHz-only AP
-                        if (infoAPs[j].APband == "2.4 GHz") {
+                        if (infoAPs[j].APband == BAND_24GHZ) {
                           // the primary band is 2.4 GHz
                           // the STA has to be switched there
                           candidateNonDualSTA = infoSTAs[i].STAid;
@@ -4197,7 +6527,7 @@ void algorithmLoadBalancing ( double period,
                           // 2.4 GHz is the primary band
                           currentAPCandidateNonDualSTA = APwhereSTAisAssociated;
                         }
-                        else if (infoAPs[j].peerAPband == "2.4 GHz") {
+                        else if (infoAPs[j].peerAPband == BAND_24GHZ) {
                           // the secondary AP is 2.4 GHz
                           // the STA has to be switched there
                           candidateNonDualSTA = infoSTAs[i].STAid + numberSTApairs;
@@ -4227,7 +6557,7 @@ void algorithmLoadBalancing ( double period,
                         // I also store the AP to which it can be switched
                         // it is currently associated to a dual AP
                         // it has to be switched to the 2.4 GHz AP
-                        if (infoAPs[j].APband == "2.4 GHz") {
+                        if (infoAPs[j].APband == BAND_24GHZ) {
                           // the primary band is 2.4 GHz
                           // the STA has to be switched there
                           candidateNonDualSTA = infoSTAs[i].STAid;
@@ -4237,7 +6567,7 @@ void algorithmLoadBalancing ( double period,
                           // 2.4 GHz is the primary band
                           currentAPCandidateNonDualSTA = APwhereSTAisAssociated;
                         }
-                        else if (infoAPs[ infoAPs[j].APid ].peerAPband == "2.4 GHz") {
+                        else if (infoAPs[ infoAPs[j].APid ].peerAPband == BAND_24GHZ) {
                           candidateNonDualSTA = infoSTAs[i].STAid + numberSTApairs;
                           newAPforCandidateNonDualSTA = infoAPs[j].peerAPid;
                           channelNewAPforCandidateNonDualSTA = infoAPs[j].channelPeerAP;
@@ -4273,17 +6603,17 @@ void algorithmLoadBalancing ( double period,
                               << "\t[algorithmLoadBalancing]   Non-dual STA candidate not found ";
                 }
               }
-              else if (infoAPs[ APwhereSTAisAssociated ].APbandsActive == "5 GHz") {
+              else if (infoAPs[ APwhereSTAisAssociated ].APbandsActive == BAND_5GHZ) {
                 if (myverbose >= 2)
                   std::cout << "(a 5 GHz only AP). Not a candidate for switch";
               }
-              else if (infoAPs[ APwhereSTAisAssociated ].APbandsActive == "2.4 GHz") {
+              else if (infoAPs[ APwhereSTAisAssociated ].APbandsActive == BAND_24GHZ) {
                 if (myverbose >= 2)
                   std::cout << "(a 2.4 GHz only AP). Not a candidate for switch";
               }
               else {
                 std::cout << "\n" << infoAPs[ APwhereSTAisAssociated ].APbandsActive << "\n";
-                NS_ASSERT(infoAPs[ APwhereSTAisAssociated ].APbandsActive == "none");
+                NS_ASSERT(infoAPs[ APwhereSTAisAssociated ].APbandsActive == BAND_NONE);
                 if (myverbose >= 2)
                   std::cout << "(an inactive AP). Not a candidate for switch";
               }
@@ -4343,7 +6673,7 @@ void algorithmLoadBalancing ( double period,
       if (currentAPCandidateDualSTA == newAPforCandidateNonDualSTA) {
         // the current AP of the dual STA is the new AP of the non-dual STA
 
-        if (infoAPs[0].APband == "2.4 GHz") {
+        if (infoAPs[0].APband == BAND_24GHZ) {
           // the primary band is 2.4 GHZ
           if (currentAPCandidateNonDualSTA == newAPforCandidateDualSTA - numberAPpairs) {
             canBeSwitched = true;
@@ -4353,7 +6683,7 @@ void algorithmLoadBalancing ( double period,
                         << std::endl;
           }
         }
-        else if (infoAPs[0].APband == "5 GHz") {
+        else if (infoAPs[0].APband == BAND_5GHZ) {
           // the primary band is 5 GHZ
           if (currentAPCandidateNonDualSTA == newAPforCandidateDualSTA + numberAPpairs) {
             canBeSwitched = true;
@@ -4393,7 +6723,7 @@ void algorithmLoadBalancing ( double period,
         NetDeviceContainer device5GDualSTA;
 
         uint16_t peerOfCandidateDualSTA;
-        if (infoAPs[0].APband == "5 GHz") {
+        if (infoAPs[0].APband == BAND_5GHZ) {
           // the primary band is 5 GHZ
           // the index of the dual STA is that of 2.4 GHz
           peerOfCandidateDualSTA = candidateDualSTA - apNodes.GetN() - numberSTApairs;
@@ -4463,6 +6793,24 @@ void algorithmLoadBalancing ( double period,
   /*********** end of - load balancing algorithm **********/
 
 
+  // STA pairs switched in this period. They are not considered again until the next period
+  std::vector<bool> switchedSTApairs (numberSTApairs, false);
+  uint32_t channelSwitches = 0;
+
+  /*********** multi-swap algorithm **********/
+  // all the exchanges of the 'load balancing algorithm' are found and applied at once
+  if (loadBalancerState.MultiSwapEnabled ())
+    channelSwitches = channelSwitches + algorithmMultiSwap (apNodes, staNodes, switchedSTApairs, channelSwitches, myverbose);
+  /*********** end of - multi-swap algorithm **********/
+
+
+  /*********** load-aware algorithm **********/
+  // dual STAs in saturated 2.4 GHz APs are moved to idle 5 GHz APs, using the load measured by 'apLoadMonitor'
+  if (loadBalancerState.LoadAwareEnabled () && apLoadMonitor.HasMeasurements ())
+    channelSwitches = channelSwitches + algorithmLoadAware (apNodes, staNodes, switchedSTApairs, channelSwitches, myverbose);
+  /*********** end of - load-aware algorithm **********/
+
+
   /*********** move-to-5GHz algorithm **********/
   // I try to find a STA that:
   // - is dual (11n & 11ac)
@@ -4479,6 +6827,10 @@ void algorithmLoadBalancing ( double period,
               << std::endl;
 
   for (uint16_t STApairIndex=0; STApairIndex < numberSTApairs; STApairIndex++) {
+
+    // the STA pair has already been switched in this period, or no more switches are allowed
+    if (switchedSTApairs[STApairIndex] || !loadBalancerState.ChannelSwitchAllowed (channelSwitches))
+      continue;
       
     /****** find a candidate dual STA **********/
     if ((infoSTAs[STApairIndex].STAenabled == true) && (infoSTAs[STApairIndex].peerSTAenabled == true)) {
@@ -4500,7 +6852,7 @@ void algorithmLoadBalancing ( double period,
       else if ((infoSTAs[STApairIndex].STAassociated == true) || (infoSTAs[STApairIndex].peerSTAassociated == true)) {
         // the STA is associated
         uint16_t APwhereSTAisAssociated, peerAPwhereSTAisAssociated;
-        std::string bandWhereTheSTAisAssociated;
+        wifiBand bandWhereTheSTAisAssociated;
 
 
         if (infoSTAs[STApairIndex].STAassociated == true) {
@@ -4526,14 +6878,14 @@ void algorithmLoadBalancing ( double period,
                     << ",#" << peerAPwhereSTAisAssociated
                     << ") in " << bandWhereTheSTAisAssociated;
 
-        if (bandWhereTheSTAisAssociated == "5 GHz") {
+        if (bandWhereTheSTAisAssociated == BAND_5GHZ) {
           std::cout << ". Already in 5 GHz. Not interesting";
 
           //std::cout << "\nnumberAPpairs:" << numberAPpairs << "\n";
           //std::cout << "STApairIndex: " << STApairIndex << "\n";
         } 
 
-        else if (bandWhereTheSTAisAssociated == "2.4 GHz") {
+        else if (bandWhereTheSTAisAssociated == BAND_24GHZ) {
           std::cout << ". Looking for coverage of a 5 GHz AP"
                     << '\n';
 
@@ -4557,7 +6909,7 @@ void algorithmLoadBalancing ( double period,
                 // it is currently associated to a 2.4 GHz AP
                 // it has to be switched to a 5 GHz AP
 
-                if (infoAPs[APpairIndex].APband == "5 GHz") {
+                if (infoAPs[APpairIndex].APband == BAND_5GHZ) {
                   
                   // the primary band is 5GHz
                   // the STA has to be switched there
@@ -4571,7 +6923,7 @@ void algorithmLoadBalancing ( double period,
                   currentAPCandidateDualSTA = APwhereSTAisAssociated + numberAPpairs;
                   
                 }
-                else if (infoAPs[APpairIndex].peerAPband == "5 GHz") {
+                else if (infoAPs[APpairIndex].peerAPband == BAND_5GHZ) {
                   
                   // the secondary AP is in 5GHz
                   // the STA has to be switched there
@@ -4668,7 +7020,7 @@ void algorithmLoadBalancing ( double period,
             NetDeviceContainer device5GDualSTA;
 
             uint16_t peerOfCandidateDualSTA;
-            if (infoAPs[0].APband == "5 GHz") {
+            if (infoAPs[0].APband == BAND_5GHZ) {
               // the primary band is 5 GHZ
               // the index of the dual STA is that of 2.4 GHz
               peerOfCandidateDualSTA = candidateDualSTA /*- apNodes.GetN()*/ - numberSTApairs;
@@ -4699,6 +7051,7 @@ void algorithmLoadBalancing ( double period,
             // change the frequency
             //if ( HANDOFFMETHOD == 0 )
               ChangeFrequencyLocal (device5GDualSTA, channelNewAPforCandidateDualSTA, mywifiModel, myverbose /*0*/ );
+            channelSwitches++;
 
             // this is not needed
             if (false) {
@@ -4764,6 +7117,10 @@ void algorithmLoadBalancing ( double period,
               << std::endl;
 
   for (uint16_t STApairIndex=0; STApairIndex < numberSTApairs; STApairIndex++) {
+
+    // the STA pair has already been switched in this period, or no more switches are allowed
+    if (switchedSTApairs[STApairIndex] || !loadBalancerState.ChannelSwitchAllowed (channelSwitches))
+      continue;
       
     /****** find a candidate dual STA **********/
     if ((infoSTAs[STApairIndex].STAenabled == true) && (infoSTAs[STApairIndex].peerSTAenabled == true)) {
@@ -4785,7 +7142,7 @@ void algorithmLoadBalancing ( double period,
       else if ((infoSTAs[STApairIndex].STAassociated == true) || (infoSTAs[STApairIndex].peerSTAassociated == true)) {
         // the STA is associated
         uint16_t APwhereSTAisAssociated, peerAPwhereSTAisAssociated;
-        std::string bandWhereTheSTAisAssociated;
+        wifiBand bandWhereTheSTAisAssociated;
 
 
         if (infoSTAs[STApairIndex].STAassociated == true) {
@@ -4811,7 +7168,7 @@ void algorithmLoadBalancing ( double period,
                     << ",#" << peerAPwhereSTAisAssociated
                     << ") in " << bandWhereTheSTAisAssociated;
 
-        if (bandWhereTheSTAisAssociated == "2.4 GHz") {
+        if (bandWhereTheSTAisAssociated == BAND_24GHZ) {
           std::cout << ". Associated in 2.4 GHz. Not interesting"
                     << '\n';
 
@@ -4819,7 +7176,7 @@ void algorithmLoadBalancing ( double period,
           //std::cout << "STApairIndex: " << STApairIndex << "\n";
         } 
 
-        else if (bandWhereTheSTAisAssociated == "5 GHz") {
+        else if (bandWhereTheSTAisAssociated == BAND_5GHZ) {
           std::cout << ". Checking if it is out of optimal coverage of the current 5 GHz AP"
                     << '\n';
 
@@ -4857,12 +7214,12 @@ void algorithmLoadBalancing ( double period,
             // Find the nearest AP
             Ptr<Node> myNearestAP;
 
-            if (infoAPs[0].APband == "5 GHz")
+            if (infoAPs[0].APband == BAND_5GHZ)
               // the primary band is 5 GHz
-              myNearestAP = nearestAp (apNodes, infoSTAs[STApairIndex].pointerToPeerSTA, myverbose, "2.4 GHz");
-            else if (infoAPs[0].APband == "2.4 GHz")
+              myNearestAP = nearestAp (apNodes, infoSTAs[STApairIndex].pointerToPeerSTA, myverbose, BAND_24GHZ);
+            else if (infoAPs[0].APband == BAND_24GHZ)
               // the primary band is 2.4 GHz
-              myNearestAP = nearestAp (apNodes, infoSTAs[STApairIndex].pointerToMainSTA, myverbose, "2.4 GHz");
+              myNearestAP = nearestAp (apNodes, infoSTAs[STApairIndex].pointerToMainSTA, myverbose, BAND_24GHZ);
             else
               NS_ASSERT(false);
 
@@ -4888,7 +7245,7 @@ void algorithmLoadBalancing ( double period,
                         << std::endl;
 
               uint16_t indexForAP;
-              if (infoAPs[0].APband == "2.4 GHz") {
+              if (infoAPs[0].APband == BAND_24GHZ) {
                 // the primary band is 2.4 GHZ
                 indexForAP = newAPforCandidateDualSTA;
               }
@@ -4897,7 +7254,7 @@ void algorithmLoadBalancing ( double period,
                 indexForAP = newAPforCandidateDualSTA - numberAPpairs;                
               }
 
-              if (infoAPs[indexForAP].APband == "2.4 GHz") {
+              if (infoAPs[indexForAP].APband == BAND_24GHZ) {
                 // the primary band is 2.4GHz
                 // the STA has to be switched there
                 candidateDualSTA = infoSTAs[STApairIndex].STAid + numberSTApairs;
@@ -4907,7 +7264,7 @@ void algorithmLoadBalancing ( double period,
                 // and 5 GHz is the secondary band
                 currentAPCandidateDualSTA = APwhereSTAisAssociated + numberAPpairs;
               }
-              else if (infoAPs[indexForAP].peerAPband == "2.4 GHz") {
+              else if (infoAPs[indexForAP].peerAPband == BAND_24GHZ) {
                 // the secondary AP is in 2.4 GHz
                 // the STA has to be switched there
                 candidateDualSTA = infoSTAs[STApairIndex].STAid;
@@ -4974,7 +7331,7 @@ void algorithmLoadBalancing ( double period,
               NetDeviceContainer device24GDualSTA;
 
               uint16_t peerOfCandidateDualSTA;
-              if (infoAPs[0].APband == "2.4 GHz") {
+              if (infoAPs[0].APband == BAND_24GHZ) {
                 // the primary band is 2.4 GHZ
                 // the index of the dual STA is that of 2.4 GHz
                 peerOfCandidateDualSTA = candidateDualSTA /*- apNodes.GetN()*/ - numberSTApairs;
@@ -5005,6 +7362,7 @@ void algorithmLoadBalancing ( double period,
               // change the frequency
               //if ( HANDOFFMETHOD == 0 )
                 ChangeFrequencyLocal (device24GDualSTA, channelNewAPforCandidateDualSTA, mywifiModel, myverbose /*0*/ );
+              channelSwitches++;
             }
 
 
@@ -5087,7 +7445,7 @@ void algorithmLoadBalancing ( double period,
                     // it is currently associated to a 5 GHz AP
                     // it has to be switched to a 2.4 GHz AP
 
-                    if (infoAPs[APpairIndex].APband == "2.4 GHz") {
+                    if (infoAPs[APpairIndex].APband == BAND_24GHZ) {
                       
                       // the primary band is 2.4GHz
                       // the STA has to be switched there
@@ -5101,7 +7459,7 @@ void algorithmLoadBalancing ( double period,
                       currentAPCandidateDualSTA = APwhereSTAisAssociated + numberAPpairs;
                       
                     }
-                    else if (infoAPs[APpairIndex].peerAPband == "2.4 GHz") {
+                    else if (infoAPs[APpairIndex].peerAPband == BAND_24GHZ) {
                       
                       // the secondary AP is in 2.4 GHz
                       // the STA has to be switched there
@@ -5197,132 +7555,550 @@ void algorithmLoadBalancing ( double period,
                 // Move this STA to the channel of the AP identified
                 NetDeviceContainer device24GDualSTA;
 
-                uint16_t peerOfCandidateDualSTA;
-                if (infoAPs[0].APband == "2.4 GHz") {
-                  // the primary band is 2.4 GHZ
-                  // the index of the dual STA is that of 2.4 GHz
-                  peerOfCandidateDualSTA = candidateDualSTA /*- apNodes.GetN()*/ - numberSTApairs;
-                }
-                else {
-                  // the primary band is 5 GHz
-                  // the index of the dual STA is that of 5 GHz
-                  peerOfCandidateDualSTA = candidateDualSTA /*- apNodes.GetN()*/;
-                }
+                uint16_t peerOfCandidateDualSTA;
+                if (infoAPs[0].APband == BAND_24GHZ) {
+                  // the primary band is 2.4 GHZ
+                  // the index of the dual STA is that of 2.4 GHz
+                  peerOfCandidateDualSTA = candidateDualSTA /*- apNodes.GetN()*/ - numberSTApairs;
+                }
+                else {
+                  // the primary band is 5 GHz
+                  // the index of the dual STA is that of 5 GHz
+                  peerOfCandidateDualSTA = candidateDualSTA /*- apNodes.GetN()*/;
+                }
+
+                if (myverbose >= 2)
+                  std::cout << Simulator::Now ().GetSeconds() 
+                            << "\t[algorithmLoadBalancing3] The peer STA of STA #" << candidateDualSTA
+                            << " is STA#" << peerOfCandidateDualSTA
+                            << '\n';
+
+                device24GDualSTA.Add( (staNodes.Get(peerOfCandidateDualSTA - apNodes.GetN()))->GetDevice(1) ); // this adds the device to the NetDeviceContainer. It has to be device 1, not device 0. I don't know why
+
+                // activate the 5 GHz STA        
+                // enable the 5 GHz network device
+                EnableNetworkDevice (device24GDualSTA, mywifiModel, myverbose /*0*/ );
+                if (myverbose >= 2)
+                  std::cout << Simulator::Now ().GetSeconds() 
+                            << "\t[algorithmLoadBalancing3] STA #" << peerOfCandidateDualSTA
+                            << " network device enabled"
+                            << '\n';
+
+                // change the frequency
+                //if ( HANDOFFMETHOD == 0 )
+                  ChangeFrequencyLocal (device24GDualSTA, channelNewAPforCandidateDualSTA, mywifiModel, myverbose /*0*/ );
+
+                if (false) {
+                  // reset the ARP cache of the STA
+                  infoArpCache(staNodes.Get(peerOfCandidateDualSTA - apNodes.GetN()), myverbose);
+                  emtpyArpCache(staNodes.Get(peerOfCandidateDualSTA - apNodes.GetN()), myverbose);
+                  infoArpCache(staNodes.Get(peerOfCandidateDualSTA - apNodes.GetN()), myverbose);
+
+                  // reset the ARP cache of the router
+                  infoArpCache(routerNode.Get(0), myverbose);
+                  emtpyArpCache(routerNode.Get(0), myverbose);
+                  infoArpCache(routerNode.Get(0), myverbose);                
+                }
+
+
+                if (myverbose >= 1)
+                  std::cout << Simulator::Now ().GetSeconds() 
+                            << "\t[algorithmLoadBalancing3] ***** Dual STA #" << peerOfCandidateDualSTA + apNodes.GetN()
+                            << " switched: channel set to " << uint16_t (channelNewAPforCandidateDualSTA) 
+                            << ", i.e. the channel of AP #" << newAPforCandidateDualSTA
+                            << " *****"
+                            << '\n';
+              }              
+            }
+          }
+        }
+        else {
+          NS_ASSERT(false);
+        }
+      }
+      else {
+        // the STA is not associated
+        if (myverbose >= 2)
+          std::cout << ". Not associated to any AP";  
+      }       
+    }
+
+    else {
+      // this is a non-dual STA
+      if (myverbose >= 2)
+        std::cout << Simulator::Now ().GetSeconds()
+                  << "\t[algorithmLoadBalancing3]   STA(#" << infoSTAs[STApairIndex].STAid
+                  << ",#" << infoSTAs[STApairIndex].peerSTAid
+                  << ") is not dual"
+                  << '\n';
+    }
+  }
+  if (myverbose >= 2)
+    std::cout << Simulator::Now ().GetSeconds()
+              << "\t[algorithmLoadBalancing3] End of the algorithm"
+              << '\n';
+  /*********** end of - move-to-2.4GHz algorithm **********/    
+
+
+
+  myverbose = 0; // FIXME remove this
+
+  // re-schedule the algorithm
+  Simulator::Schedule(Seconds(period), &algorithmLoadBalancing, period, apNodes, staNodes, routerNode, coverage, /*coverage_24GHz, coverage_5GHz,*/ myverbose);
+
+}
+
+
+/********* FUNCTIONS ************/
+extern FlowMonitorHelper& flowmon;  // FIXME avoid this global variable
+
+
+// statistics of a flow reported by FlowMonitor (cumulative values, or the increment in the last interval)
+struct FlowCounters {
+  bool present;             // false if FlowMonitor has no statistics of this flow yet
+  uint32_t rxPackets;
+  uint32_t lostPackets;
+  uint64_t rxBytes;
+  double delaySum;          // [s]
+  double jitterSum;         // [s]
+};
+
+// incremental collector of the statistics of FlowMonitor. Each time it is polled, it reads the
+//statistics of all the flows without copying the map of FlowMonitor (and the histograms of each flow),
+//and keeps the cumulative values and the increments since the previous poll in flat arrays indexed by 'FlowId - 1'
+// if it is polled twice at the same instant, FlowMonitor is only read in the first call
+class KPICollector
+{
+  public:
+    KPICollector ();
+    void Poll (Ptr<FlowMonitor> monitor);
+    uint32_t GetNumberFlows ();
+    const FlowCounters& GetCumulative (FlowId thisFlowId);
+    const FlowCounters& GetDelta (FlowId thisFlowId);
+  private:
+    bool polled;
+    Time lastPoll;
+    std::vector<FlowCounters> cumulative;   // indexed by 'FlowId - 1'
+    std::vector<FlowCounters> delta;        // indexed by 'FlowId - 1'
+};
+
+KPICollector::KPICollector ()
+{
+  polled = false;
+}
+
+void
+KPICollector::Poll (Ptr<FlowMonitor> monitor)
+{
+  if (polled && (lastPoll == Simulator::Now ()))
+    return;
+
+  polled = true;
+  lastPoll = Simulator::Now ();
+
+  // 'CheckForLostPackets' is not called here: it scans all the packets in flight each time, and the
+  //losses of the UDP flows are obtained from their sequence numbers (see 'IntervalLossEstimator')
+
+  // a reference: the map is not copied
+  const FlowMonitor::FlowStatsContainer& stats = monitor->GetFlowStats ();
+
+  // the flows are numbered from 1, so the last one gives the size of the arrays
+  if (!stats.empty () && (stats.rbegin ()->first > cumulative.size ())) {
+    FlowCounters noStatistics = {false, 0, 0, 0, 0.0, 0.0};
+    cumulative.resize (stats.rbegin ()->first, noStatistics);
+    delta.resize (stats.rbegin ()->first, noStatistics);
+  }
+
+  for (FlowMonitor::FlowStatsContainerCI i = stats.begin (); i != stats.end (); ++i) {
+    FlowCounters& previous = cumulative[i->first - 1];
+    FlowCounters& increment = delta[i->first - 1];
+
+    // the numbers MUST be positive
+    increment.present = true;
+    increment.rxPackets = (i->second.rxPackets >= previous.rxPackets) ? i->second.rxPackets - previous.rxPackets : 0;
+    increment.lostPackets = (i->second.lostPackets >= previous.lostPackets) ? i->second.lostPackets - previous.lostPackets : 0;
+    increment.rxBytes = (i->second.rxBytes > previous.rxBytes) ? i->second.rxBytes - previous.rxBytes : 0;
+    increment.delaySum = i->second.delaySum.GetSeconds () - previous.delaySum;
+    increment.jitterSum = i->second.jitterSum.GetSeconds () - previous.jitterSum;
+
+    previous.present = true;
+    previous.rxPackets = i->second.rxPackets;
+    previous.lostPackets = i->second.lostPackets;
+    previous.rxBytes = i->second.rxBytes;
+    previous.delaySum = i->second.delaySum.GetSeconds ();
+    previous.jitterSum = i->second.jitterSum.GetSeconds ();
+  }
+}
+
+uint32_t
+KPICollector::GetNumberFlows ()
+{
+  return cumulative.size ();
+}
+
+const FlowCounters&
+KPICollector::GetCumulative (FlowId thisFlowId)
+{
+  NS_ASSERT ((thisFlowId > 0) && (thisFlowId <= cumulative.size ()));
+  return cumulative[thisFlowId - 1];
+}
+
+const FlowCounters&
+KPICollector::GetDelta (FlowId thisFlowId)
+{
+  NS_ASSERT ((thisFlowId > 0) && (thisFlowId <= delta.size ()));
+  return delta[thisFlowId - 1];
+}
+
+extern KPICollector& kpiCollector;
+
+
+// finds the statistics of the flow received by a UDP server, using the port of the server.
+//It has to be called after 'flowRegistry.Init'
+bool
+flowOfUdpServer (Ptr<UdpServer> server, uint32_t& typeofapplication, uint32_t& statisticsIndex)
+{
+  UintegerValue port;
+  server->GetAttribute ("Port", port);
+  return flowRegistry.ClassifyPort (port.Get (), typeofapplication, statisticsIndex);
+}
+
+
+// sequence numbers received by the UDP server of a flow
+struct SequenceCounters {
+  bool tracked;
+  int64_t highestSeq;         // -1 if nothing has been received
+  uint64_t received;
+  uint64_t lostAtLastInterval;
+};
+
+// exact losses of the VoIP and video flows. UdpClient and UdpTraceClient add a SeqTsHeader to each packet,
+//so the losses are the sequence numbers that have not been received up to the highest one. It only
+//costs a counter update per received packet, and does not need 'CheckForLostPackets'
+class IntervalLossEstimator
+{
+  public:
+    void Init (AllTheFlowStatistics myAllTheFlowStatistics);
+    bool Track (Ptr<UdpServer> server);
+    void Receive (uint32_t typeofapplication, uint32_t statisticsIndex, Ptr<const Packet> packet);
+    bool IsTracked (uint32_t typeofapplication, uint32_t statisticsIndex);
+    uint64_t GetCumulativeLost (uint32_t typeofapplication, uint32_t statisticsIndex);
+    uint32_t CloseInterval (uint32_t typeofapplication, uint32_t statisticsIndex);
+  private:
+    std::vector<std::vector<SequenceCounters> > counters;   // indexed by type of application and index of the statistics
+};
+
+// trace sink of the "Rx" trace of UdpServer. The type and the index are bound when connecting it
+void
+IntervalLossRx (uint32_t typeofapplication, uint32_t statisticsIndex, Ptr<const Packet> packet);
+
+void
+IntervalLossEstimator::Init (AllTheFlowStatistics myAllTheFlowStatistics)
+{
+  SequenceCounters notTracked = {false, -1, 0, 0};
+  counters.assign (NUMBER_OF_APPLICATION_TYPES, std::vector<SequenceCounters> ());
+  counters[1].assign (myAllTheFlowStatistics.numberVoIPUploadFlows, notTracked);
+  counters[2].assign (myAllTheFlowStatistics.numberVoIPDownloadFlows, notTracked);
+  counters[5].assign (myAllTheFlowStatistics.numberVideoDownloadFlows, notTracked);
+}
+
+// connects to the server, if it is one of the VoIP or video applications
+bool
+IntervalLossEstimator::Track (Ptr<UdpServer> server)
+{
+  uint32_t typeofapplication;
+  uint32_t statisticsIndex;
+  if (!flowOfUdpServer (server, typeofapplication, statisticsIndex))
+    return false;
+  if ((typeofapplication >= counters.size ()) || (statisticsIndex >= counters[typeofapplication].size ()))
+    return false;
+
+  counters[typeofapplication][statisticsIndex].tracked = true;
+  server->TraceConnectWithoutContext ("Rx", MakeBoundCallback (&IntervalLossRx, typeofapplication, statisticsIndex));
+  return true;
+}
+
+void
+IntervalLossEstimator::Receive (uint32_t typeofapplication, uint32_t statisticsIndex, Ptr<const Packet> packet)
+{
+  SeqTsHeader seqTs;
+  if (packet->GetSize () < seqTs.GetSerializedSize ())
+    return;
+  packet->PeekHeader (seqTs);
+
+  SequenceCounters& flow = counters[typeofapplication][statisticsIndex];
+  flow.received++;
+  if (int64_t (seqTs.GetSeq ()) > flow.highestSeq)
+    flow.highestSeq = seqTs.GetSeq ();
+}
+
+bool
+IntervalLossEstimator::IsTracked (uint32_t typeofapplication, uint32_t statisticsIndex)
+{
+  return (typeofapplication < counters.size ())
+      && (statisticsIndex < counters[typeofapplication].size ())
+      && counters[typeofapplication][statisticsIndex].tracked;
+}
+
+uint64_t
+IntervalLossEstimator::GetCumulativeLost (uint32_t typeofapplication, uint32_t statisticsIndex)
+{
+  NS_ASSERT (IsTracked (typeofapplication, statisticsIndex));
+  const SequenceCounters& flow = counters[typeofapplication][statisticsIndex];
+
+  // a packet arriving out of order may have received a sequence number higher than the ones pending
+  uint64_t expected = flow.highestSeq + 1;
+  return (expected > flow.received) ? expected - flow.received : 0;
+}
+
+// returns the packets lost since the previous call. If a packet counted as lost arrives later (reordering),
+//it is not subtracted from the next interval, so the sum of the intervals never exceeds the cumulative value
+uint32_t
+IntervalLossEstimator::CloseInterval (uint32_t typeofapplication, uint32_t statisticsIndex)
+{
+  uint64_t lost = GetCumulativeLost (typeofapplication, statisticsIndex);
+  SequenceCounters& flow = counters[typeofapplication][statisticsIndex];
+
+  if (lost <= flow.lostAtLastInterval)
+    return 0;
+
+  uint32_t lostThisInterval = lost - flow.lostAtLastInterval;
+  flow.lostAtLastInterval = lost;
+  return lostThisInterval;
+}
+
+extern IntervalLossEstimator& intervalLossEstimator;
+
+void
+IntervalLossRx (uint32_t typeofapplication, uint32_t statisticsIndex, Ptr<const Packet> packet)
+{
+  intervalLossEstimator.Receive (typeofapplication, statisticsIndex, packet);
+}
+
+
+#define SKETCH_RELATIVE_ACCURACY 0.02   // relative error of the quantiles given by QuantileSketch
+#define SKETCH_MIN_VALUE 0.000001       // [s] smaller values are counted in the first bucket
+#define SKETCH_NUMBER_OF_BUCKETS 512    // with 2% of accuracy, they cover from 1 us to more than 10 minutes
+
+// streaming quantiles with fixed memory. The values are counted in buckets whose limits grow geometrically,
+//so any quantile is obtained with a relative error below SKETCH_RELATIVE_ACCURACY. Two sketches can be
+//merged by adding their buckets (e.g. to obtain the quantiles of all the STAs of an AP)
+class QuantileSketch
+{
+  public:
+    QuantileSketch ();
+    void Add (double value);
+    void Merge (const QuantileSketch& other);
+    void Reset ();
+    uint32_t GetCount () const;
+    double GetPercentile (double percentile) const;
+  private:
+    std::vector<uint32_t> buckets;
+    uint32_t count;
+};
+
+// ratio between the limits of two consecutive buckets
+static const double sketchGamma = (1.0 + SKETCH_RELATIVE_ACCURACY) / (1.0 - SKETCH_RELATIVE_ACCURACY);
+static const double sketchLogGamma = std::log (sketchGamma);
+
+QuantileSketch::QuantileSketch ()
+{
+  buckets.assign (SKETCH_NUMBER_OF_BUCKETS, 0);
+  count = 0;
+}
+
+void
+QuantileSketch::Add (double value)
+{
+  uint32_t bucket = 0;
+  if (value > SKETCH_MIN_VALUE)
+    bucket = std::min (uint32_t (std::ceil (std::log (value / SKETCH_MIN_VALUE) / sketchLogGamma)), uint32_t (SKETCH_NUMBER_OF_BUCKETS - 1));
+  buckets[bucket]++;
+  count++;
+}
+
+void
+QuantileSketch::Merge (const QuantileSketch& other)
+{
+  for (uint32_t i = 0; i < SKETCH_NUMBER_OF_BUCKETS; i++)
+    buckets[i] += other.buckets[i];
+  count += other.count;
+}
+
+void
+QuantileSketch::Reset ()
+{
+  if (count == 0)
+    return;
+  std::fill (buckets.begin (), buckets.end (), 0);
+  count = 0;
+}
+
+uint32_t
+QuantileSketch::GetCount () const
+{
+  return count;
+}
+
+// 'percentile' is between 0 and 100. It returns NaN if there are no values
+double
+QuantileSketch::GetPercentile (double percentile) const
+{
+  if (count == 0)
+    return NAN;
+
+  // rank of the value, starting from 0
+  uint64_t rank = uint64_t (percentile / 100.0 * (count - 1));
+  uint64_t accumulated = 0;
+  uint32_t bucket = 0;
+  for (; bucket < SKETCH_NUMBER_OF_BUCKETS - 1; bucket++) {
+    accumulated += buckets[bucket];
+    if (accumulated > rank)
+      break;
+  }
 
-                if (myverbose >= 2)
-                  std::cout << Simulator::Now ().GetSeconds() 
-                            << "\t[algorithmLoadBalancing3] The peer STA of STA #" << candidateDualSTA
-                            << " is STA#" << peerOfCandidateDualSTA
-                            << '\n';
+  if (bucket == 0)
+    return SKETCH_MIN_VALUE;
 
-                device24GDualSTA.Add( (staNodes.Get(peerOfCandidateDualSTA - apNodes.GetN()))->GetDevice(1) ); // this adds the device to the NetDeviceContainer. It has to be device 1, not device 0. I don't know why
+  // the value in the middle of the bucket (in relative terms) has the lowest error
+  return SKETCH_MIN_VALUE * 2.0 * std::pow (sketchGamma, bucket) / (sketchGamma + 1.0);
+}
 
-                // activate the 5 GHz STA        
-                // enable the 5 GHz network device
-                EnableNetworkDevice (device24GDualSTA, mywifiModel, myverbose /*0*/ );
-                if (myverbose >= 2)
-                  std::cout << Simulator::Now ().GetSeconds() 
-                            << "\t[algorithmLoadBalancing3] STA #" << peerOfCandidateDualSTA
-                            << " network device enabled"
-                            << '\n';
 
-                // change the frequency
-                //if ( HANDOFFMETHOD == 0 )
-                  ChangeFrequencyLocal (device24GDualSTA, channelNewAPforCandidateDualSTA, mywifiModel, myverbose /*0*/ );
+// delay and jitter of the packets received by the UDP server of a flow
+struct FlowLatency {
+  bool tracked;
+  bool hasPreviousDelay;
+  double previousDelay;
+  QuantileSketch delay;                 // current interval
+  QuantileSketch jitter;
+  QuantileSketch lastIntervalDelay;     // last complete interval
+  QuantileSketch lastIntervalJitter;
+};
 
-                if (false) {
-                  // reset the ARP cache of the STA
-                  infoArpCache(staNodes.Get(peerOfCandidateDualSTA - apNodes.GetN()), myverbose);
-                  emtpyArpCache(staNodes.Get(peerOfCandidateDualSTA - apNodes.GetN()), myverbose);
-                  infoArpCache(staNodes.Get(peerOfCandidateDualSTA - apNodes.GetN()), myverbose);
+// percentiles of the delay and the jitter of the VoIP and video flows. Each packet received by the UdpServer
+//carries the time it was sent (SeqTsHeader), so the delay is measured in the receive path. The jitter is
+//the difference between the delays of consecutive packets, as in FlowMonitor
+class LatencyQuantiles
+{
+  public:
+    void Init (AllTheFlowStatistics myAllTheFlowStatistics);
+    bool Track (Ptr<UdpServer> server);
+    void Receive (uint32_t typeofapplication, uint32_t statisticsIndex, Ptr<const Packet> packet);
+    bool IsTracked (uint32_t typeofapplication, uint32_t statisticsIndex);
+    void CloseInterval (uint32_t typeofapplication, uint32_t statisticsIndex, FlowStatistics* statistics);
+    const QuantileSketch* GetLastIntervalDelay (uint32_t typeofapplication, uint32_t statisticsIndex);
+    const QuantileSketch* GetLastIntervalJitter (uint32_t typeofapplication, uint32_t statisticsIndex);
+  private:
+    std::vector<std::vector<FlowLatency> > flows;   // indexed by type of application and index of the statistics
+};
 
-                  // reset the ARP cache of the router
-                  infoArpCache(routerNode.Get(0), myverbose);
-                  emtpyArpCache(routerNode.Get(0), myverbose);
-                  infoArpCache(routerNode.Get(0), myverbose);                
-                }
+// trace sink of the "Rx" trace of UdpServer. The type and the index are bound when connecting it
+void
+LatencyQuantilesRx (uint32_t typeofapplication, uint32_t statisticsIndex, Ptr<const Packet> packet);
 
+void
+LatencyQuantiles::Init (AllTheFlowStatistics myAllTheFlowStatistics)
+{
+  flows.assign (NUMBER_OF_APPLICATION_TYPES, std::vector<FlowLatency> ());
+  flows[1].resize (myAllTheFlowStatistics.numberVoIPUploadFlows);
+  flows[2].resize (myAllTheFlowStatistics.numberVoIPDownloadFlows);
+  flows[5].resize (myAllTheFlowStatistics.numberVideoDownloadFlows);
 
-                if (myverbose >= 1)
-                  std::cout << Simulator::Now ().GetSeconds() 
-                            << "\t[algorithmLoadBalancing3] ***** Dual STA #" << peerOfCandidateDualSTA + apNodes.GetN()
-                            << " switched: channel set to " << uint16_t (channelNewAPforCandidateDualSTA) 
-                            << ", i.e. the channel of AP #" << newAPforCandidateDualSTA
-                            << " *****"
-                            << '\n';
-              }              
-            }
-          }
-        }
-        else {
-          NS_ASSERT(false);
-        }
-      }
-      else {
-        // the STA is not associated
-        if (myverbose >= 2)
-          std::cout << ". Not associated to any AP";  
-      }       
+  for (uint32_t typeofapplication = 0; typeofapplication < NUMBER_OF_APPLICATION_TYPES; typeofapplication++)
+    for (uint32_t i = 0; i < flows[typeofapplication].size (); i++) {
+      flows[typeofapplication][i].tracked = false;
+      flows[typeofapplication][i].hasPreviousDelay = false;
+      flows[typeofapplication][i].previousDelay = 0.0;
     }
+}
 
-    else {
-      // this is a non-dual STA
-      if (myverbose >= 2)
-        std::cout << Simulator::Now ().GetSeconds()
-                  << "\t[algorithmLoadBalancing3]   STA(#" << infoSTAs[STApairIndex].STAid
-                  << ",#" << infoSTAs[STApairIndex].peerSTAid
-                  << ") is not dual"
-                  << '\n';
-    }
-  }
-  if (myverbose >= 2)
-    std::cout << Simulator::Now ().GetSeconds()
-              << "\t[algorithmLoadBalancing3] End of the algorithm"
-              << '\n';
-  /*********** end of - move-to-2.4GHz algorithm **********/    
+// connects to the server, if it is one of the VoIP or video applications
+bool
+LatencyQuantiles::Track (Ptr<UdpServer> server)
+{
+  uint32_t typeofapplication;
+  uint32_t statisticsIndex;
+  if (!flowOfUdpServer (server, typeofapplication, statisticsIndex))
+    return false;
+  if ((typeofapplication >= flows.size ()) || (statisticsIndex >= flows[typeofapplication].size ()))
+    return false;
+
+  flows[typeofapplication][statisticsIndex].tracked = true;
+  server->TraceConnectWithoutContext ("Rx", MakeBoundCallback (&LatencyQuantilesRx, typeofapplication, statisticsIndex));
+  return true;
+}
 
+void
+LatencyQuantiles::Receive (uint32_t typeofapplication, uint32_t statisticsIndex, Ptr<const Packet> packet)
+{
+  SeqTsHeader seqTs;
+  if (packet->GetSize () < seqTs.GetSerializedSize ())
+    return;
+  packet->PeekHeader (seqTs);
+
+  FlowLatency& flow = flows[typeofapplication][statisticsIndex];
+  double delay = (Simulator::Now () - seqTs.GetTs ()).GetSeconds ();
+  flow.delay.Add (delay);
+  if (flow.hasPreviousDelay)
+    flow.jitter.Add (std::abs (delay - flow.previousDelay));
+  flow.previousDelay = delay;
+  flow.hasPreviousDelay = true;
+}
 
+bool
+LatencyQuantiles::IsTracked (uint32_t typeofapplication, uint32_t statisticsIndex)
+{
+  return (typeofapplication < flows.size ())
+      && (statisticsIndex < flows[typeofapplication].size ())
+      && flows[typeofapplication][statisticsIndex].tracked;
+}
 
-  myverbose = 0; // FIXME remove this
+// the current interval becomes the last one, and its percentiles are written in the statistics
+void
+LatencyQuantiles::CloseInterval (uint32_t typeofapplication, uint32_t statisticsIndex, FlowStatistics* statistics)
+{
+  NS_ASSERT (IsTracked (typeofapplication, statisticsIndex));
+  FlowLatency& flow = flows[typeofapplication][statisticsIndex];
 
-  // re-schedule the algorithm
-  Simulator::Schedule(Seconds(period), &algorithmLoadBalancing, period, apNodes, staNodes, routerNode, coverage, /*coverage_24GHz, coverage_5GHz,*/ myverbose);
+  flow.lastIntervalDelay.Reset ();
+  flow.lastIntervalDelay.Merge (flow.delay);
+  flow.delay.Reset ();
+  flow.lastIntervalJitter.Reset ();
+  flow.lastIntervalJitter.Merge (flow.jitter);
+  flow.jitter.Reset ();
 
+  for (uint32_t p = 0; p < NUMBER_OF_PERCENTILES; p++) {
+    statistics->lastIntervalDelayPercentile[p] = flow.lastIntervalDelay.GetPercentile (reportedPercentiles[p]);
+    statistics->lastIntervalJitterPercentile[p] = flow.lastIntervalJitter.GetPercentile (reportedPercentiles[p]);
+  }
 }
 
+// NULL if the flow is not tracked
+const QuantileSketch*
+LatencyQuantiles::GetLastIntervalDelay (uint32_t typeofapplication, uint32_t statisticsIndex)
+{
+  if (!IsTracked (typeofapplication, statisticsIndex))
+    return NULL;
+  return &flows[typeofapplication][statisticsIndex].lastIntervalDelay;
+}
 
-/********* FUNCTIONS ************/
-FlowMonitorHelper flowmon;  // FIXME avoid this global variable
-
+// NULL if the flow is not tracked
+const QuantileSketch*
+LatencyQuantiles::GetLastIntervalJitter (uint32_t typeofapplication, uint32_t statisticsIndex)
+{
+  if (!IsTracked (typeofapplication, statisticsIndex))
+    return NULL;
+  return &flows[typeofapplication][statisticsIndex].lastIntervalJitter;
+}
 
-// Struct for storing the statistics of the VoIP flows
-struct FlowStatistics {
-  double acumDelay;
-  double acumJitter;
-  uint32_t acumRxPackets;
-  uint32_t acumLostPackets;
-  uint32_t acumRxBytes;
-  double lastIntervalDelay;
-  double lastIntervalJitter;
-  uint32_t lastIntervalRxPackets;
-  uint32_t lastIntervalLostPackets;
-  uint32_t lastIntervalRxBytes;
-  uint16_t destinationPort;
-  uint16_t finalDestinationPort;
-};
+extern LatencyQuantiles& latencyQuantiles;
 
-struct AllTheFlowStatistics {
-  uint32_t numberVoIPUploadFlows;
-  uint32_t numberVoIPDownloadFlows;
-  uint32_t numberTCPUploadFlows;
-  uint32_t numberTCPDownloadFlows;
-  uint32_t numberVideoDownloadFlows;
-  FlowStatistics* FlowStatisticsVoIPUpload;
-  FlowStatistics* FlowStatisticsVoIPDownload;
-  FlowStatistics* FlowStatisticsTCPUpload;
-  FlowStatistics* FlowStatisticsTCPDownload;
-  FlowStatistics* FlowStatisticsVideoDownload;
-};
+void
+LatencyQuantilesRx (uint32_t typeofapplication, uint32_t statisticsIndex, Ptr<const Packet> packet)
+{
+  latencyQuantiles.Receive (typeofapplication, statisticsIndex, packet);
+}
 
 
 // The number of parameters for calling functions using 'schedule' is limited to 6, so I have to create a struct
@@ -5336,10 +8112,11 @@ struct adjustAmpduParameters {
   uint32_t stepAdjustAmpdu;
   bool eachSTArunsAllTheApps;
   std::string APsActive;
+  double latencyPercentile;   // percentile of the delay compared with the budget. 0 means the average of the interval
 };
 
 
-// Dynamically adjust the size of the AMPDU
+// Dynamically adjust the size of the AMPDU. Called by 'kpiScheduler' after the KPIs have been obtained
 void adjustAMPDU (//FlowStatistics* myFlowStatistics,
                   AllTheFlowStatistics myAllTheFlowStatistics,
                   adjustAmpduParameters myparam,
@@ -5347,7 +8124,9 @@ void adjustAMPDU (//FlowStatistics* myFlowStatistics,
                   uint32_t* aboveLatencyAmpduValue,
                   uint32_t myNumberAPs)  
 {
+  CallbackTimer callbackTimer ("adjustAMPDU");
   int numberSTAsNonAssociated; // counts the number of STAs that are not associated to any AP
+  numberSTAsNonAssociated = sta_vector.size () - Get_STA_record_num ();
 
   uint32_t i = 0; // index for the APs
 
@@ -5377,206 +8156,82 @@ void adjustAMPDU (//FlowStatistics* myFlowStatistics,
       // find the highest latency of all the VoIP STAs associated to that AP
       double highestLatencyVoIPFlows = 0.0;
 
-      numberSTAsNonAssociated = 0;
-      for (STA_recordVector::const_iterator indexSTA = sta_vector.begin (); indexSTA != sta_vector.end (); indexSTA++) {
-
-        // check if the STA is associated to an AP
-        if ((*indexSTA)->GetAssoc()) {
-          // auxiliar string
-          std::ostringstream auxString;
-          // create a string with the MAC
-          auxString << "02-06-" << (*indexSTA)->GetMacOfitsAP();
-          std::string addressOfTheAPwhereThisSTAis = auxString.str();
-          NS_ASSERT(!addressOfTheAPwhereThisSTAis.empty());
+      // only the STAs associated to this AP are considered
+      const std::set<uint16_t>& stasOfThisAP = registry.GetSTAsOfAP ((*indexAP)->GetApid());
+      for (std::set<uint16_t>::const_iterator indexSTA = stasOfThisAP.begin (); indexSTA != stasOfThisAP.end (); indexSTA++) {
 
-          // check if the STA is associated to this AP
-          if ( (*indexAP)->GetMac() == addressOfTheAPwhereThisSTAis ) {
+        STA_record* thisSTA = registry.GetSTA (*indexSTA);
 
-            if (myparam.verboseLevel > 0) 
-              std::cout << Simulator::Now ().GetSeconds() 
-                        << "\t[adjustAMPDU]"
-                        << "\t\tSTA #" << (*indexSTA)->GetStaid() 
-                        << "\tassociated to AP #" << GetAnAP_Id(addressOfTheAPwhereThisSTAis) 
-                        << "\twith MAC " << (*indexSTA)->GetMacOfitsAP();
-            /*
-            uint32_t total_number_of_flows;
-            if (myparam.eachSTArunsAllTheApps == false)
-              total_number_of_flows = 
-            */
-
-            // VoIP upload
-            if ((*indexSTA)->Gettypeofapplication () == 1) {
-              if (myparam.verboseLevel > 0)
-                std::cout << "\tVoIP upload";
-
-              // index for the vector of statistics of VoIPDownload flows
-              uint32_t indexForVector = (*indexSTA)->GetStaid()
-                                        - AP_vector.size();
-
-              // 'std::isnan' checks if the value is not a number
-              if (!std::isnan(myAllTheFlowStatistics.FlowStatisticsVoIPUpload[indexForVector].lastIntervalDelay)) {
-                if (myparam.verboseLevel > 0)
-                  std::cout << "\tDelay: " << myAllTheFlowStatistics.FlowStatisticsVoIPUpload[indexForVector].lastIntervalDelay 
-                            << "\tThroughput: " << myAllTheFlowStatistics.FlowStatisticsVoIPUpload[indexForVector].lastIntervalRxBytes * 8 / myparam.timeInterval
-                            //<< "\t indexForVector is " << indexForVector
-                            ;
-
-                // if the latency of this STA is the highest one so far, update the value of the highest latency
-                if (  myAllTheFlowStatistics.FlowStatisticsVoIPUpload[ indexForVector ].lastIntervalDelay > highestLatencyVoIPFlows && 
-                      !std::isnan(myAllTheFlowStatistics.FlowStatisticsVoIPUpload[ indexForVector].lastIntervalDelay))
-
-                  highestLatencyVoIPFlows = myAllTheFlowStatistics.FlowStatisticsVoIPUpload[ indexForVector].lastIntervalDelay;
-              }
-              else {
-                if (myparam.verboseLevel > 0) 
-                  std::cout << "\tDelay not defined in this period" 
-                            //<< "\t (*indexSTA)->GetStaid()  - AP_vector.size() is " << (*indexSTA)->GetStaid() - AP_vector.size()
-                            ;
-              }
+        if (myparam.verboseLevel > 0) 
+          std::cout << Simulator::Now ().GetSeconds() 
+                    << "\t[adjustAMPDU]"
+                    << "\t\tSTA #" << thisSTA->GetStaid() 
+                    << "\tassociated to AP #" << (*indexAP)->GetApid() 
+                    << "\twith MAC " << thisSTA->GetMacOfitsAP();
+        // the statistics of the flow of this STA are found by the flow registry.
+        //It is NULL if the flow has not been seen yet
+        FlowStatistics* statisticsOfThisSTA = flowRegistry.GetStatisticsOfSTA (thisSTA->GetStaid(), thisSTA->Gettypeofapplication ());
+
+        // VoIP upload and VoIP download
+        if ((thisSTA->Gettypeofapplication () == 1) || (thisSTA->Gettypeofapplication () == 2)) {
+          if (myparam.verboseLevel > 0)
+            std::cout << ((thisSTA->Gettypeofapplication () == 1) ? "\tVoIP upload" : "\tVoIP download");
+
+          // the latency of the STA is the average of the interval, or a percentile if it has been selected
+          double latencyThisSTA = NAN;
+          if (statisticsOfThisSTA != NULL) {
+            latencyThisSTA = statisticsOfThisSTA->lastIntervalDelay;
+
+            if (myparam.latencyPercentile > 0.0) {
+              int32_t indexOfThisSTA = flowRegistry.GetStatisticsIndexOfSTA (thisSTA->GetStaid(), thisSTA->Gettypeofapplication ());
+              const QuantileSketch* delayThisSTA = (indexOfThisSTA < 0) ? NULL : latencyQuantiles.GetLastIntervalDelay (thisSTA->Gettypeofapplication (), indexOfThisSTA);
+              if (delayThisSTA != NULL)
+                latencyThisSTA = delayThisSTA->GetPercentile (myparam.latencyPercentile);
             }
+          }
 
-            // VoIP download
-            else if ((*indexSTA)->Gettypeofapplication () == 2) {
-              if (myparam.verboseLevel > 0)
-                std::cout << "\tVoIP download";
-
-              // index for the vector of statistics of VoIPDownload flows
-              uint32_t indexForVector;
-              if (myparam.eachSTArunsAllTheApps == false)
-                indexForVector =  (*indexSTA)->GetStaid()
-                                  - AP_vector.size()
-                                  - myAllTheFlowStatistics.numberVoIPUploadFlows;
-              else
-                indexForVector =  (*indexSTA)->GetStaid()
-                                  - AP_vector.size();
-
-              // 'std::isnan' checks if the value is not a number                                      
-              if (!std::isnan(myAllTheFlowStatistics.FlowStatisticsVoIPDownload[indexForVector].lastIntervalDelay)) {
-                if (myparam.verboseLevel > 0)
-                  std::cout << "\tDelay: " << myAllTheFlowStatistics.FlowStatisticsVoIPDownload[indexForVector ].lastIntervalDelay 
-                            << "\tThroughput: " << myAllTheFlowStatistics.FlowStatisticsVoIPDownload[indexForVector ].lastIntervalRxBytes * 8 / myparam.timeInterval
-                            //<< "\t indexForVector is " << indexForVector
-                            ;
-                // if the latency of this STA is the highest one so far, update the value of the highest latency
-                if (  myAllTheFlowStatistics.FlowStatisticsVoIPDownload[ indexForVector ].lastIntervalDelay > highestLatencyVoIPFlows && 
-                      !std::isnan(myAllTheFlowStatistics.FlowStatisticsVoIPDownload[ indexForVector ].lastIntervalDelay))
-
-                  highestLatencyVoIPFlows = myAllTheFlowStatistics.FlowStatisticsVoIPDownload[ indexForVector ].lastIntervalDelay;
-              }
-              else {
-                if (myparam.verboseLevel > 0) 
-                  std::cout << "\tDelay not defined in this period" 
-                            //<< "\t indexForVector is " << indexForVector
-                            ;
-              }
-            } 
-
-            // TCP upload
-            else if ((*indexSTA)->Gettypeofapplication () == 3) {
-              if (myparam.verboseLevel > 0)
-                std::cout << "\tTCP upload";
-
-              // index for the vector of statistics of TCPload flows
-              uint32_t indexForVector;
-              if (myparam.eachSTArunsAllTheApps == false)
-                indexForVector =  (*indexSTA)->GetStaid()
-                                  - AP_vector.size()
-                                  - myAllTheFlowStatistics.numberVoIPDownloadFlows
-                                  - myAllTheFlowStatistics.numberTCPUploadFlows;
-              else
-                indexForVector =  (*indexSTA)->GetStaid()
-                                  - AP_vector.size();
-
-              // 'std::isnan' checks if the value is not a number
-              if (!std::isnan(myAllTheFlowStatistics.FlowStatisticsTCPUpload[ indexForVector ].lastIntervalRxBytes)) {
-                if (myparam.verboseLevel > 0)
-                std::cout << "\tThroughput: " << myAllTheFlowStatistics.FlowStatisticsTCPUpload[ indexForVector ].lastIntervalRxBytes * 8 / myparam.timeInterval 
-                          //<< "\t indexForVector is " << indexForVector
-                          ;
-              }
-              else {
-                if (myparam.verboseLevel > 0)
-                  std::cout << "\tThroughput not defined in this period" 
-                            //<< "\t (*indexSTA)->GetStaid()  - AP_vector.size() is " << (*indexSTA)->GetStaid() - AP_vector.size()
-                            ;
-              }
+          // 'std::isnan' checks if the value is not a number
+          if (!std::isnan(latencyThisSTA)) {
+            if (myparam.verboseLevel > 0) {
+              std::cout << "\tDelay: " << statisticsOfThisSTA->lastIntervalDelay;
+              if (myparam.latencyPercentile > 0.0)
+                std::cout << "\tp" << myparam.latencyPercentile << " delay: " << latencyThisSTA;
+              std::cout << "\tThroughput: " << statisticsOfThisSTA->lastIntervalRxBytes * 8 / myparam.timeInterval;
             }
 
-            // TCP download
-            else if ((*indexSTA)->Gettypeofapplication () == 4) {
-              if (myparam.verboseLevel > 0)
-                std::cout << "\tTCP download";
-
-              // index for the vector of statistics of TCPDownload flows
-              uint32_t indexForVector;
-              if (myparam.eachSTArunsAllTheApps == false)
-                indexForVector =  (*indexSTA)->GetStaid()
-                                  - AP_vector.size()
-                                  - myAllTheFlowStatistics.numberVoIPDownloadFlows
-                                  - myAllTheFlowStatistics.numberTCPUploadFlows
-                                  - myAllTheFlowStatistics.numberTCPUploadFlows;
-              else
-                indexForVector =  (*indexSTA)->GetStaid()
-                                  - AP_vector.size();
-
-              // 'std::isnan' checks if the value is not a number
-              if (!std::isnan(myAllTheFlowStatistics.FlowStatisticsTCPDownload[ indexForVector ].lastIntervalRxBytes)) {
-                if (myparam.verboseLevel > 0)
-                std::cout << "\tThroughput: " << myAllTheFlowStatistics.FlowStatisticsTCPDownload[ indexForVector ].lastIntervalRxBytes * 8 / myparam.timeInterval 
-                          //<< "\t indexForVector is " << indexForVector
-                          ;
-
-              } else {
-                if (myparam.verboseLevel > 0)
-                  std::cout << "\tThroughput not defined in this period" 
-                            //<< "\t indexForVector is " << indexForVector
-                            ;
-              }
-            }
+            // if the latency of this STA is the highest one so far, update the value of the highest latency
+            if (latencyThisSTA > highestLatencyVoIPFlows)
+              highestLatencyVoIPFlows = latencyThisSTA;
+          }
+          else {
+            if (myparam.verboseLevel > 0) 
+              std::cout << "\tDelay not defined in this period";
+          }
+        }
 
-            // Video download
-            else if ((*indexSTA)->Gettypeofapplication () == 5) {
-              if (myparam.verboseLevel > 0)
-                std::cout << "\tVideo download";
-
-              // index for the vector of statistics of VideoDownload flows
-              uint32_t indexForVector;
-              if (myparam.eachSTArunsAllTheApps == false)
-                indexForVector =  (*indexSTA)->GetStaid()
-                                  - AP_vector.size()
-                                  - myAllTheFlowStatistics.numberVoIPDownloadFlows
-                                  - myAllTheFlowStatistics.numberTCPUploadFlows
-                                  - myAllTheFlowStatistics.numberTCPUploadFlows
-                                  - myAllTheFlowStatistics.numberTCPDownloadFlows;
-              else
-                indexForVector =  (*indexSTA)->GetStaid()
-                                  - AP_vector.size();
-
-
-              // 'std::isnan' checks if the value is not a number
-              if (!std::isnan(myAllTheFlowStatistics.FlowStatisticsVideoDownload[ indexForVector ].lastIntervalRxBytes)) {
-                if (myparam.verboseLevel > 0)
-                std::cout << "\t\t"
-                          << "\tThroughput: " << myAllTheFlowStatistics.FlowStatisticsVideoDownload[ indexForVector ].lastIntervalRxBytes * 8 / myparam.timeInterval 
-                          //<< "\t indexForVector is " << indexForVector
-                          ;
-              } else {
-                if (myparam.verboseLevel > 0)
-                  std::cout << "\tThroughput not defined in this period" 
-                            //<< "\t indexForVector is " << indexForVector
-                            ;
-              }
-            }
-            if (myparam.verboseLevel > 0)           
-              std::cout << "\n";
+        // TCP upload, TCP download and Video download
+        else if ((thisSTA->Gettypeofapplication () >= 3) && (thisSTA->Gettypeofapplication () <= 5)) {
+          if (myparam.verboseLevel > 0) {
+            if (thisSTA->Gettypeofapplication () == 3)
+              std::cout << "\tTCP upload";
+            else if (thisSTA->Gettypeofapplication () == 4)
+              std::cout << "\tTCP download";
+            else
+              std::cout << "\tVideo download\t\t";
           }
 
+          // 'std::isnan' checks if the value is not a number
+          if ((statisticsOfThisSTA != NULL) && !std::isnan(statisticsOfThisSTA->lastIntervalRxBytes)) {
+            if (myparam.verboseLevel > 0)
+              std::cout << "\tThroughput: " << statisticsOfThisSTA->lastIntervalRxBytes * 8 / myparam.timeInterval;
+          }
+          else {
+            if (myparam.verboseLevel > 0)
+              std::cout << "\tThroughput not defined in this period";
+          }
         }
-        else {
-          // this STA is not associated to any AP
-          // these STAs will be listed together below
-          numberSTAsNonAssociated ++;
-        }
+        if (myparam.verboseLevel > 0)           
+          std::cout << "\n";
       }
 
       // Adjust the value of the AMPDU
@@ -5748,14 +8403,15 @@ void adjustAMPDU (//FlowStatistics* myFlowStatistics,
       // write the AMPDU value to a file (it is written at the end of the file)
       if ( myparam.mynameAMPDUFile != "" ) {
 
-        std::ofstream ofsAMPDU;
-        ofsAMPDU.open ( myparam.mynameAMPDUFile, std::ofstream::out | std::ofstream::app); // with "trunc" Any contents that existed in the file before it is open are discarded. with "app", all output operations happen at the end of the file, appending to its existing contents
+        TraceWriter* writerAMPDU = traceWriters.Get (myparam.mynameAMPDUFile);
+        NS_ASSERT (writerAMPDU != NULL);
 
-        ofsAMPDU << Simulator::Now().GetSeconds() << "\t";    // timestamp
-        ofsAMPDU << GetAnAP_Id((*indexAP)->GetMac()) << "\t"; // write the ID of the AP to the file
-        ofsAMPDU << "AP\t";                                   // type of node
-        ofsAMPDU << "-\t";                                    // It is not associated to any AP, since it is an AP
-        ofsAMPDU << newAmpduValue << "\n";                    // new value of the AMPDU
+        writerAMPDU->AddDouble (Simulator::Now().GetSeconds());    // timestamp
+        writerAMPDU->AddInteger ((*indexAP)->GetApid());            // write the ID of the AP to the file
+        writerAMPDU->AddString ("AP");                              // type of node
+        writerAMPDU->AddString ("-");                               // It is not associated to any AP, since it is an AP
+        writerAMPDU->AddInteger (newAmpduValue);                    // new value of the AMPDU
+        writerAMPDU->EndRow ();
       }
 
       // Check if the AMPDU has to be modified or not
@@ -5774,9 +8430,13 @@ void adjustAMPDU (//FlowStatistics* myFlowStatistics,
       // the AMPDU of the AP has to be modified
       } else {
 
+        // the AP and its STAs are modified all together, after filling this vector
+        AmpduUpdateVector ampduUpdates;
+
         // Modify the AMPDU value of the AP itself
-        ModifyAmpdu ( GetAnAP_Id((*indexAP)->GetMac()), newAmpduValue, 1 );
-        Modify_AP_Record (GetAnAP_Id((*indexAP)->GetMac()), (*indexAP)->GetMac(), newAmpduValue );
+        AmpduUpdate updateAP = { (*indexAP)->GetApid(), newAmpduValue };
+        ampduUpdates.push_back (updateAP);
+        Modify_AP_Record ((*indexAP)->GetApid(), (*indexAP)->GetMac(), newAmpduValue );
 
         // Report the AMPDU modification
         if (myparam.verboseLevel > 0) {
@@ -5796,66 +8456,60 @@ void adjustAMPDU (//FlowStatistics* myFlowStatistics,
 
 
         // Modify the AMPDU value of the STAs associated to the AP which are NOT running VoIP (VoIP STAs never use aggregation)
-        for (STA_recordVector::const_iterator indexSTA = sta_vector.begin (); indexSTA != sta_vector.end (); indexSTA++) {
-
-          // if the STA is associated
-          if ((*indexSTA)->GetAssoc()) {
+        const std::set<uint16_t>& stasOfThisAP = registry.GetSTAsOfAP ((*indexAP)->GetApid());
+        for (std::set<uint16_t>::const_iterator indexSTA = stasOfThisAP.begin (); indexSTA != stasOfThisAP.end (); indexSTA++) {
 
-            // if the STA is NOT running VoIP
-            if ( ( (*indexSTA)->Gettypeofapplication () > 2) ) {
+          STA_record* thisSTA = registry.GetSTA (*indexSTA);
 
-              // auxiliar string
-              std::ostringstream auxString;
-              // create a string with the MAC
-              auxString << "02-06-" << (*indexSTA)->GetMacOfitsAP();
-              std::string addressOfTheAPwhereThisSTAis = auxString.str();
+          // if the STA is NOT running VoIP
+          if ( ( thisSTA->Gettypeofapplication () > 2) ) {
+            // modify the AMPDU value
+            AmpduUpdate updateSTA = { thisSTA->GetStaid(), newAmpduValue };
+            ampduUpdates.push_back (updateSTA);                   // modify the AMPDU in the STA node
+            thisSTA->SetMaxSizeAmpdu(newAmpduValue);              // update the data in the STA_record structure
 
-              // if the STA is associated to this AP
-              if ( (*indexAP)->GetMac() == addressOfTheAPwhereThisSTAis ) {
-                // modify the AMPDU value
-                ModifyAmpdu ((*indexSTA)->GetStaid(), newAmpduValue, 1);  // modify the AMPDU in the STA node
-                (*indexSTA)->SetMaxSizeAmpdu(newAmpduValue);              // update the data in the STA_record structure
-
-                // Report this modification
-                if (myparam.verboseLevel > 0) {
-                  std::cout << Simulator::Now ().GetSeconds() 
-                            << "\t[adjustAMPDU]"
-                            << "\t\t\tSTA #" << (*indexSTA)->GetStaid() 
-                            //<< "\tassociated to AP #" << GetAnAP_Id(addressOfTheAPwhereThisSTAis) 
-                            //<< "\twith MAC " << (*indexSTA)->GetMacOfitsAP()
-                            ;
-
-                  if ((*indexSTA)->Gettypeofapplication () == 3)
-                    std::cout << "\t TCP upload";
-                  else if ((*indexSTA)->Gettypeofapplication () == 4)
-                    std::cout << "\t TCP download";
-                  else if ((*indexSTA)->Gettypeofapplication () == 5)
-                    std::cout << "\t Video download";
-
-                  if ( newAmpduValue > currentAmpduValue )
-                    std::cout << "\t\tAMPDU of the STA increased to " << newAmpduValue;
-                  else 
-                    std::cout << "\t\tAMPDU of the STA reduced to " << newAmpduValue;
-
-                  std::cout << "\n";              
-                }
+            // Report this modification
+            if (myparam.verboseLevel > 0) {
+              std::cout << Simulator::Now ().GetSeconds() 
+                        << "\t[adjustAMPDU]"
+                        << "\t\t\tSTA #" << thisSTA->GetStaid() 
+                        //<< "\tassociated to AP #" << GetAnAP_Id(addressOfTheAPwhereThisSTAis) 
+                        //<< "\twith MAC " << thisSTA->GetMacOfitsAP()
+                        ;
+
+              if (thisSTA->Gettypeofapplication () == 3)
+                std::cout << "\t TCP upload";
+              else if (thisSTA->Gettypeofapplication () == 4)
+                std::cout << "\t TCP download";
+              else if (thisSTA->Gettypeofapplication () == 5)
+                std::cout << "\t Video download";
+
+              if ( newAmpduValue > currentAmpduValue )
+                std::cout << "\t\tAMPDU of the STA increased to " << newAmpduValue;
+              else 
+                std::cout << "\t\tAMPDU of the STA reduced to " << newAmpduValue;
+
+              std::cout << "\n";              
+            }
 
-                // write the new AMPDU value to a file (it is written at the end of the file)
-                if ( myparam.mynameAMPDUFile != "" ) {
+            // write the new AMPDU value to a file (it is written at the end of the file)
+            if ( myparam.mynameAMPDUFile != "" ) {
 
-                  std::ofstream ofsAMPDU;
-                  ofsAMPDU.open ( myparam.mynameAMPDUFile, std::ofstream::out | std::ofstream::app); // with "trunc" Any contents that existed in the file before it is open are discarded. with "app", all output operations happen at the end of the file, appending to its existing contents
+              TraceWriter* writerAMPDU = traceWriters.Get (myparam.mynameAMPDUFile);
+              NS_ASSERT (writerAMPDU != NULL);
 
-                  ofsAMPDU << Simulator::Now().GetSeconds() << "\t";    // timestamp
-                  ofsAMPDU << (*indexSTA)->GetStaid() << "\t";          // ID of the AP
-                  ofsAMPDU << "STA \t";
-                  ofsAMPDU << GetAnAP_Id((*indexAP)->GetMac()) << "\t";
-                  ofsAMPDU << newAmpduValue << "\n";                    // new value of the AMPDU
-                }
-              }
+              writerAMPDU->AddDouble (Simulator::Now().GetSeconds());    // timestamp
+              writerAMPDU->AddInteger (thisSTA->GetStaid());              // ID of the STA
+              writerAMPDU->AddString ("STA ");
+              writerAMPDU->AddString (std::to_string ((*indexAP)->GetApid()));
+              writerAMPDU->AddInteger (newAmpduValue);                    // new value of the AMPDU
+              writerAMPDU->EndRow ();
             }
           }
         }
+
+        // apply the new AMPDU value to the AP and its STAs
+        ModifyAmpduBatch (ampduUpdates, 1);
       }
     }
     i++;
@@ -5881,457 +8535,669 @@ void adjustAMPDU (//FlowStatistics* myFlowStatistics,
                     << "\n";
     }    
   }
+}
+
+
+// Obtain the statistics of all the flows, using Flowmonitor. It is read once, and the statistics
+//of all the types of flow are updated in a single pass. Called by 'kpiScheduler'
+void obtainKPIs ( Ptr<FlowMonitor> monitor/*, FlowMonitorHelper flowmon*/, 
+                  AllTheFlowStatistics myAllTheFlowStatistics,
+                  uint16_t TcpDownMultiConnection,
+                  uint32_t verboseLevel,
+                  double timeInterval)  //Interval between monitoring moments
+{
+  CallbackTimer callbackTimer ("obtainKPIs");
+  if (VERBOSE_FOR_DEBUG >= 1)
+    std::cout << Simulator::Now().GetSeconds()
+              << "\t[obtainKPIs] Starting function 'obtainKPIs'"
+              << "\n"; 
+
+  // the statistics of all the flows are read only once per instant
+  kpiCollector.Poll (monitor);
+  Ptr<Ipv4FlowClassifier> classifier = DynamicCast<Ipv4FlowClassifier> (flowmon.GetClassifier ());
+
+  // in the case of having a TCP download with multiple TCP connections, the increments
+  //of all the connections of a STA are accumulated here
+  // FIXME: add the rest of the variables 'ThisInterval'
+  uint32_t numberMultiTCP = (TcpDownMultiConnection > 0) ? myAllTheFlowStatistics.numberTCPDownloadFlows : 0;
+  std::vector<uint32_t> RxPacketsMultiTCP (numberMultiTCP, 0);
+  std::vector<uint32_t> RxBytesMultiTCP (numberMultiTCP, 0);
+
+  // for each flow, obtain and update the statistics
+  for (FlowId flowId = 1; flowId <= kpiCollector.GetNumberFlows (); flowId++) {
+
+    const FlowCounters& cumulative = kpiCollector.GetCumulative (flowId);
+    const FlowCounters& delta = kpiCollector.GetDelta (flowId);
+
+    // FlowMonitor has no statistics of this flow yet
+    if (!cumulative.present)
+      continue;
+
+    // the flow is only classified the first time it is seen
+    const FlowInfo& flowInfo = flowRegistry.Classify (flowId, classifier);
+    FlowStatistics* statistics = flowRegistry.GetStatisticsOfFlow (flowId);
+
+    // avoid the flows of ACKs (TCP also generates flows of ACKs in the opposite direction)
+    //and the flows that do not belong to the applications
+    if (statistics == NULL) {
+      if (VERBOSE_FOR_DEBUG >= 1)
+        std::cout << Simulator::Now().GetSeconds()
+                  << "\t[obtainKPIs] flow #" << flowId 
+                  << (flowInfo.isAck ? ". This is a flow of ACKs" : ". This is not one of the desired flows")
+                  << "\n";
+      continue;
+    }
+
+    if ((flowInfo.typeofapplication == 4) && (TcpDownMultiConnection > 0)) {
+      // all the connections of a STA share the same index
+      RxPacketsMultiTCP[flowInfo.statisticsIndex] = RxPacketsMultiTCP[flowInfo.statisticsIndex] + delta.rxPackets;
+      RxBytesMultiTCP[flowInfo.statisticsIndex] = RxBytesMultiTCP[flowInfo.statisticsIndex] + delta.rxBytes;
+
+      if (verboseLevel >= 2)
+        std::cout << Simulator::Now().GetSeconds()
+                  << "\t[obtainKPIs] flow #" << flowId 
+                  << ". TCP download. Corresponds to STA num" << flowInfo.statisticsIndex
+                  << ". Rx packets " << cumulative.rxPackets
+                  << ". Rx bytes " << cumulative.rxBytes
+                  << "\n";
+      continue;
+    }
+
+    // obtain the average latency and jitter only in the last interval
+
+    // the increments since the last interval are calculated by 'kpiCollector'
+    uint32_t RxPacketsThisInterval = delta.rxPackets;
+    uint32_t lostPacketsThisInterval = delta.lostPackets;
+    uint32_t RxBytesThisInterval = delta.rxBytes;
+    double averageLatencyThisInterval = 0;
+    double averageJitterThisInterval = 0;
+
+    if (RxPacketsThisInterval > 0) {
+      averageLatencyThisInterval = delta.delaySum / RxPacketsThisInterval;
+      averageJitterThisInterval = delta.jitterSum / RxPacketsThisInterval;
+    }
+
+    // the losses of the VoIP and video flows are obtained from the sequence numbers
+    uint32_t acumLostPackets = cumulative.lostPackets;
+    if (intervalLossEstimator.IsTracked (flowInfo.typeofapplication, flowInfo.statisticsIndex)) {
+      lostPacketsThisInterval = intervalLossEstimator.CloseInterval (flowInfo.typeofapplication, flowInfo.statisticsIndex);
+      acumLostPackets = intervalLossEstimator.GetCumulativeLost (flowInfo.typeofapplication, flowInfo.statisticsIndex);
+    }
+
+    // update the values of the statistics
+    statistics->acumDelay = cumulative.delaySum;
+    statistics->acumJitter = cumulative.jitterSum;
+    statistics->acumRxPackets = cumulative.rxPackets;
+    statistics->acumLostPackets = acumLostPackets;
+    statistics->acumRxBytes = cumulative.rxBytes;
+    statistics->lastIntervalDelay = averageLatencyThisInterval;
+    statistics->lastIntervalJitter = averageJitterThisInterval;
+    statistics->lastIntervalRxPackets = RxPacketsThisInterval;
+    statistics->lastIntervalLostPackets = lostPacketsThisInterval;
+    statistics->lastIntervalRxBytes = RxBytesThisInterval;
+
+    // the percentiles are only available for the flows whose UdpServer is tracked
+    if (latencyQuantiles.IsTracked (flowInfo.typeofapplication, flowInfo.statisticsIndex))
+      latencyQuantiles.CloseInterval (flowInfo.typeofapplication, flowInfo.statisticsIndex, statistics);
+
+    if (verboseLevel > 1) {
+      Ipv4FlowClassifier::FiveTuple t = classifier->FindFlow (flowId);
+
+      std::cout << Simulator::Now().GetSeconds()
+                << "\t[obtainKPIs] flow #" << flowId
+                << ". dst port: " << t.destinationPort
+                << ". src port: " << t.sourcePort;
+
+      if (flowInfo.typeofapplication == 1)
+        std::cout << "\tVoIP upload\n";
+      else if (flowInfo.typeofapplication == 2)
+        std::cout << "\tVoIP download\n";
+      else if (flowInfo.typeofapplication == 3)
+        std::cout << "\tTCP upload\n";
+      else if (flowInfo.typeofapplication == 4)
+        std::cout << "\tTCP download\n";
+      else if (flowInfo.typeofapplication == 5)
+        std::cout << "\tVideo download\n";
+
+      if (verboseLevel > 2) {
+        std::cout << "\t\t\tAcum delay at the end of the period: " << cumulative.delaySum << " [s]\n";
+        std::cout << "\t\t\tAcum number of Rx packets: " << cumulative.rxPackets << "\n";
+        std::cout << "\t\t\tAcum number of Rx bytes: " << cumulative.rxBytes << "\n";
+        std::cout << "\t\t\tAcum number of lost packets: " << acumLostPackets << "\n";
+        std::cout << "\t\t\tAcum throughput: " << cumulative.rxBytes * 8.0 / (Simulator::Now().GetSeconds() - INITIALTIMEINTERVAL) << "  [bps]\n";  // throughput
+      }
+      std::cout << "\t\t\tAverage delay this period: " << averageLatencyThisInterval << " [s]\n";
+      std::cout << "\t\t\tAverage jitter this period: " << averageJitterThisInterval << " [s]\n";
+      if (latencyQuantiles.IsTracked (flowInfo.typeofapplication, flowInfo.statisticsIndex))
+        for (uint32_t p = 0; p < NUMBER_OF_PERCENTILES; p++)
+          std::cout << "\t\t\tp" << reportedPercentiles[p] << " delay / jitter this period: "
+                    << statistics->lastIntervalDelayPercentile[p] << " / "
+                    << statistics->lastIntervalJitterPercentile[p] << " [s]\n";
+      std::cout << "\t\t\tNumber of Rx packets this period: " << RxPacketsThisInterval << "\n";
+      std::cout << "\t\t\tNumber of Rx bytes this period: " << RxBytesThisInterval << "\n";
+      std::cout << "\t\t\tNumber of lost packets this period: " << lostPacketsThisInterval << "\n";
+      std::cout << "\t\t\tThroughput this period: " << RxBytesThisInterval * 8.0 / timeInterval << "  [bps]\n\n";  // throughput
+    }
+  }
+  // the 'for' ends here
+
+  // update the statistics of the STAs with multiple TCP connections
+  if ((numberMultiTCP > 0) && (verboseLevel > 1))
+    std::cout << Simulator::Now().GetSeconds()
+              << "\t[obtainKPIs] Summary multiTCP flows\n";
+
+  for (uint32_t k = 0; k < numberMultiTCP; k++) {
+    FlowStatistics& statistics = myAllTheFlowStatistics.FlowStatisticsTCPDownload[k];
+    statistics.acumRxPackets = statistics.acumRxPackets + RxPacketsMultiTCP[k];
+    statistics.acumRxBytes = statistics.acumRxBytes + RxBytesMultiTCP[k];
+    statistics.lastIntervalRxPackets = RxPacketsMultiTCP[k];
+    statistics.lastIntervalRxBytes = RxBytesMultiTCP[k];
+
+    if (verboseLevel >= 2)
+      // note: 'k' is NOT the STA id, but the index of the STA here
+      std::cout << "\t\t\tSTA mum" << k
+                << ". Acum Rx packets: " << statistics.acumRxPackets
+                << ". Acum Rx bytes: " << statistics.acumRxBytes
+                << "\n";
+  }
+
+  if (VERBOSE_FOR_DEBUG >= 1)
+    std::cout << Simulator::Now().GetSeconds()
+              << "\t[obtainKPIs] Ending function 'obtainKPIs'"
+              << '\n'; 
+}
+
+
+// write a line of the KPI file
+void writeKPIs (TraceWriter* writer, uint32_t flowNumber, std::string application, const FlowStatistics& statistics, double timeInterval)
+{
+  writer->AddDouble (Simulator::Now().GetSeconds());  // timestamp
+  writer->AddInteger (flowNumber);                    // number of the flow
+  writer->AddString (application);
+  writer->AddInteger (statistics.destinationPort);
+  writer->AddInteger (statistics.finalDestinationPort);
+  writer->AddDouble (statistics.lastIntervalDelay);
+  writer->AddDouble (statistics.lastIntervalJitter);
+  writer->AddInteger (statistics.lastIntervalRxPackets);
+  writer->AddInteger (statistics.lastIntervalLostPackets);
+  writer->AddDouble (statistics.lastIntervalRxBytes * 8.0 / timeInterval);  // throughput
+  for (uint32_t p = 0; p < NUMBER_OF_PERCENTILES; p++)
+    writer->AddDouble (statistics.lastIntervalDelayPercentile[p]);
+  for (uint32_t p = 0; p < NUMBER_OF_PERCENTILES; p++)
+    writer->AddDouble (statistics.lastIntervalJitterPercentile[p]);
+  writer->EndRow ();
+}
+
+
+// Write the KPIs of the last interval to a file. Called by 'kpiScheduler'
+void saveKPIs ( std::string mynameKPIFile,
+                AllTheFlowStatistics myAllTheFlowStatistics,
+                uint32_t verboseLevel,
+                double timeInterval)  //Interval between monitoring moments
+{
+  CallbackTimer callbackTimer ("saveKPIs");
+  // the file is kept open during the simulation
+  TraceWriter* writer = traceWriters.Get (mynameKPIFile);
+  if (writer == NULL)
+    return;
 
+  // the flows are numbered consecutively, in the order of the types of application
+  uint32_t flowNumber = 0;
 
-  // Reschedule the calculation
-  Simulator::Schedule(  Seconds(myparam.timeInterval),
-                        &adjustAMPDU,
-                        myAllTheFlowStatistics,
-                        myparam,
-                        belowLatencyAmpduValue,
-                        aboveLatencyAmpduValue,
-                        myNumberAPs);
-}
+  for (uint32_t i = 0; i < myAllTheFlowStatistics.numberVoIPUploadFlows; i++)
+    writeKPIs (writer, flowNumber++, "VoIP_upload", myAllTheFlowStatistics.FlowStatisticsVoIPUpload[i], timeInterval);
 
+  for (uint32_t i = 0; i < myAllTheFlowStatistics.numberVoIPDownloadFlows; i++)
+    writeKPIs (writer, flowNumber++, "VoIP_download", myAllTheFlowStatistics.FlowStatisticsVoIPDownload[i], timeInterval);
 
-// Periodically obtain the statistics of the VoIP flows, using Flowmonitor
-void obtainKPIs ( Ptr<FlowMonitor> monitor/*, FlowMonitorHelper flowmon*/, 
-                  FlowStatistics* myFlowStatistics,
-                  uint16_t typeOfFlow,
-                  uint32_t verboseLevel,
-                  double timeInterval)  //Interval between monitoring moments
-{
-  if (VERBOSE_FOR_DEBUG >= 1)
-    std::cout << Simulator::Now().GetSeconds()
-              << "\t[obtainKPIs] Starting function 'obtainKPIs' with type of flow " << (uint16_t)typeOfFlow
-              << " (" << typeOfFlow * 10000 
-              << ")\n"; 
+  for (uint32_t i = 0; i < myAllTheFlowStatistics.numberTCPUploadFlows; i++)
+    writeKPIs (writer, flowNumber++, "TCP_upload", myAllTheFlowStatistics.FlowStatisticsTCPUpload[i], timeInterval);
 
-  monitor->CheckForLostPackets ();
-  Ptr<Ipv4FlowClassifier> classifier = DynamicCast<Ipv4FlowClassifier> (flowmon.GetClassifier ());
-  std::map<FlowId, FlowMonitor::FlowStats> stats = monitor->GetFlowStats ();
+  for (uint32_t i = 0; i < myAllTheFlowStatistics.numberTCPDownloadFlows; i++)
+    writeKPIs (writer, flowNumber++, "TCP_download", myAllTheFlowStatistics.FlowStatisticsTCPDownload[i], timeInterval);
 
-  // for each flow, obtain and update the statistics
-  for (std::map<FlowId, FlowMonitor::FlowStats>::const_iterator i = stats.begin (); i != stats.end (); ++i) {
+  for (uint32_t i = 0; i < myAllTheFlowStatistics.numberVideoDownloadFlows; i++)
+    writeKPIs (writer, flowNumber++, "Video_download", myAllTheFlowStatistics.FlowStatisticsVideoDownload[i], timeInterval);
+}
 
-    Ipv4FlowClassifier::FiveTuple t = classifier->FindFlow (i->first);
 
-    // note: i->first starts from '1', not from '0'
-    // to use it as an index for the statistics, you must use 'i->first - 1'
+// Write the percentiles of the delay and the jitter of the packets of all the VoIP and video STAs associated
+//to each AP in the last interval. The sketches of the STAs are merged. Called by 'kpiScheduler'
+void saveLatencyPercentilesAP ( std::string mynameFile,
+                                uint32_t verboseLevel)
+{
+  CallbackTimer callbackTimer ("saveLatencyPercentilesAP");
+  // the file is kept open during the simulation
+  TraceWriter* writer = traceWriters.Get (mynameFile);
+  if (writer == NULL)
+    return;
 
-    if (VERBOSE_FOR_DEBUG >= 1)
-      std::cout << Simulator::Now().GetSeconds()
-                << "\t[obtainKPIs] flow #" << i->first 
-                << ". dst port: " << t.destinationPort 
-                << ". src port: " << t.sourcePort
-                << "\n";
+  for (AP_recordVector::const_iterator indexAP = AP_vector.begin (); indexAP != AP_vector.end (); indexAP++) {
+    QuantileSketch delayThisAP;
+    QuantileSketch jitterThisAP;
+
+    const std::set<uint16_t>& stasOfThisAP = registry.GetSTAsOfAP ((*indexAP)->GetApid());
+    for (std::set<uint16_t>::const_iterator indexSTA = stasOfThisAP.begin (); indexSTA != stasOfThisAP.end (); indexSTA++) {
+      uint32_t typeofapplication = registry.GetSTA (*indexSTA)->Gettypeofapplication ();
+      int32_t statisticsIndex = flowRegistry.GetStatisticsIndexOfSTA (*indexSTA, typeofapplication);
+      if (statisticsIndex < 0)
+        continue;
+
+      const QuantileSketch* delayThisSTA = latencyQuantiles.GetLastIntervalDelay (typeofapplication, statisticsIndex);
+      const QuantileSketch* jitterThisSTA = latencyQuantiles.GetLastIntervalJitter (typeofapplication, statisticsIndex);
+      if (delayThisSTA != NULL)
+        delayThisAP.Merge (*delayThisSTA);
+      if (jitterThisSTA != NULL)
+        jitterThisAP.Merge (*jitterThisSTA);
+    }
+
+    writer->AddDouble (Simulator::Now().GetSeconds());
+    writer->AddInteger ((*indexAP)->GetApid());
+    writer->AddInteger (delayThisAP.GetCount ());
+    for (uint32_t p = 0; p < NUMBER_OF_PERCENTILES; p++)
+      writer->AddDouble (delayThisAP.GetPercentile (reportedPercentiles[p]));
+    for (uint32_t p = 0; p < NUMBER_OF_PERCENTILES; p++)
+      writer->AddDouble (jitterThisAP.GetPercentile (reportedPercentiles[p]));
+    writer->EndRow ();
+
+    if ((verboseLevel > 1) && (delayThisAP.GetCount () > 0))
+      std::cout << Simulator::Now ().GetSeconds()
+                << "\t[saveLatencyPercentilesAP] AP #" << (*indexAP)->GetApid()
+                << "\tp50/p95/p99 delay: " << delayThisAP.GetPercentile (50.0)
+                << " / " << delayThisAP.GetPercentile (95.0)
+                << " / " << delayThisAP.GetPercentile (99.0)
+                << " s (" << delayThisAP.GetCount () << " packets)\n";
+  }
+}
 
-    uint32_t RxPacketsThisInterval;
-    uint32_t lostPacketsThisInterval;
-    uint32_t RxBytesThisInterval;
-    double averageLatencyThisInterval;
-    double averageJitterThisInterval;
 
-    // avoid the flows of ACKs (TCP also generates flows of ACKs in the opposite direction)
-    // TCP download flows generate:
-    //  - the information flow:
-    //      - destination port 40000, 40001, etc.
-    //      - source port 49153. If two flows depart from the same server (e.g. in TCP upload), port 49154 is also used
-    //  - the ACK flow
-    //      - destination port 49153, 49154.
-    //      - source port 40000, 40001, etc.
-    if (t.destinationPort / 10000 != typeOfFlow ) {
-      if (VERBOSE_FOR_DEBUG >= 1)
-        std::cout << Simulator::Now().GetSeconds()
-                  << "\t[obtainKPIs] flow #" << i->first 
-                  //<< ". dst port: " << t.destinationPort 
-                  //<< ". src port: " << t.sourcePort
-                  << ". This is not one of the desired flows (" << typeOfFlow * 10000
-                  << ")\n";
-    }
-    else {
-      // this MAY be one of the desired flows (or a flow of ACKs)
+// periodic KPI engine. In each interval, FlowMonitor is read once and the statistics of all the flows are
+//updated in a single pass (obtainKPIs). After that, the registered consumers (KPI file, AMPDU adjustment,
+//load of the APs...) are called in the order they were registered, so all of them see the same snapshot
+class KPIScheduler
+{
+  public:
+    KPIScheduler ();
+    void Init (Ptr<FlowMonitor> monitor, AllTheFlowStatistics myAllTheFlowStatistics, uint16_t myTcpDownMultiConnection, uint32_t myverbose, double myTimeInterval);
+    void AddConsumer (std::string name, std::function<void ()> consumer);
+    bool ReplaceConsumer (std::string name, std::function<void ()> consumer);
+    void Start (double initialTime);
+  private:
+    void Run ();
+    Ptr<FlowMonitor> flowMonitor;
+    AllTheFlowStatistics allTheFlowStatistics;
+    uint16_t TcpDownMultiConnection;
+    uint32_t verboseLevel;
+    double timeInterval;
+    bool firstSnapshot;
+    std::vector<std::string> consumerNames;
+    std::vector<std::function<void ()> > consumers;
+};
 
-      if ((t.destinationPort == 49153) || (t.destinationPort == 49154)) {
-        // this is a flow of ACKs
-        if (VERBOSE_FOR_DEBUG >= 1)
-          std::cout << Simulator::Now().GetSeconds()
-                    << "\t[obtainKPIs] flow #" << i->first 
-                    //<< ". dst port: " << t.destinationPort 
-                    //<< ". src port: " << t.sourcePort
-                    << ". This is a flow of ACKs"
-                    << "\n";
-      }
-      else {
-        // this is NOT a flow of ACKs
-        if (VERBOSE_FOR_DEBUG >= 1)
-          std::cout << Simulator::Now().GetSeconds()
-                    << "\t[obtainKPIs] flow #" << i->first 
-                    //<< ". dst port: " << t.destinationPort 
-                    //<< ". src port: " << t.sourcePort
-                    << ". This is one of the desired flows (" << typeOfFlow * 10000
-                    << ")\n";
+KPIScheduler::KPIScheduler ()
+{
+  TcpDownMultiConnection = 0;
+  verboseLevel = 0;
+  timeInterval = 0.0;
+  firstSnapshot = true;
+}
 
-        // obtain the average latency and jitter only in the last interval
+void
+KPIScheduler::Init (Ptr<FlowMonitor> monitor, AllTheFlowStatistics myAllTheFlowStatistics, uint16_t myTcpDownMultiConnection, uint32_t myverbose, double myTimeInterval)
+{
+  flowMonitor = monitor;
+  allTheFlowStatistics = myAllTheFlowStatistics;
+  TcpDownMultiConnection = myTcpDownMultiConnection;
+  verboseLevel = myverbose;
+  timeInterval = myTimeInterval;
+}
 
-        // note: i->first starts from '1', not from '0'
-        // to use it as an index for the statistics, you must use 'i->first - 1'
-        
-        // the numbers MUST be positive
-        if (i->second.rxPackets >= myFlowStatistics[i->first - 1].acumRxPackets)
-          RxPacketsThisInterval = i->second.rxPackets - myFlowStatistics[i->first - 1].acumRxPackets;
-        else
-          RxPacketsThisInterval = 0;
-
-        if (i->second.lostPackets >= myFlowStatistics[i->first - 1].acumLostPackets)
-          lostPacketsThisInterval = i->second.lostPackets - myFlowStatistics[i->first - 1].acumLostPackets;
-        else
-          lostPacketsThisInterval = 0;
-
-        if (i->second.rxBytes > myFlowStatistics[i->first - 1].acumRxBytes)
-          RxBytesThisInterval = i->second.rxBytes - myFlowStatistics[i->first - 1].acumRxBytes;
-        else
-          RxBytesThisInterval = 0;
-
-        if (RxPacketsThisInterval > 0) {
-          averageLatencyThisInterval = (i->second.delaySum.GetSeconds() - myFlowStatistics[i->first - 1].acumDelay) / RxPacketsThisInterval;
-          averageJitterThisInterval = (i->second.jitterSum.GetSeconds() - myFlowStatistics[i->first - 1].acumJitter) / RxPacketsThisInterval;          
-        }
-        else {
-          averageLatencyThisInterval = 0;
-          averageJitterThisInterval = 0;
-        }
+// the consumers are called in the order they are added
+void
+KPIScheduler::AddConsumer (std::string name, std::function<void ()> consumer)
+{
+  consumerNames.push_back (name);
+  consumers.push_back (consumer);
+}
 
+// the consumer keeps its place in the order. It returns false if there is no consumer with that name
+bool
+KPIScheduler::ReplaceConsumer (std::string name, std::function<void ()> consumer)
+{
+  for (uint32_t i = 0; i < consumers.size (); i++)
+    if (consumerNames[i] == name) {
+      consumers[i] = consumer;
+      return true;
+    }
+  return false;
+}
 
-        // update the values of the statistics
-        myFlowStatistics[i->first - 1].acumDelay = i->second.delaySum.GetSeconds();
-        myFlowStatistics[i->first - 1].acumJitter = i->second.jitterSum.GetSeconds();
-        myFlowStatistics[i->first - 1].acumRxPackets = i->second.rxPackets;
-        myFlowStatistics[i->first - 1].acumLostPackets = i->second.lostPackets;
-        myFlowStatistics[i->first - 1].acumRxBytes = i->second.rxBytes;
-        myFlowStatistics[i->first - 1].lastIntervalDelay = averageLatencyThisInterval;
-        myFlowStatistics[i->first - 1].lastIntervalJitter = averageJitterThisInterval;
-        myFlowStatistics[i->first - 1].lastIntervalRxPackets = RxPacketsThisInterval;
-        myFlowStatistics[i->first - 1].lastIntervalLostPackets = lostPacketsThisInterval;
-        myFlowStatistics[i->first - 1].lastIntervalRxBytes = RxBytesThisInterval;
+void
+KPIScheduler::Start (double initialTime)
+{
+  NS_ASSERT (timeInterval > 0.0);
+  Simulator::Schedule (Seconds (initialTime), &KPIScheduler::Run, this);
+}
 
-        if (verboseLevel > 1) {
+void
+KPIScheduler::Run ()
+{
+  CallbackTimer callbackTimer ("KPIScheduler::Run");
+  obtainKPIs (flowMonitor, allTheFlowStatistics, TcpDownMultiConnection, verboseLevel, timeInterval);
 
-          std::cout << Simulator::Now().GetSeconds()
-                    << "\t[obtainKPIs] flow #" << i->first
-                    << ". dst port: " << t.destinationPort
-                    << ". src port: " << t.sourcePort;
-
-          if (t.destinationPort / 10000 == 1 )
-            std::cout << "\tVoIP upload\n";
-          else if (t.destinationPort / 10000 == 2 )
-            std::cout << "\tVoIP download\n";
-          else if (t.destinationPort / 1000 == 55 )
-            std::cout << "\tTCP upload\n";
-          else if (t.destinationPort / 10000 == 3 )
-            std::cout << "\tTCP download\n";
-          else if (t.destinationPort / 10000 == 6 )
-            std::cout << "\tVideo download\n";
-
-          if (verboseLevel > 2) {
-            std::cout << "\t\t\tAcum delay at the end of the period: " << i->second.delaySum.GetSeconds() << " [s]\n";
-            std::cout << "\t\t\tAcum number of Rx packets: " << i->second.rxPackets << "\n";
-            std::cout << "\t\t\tAcum number of Rx bytes: " << i->second.rxBytes << "\n";
-            std::cout << "\t\t\tAcum number of lost packets: " << i->second.lostPackets << "\n"; // FIXME
-            std::cout << "\t\t\tAcum throughput: " << i->second.rxBytes * 8.0 / (Simulator::Now().GetSeconds() - INITIALTIMEINTERVAL) << "  [bps]\n";  // throughput
-            //The previous line does not work correctly. If you add 'monitor->CheckForLostPackets (0.01)' at the beginning of the function, the number
-            //of lost packets seems to be higher. However, the obtained number does not correspond to the final number
-          }
-          std::cout << "\t\t\tAverage delay this period: " << averageLatencyThisInterval << " [s]\n";
-          std::cout << "\t\t\tAverage jitter this period: " << averageJitterThisInterval << " [s]\n";
-          std::cout << "\t\t\tNumber of Rx packets this period: " << RxPacketsThisInterval << "\n";
-          std::cout << "\t\t\tNumber of Rx bytes this period: " << RxBytesThisInterval << "\n";
-          std::cout << "\t\t\tNumber of lost packets this period: " << lostPacketsThisInterval << "\n"; // FIXME: This does not work correctly
-          std::cout << "\t\t\tThroughput this period: " << RxBytesThisInterval * 8.0 / timeInterval << "  [bps]\n\n";  // throughput
-        }
-      }
+  // the first snapshot only sets the starting point of the intervals, so the consumers are not called
+  if (!firstSnapshot) {
+    for (uint32_t i = 0; i < consumers.size (); i++) {
+      if (VERBOSE_FOR_DEBUG >= 1)
+        std::cout << Simulator::Now ().GetSeconds()
+                  << "\t[KPIScheduler] Calling " << consumerNames[i]
+                  << '\n';
+      consumers[i] ();
     }
   }
+  firstSnapshot = false;
 
-  // Reschedule the calculation
-  Simulator::Schedule(  Seconds(timeInterval),
-                        &obtainKPIs,
-                        monitor/*, flowmon*/, 
-                        myFlowStatistics,
-                        typeOfFlow,
-                        verboseLevel,
-                        timeInterval);
-
-  if (VERBOSE_FOR_DEBUG >= 1)
-    std::cout << Simulator::Now().GetSeconds()
-              << "\t[obtainKPIs] Ending function 'obtainKPIs'"
-              << '\n'; 
+  Simulator::Schedule (Seconds (timeInterval), &KPIScheduler::Run, this);
 }
 
+extern KPIScheduler& kpiScheduler;
 
-// Periodically obtain the statistics of the flows, using Flowmonitor
-void obtainKPIsMultiTCP ( Ptr<FlowMonitor> monitor, 
-                          FlowStatistics* myFlowStatistics,
-                          uint16_t numSTAs,
-                          uint16_t TcpDownMultiConnection,
-                          uint32_t verboseLevel,
-                          double timeInterval)  //Interval between monitoring moments
-{
-  // this function is only used for multi TCP connections
-  uint16_t typeOfFlow = INITIALPORT_TCP_DOWNLOAD / 10000;
-
-  // I am using all 3xxxx ports
-  NS_ASSERT(TcpDownMultiConnection * numSTAs < 10000);
-
-  if (VERBOSE_FOR_DEBUG >= 1)
-    std::cout << Simulator::Now().GetSeconds()
-              << "\t[obtainKPIsMultiTCP] Starting function 'obtainKPIsMultiTCP' with " << (uint16_t)TcpDownMultiConnection
-              << " connections for each of the " << numSTAs
-              << " TCP STAs. Total " << TcpDownMultiConnection * numSTAs
-              << " (port " << typeOfFlow 
-              << "xxxx) flows\n"; 
 
-  monitor->CheckForLostPackets ();
-  Ptr<Ipv4FlowClassifier> classifier = DynamicCast<Ipv4FlowClassifier> (flowmon.GetClassifier ());
-  std::map<FlowId, FlowMonitor::FlowStats> stats = monitor->GetFlowStats ();
-  
-  // FIXME: add the rest of the variables 'ThisInterval'
+// The state of the controller during a replication: the records of the APs and the STAs, the statistics of
+//the flows, the KPIs, the output files... The functions of the controller (many of them are callbacks of ns-3)
+//reach it through the global names declared above with the classes (AP_vector, kpiScheduler...), which are
+//references to the members of this object. A new piece of state has to be added here
+struct ControllerState
+{
+    AmpduController ampduController;
+    CallbackProfiler callbackProfiler;
+    AP_recordVector AP_vector;
+    AP_spatial_index apSpatialIndex;
+    AP_STA_registry registry;
+    LoadBalancerState loadBalancerState;
+    CoverageTracker coverageTracker;
+    STA_recordVector sta_vector;
+    TraceWriterRegistry traceWriters;
+    ProgressMonitor progressMonitor;
+    FlowRegistry flowRegistry;
+    APLoadMonitor apLoadMonitor;
+    FlowMonitorHelper flowmon;
+    KPICollector kpiCollector;
+    IntervalLossEstimator intervalLossEstimator;
+    LatencyQuantiles latencyQuantiles;
+    KPIScheduler kpiScheduler;
+
+    ~ControllerState ();
+};
 
-  uint32_t RxPacketsThisInterval[numSTAs];
-  //uint32_t lostPacketsThisInterval = 0;
-  uint32_t RxBytesThisInterval[numSTAs];
-  //double averageLatencyThisInterval = 0;
-  //double averageJitterThisInterval = 0;
+ControllerState::~ControllerState ()
+{
+  traceWriters.CloseAll ();
 
-  uint32_t RxPacketsBeforeThisInterval[numSTAs];
-  uint32_t RxBytesBeforeThisInterval[numSTAs];
+  // the records are created with 'new' when the scenario is built
+  for (AP_recordVector::const_iterator index = AP_vector.begin (); index != AP_vector.end (); index++)
+    delete *index;
+  for (STA_recordVector::const_iterator index = sta_vector.begin (); index != sta_vector.end (); index++)
+    delete *index;
+}
 
-  for (uint16_t k = 0; k < numSTAs; k++) {
-    RxPacketsThisInterval[k] = 0;
-    RxBytesThisInterval[k] = 0;
+ControllerState controllerState;
+
+AmpduController& ampduController = controllerState.ampduController;
+CallbackProfiler& callbackProfiler = controllerState.callbackProfiler;
+AP_recordVector& AP_vector = controllerState.AP_vector;
+AP_spatial_index& apSpatialIndex = controllerState.apSpatialIndex;
+AP_STA_registry& registry = controllerState.registry;
+LoadBalancerState& loadBalancerState = controllerState.loadBalancerState;
+CoverageTracker& coverageTracker = controllerState.coverageTracker;
+STA_recordVector& sta_vector = controllerState.sta_vector;
+TraceWriterRegistry& traceWriters = controllerState.traceWriters;
+ProgressMonitor& progressMonitor = controllerState.progressMonitor;
+FlowRegistry& flowRegistry = controllerState.flowRegistry;
+APLoadMonitor& apLoadMonitor = controllerState.apLoadMonitor;
+FlowMonitorHelper& flowmon = controllerState.flowmon;
+KPICollector& kpiCollector = controllerState.kpiCollector;
+IntervalLossEstimator& intervalLossEstimator = controllerState.intervalLossEstimator;
+LatencyQuantiles& latencyQuantiles = controllerState.latencyQuantiles;
+KPIScheduler& kpiScheduler = controllerState.kpiScheduler;
+
+
+// Runs a number of replications in the same process: when a replication finishes, its ControllerState is
+//destroyed and a new one is created in the same place, so the references above are still valid
+class ReplicationContext
+{
+  public:
+    void Begin (uint32_t replicationNumber);
+    void End ();
+};
 
-    RxPacketsBeforeThisInterval[k] = myFlowStatistics[k].acumRxPackets;
-    RxBytesBeforeThisInterval[k] = myFlowStatistics[k].acumRxBytes;
-  }
+void
+ReplicationContext::Begin (uint32_t replicationNumber)
+{
+  if (replicationNumber == 0)
+    return;
+
+  // the default values of the attributes and the global values (RngRun...) set by the previous replication.
+  //ns-3.30 cannot reset the index of the streams assigned automatically to the random variables, so they keep
+  //counting from the previous replication: the results are independent, but they are not the same ones that
+  //a separate process would get with the same RngRun
+  Config::Reset ();
+}
 
-  // for each flow found, obtain and update the statistics
-  // in the case of having a TCP download with multiple TCP connections, the statistics
-  //of a number of flows will be accumulated
-  for (std::map<FlowId, FlowMonitor::FlowStats>::const_iterator i = stats.begin (); i != stats.end (); ++i) {
+void
+ReplicationContext::End ()
+{
+  // it may have finished before running the simulation (e.g. a wrong parameter)
+  Simulator::Destroy ();
 
-    Ipv4FlowClassifier::FiveTuple t = classifier->FindFlow (i->first);
+  controllerState.~ControllerState ();
+  new (&controllerState) ControllerState ();
 
-    // note: i->first starts from '1', not from '0'
-    // to use it as an index for the statistics, you must use 'i->first - 1'
+  // the logs enabled with verboseLevel
+  LogComponentDisable ("UdpEchoClientApplication", LOG_LEVEL_INFO);
+  LogComponentDisable ("UdpEchoServerApplication", LOG_LEVEL_INFO);
+  LogComponentDisable ("SimpleMpduAggregation", LOG_LEVEL_INFO);
+  LogComponentDisable ("BulkSendApplication", LOG_LEVEL_INFO);
+}
 
-    if (verboseLevel >= 2)
-      std::cout << Simulator::Now().GetSeconds()
-                << "\t[obtainKPIsMultiTCP] flow #" << i->first 
-                << ". dst port: " << t.destinationPort 
-                << ". src port: " << t.sourcePort;
 
-    // avoid the flows of ACKs (TCP also generates flows of ACKs in the opposite direction)
-    // TCP download flows generate:
-    //  - the information flow:
-    //      - destination port 50000, 50001, etc.
-    //      - source port 49153. If two flows depart from the same server (e.g. in TCP upload), port 49154 is also used
-    //  - the ACK flow
-    //      - destination port 49153, 49154.
-    //      - source port 50000, 50001, etc.
-    if (t.destinationPort / 10000 != typeOfFlow ) {
-      if (VERBOSE_FOR_DEBUG >= 1)
-        std::cout //<< Simulator::Now().GetSeconds()
-                  //<< "\t[obtainKPIsMultiTCP] flow #" << i->first 
-                  //<< ". dst port: " << t.destinationPort 
-                  //<< ". src port: " << t.sourcePort
-                  << ". This is not one of the desired flows (" << typeOfFlow
-                  << "xxxx)\n";
-    }
-    else { // if (t.destinationPort / 10000 == typeOfFlow ) 
+// The parameters of the controller that can be different in each variant of a warm start
+struct warmStartVariant {
+  std::string outputFileSurname;
+  double latencyBudget;
+  uint16_t methodAdjustAmpdu;
+  uint32_t stepAdjustAmpdu;
+  double latencyPercentileAmpdu;
+};
 
-      uint16_t flowIndex = (t.destinationPort - INITIALPORT_TCP_DOWNLOAD) % TcpDownMultiConnection;
-      NS_ASSERT (flowIndex <= TcpDownMultiConnection);
+// Check the parameters of the controller that a variant of a warm start can change. The ones of the command
+//line and the ones of each variant are checked in the same way. 'origin' is added to the messages
+static bool
+checkControllerParameters (const warmStartVariant& parameters, uint16_t aggregationDynamicAlgorithm, std::string origin)
+{
+  bool correct = true;
 
-      uint16_t staIndex = (t.destinationPort - INITIALPORT_TCP_DOWNLOAD) / TcpDownMultiConnection;
-      NS_ASSERT (staIndex <= numSTAs);
+  if ((aggregationDynamicAlgorithm == 1 ) && (parameters.latencyBudget == 0.0)) {
+    std::cout << "INPUT PARAMETER ERROR: The algorithm for dynamic AMPDU adaptation (--aggregationDynamicAlgorithm=1) requires a latency budget ('latencyBudget'" << origin << " should not be 0.0). Stopping the simulation." << '\n';
+    correct = false;
+  }
 
-      if (verboseLevel >= 2)
-        // note: 'k' is NOT the STA id, but the index of the STA here
-        std::cout //<< Simulator::Now().GetSeconds()
-                  //<< "\t[obtainKPIsMultiTCP] flow #" << i->first 
-                  //<< ". dst port: " << t.destinationPort 
-                  //<< ". src port: " << t.sourcePort
-                  << " (" << typeOfFlow
-                  << "xxxx). Corresponds to flow #" << flowIndex
-                  << " of STA num" << staIndex
-                  << ". Rx packets " << i->second.rxPackets
-                  << ". Rx bytes " << i->second.rxBytes
-                  << "\n";
+  if ((parameters.latencyPercentileAmpdu < 0.0) || (parameters.latencyPercentileAmpdu >= 100.0)) {
+    std::cout << "INPUT PARAMETER ERROR: The percentile of the delay ('latencyPercentileAmpdu'" << origin << ") has to be between 0 and 100. Stopping the simulation." << '\n';
+    correct = false;
+  }
 
-      //myFlowStatistics[staIndex].acumRxPackets = myFlowStatistics[staIndex].acumRxPackets + i->second.rxPackets;
-      //myFlowStatistics[staIndex].acumRxBytes = myFlowStatistics[staIndex].acumRxBytes + i->second.rxBytes;
+  return correct;
+}
 
-      RxPacketsThisInterval[staIndex] = RxPacketsThisInterval[staIndex] + i->second.rxPackets;
-      RxBytesThisInterval[staIndex] = RxBytesThisInterval[staIndex] + i->second.rxBytes;
-      // obtain the average latency and jitter only in the last interval
+// Read the file of variants of a warm start: a line per variant, with parameters as in the command line
+//("--latencyBudget=0.05"). The parameters that are not in a line keep the value of 'defaults'
+static bool
+readWarmStartVariants (std::string fileName, warmStartVariant defaults, std::vector<warmStartVariant>& variants, std::string& errorMessage)
+{
+  std::ifstream ifs (fileName);
+  if (!ifs.is_open ()) {
+    errorMessage = fileName + " cannot be opened";
+    return false;
+  }
+
+  std::string line;
+  uint32_t lineNumber = 0;
+  while (std::getline (ifs, line)) {
+    lineNumber++;
+    if (line.find ('#') != std::string::npos)
+      line = line.substr (0, line.find ('#'));
+
+    warmStartVariant variant = defaults;
+    variant.outputFileSurname = "";
+    std::istringstream words (line);
+    std::string word;
+    uint32_t numberOfWords = 0;
+    while (words >> word) {
+      numberOfWords++;
+      size_t equal = word.find ('=');
+      std::string name = (word.compare (0, 2, "--") == 0) ? word.substr (2, equal - 2) : "";
+      std::istringstream value ((equal == std::string::npos) ? "" : word.substr (equal + 1));
+      if (name == "outputFileSurname")
+        value >> variant.outputFileSurname;
+      else if (name == "latencyBudget")
+        value >> variant.latencyBudget;
+      else if (name == "methodAdjustAmpdu")
+        value >> variant.methodAdjustAmpdu;
+      else if (name == "stepAdjustAmpdu")
+        value >> variant.stepAdjustAmpdu;
+      else if (name == "latencyPercentileAmpdu")
+        value >> variant.latencyPercentileAmpdu;
+      else
+        value.setstate (std::ios::failbit);
 
-      // note: i->first starts from '1', not from '0'      
+      if (value.fail () || (equal == std::string::npos)) {
+        errorMessage = fileName + ":" + std::to_string (lineNumber) + ": wrong parameter " + word;
+        return false;
+      }
     }
+    if (numberOfWords == 0)
+      continue;
 
-    // ACK flows start in 49153
-    if ((t.destinationPort / 1000 == 49)) {
-      // this is a flow of ACKs
-      if (VERBOSE_FOR_DEBUG >= 1)
-        std::cout //<< Simulator::Now().GetSeconds()
-                  //<< "\t[obtainKPIs] flow #" << i->first 
-                  //<< ". dst port: " << t.destinationPort 
-                  //<< ". src port: " << t.sourcePort
-                  << ". This is a flow of ACKs"
-                  << "\n\n";
+    // each variant writes its own files
+    if (variant.outputFileSurname == "") {
+      errorMessage = fileName + ":" + std::to_string (lineNumber) + ": the variant has no outputFileSurname";
+      return false;
+    }
+    bool used = (defaults.outputFileSurname == variant.outputFileSurname);
+    for (uint32_t i = 0; i < variants.size (); i++)
+      used = used || (variants[i].outputFileSurname == variant.outputFileSurname);
+    if (used) {
+      errorMessage = fileName + ":" + std::to_string (lineNumber) + ": the outputFileSurname " + variant.outputFileSurname + " is already used";
+      return false;
     }
+    variants.push_back (variant);
   }
-  // the 'for' ends here
-
 
-  if (verboseLevel > 1) {
-    std::cout << Simulator::Now().GetSeconds()
-              << "\t[obtainKPIsMultiTCP] Summary multiTCP flows\n";
+  if (variants.empty ()) {
+    errorMessage = fileName + " has no variants";
+    return false;
   }
+  return true;
+}
 
-  for (uint16_t k = 0; k < numSTAs; k++) {
-    myFlowStatistics[k].acumRxPackets = RxPacketsThisInterval[k];
-    myFlowStatistics[k].acumRxBytes = RxBytesThisInterval[k];
+// true if all the STAs that are not disabled are associated to an AP
+static bool
+allActiveSTAsAssociated ()
+{
+  for (STA_recordVector::const_iterator index = sta_vector.begin (); index != sta_vector.end (); index++)
+    if (!(*index)->GetDisabledPermanently () && !(*index)->GetAssoc ())
+      return false;
+  return true;
+}
 
-    if (verboseLevel >= 2)
-      // note: 'k' is NOT the STA id, but the index of the STA here
-      std::cout << "\t\t\tSTA mum" << k
-                << ". Acum Rx packets: " << myFlowStatistics[k].acumRxPackets
-                << ". Acum Rx bytes: " << myFlowStatistics[k].acumRxBytes
-                << "\n";
+// Check the association of the STAs during the initial interval, every 'period'. It reports when all the active
+//STAs have associated, so the initial interval can be shortened to that time (--initialTimeInterval). If they
+//have not associated when the applications start, their first packets are lost: a warning is printed
+static void
+checkAssociationsBeforeStart (double period, uint32_t verboseLevel)
+{
+  double now = Simulator::Now ().GetSeconds ();
 
-    myFlowStatistics[k].lastIntervalRxPackets = myFlowStatistics[k].acumRxPackets - RxPacketsBeforeThisInterval[k];
-    myFlowStatistics[k].lastIntervalRxBytes = myFlowStatistics[k].acumRxBytes - RxBytesBeforeThisInterval[k];
-  }    
+  if (allActiveSTAsAssociated ()) {
+    if (verboseLevel > 0)
+      std::cout << now
+                << "\t[checkAssociationsBeforeStart] All the active STAs are associated. The applications start at "
+                << INITIALTIMEINTERVAL << " s" << '\n';
+    return;
+  }
 
-  // Reschedule the calculation
-  Simulator::Schedule(  Seconds(timeInterval),
-                        &obtainKPIsMultiTCP,
-                        monitor/*, flowmon*/, 
-                        myFlowStatistics,
-                        numSTAs,
-                        TcpDownMultiConnection,
-                        verboseLevel,
-                        timeInterval);
+  if (now >= INITIALTIMEINTERVAL) {
+    std::cout << now
+              << "\t[checkAssociationsBeforeStart] WARNING: the applications start, but not all the active STAs are associated. "
+              << "The initial interval ('initialTimeInterval') may be too short" << '\n';
+    return;
+  }
 
-  if (VERBOSE_FOR_DEBUG >= 1)
-    std::cout << Simulator::Now().GetSeconds()
-              << "\t[obtainKPIsMultiTCP] Ending function 'obtainKPIsMultiTCP'"
-              << "\n\n"; 
+  Simulator::Schedule (Seconds (std::min (period, INITIALTIMEINTERVAL - now)), &checkAssociationsBeforeStart, period, verboseLevel);
+}
+
+// Wait for a variant of a warm start to finish. It returns false if it has failed
+static bool
+waitWarmStartVariant ()
+{
+  int status;
+  pid_t child = waitpid (-1, &status, 0);
+  if ((child < 0) || !WIFEXITED (status) || (WEXITSTATUS (status) != 0)) {
+    std::cout << "ERROR: the variant in process " << child << " has failed\n";
+    return false;
+  }
+  return true;
 }
 
 
-// Periodically obtain the statistics of the VoIP flows, using Flowmonitor
-void saveKPIs ( std::string mynameKPIFile,
-                AllTheFlowStatistics myAllTheFlowStatistics,
-                uint32_t verboseLevel,
-                double timeInterval)  //Interval between monitoring moments
+// The arguments of the command line, preceded by the parameters of the scenario file (--scenarioFile=file),
+//so the command line has priority. It returns false if the file is wrong
+static bool
+argumentsWithScenarioFile (int argc, char *argv[], std::vector<std::string>& arguments, std::string& errorMessage)
 {
-  // print the results to a file (they are written at the end of the file)
-  if ( mynameKPIFile != "" ) {
+  std::string scenarioFileName = "";
+  for (int i = 1; i < argc; i++)
+    if (std::string (argv[i]).compare (0, 15, "--scenarioFile=") == 0)
+      scenarioFileName = std::string (argv[i]).substr (15);
 
-    std::ofstream ofs;
-    ofs.open ( mynameKPIFile, std::ofstream::out | std::ofstream::app); // with "trunc" Any contents that existed in the file before it is open are discarded. with "app", all output operations happen at the end of the file, appending to its existing contents
-
-    for (uint32_t i = 0; i < myAllTheFlowStatistics.numberVoIPUploadFlows; i++) {
-      ofs << Simulator::Now().GetSeconds() << "\t"; // timestamp
-      ofs << i << "\t"; // number of the flow
-      ofs << "VoIP_upload\t";
-      ofs << myAllTheFlowStatistics.FlowStatisticsVoIPUpload[i].destinationPort << "\t"
-          << myAllTheFlowStatistics.FlowStatisticsVoIPUpload[i].finalDestinationPort << "\t"
-          << myAllTheFlowStatistics.FlowStatisticsVoIPUpload[i].lastIntervalDelay << "\t"
-          << myAllTheFlowStatistics.FlowStatisticsVoIPUpload[i].lastIntervalJitter << "\t"
-          << myAllTheFlowStatistics.FlowStatisticsVoIPUpload[i].lastIntervalRxPackets << "\t"
-          << myAllTheFlowStatistics.FlowStatisticsVoIPUpload[i].lastIntervalLostPackets << "\t"
-          << myAllTheFlowStatistics.FlowStatisticsVoIPUpload[i].lastIntervalRxBytes * 8.0 / timeInterval << "\n"; // throughput
-    }
-
-    for (uint32_t i = 0; i < myAllTheFlowStatistics.numberVoIPDownloadFlows; i++) {
-      ofs << Simulator::Now().GetSeconds() << "\t"; // timestamp
-      ofs << i
-              + myAllTheFlowStatistics.numberVoIPUploadFlows << "\t"; // number of the flow
-      ofs << "VoIP_download\t";
-      ofs << myAllTheFlowStatistics.FlowStatisticsVoIPDownload[i].destinationPort << "\t"
-          << myAllTheFlowStatistics.FlowStatisticsVoIPDownload[i].finalDestinationPort << "\t"
-          << myAllTheFlowStatistics.FlowStatisticsVoIPDownload[i].lastIntervalDelay << "\t"
-          << myAllTheFlowStatistics.FlowStatisticsVoIPDownload[i].lastIntervalJitter << "\t"
-          << myAllTheFlowStatistics.FlowStatisticsVoIPDownload[i].lastIntervalRxPackets << "\t"
-          << myAllTheFlowStatistics.FlowStatisticsVoIPDownload[i].lastIntervalLostPackets << "\t"
-          << myAllTheFlowStatistics.FlowStatisticsVoIPDownload[i].lastIntervalRxBytes * 8.0 / timeInterval << "\n"; // throughput
-    }
-
-    for (uint32_t i = 0; i < myAllTheFlowStatistics.numberTCPUploadFlows; i++) {
-      ofs << Simulator::Now().GetSeconds() << "\t"; // timestamp
-      ofs << i 
-              + myAllTheFlowStatistics.numberVoIPUploadFlows 
-              + myAllTheFlowStatistics.numberVoIPDownloadFlows << "\t"; // number of the flow
-      ofs << "TCP_upload\t";
-      ofs << myAllTheFlowStatistics.FlowStatisticsTCPUpload[i].destinationPort << "\t"
-          << myAllTheFlowStatistics.FlowStatisticsTCPUpload[i].finalDestinationPort << "\t"
-          << myAllTheFlowStatistics.FlowStatisticsTCPUpload[i].lastIntervalDelay << "\t"
-          << myAllTheFlowStatistics.FlowStatisticsTCPUpload[i].lastIntervalJitter << "\t"
-          << myAllTheFlowStatistics.FlowStatisticsTCPUpload[i].lastIntervalRxPackets << "\t"
-          << myAllTheFlowStatistics.FlowStatisticsTCPUpload[i].lastIntervalLostPackets << "\t"
-          << myAllTheFlowStatistics.FlowStatisticsTCPUpload[i].lastIntervalRxBytes * 8.0 / timeInterval << "\n"; // throughput
-    }
-
-    for (uint32_t i = 0; i < myAllTheFlowStatistics.numberTCPDownloadFlows; i++) {
-      ofs << Simulator::Now().GetSeconds() << "\t"; // timestamp
-      ofs << i 
-              + myAllTheFlowStatistics.numberVoIPUploadFlows 
-              + myAllTheFlowStatistics.numberVoIPDownloadFlows 
-              + myAllTheFlowStatistics.numberTCPUploadFlows << "\t"; // number of the flow
-      ofs << "TCP_download\t";
-      ofs << myAllTheFlowStatistics.FlowStatisticsTCPDownload[i].destinationPort << "\t"
-          << myAllTheFlowStatistics.FlowStatisticsTCPDownload[i].finalDestinationPort << "\t"
-          << myAllTheFlowStatistics.FlowStatisticsTCPDownload[i].lastIntervalDelay << "\t"
-          << myAllTheFlowStatistics.FlowStatisticsTCPDownload[i].lastIntervalJitter << "\t"
-          << myAllTheFlowStatistics.FlowStatisticsTCPDownload[i].lastIntervalRxPackets << "\t"
-          << myAllTheFlowStatistics.FlowStatisticsTCPDownload[i].lastIntervalLostPackets << "\t"
-          << myAllTheFlowStatistics.FlowStatisticsTCPDownload[i].lastIntervalRxBytes * 8.0 / timeInterval << "\n"; // throughput
-    }
-
-    for (uint32_t i = 0; i < myAllTheFlowStatistics.numberVideoDownloadFlows; i++) {
-      ofs << Simulator::Now().GetSeconds() << "\t"; // timestamp
-      ofs << i  
-              + myAllTheFlowStatistics.numberVoIPUploadFlows 
-              + myAllTheFlowStatistics.numberVoIPDownloadFlows 
-              + myAllTheFlowStatistics.numberTCPUploadFlows 
-              + myAllTheFlowStatistics.numberTCPDownloadFlows << "\t"; // number of the flow
-      ofs << "Video_download\t"; 
-      ofs << myAllTheFlowStatistics.FlowStatisticsVideoDownload[i].destinationPort << "\t"
-          << myAllTheFlowStatistics.FlowStatisticsVideoDownload[i].finalDestinationPort << "\t"
-          << myAllTheFlowStatistics.FlowStatisticsVideoDownload[i].lastIntervalDelay << "\t"
-          << myAllTheFlowStatistics.FlowStatisticsVideoDownload[i].lastIntervalJitter << "\t"
-          << myAllTheFlowStatistics.FlowStatisticsVideoDownload[i].lastIntervalRxPackets << "\t"
-          << myAllTheFlowStatistics.FlowStatisticsVideoDownload[i].lastIntervalLostPackets << "\t"
-          << myAllTheFlowStatistics.FlowStatisticsVideoDownload[i].lastIntervalRxBytes * 8.0 / timeInterval << "\n"; // throughput
-    }
-  }
-
-  // Reschedule the writing
-  Simulator::Schedule(  Seconds(timeInterval),
-                        &saveKPIs,
-                        mynameKPIFile,
-                        myAllTheFlowStatistics,
-                        verboseLevel,
-                        timeInterval);
+  arguments.push_back (argv[0]);
+  if (scenarioFileName != "") {
+    ScenarioFile scenario;
+    if (!scenario.Load (scenarioFileName)) {
+      errorMessage = scenario.error;
+      return false;
+    }
+
+    for (uint32_t i = 0; i < scenario.parameters.size (); i++)
+      arguments.push_back ("--" + scenario.parameters[i].first + "=" + scenario.parameters[i].second);
+
+    // a sweep has a number of values: the one of this run has to be in the command line
+    for (uint32_t i = 0; i < scenario.sweeps.size (); i++) {
+      bool found = false;
+      for (int j = 1; j < argc; j++)
+        if (std::string (argv[j]).compare (0, scenario.sweeps[i].first.size () + 3, "--" + scenario.sweeps[i].first + "=") == 0)
+          found = true;
+      if (!found) {
+        errorMessage = scenarioFileName + " has a sweep of " + scenario.sweeps[i].first
+                        + ". Run it with wifi-sweep-runner, or set --" + scenario.sweeps[i].first + " in the command line";
+        return false;
+      }
+    }
+  }
+
+  for (int i = 1; i < argc; i++)
+    arguments.push_back (argv[i]);
+  return true;
 }
 
 
 /*****************************/
-/************ main ***********/
+/******** replication ********/
 /*****************************/
-int main (int argc, char *argv[]) {
+// It builds the scenario with the parameters of the command line, runs the simulation and writes the results
+static int
+runReplication (int argc, char *argv[]) {
 
   //bool populatearpcache = false; // Provisional variable FIXME: It should not be necessary
 
@@ -6426,10 +9292,15 @@ int main (int argc, char *argv[]) {
   bool enablePcap = 0; // set this to 1 and .pcap files will be generated (in the ns-3.26 folder)
   uint32_t verboseLevel = 0; // verbose level.
   uint32_t printSeconds = 0; // print the time every 'printSeconds' simulation seconds
+  bool profileCallbacks = false; // measure the wall-clock time of the callbacks of the controller (see CallbackProfiler)
   bool generateHistograms = false; // generate histograms
   std::string outputFileName; // the beginning of the name of the output files to be generated during the simulations
   std::string outputFileSurname; // this will be added to certain files
   bool saveXMLFile = false; // save per-flow results in an XML file
+  bool saveProgress = false; // write the progress reported every 'printSeconds' to a file
+  bool binaryOutputFiles = false; // write the periodic output files (KPIs, positions, AMPDU) in binary columnar format
+  bool resultStore = false; // write all the results of the run as tables of a single binary file
+  std::string averageShardDirectory = ""; // if not empty, the line of _average.txt is written to a file of this run in this directory
 
   uint32_t numOperationalChannelsPrimary = 4; // by default, 4 different channels are used in the APs
   uint32_t numOperationalChannelsSecondary = 4; // by default, 4 different channels are used in the APs
@@ -6453,6 +9324,10 @@ int main (int argc, char *argv[]) {
   
   bool algorithm_load_balancing = false;  // activate (or not) the load balancing between 2.4 an 5GHz
   double periodLoadBalancing = 2.0; // period for the load balancing [seconds]
+  bool multiSwapLoadBalancing = false;  // find all the exchanges of STAs of a period at once (not only one)
+  uint32_t maxChannelSwitchesLoadBalancing = 0; // maximum number of STAs switched in a period (0 means no limit)
+  bool loadAwareLoadBalancing = false;  // move STAs from saturated 2.4 GHz APs to idle 5 GHz APs, using the measured KPIs
+  double saturationThroughputLoadBalancing = 0.0; // throughput of a saturated AP [Mbps] (0 means that only the delay budget is considered)
 
 
   uint32_t maxAmpduSize, maxAmpduSizeSecondary;     // taken from https://www.nsnam.org/doxygen/minstrel-ht-wifi-manager-example_8cc_source.html
@@ -6461,6 +9336,8 @@ int main (int argc, char *argv[]) {
 
   uint32_t stepAdjustAmpdu = STEPADJUSTAMPDUDEFAULT; // step for adjusting the AMPDU size. Assign the default value
 
+  double latencyPercentileAmpdu = 0.0;  // percentile of the VoIP delay compared with the budget. 0 means the average
+
   //uint32_t version80211primary = 0; // 0 means 802.11n in 5GHz; 1 means 802.11ac; 2 means 802.11n in 2.4GHz 
   std::string version80211primary = "11ac";
 
@@ -6577,6 +9454,7 @@ int main (int argc, char *argv[]) {
   cmd.AddValue ("latencyBudget", "Maximum latency [s] tolerated by VoIP applications", latencyBudget);
   cmd.AddValue ("methodAdjustAmpdu", "Method for adjusting AMPDU size: '0' (default), '1' ...", methodAdjustAmpdu);
   cmd.AddValue ("stepAdjustAmpdu", "Step for adjusting AMPDU size [bytes]", stepAdjustAmpdu);
+  cmd.AddValue ("latencyPercentileAmpdu", "Percentile of the VoIP delay compared with 'latencyBudget' (e.g. 95). '0' (default) uses the average", latencyPercentileAmpdu);
 
   // TCP parameters
   cmd.AddValue ("TcpPayloadSize", "Payload size [bytes]", TcpPayloadSize);
@@ -6604,6 +9482,10 @@ int main (int argc, char *argv[]) {
   cmd.AddValue ("coverage_5GHz", "Estimated coverage of APs in 5GHz [meters]", coverage_5GHz);
   cmd.AddValue ("algorithm_load_balancing", "Set to 1 to activate the load balancing between 2.4 and 5 GHz", algorithm_load_balancing);
   cmd.AddValue ("periodLoadBalancing", "Period of the load balancing between 2.4 and 5 GHz", periodLoadBalancing);
+  cmd.AddValue ("multiSwapLoadBalancing", "Set to 1 to perform all the possible exchanges of STAs in each period of the load balancing", multiSwapLoadBalancing);
+  cmd.AddValue ("maxChannelSwitchesLoadBalancing", "Maximum number of STAs switched in each period of the load balancing (0 means no limit)", maxChannelSwitchesLoadBalancing);
+  cmd.AddValue ("loadAwareLoadBalancing", "Set to 1 to move dual STAs from saturated 2.4 GHz APs to idle 5 GHz APs, according to the measured KPIs", loadAwareLoadBalancing);
+  cmd.AddValue ("saturationThroughputLoadBalancing", "Throughput of an AP considered saturated by the load-aware load balancing [Mbps]. 0 means that only the latency budget is considered", saturationThroughputLoadBalancing);
   
 
   // Parameters of the output of the program
@@ -6611,10 +9493,15 @@ int main (int argc, char *argv[]) {
   cmd.AddValue ("enablePcap", "Enable/disable pcap file generation", enablePcap);
   cmd.AddValue ("verboseLevel", "Tell echo applications to log if true", verboseLevel);
   cmd.AddValue ("printSeconds", "Periodically print simulation time (even in verboseLevel=0)", printSeconds);
+  cmd.AddValue ("profileCallbacks", "Measure the wall-clock time of the functions of the controller called by the simulator, and print a table at the end", profileCallbacks);
   cmd.AddValue ("generateHistograms", "Generate histograms?", generateHistograms);
   cmd.AddValue ("outputFileName", "First characters to be used in the name of the output files", outputFileName);
   cmd.AddValue ("outputFileSurname", "Other characters to be used in the name of the output files (not in the average one)", outputFileSurname);
   cmd.AddValue ("saveXMLFile", "Save per-flow results to an XML file?", saveXMLFile);
+  cmd.AddValue ("saveProgress", "Write the progress reported every 'printSeconds' (speed, peak memory, ETA) to a file (_progress.txt)", saveProgress);
+  cmd.AddValue ("binaryOutputFiles", "Write the periodic output files (KPIs, positions, AMPDU values) in binary columnar format (.bin)", binaryOutputFiles);
+  cmd.AddValue ("resultStore", "Write all the results of the run (periodic files, flows, histograms) in a single binary file (_results.bin)", resultStore);
+  cmd.AddValue ("averageShardDirectory", "Write the averages of the run to its own file in this directory, instead of appending them to _average.txt", averageShardDirectory);
 
   /* Parameters that allow the manual definition of the scenario */
   cmd.AddValue ("version80211primary", "Version of 802.11 in primary APs and in the primary device of STAs: '11ac' (default); '11n5'; '11n2.4'; '11g'; '11a'", version80211primary);
@@ -6631,7 +9518,34 @@ int main (int argc, char *argv[]) {
   cmd.AddValue ("onlyOnePeerSTAallowedAtATime", "If 'true' (default), only one of the two peer STAs that are in the same place will be used at the same time", onlyOnePeerSTAallowedAtATime);
   // the inactive STAs will have network device, but it will be put in an unused channel, where there are no APs
 
-  cmd.Parse (argc, argv);
+  // the parameters can also be read from a file. Those of the command line have priority
+  std::string scenarioFile = "";
+  cmd.AddValue ("scenarioFile", "File with the parameters of the scenario (see wifi-scenario-file.h). The command line has priority over it", scenarioFile);
+  // it is used by main, and it is here so it appears in the help
+  std::string replicationsFile = "";
+  cmd.AddValue ("replications", "File with the parameters of a number of replications (one per line), to be run one after the other in this process", replicationsFile);
+
+  std::string warmStartVariants = "";
+  cmd.AddValue ("warmStartVariants", "File with the parameters of a number of variants of the controller (one per line). The common part is simulated once, and then a child process runs each variant", warmStartVariants);
+
+  uint32_t warmStartJobs = 0;
+  cmd.AddValue ("warmStartJobs", "Maximum number of variants of a warm start running at the same time. '0' (default) is the number of cores", warmStartJobs);
+
+  // it is a global variable (INITIALTIMEINTERVAL), so a replication does not get the value of the previous one
+  initialTimeInterval = INITIALTIMEINTERVALDEFAULT;
+  cmd.AddValue ("initialTimeInterval", "Time before the applications start [s], for the association of the STAs. The same time is added at the end", initialTimeInterval);
+
+  std::vector<std::string> arguments;
+  std::string scenarioFileError;
+  if (!argumentsWithScenarioFile (argc, argv, arguments, scenarioFileError)) {
+    std::cout << "INPUT PARAMETER ERROR: Wrong scenario file. " << scenarioFileError << ". Stopping the simulation." << '\n';
+    return 1;
+  }
+  std::vector<char*> argumentPointers;
+  for (uint32_t i = 0; i < arguments.size (); i++)
+    argumentPointers.push_back (&arguments[i][0]);
+
+  cmd.Parse (argumentPointers.size (), &argumentPointers[0]);
 
 
   // Variable to store the last AMPDU value for which latency was below the limit
@@ -6663,21 +9577,7 @@ int main (int argc, char *argv[]) {
   uint32_t number_of_Servers = number_of_STAs;  // the number of servers is the same as the number of STAs. Each server attends a STA
 
 
-  //the list of channels is here: https://www.nsnam.org/docs/models/html/wifi-user.html
-  // see https://en.wikipedia.org/wiki/List_of_WLAN_channels
- 
-  //uint8_t availableChannels24GHz20MHz[NUM_CHANNELS_24GHZ] = {1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12};
-  uint8_t availableChannels24GHz20MHz[NUM_CHANNELS_24GHZ] = {1, 6, 11};
-
-  uint8_t availableChannels20MHz[NUM_CHANNELS_5GHZ_20MHZ] = {36, 40, 44, 48, 52, 56, 60, 64, 100, 104, 108, 112,
-                                                            116, 120, 124, 128, 132, 136, 140, 144, 149, 153, 157, 
-                                                            161, 165, 169, 173, 184, 188, 192, 196, 8, 12, 16};
-
-  uint8_t availableChannels40MHz[NUM_CHANNELS_5GHZ_40MHZ] = {38, 46, 54, 62, 102, 110, 118, 126, 134, 142, 151, 159}; 
-
-  uint8_t availableChannels80MHz[NUM_CHANNELS_5GHZ_80MHZ] = {42, 58, 106, 122, 138, 155}; 
-
-  uint8_t availableChannels160MHz[NUM_CHANNELS_5GHZ_160MHZ] = {50, 114};
+  // the sets of available channels are defined at the beginning (availableChannels20MHz, etc.)
 
 
   // One server interacts with each STA
@@ -6780,8 +9680,18 @@ int main (int argc, char *argv[]) {
     error = 1;
   }
 
-  if ((aggregationDynamicAlgorithm == 1 ) && (latencyBudget == 0.0)) {
-    std::cout << "INPUT PARAMETER ERROR: The algorithm for dynamic AMPDU adaptation (--aggregationDynamicAlgorithm=1) requires a latency budget ('latencyBudget' should not be 0.0). Stopping the simulation." << '\n';
+  // the ones that a variant of a warm start can change
+  warmStartVariant controllerParameters;
+  controllerParameters.outputFileSurname = outputFileSurname;
+  controllerParameters.latencyBudget = latencyBudget;
+  controllerParameters.methodAdjustAmpdu = methodAdjustAmpdu;
+  controllerParameters.stepAdjustAmpdu = stepAdjustAmpdu;
+  controllerParameters.latencyPercentileAmpdu = latencyPercentileAmpdu;
+  if (!checkControllerParameters (controllerParameters, aggregationDynamicAlgorithm, ""))
+    error = 1;
+
+  if (initialTimeInterval <= 0.0) {
+    std::cout << "INPUT PARAMETER ERROR: The STAs need some time to associate before the applications start ('initialTimeInterval' should be higher than 0.0). Stopping the simulation." << '\n';
     error = 1;
   }
 
@@ -6892,16 +9802,16 @@ int main (int argc, char *argv[]) {
   }
 
   // the primary and secondary interfaces CANNOT be in the same band
-  std::string frequencyBandPrimary, frequencyBandSecondary;
+  wifiBand frequencyBandPrimary, frequencyBandSecondary;
   if ( (version80211primary == "11n5") || (version80211primary == "11ac") || (version80211primary == "11a") )
-    frequencyBandPrimary = "5 GHz"; // 5GHz
+    frequencyBandPrimary = BAND_5GHZ; // 5GHz
   else
-    frequencyBandPrimary = "2.4 GHz"; // 2.4 GHz
+    frequencyBandPrimary = BAND_24GHZ; // 2.4 GHz
 
   if ( (version80211secondary == "11n5") || (version80211secondary == "11ac") || (version80211secondary == "11a") )
-    frequencyBandSecondary = "5 GHz"; // 5GHz
+    frequencyBandSecondary = BAND_5GHZ; // 5GHz
   else
-    frequencyBandSecondary = "2.4 GHz"; // 2.4 GHz  
+    frequencyBandSecondary = BAND_24GHZ; // 2.4 GHz  
 
 
   if ((numberAPsSamePlace == 2) || (numberSTAsSamePlace == 2)) {
@@ -6963,6 +9873,10 @@ int main (int argc, char *argv[]) {
       std::cout << "INPUT PARAMETER ERROR: The load balancing algorithm is active, but 'periodLoadBalancing' is null. Stopping the simulation." << '\n';
       error = 1;       
     }
+    if (loadAwareLoadBalancing && (timeMonitorKPIs <= 0.0)) {
+      std::cout << "INPUT PARAMETER ERROR: The load-aware load balancing requires the KPIs of the flows, but 'timeMonitorKPIs' is null. Stopping the simulation." << '\n';
+      error = 1;
+    }
     if (onlyOnePeerSTAallowedAtATime != true) {
       std::cout << "INPUT PARAMETER ERROR: The load balancing algorithm is active, but 'onlyOnePeerSTAallowedAtATime' is false. It does not make sense to run the algorithm if dual STAs can be connected to both bands. Stopping the simulation." << '\n';
       error = 1;       
@@ -6972,7 +9886,7 @@ int main (int argc, char *argv[]) {
 
   // check if the channel width is correct
   // this is only applicable to the 5GHz band
-  if (frequencyBandPrimary == "5 GHz" ) {
+  if (frequencyBandPrimary == BAND_5GHZ ) {
     if ((channelWidthPrimary != 20) && (channelWidthPrimary != 40) && (channelWidthPrimary != 80) && (channelWidthPrimary != 160)) {
       std::cout << "INPUT PARAMETER ERROR: The witdth of the channels in 5GHz band has to be 20, 40, 80 or 160. Stopping the simulation." << '\n';
       error = 1;    
@@ -7006,7 +9920,7 @@ int main (int argc, char *argv[]) {
     }
   }
 
-  if (frequencyBandSecondary == "5 GHz" ) {
+  if (frequencyBandSecondary == BAND_5GHZ ) {
     if ((channelWidthSecondary != 20) && (channelWidthSecondary != 40) && (channelWidthSecondary != 80) && (channelWidthSecondary != 160)) {
       std::cout << "INPUT PARAMETER ERROR: The witdth of the channels has to be 20, 40, 80 or 160. Stopping the simulation." << '\n';
       error = 1;    
@@ -7041,14 +9955,42 @@ int main (int argc, char *argv[]) {
   }
 
 
-  if (error) return 0;
+  if (saveProgress && (printSeconds == 0)) {
+    std::cout << "INPUT PARAMETER ERROR: The progress is saved every 'printSeconds' ('printSeconds' should not be 0 with 'saveProgress'). Stopping the simulation." << '\n';
+    error = 1;
+  }
+
+  // warm start: the variants are read now, so a wrong file stops the simulation before building the scenario
+  std::vector<warmStartVariant> warmStartVariantList;
+  if (warmStartVariants != "") {
+    if (timeMonitorKPIs <= 0.0) {
+      std::cout << "INPUT PARAMETER ERROR: The variants of a warm start are variants of the controller, which requires the KPIs of the flows ('timeMonitorKPIs' should not be 0.0). Stopping the simulation." << '\n';
+      error = 1;
+    }
+    if (saveMobility || enablePcap) {
+      std::cout << "INPUT PARAMETER ERROR: The mobility trace and the pcap files cannot be used with a warm start ('warmStartVariants'). Stopping the simulation." << '\n';
+      error = 1;
+    }
+
+    std::string warmStartError;
+    if (!readWarmStartVariants (warmStartVariants, controllerParameters, warmStartVariantList, warmStartError)) {
+      std::cout << "INPUT PARAMETER ERROR: Wrong file of variants. " << warmStartError << ". Stopping the simulation." << '\n';
+      error = 1;
+    }
+    for (uint32_t i = 0; i < warmStartVariantList.size (); i++)
+      if (!checkControllerParameters (warmStartVariantList[i], aggregationDynamicAlgorithm, " of the variant " + warmStartVariantList[i].outputFileSurname))
+        error = 1;
+  }
+
+
+  if (error) return 1;
   /********** end of - check input parameters **************/
 
   
   /******** fill the variable with the available channels *************/
   uint8_t availableChannels[numOperationalChannelsPrimary];
   for (uint32_t i = 0; i < numOperationalChannelsPrimary; ++i) {
-    if (frequencyBandPrimary == "5 GHz") {
+    if (frequencyBandPrimary == BAND_5GHZ) {
       if (channelWidthPrimary == 20)
         availableChannels[i] = availableChannels20MHz[i % NUM_CHANNELS_5GHZ_20MHZ];
       else if (channelWidthPrimary == 40)
@@ -7066,7 +10008,7 @@ int main (int argc, char *argv[]) {
 
   uint8_t availableChannelsSecondary[numOperationalChannelsSecondary];
   for (uint32_t i = 0; i < numOperationalChannelsSecondary; ++i) {
-    if (frequencyBandSecondary == "5 GHz") {
+    if (frequencyBandSecondary == BAND_5GHZ) {
       if (channelWidthSecondary == 20)
         availableChannelsSecondary[i] = availableChannels20MHz[i % NUM_CHANNELS_5GHZ_20MHZ];
       else if (channelWidthSecondary == 40)
@@ -7156,6 +10098,7 @@ int main (int argc, char *argv[]) {
     std::cout << "Maximum latency tolerated by VoIP applications: " << latencyBudget << " s" << '\n';
     std::cout << "Method for adjusting AMPDU size: '0' (default), '1' PENDING: " << methodAdjustAmpdu << '\n';
     std::cout << "Step for adjusting AMPDU size: " << stepAdjustAmpdu << " bytes" << '\n';
+    std::cout << "Percentile of the VoIP delay compared with the budget (0 is the average): " << latencyPercentileAmpdu << '\n';
 
     std::cout << '\n';
     // TCP parameters
@@ -7206,11 +10149,27 @@ int main (int argc, char *argv[]) {
     std::cout << "First characters to be used in the name of the output file: " << outputFileName << '\n';
     std::cout << "Other characters to be used in the name of the output file (not in the average one): " << outputFileSurname << '\n';
     std::cout << "Save per-flow results to an XML file?: " << saveXMLFile << '\n';
+    std::cout << "Save the progress of the run to a file?: " << saveProgress << '\n';
+    std::cout << "Write the periodic output files in binary format?: " << binaryOutputFiles << '\n';
+    std::cout << "Write all the results in a single binary file?: " << resultStore << '\n';
+    std::cout << "Directory for the averages of each run (empty: append to _average.txt): " << averageShardDirectory << '\n';
+    std::cout << "Scenario file: " << scenarioFile << '\n';
+    std::cout << "File of variants of a warm start: " << warmStartVariants << '\n';
+    std::cout << "Time before the applications start: " << initialTimeInterval << " s" << '\n';
+    std::cout << "Measure the wall-clock time of the callbacks of the controller?: " << profileCallbacks << '\n';
     std::cout << '\n';
   }
   /************* end of - Show the parameters by the screen *****************/
 
 
+  callbackProfiler.Enable (profileCallbacks);
+
+  // format of the periodic output files. They are opened later
+  traceWriters.SetBinary (binaryOutputFiles);
+  if (resultStore)
+    traceWriters.SetResultStore (outputFileName + "_" + outputFileSurname + "_results.bin");
+
+
   /************* Create the variables to store the flowmonitor statistics of the flows during the simulation ************/
   uint32_t  numberVoIPuploadConnections,
             numberVoIPdownloadConnections,
@@ -7299,6 +10258,8 @@ int main (int argc, char *argv[]) {
     myFlowStatisticsVoIPUpload[i].acumRxPackets = 0;
     myFlowStatisticsVoIPUpload[i].acumRxBytes = 0;
     myFlowStatisticsVoIPUpload[i].acumLostPackets = 0;
+    std::fill_n (myFlowStatisticsVoIPUpload[i].lastIntervalDelayPercentile, NUMBER_OF_PERCENTILES, NAN);
+    std::fill_n (myFlowStatisticsVoIPUpload[i].lastIntervalJitterPercentile, NUMBER_OF_PERCENTILES, NAN);
     myFlowStatisticsVoIPUpload[i].destinationPort = INITIALPORT_VOIP_UPLOAD + i;
     myFlowStatisticsVoIPUpload[i].finalDestinationPort = INITIALPORT_VOIP_UPLOAD + i;
   }
@@ -7310,6 +10271,8 @@ int main (int argc, char *argv[]) {
     myFlowStatisticsVoIPDownload[i].acumRxPackets = 0;
     myFlowStatisticsVoIPDownload[i].acumRxBytes = 0;
     myFlowStatisticsVoIPDownload[i].acumLostPackets = 0;
+    std::fill_n (myFlowStatisticsVoIPDownload[i].lastIntervalDelayPercentile, NUMBER_OF_PERCENTILES, NAN);
+    std::fill_n (myFlowStatisticsVoIPDownload[i].lastIntervalJitterPercentile, NUMBER_OF_PERCENTILES, NAN);
     myFlowStatisticsVoIPDownload[i].destinationPort = INITIALPORT_VOIP_DOWNLOAD + i;
     myFlowStatisticsVoIPDownload[i].finalDestinationPort = INITIALPORT_VOIP_DOWNLOAD + i;
   }
@@ -7321,6 +10284,8 @@ int main (int argc, char *argv[]) {
     myFlowStatisticsTCPUpload[i].acumRxPackets = 0;
     myFlowStatisticsTCPUpload[i].acumRxBytes = 0;
     myFlowStatisticsTCPUpload[i].acumLostPackets = 0;
+    std::fill_n (myFlowStatisticsTCPUpload[i].lastIntervalDelayPercentile, NUMBER_OF_PERCENTILES, NAN);
+    std::fill_n (myFlowStatisticsTCPUpload[i].lastIntervalJitterPercentile, NUMBER_OF_PERCENTILES, NAN);
     myFlowStatisticsTCPUpload[i].destinationPort = INITIALPORT_TCP_UPLOAD + i;
     myFlowStatisticsTCPUpload[i].finalDestinationPort = INITIALPORT_TCP_UPLOAD + i;
   }
@@ -7332,6 +10297,8 @@ int main (int argc, char *argv[]) {
     myFlowStatisticsTCPDownload[i].acumRxPackets = 0;
     myFlowStatisticsTCPDownload[i].acumRxBytes = 0;
     myFlowStatisticsTCPDownload[i].acumLostPackets = 0;
+    std::fill_n (myFlowStatisticsTCPDownload[i].lastIntervalDelayPercentile, NUMBER_OF_PERCENTILES, NAN);
+    std::fill_n (myFlowStatisticsTCPDownload[i].lastIntervalJitterPercentile, NUMBER_OF_PERCENTILES, NAN);
     if ( TcpDownMultiConnection == 0 ) {
       // in this case, there is only one port for each TCP download
       myFlowStatisticsTCPDownload[i].destinationPort = INITIALPORT_TCP_DOWNLOAD + i;
@@ -7343,7 +10310,7 @@ int main (int argc, char *argv[]) {
       myFlowStatisticsTCPDownload[i].finalDestinationPort = INITIALPORT_TCP_DOWNLOAD + ((i + 1) * TcpDownMultiConnection) - 1;
 
       // I set to 0 these variables because I am not updating them
-      // FIXME: if I update them in 'obtainKPIsMultiTCP', I can remove this
+      // FIXME: if I update them in 'obtainKPIs', I can remove this
       myFlowStatisticsTCPDownload[i].lastIntervalDelay = 0.0;
       myFlowStatisticsTCPDownload[i].lastIntervalJitter = 0.0;
       myFlowStatisticsTCPDownload[i].lastIntervalRxPackets = 0;
@@ -7359,6 +10326,8 @@ int main (int argc, char *argv[]) {
     myFlowStatisticsVideoDownload[i].acumRxPackets = 0;
     myFlowStatisticsVideoDownload[i].acumRxBytes = 0;
     myFlowStatisticsVideoDownload[i].acumLostPackets = 0;
+    std::fill_n (myFlowStatisticsVideoDownload[i].lastIntervalDelayPercentile, NUMBER_OF_PERCENTILES, NAN);
+    std::fill_n (myFlowStatisticsVideoDownload[i].lastIntervalJitterPercentile, NUMBER_OF_PERCENTILES, NAN);
     myFlowStatisticsVideoDownload[i].destinationPort = INITIALPORT_VIDEO_DOWNLOAD + i;
     myFlowStatisticsVideoDownload[i].finalDestinationPort = INITIALPORT_VIDEO_DOWNLOAD + i;
   }
@@ -7829,24 +10798,23 @@ int main (int argc, char *argv[]) {
                 << outputFileSurname
                 << "_positions.txt";
 
-    std::ofstream ofs;
-    ofs.open ( namePositionsFile.str(), std::ofstream::out | std::ofstream::trunc); // with "trunc" Any contents that existed in the file before it is open are discarded. with "app", all output operations happen at the end of the file, appending to its existing contents
-
-    // write the first line in the file (includes the titles of the columns)
-    ofs << "timestamp [s]\t"
-        << "STA ID\t"
-        << "destinationPort\t"
-        << "STA x [m]\t"
-        << "STA y [m]\t"
-        << "Nearest AP ID\t" 
-        << "AP x [m]\t"
-        << "AP y [m]\t"
-        << "distance STA-nearest AP [m]\t"
-        << "Associated to AP ID\t"
-        << "AP x [m]\t"
-        << "AP y [m]\t"
-        << "distance STA-my AP [m]\t"
-        << "\n";
+    // the file is kept open until the end of the simulation
+    TraceWriter* writerPositions = traceWriters.Open (namePositionsFile.str(), "positions");
+
+    // the titles of the columns
+    writerPositions->AddColumn ("timestamp [s]", 'd');
+    writerPositions->AddColumn ("STA ID", 'i');
+    writerPositions->AddColumn ("destinationPort", 'i');
+    writerPositions->AddColumn ("STA x [m]", 'd');
+    writerPositions->AddColumn ("STA y [m]", 'd');
+    writerPositions->AddColumn ("Nearest AP ID", 'i');
+    writerPositions->AddColumn ("AP x [m]", 'd');
+    writerPositions->AddColumn ("AP y [m]", 'd');
+    writerPositions->AddColumn ("distance STA-nearest AP [m]", 'd');
+    writerPositions->AddColumn ("Associated to AP ID", 'i');
+    writerPositions->AddColumn ("AP x [m]", 'd');
+    writerPositions->AddColumn ("AP y [m]", 'd');
+    writerPositions->AddColumn ("distance STA-my AP [m]", 'd');
 
     // for each STA running each application, schedule the store of statistics
     if (eachSTArunsAllTheApps == false) {
@@ -8124,19 +11092,19 @@ int main (int argc, char *argv[]) {
   //                    enableRtsCts ? StringValue ("0") : StringValue ("999999")); // if enableRtsCts is true, I select the first option
 
 
-  std::string bandPrimary = getWirelessBandOfStandard(convertVersionToStandard(version80211primary));
-  std::string bandSecondary = getWirelessBandOfStandard(convertVersionToStandard(version80211secondary));
+  wifiBand bandPrimary = getWirelessBandOfStandard(convertVersionToStandard(version80211primary));
+  wifiBand bandSecondary = getWirelessBandOfStandard(convertVersionToStandard(version80211secondary));
 
   // MinstrelHt and Ideal do support HT/VHT (i.e. 802.11n and above)
   if (rateModel == "Constant") {
-    if (bandPrimary == "2.4 GHz") {
+    if (bandPrimary == BAND_24GHZ) {
 
       // more rates here https://www.nsnam.org/doxygen/wifi-spectrum-per-example_8cc_source.html
       wifi.SetRemoteStationManager ("ns3::ConstantRateWifiManager",
                                     "DataMode", StringValue ("HtMcs7"),
                                     "ControlMode", StringValue ("HtMcs0"),
                                     "RtsCtsThreshold", UintegerValue (RtsCtsThreshold24GHz));
-      if (bandSecondary == "5 GHz") {
+      if (bandSecondary == BAND_5GHZ) {
         wifiSecondary.SetRemoteStationManager ("ns3::ConstantRateWifiManager",
                                       "DataMode", StringValue ("HtMcs7"),
                                       "ControlMode", StringValue ("HtMcs0"),
@@ -8150,7 +11118,7 @@ int main (int argc, char *argv[]) {
                                     "RtsCtsThreshold", UintegerValue (ctsThr));
     */      
     }
-    else if (bandPrimary == "5 GHz") {
+    else if (bandPrimary == BAND_5GHZ) {
 
       // more rates here https://www.nsnam.org/doxygen/wifi-spectrum-per-example_8cc_source.html
       wifi.SetRemoteStationManager ("ns3::ConstantRateWifiManager",
@@ -8158,7 +11126,7 @@ int main (int argc, char *argv[]) {
                                     "ControlMode", StringValue ("HtMcs0"),
                                     "RtsCtsThreshold", UintegerValue (RtsCtsThreshold5GHz));
 
-      if (bandSecondary == "2.4 GHz")
+      if (bandSecondary == BAND_24GHZ)
         wifiSecondary.SetRemoteStationManager ("ns3::ConstantRateWifiManager",
                                       "DataMode", StringValue ("HtMcs7"),
                                       "ControlMode", StringValue ("HtMcs0"),
@@ -8178,23 +11146,23 @@ int main (int argc, char *argv[]) {
 
   else if (rateModel == "Ideal") {
     // Ideal Wifi Manager, https://www.nsnam.org/doxygen/classns3_1_1_ideal_wifi_manager.html#details
-    if (bandPrimary == "2.4 GHz") {
+    if (bandPrimary == BAND_24GHZ) {
       wifi.SetRemoteStationManager ("ns3::IdealWifiManager",
                                     //"MaxSlrc", UintegerValue (7)  // 7 is the default value
                                     "RtsCtsThreshold", UintegerValue (RtsCtsThreshold24GHz));
 
-      if (bandSecondary == "5 GHz") {
+      if (bandSecondary == BAND_5GHZ) {
         wifiSecondary.SetRemoteStationManager ("ns3::IdealWifiManager",
                                       //"MaxSlrc", UintegerValue (7)  // 7 is the default value
                                       "RtsCtsThreshold", UintegerValue (RtsCtsThreshold5GHz));
       }
     }
-    else if (bandPrimary == "5 GHz") {
+    else if (bandPrimary == BAND_5GHZ) {
       wifi.SetRemoteStationManager ("ns3::IdealWifiManager",
                                     //"MaxSlrc", UintegerValue (7)  // 7 is the default value
                                     "RtsCtsThreshold", UintegerValue (RtsCtsThreshold5GHz));
 
-      if (bandSecondary == "2.4 GHz") {
+      if (bandSecondary == BAND_24GHZ) {
         wifiSecondary.SetRemoteStationManager ("ns3::IdealWifiManager",
                                       //"MaxSlrc", UintegerValue (7)  // 7 is the default value
                                       "RtsCtsThreshold", UintegerValue (RtsCtsThreshold24GHz));        
@@ -8216,24 +11184,24 @@ int main (int argc, char *argv[]) {
     // I obtain some errors when running Minstrel
     // https://www.nsnam.org/bugzilla/show_bug.cgi?id=1797
     // https://www.nsnam.org/doxygen/classns3_1_1_minstrel_ht_wifi_manager.html
-    if (bandPrimary == "2.4 GHz") {
+    if (bandPrimary == BAND_24GHZ) {
       wifi.SetRemoteStationManager ("ns3::MinstrelHtWifiManager",
                                     "RtsCtsThreshold", UintegerValue (RtsCtsThreshold24GHz),
                                     "PrintStats", BooleanValue (false)); // if you set this to true, you will obtain a file with the stats
 
-      if (bandSecondary == "5 GHz") {
+      if (bandSecondary == BAND_5GHZ) {
         wifiSecondary.SetRemoteStationManager ("ns3::MinstrelHtWifiManager",
                                       "RtsCtsThreshold", UintegerValue (RtsCtsThreshold5GHz),
                                       "PrintStats", BooleanValue (false)); // if you set this to true, you will obtain a file with the stats
 
       }
     }
-    else if (bandPrimary == "5 GHz") {
+    else if (bandPrimary == BAND_5GHZ) {
       wifi.SetRemoteStationManager ("ns3::MinstrelHtWifiManager",
                                     "RtsCtsThreshold", UintegerValue (RtsCtsThreshold5GHz),
                                     "PrintStats", BooleanValue (false)); // if you set this to true, you will obtain a file with the stats
 
-      if (bandSecondary == "2.4 GHz") {
+      if (bandSecondary == BAND_24GHZ) {
         wifiSecondary.SetRemoteStationManager ("ns3::MinstrelHtWifiManager",
                                       "RtsCtsThreshold", UintegerValue (RtsCtsThreshold24GHz),
                                       "PrintStats", BooleanValue (false)); // if you set this to true, you will obtain a file with the stats  
@@ -8534,13 +11502,8 @@ int main (int argc, char *argv[]) {
 
 
 
-        // auxiliar string
-        std::ostringstream auxString;
-        std::string myaddress;
-
-        // create a string with the MAC
-        auxString << apWiFiDev.Get(0)->GetAddress();
-        myaddress = auxString.str();
+        // MAC address of the AP
+        Mac48Address myaddress = Mac48Address::ConvertFrom (apWiFiDev.Get(0)->GetAddress());
 
         // update the AP record with the correct value, using the correct version of the function
         AP_vector[i + j*number_of_APs]->SetApRecord (i + j*number_of_APs, myaddress, my_maxAmpduSize);
@@ -8548,6 +11511,9 @@ int main (int argc, char *argv[]) {
         // fill the values of the vector of APs
         AP_vector[i + j*number_of_APs]->setWirelessChannel(ChannelNoForThisAP);
 
+        // add the AP to the registry (indexed by id and by MAC)
+        registry.AddAP (AP_vector[i + j*number_of_APs]);
+
 
         // print the IP and the MAC address, and the WiFi channel
         if (verboseLevel >= 1) {
@@ -8570,11 +11536,14 @@ int main (int argc, char *argv[]) {
       else if (APsActive.at(i + j*number_of_APs) == '0') {
 
         // update the AP record with the correct value, using the correct version of the function
-        AP_vector[i + j*number_of_APs]->SetApRecord (i + j*number_of_APs, "0.0.0.0", 0);
+        AP_vector[i + j*number_of_APs]->SetApRecord (i + j*number_of_APs, Mac48Address ("00:00:00:00:00:00"), 0);
 
         // fill the values of the vector of APs
         AP_vector[i + j*number_of_APs]->setWirelessChannel(0);
 
+        // add the AP to the registry (only indexed by id, as it has no MAC)
+        registry.AddAP (AP_vector[i + j*number_of_APs]);
+
         if (verboseLevel >= 1) {
           std::cout << "AP     #" << i + (j * number_of_APs)
                     << "\twill NOT be active"
@@ -8591,6 +11560,10 @@ int main (int argc, char *argv[]) {
   }
   if (VERBOSE_FOR_DEBUG >=1)
     std::cout << "Final size of 'apWiFiDevices': " << apWiFiDevices.size() << '\n';  
+
+  // the positions and the channels of the APs are now fixed, so I can build the spatial index
+  //used for finding the nearest AP and the APs covering a STA
+  apSpatialIndex.Build (apNodes, distance_between_APs);
   /*************************** end of - Define the APs ******************************/
 
 
@@ -8603,8 +11576,8 @@ int main (int argc, char *argv[]) {
   // find the frequency band(s) where a STA can find an AP
   // if it has a single card, only one band can be used
   // if it has two cards, it depends on the band(s) supported by the present AP(s)
-  std::string bandsSupportedByAPs = bandsSupportedByTheAPs(numberAPsSamePlace, version80211primary, version80211secondary);
-  std::string bandsSupportedBySTAs = bandsSupportedByTheSTAs(numberSTAsSamePlace, version80211primary, version80211secondary);
+  wifiBand bandsSupportedByAPs = bandsSupportedByTheAPs(numberAPsSamePlace, version80211primary, version80211secondary);
+  wifiBand bandsSupportedBySTAs = bandsSupportedByTheSTAs(numberSTAsSamePlace, version80211primary, version80211secondary);
 
   //std::string bandPrimary = getWirelessBandOfStandard(convertVersionToStandard(version80211primary));
   //std::string bandSecondary = getWirelessBandOfStandard(convertVersionToStandard(version80211secondary));
@@ -8745,7 +11718,7 @@ int main (int argc, char *argv[]) {
     // 802.11 version of this STA
     std::string version80211ThisSTA;
     // band of this STA
-    std::string bandThisSTA;
+    wifiBand bandThisSTA;
     // set it if the STA has to be disabled
     bool STAinNonSupportedBand = false;
 
@@ -8766,7 +11739,7 @@ int main (int argc, char *argv[]) {
     Ptr<Node> myNearestAp, myNearestAp24GHz, myNearestAp5GHz;  
     uint32_t myNearestApId;
 
-    if (bandsSupportedByAPs == "both") {
+    if (bandsSupportedByAPs == BAND_BOTH) {
       // there are APs in both bands
 
       if (VERBOSE_FOR_DEBUG >= 1)
@@ -9102,6 +12075,19 @@ int main (int argc, char *argv[]) {
     m_STArecord->SetmaxAmpduSizeWhenAggregationLimited (maxAmpduSizeWhenAggregationLimited);
     m_STArecord->SetWifiModel (wifiModel);
 
+    // store the pointers to the node of the STA and to the node of its peer STA,
+    //so they do not have to be searched in the NodeList each time
+    if (m_STArecord->GetpeerStaid () != 0) {
+      if ( i < number_of_STAs )
+        m_STArecord->SetNodePointers (staNodes.Get(i), staNodes.Get(i + number_of_STAs));
+      else
+        m_STArecord->SetNodePointers (staNodes.Get(i), staNodes.Get(i - number_of_STAs));
+    }
+    else {
+      m_STArecord->SetNodePointers (staNodes.Get(i), 0);
+    }
+    m_STArecord->SetAPNodes (apNodes);
+
     // Set a callback function to be called each time a STA gets associated to an AP
     std::ostringstream STA;
 
@@ -9128,6 +12114,9 @@ int main (int argc, char *argv[]) {
     // Add the new record to the vector of STA associations
     sta_vector.push_back (m_STArecord);
 
+    // and to the registry, indexed by the id of the STA
+    registry.AddSTA (m_STArecord, m_STArecord->GetStaid ());
+
     // once filled, print all the member variables
     if (VERBOSE_FOR_DEBUG >= 1)
       m_STArecord->PrintAllVariables ();
@@ -9845,7 +12834,7 @@ int main (int argc, char *argv[]) {
     Config::SetDefault ("ns3::TcpWestwood::FilterType", EnumValue (TcpWestwood::TUSTIN));
   } else {
     std::cout << "INPUT PARAMETER ERROR: Bad TCP variant. Supported: TcpNewReno, TcpHighSpeed, TcpWestwoodPlus. Stopping the simulation." << '\n';
-    return 0;  
+    return 1;
   }
 
   // Activate the log of BulkSend application
@@ -10547,75 +13536,30 @@ int main (int argc, char *argv[]) {
   }
 
 
+  // parameters of the function adjustAMPDU. They are declared here because the variants of a warm start modify them
+  adjustAmpduParameters myparam;
+
   // If the delay monitor is on, periodically calculate the statistics
   if (timeMonitorKPIs > 0.0) {
-    // Schedule a periodic task to obtain the statistics of each kind of flow
-    if (numberVoIPupload > 0)    
-      Simulator::Schedule(  Seconds(INITIALTIMEINTERVAL),
-                            &obtainKPIs,
-                            monitor
-                            /*, flowmon*/, // FIXME Avoid the use of a global variable 'flowmon'
-                            myFlowStatisticsVoIPUpload,
-                            1,
-                            verboseLevel,
-                            timeMonitorKPIs);
-
-    if (numberVoIPdownload > 0)   
-      Simulator::Schedule(  Seconds(INITIALTIMEINTERVAL),
-                            &obtainKPIs,
-                            monitor
-                            /*, flowmon*/, // FIXME Avoid the use of a global variable 'flowmon'
-                            myFlowStatisticsVoIPDownload,
-                            2,
-                            verboseLevel,
-                            timeMonitorKPIs);
-
-    if (numberTCPupload > 0)
-      // Schedule a periodic obtaining of statistics    
-      Simulator::Schedule(  Seconds(INITIALTIMEINTERVAL),
-                            &obtainKPIs,
-                            monitor
-                            /*, flowmon*/, // FIXME Avoid the use of a global variable 'flowmon'
-                            myFlowStatisticsTCPUpload,
-                            3,
-                            verboseLevel,
-                            timeMonitorKPIs);
-
-    if (numberTCPdownload > 0) {
-      // Schedule a periodic obtaining of statistics  
-      if (TcpDownMultiConnection == 0) {
-        Simulator::Schedule(  Seconds(INITIALTIMEINTERVAL),
-                              &obtainKPIs,
-                              monitor
-                              /*, flowmon*/, // FIXME Avoid the use of a global variable 'flowmon'
-                              myFlowStatisticsTCPDownload,
-                              5,
-                              verboseLevel,
-                              timeMonitorKPIs);
-      }
-      else {
-        Simulator::Schedule(  Seconds(INITIALTIMEINTERVAL),
-                              &obtainKPIsMultiTCP,
-                              monitor
-                              /*, flowmon*/, // FIXME Avoid the use of a global variable 'flowmon'
-                              myFlowStatisticsTCPDownload,
-                              number_of_STAs * numberSTAsSamePlace,
-                              TcpDownMultiConnection,
-                              verboseLevel,
-                              timeMonitorKPIs);
+    // the flows will be classified the first time they are seen
+    flowRegistry.Init (staNodes, myAllTheFlowStatistics, TcpDownMultiConnection);
+
+    // the losses of the VoIP and video flows are counted with the sequence numbers received by their UdpServer
+    intervalLossEstimator.Init (myAllTheFlowStatistics);
+    latencyQuantiles.Init (myAllTheFlowStatistics);
+    for (NodeList::Iterator node = NodeList::Begin (); node != NodeList::End (); ++node)
+      for (uint32_t app = 0; app < (*node)->GetNApplications (); app++) {
+        Ptr<UdpServer> server = DynamicCast<UdpServer> ((*node)->GetApplication (app));
+        if (server == 0)
+          continue;
+        // the delay and the jitter of each packet are also added to the sketches of the percentiles
+        latencyQuantiles.Track (server);
+        if (intervalLossEstimator.Track (server) && (verboseLevel > 1))
+          std::cout << "Counting the losses of the UDP server in node #" << (*node)->GetId () << '\n';
       }
-    }
 
-    if (numberVideoDownload > 0)
-      // Schedule a periodic obtaining of statistics    
-      Simulator::Schedule(  Seconds(INITIALTIMEINTERVAL),
-                            &obtainKPIs,
-                            monitor
-                            /*, flowmon*/, // FIXME Avoid the use of a global variable 'flowmon'
-                            myFlowStatisticsVideoDownload,
-                            6,
-                            verboseLevel,
-                            timeMonitorKPIs);
+    // a single periodic task obtains the statistics of all the kinds of flow, and then calls the consumers
+    kpiScheduler.Init (monitor, myAllTheFlowStatistics, TcpDownMultiConnection, verboseLevel, timeMonitorKPIs);
 
     // Write the values of the network KPIs (delay, etc.) to a file
     // create a string with the name of the output file
@@ -10626,28 +13570,44 @@ int main (int argc, char *argv[]) {
                 << outputFileSurname
                 << "_KPIs.txt";
 
-    std::ofstream ofs;
-    ofs.open ( nameKPIFile.str(), std::ofstream::out | std::ofstream::trunc); // with "trunc" Any contents that existed in the file before it is open are discarded. with "app", all output operations happen at the end of the file, appending to its existing contents
-
-    // write the first line in the file (includes the titles of the columns)
-    ofs << "timestamp [s]" << "\t"
-        << "flow ID" << "\t"
-        << "application" << "\t"
-        << "initial destinationPort" << "\t"
-        << "final destinationPort" << "\t"
-        << "delay [s]" << "\t"
-        << "jitter [s]" << "\t" 
-        << "numRxPackets" << "\t"
-        << "numlostPackets" << "\t"
-        << "throughput [bps]" << "\n";
-
-    // schedule this after the first time when statistics have been obtained
-    Simulator::Schedule(  Seconds(INITIALTIMEINTERVAL + timeMonitorKPIs + 0.0001),
-                          &saveKPIs,
-                          nameKPIFile.str(),
-                          myAllTheFlowStatistics,
-                          verboseLevel,
-                          timeMonitorKPIs);
+    // the file is kept open until the end of the simulation
+    TraceWriter* writerKPIs = traceWriters.Open (nameKPIFile.str(), "KPIs");
+
+    // the titles of the columns
+    writerKPIs->AddColumn ("timestamp [s]", 'd');
+    writerKPIs->AddColumn ("flow ID", 'i');
+    writerKPIs->AddColumn ("application", 's');
+    writerKPIs->AddColumn ("initial destinationPort", 'i');
+    writerKPIs->AddColumn ("final destinationPort", 'i');
+    writerKPIs->AddColumn ("delay [s]", 'd');
+    writerKPIs->AddColumn ("jitter [s]", 'd');
+    writerKPIs->AddColumn ("numRxPackets", 'i');
+    writerKPIs->AddColumn ("numlostPackets", 'i');
+    writerKPIs->AddColumn ("throughput [bps]", 'd');
+    for (uint32_t p = 0; p < NUMBER_OF_PERCENTILES; p++)
+      writerKPIs->AddColumn ("p" + std::to_string (int (reportedPercentiles[p])) + " delay [s]", 'd');
+    for (uint32_t p = 0; p < NUMBER_OF_PERCENTILES; p++)
+      writerKPIs->AddColumn ("p" + std::to_string (int (reportedPercentiles[p])) + " jitter [s]", 'd');
+
+    // percentiles of the delay and the jitter of the VoIP and video STAs of each AP
+    std::ostringstream nameLatencyAPFile;
+    nameLatencyAPFile << outputFileName
+                      << "_"
+                      << outputFileSurname
+                      << "_latencyAPs.txt";
+
+    TraceWriter* writerLatencyAP = traceWriters.Open (nameLatencyAPFile.str(), "latencyAPs");
+    writerLatencyAP->AddColumn ("timestamp [s]", 'd');
+    writerLatencyAP->AddColumn ("AP ID", 'i');
+    writerLatencyAP->AddColumn ("numRxPackets", 'i');
+    for (uint32_t p = 0; p < NUMBER_OF_PERCENTILES; p++)
+      writerLatencyAP->AddColumn ("p" + std::to_string (int (reportedPercentiles[p])) + " delay [s]", 'd');
+    for (uint32_t p = 0; p < NUMBER_OF_PERCENTILES; p++)
+      writerLatencyAP->AddColumn ("p" + std::to_string (int (reportedPercentiles[p])) + " jitter [s]", 'd');
+
+    // the consumers are called in this order: KPI files, AMPDU adjustment, load of the APs
+    kpiScheduler.AddConsumer ("saveKPIs", std::bind (&saveKPIs, nameKPIFile.str(), myAllTheFlowStatistics, verboseLevel, timeMonitorKPIs));
+    kpiScheduler.AddConsumer ("saveLatencyPercentilesAP", std::bind (&saveLatencyPercentilesAP, nameLatencyAPFile.str(), verboseLevel));
 
     // Algorithm for dynamically adjusting aggregation
     if (aggregationDynamicAlgorithm ==1) {
@@ -10660,18 +13620,17 @@ int main (int argc, char *argv[]) {
                     << outputFileSurname
                     << "_AMPDUvalues.txt";
 
-      std::ofstream ofsAMPDU;
-      ofsAMPDU.open ( nameAMPDUFile.str(), std::ofstream::out | std::ofstream::trunc); // with "trunc" Any contents that existed in the file before it is open are discarded. with "app", all output operations happen at the end of the file, appending to its existing contents
+      // the file is kept open until the end of the simulation
+      TraceWriter* writerAMPDU = traceWriters.Open (nameAMPDUFile.str(), "AMPDUvalues");
 
-      // write the first line in the file (includes the titles of the columns)
-      ofsAMPDU  << "timestamp" << "\t"
-                << "ID" << "\t"
-                << "type" << "\t"
-                << "associated to AP\t"
-                << "AMPDU set to [bytes]" << "\n";
+      // the titles of the columns
+      writerAMPDU->AddColumn ("timestamp", 'd');
+      writerAMPDU->AddColumn ("ID", 'i');
+      writerAMPDU->AddColumn ("type", 's');
+      writerAMPDU->AddColumn ("associated to AP", 's');
+      writerAMPDU->AddColumn ("AMPDU set to [bytes]", 'i');
 
       // prepare the parameters to call the function adjustAMPDU
-      adjustAmpduParameters myparam;
       myparam.verboseLevel = verboseLevel;
       myparam.timeInterval = timeMonitorKPIs;
       myparam.latencyBudget = latencyBudget;
@@ -10681,16 +13640,23 @@ int main (int argc, char *argv[]) {
       myparam.stepAdjustAmpdu = stepAdjustAmpdu;
       myparam.eachSTArunsAllTheApps = eachSTArunsAllTheApps;
       myparam.APsActive = APsActive;
+      myparam.latencyPercentile = latencyPercentileAmpdu;
 
       // Modify the AMPDU of the APs where there are VoIP flows
-      Simulator::Schedule(  Seconds(INITIALTIMEINTERVAL + timeMonitorKPIs + 0.0002),
-                            &adjustAMPDU,
-                            myAllTheFlowStatistics,
-                            myparam,
-                            belowLatencyAmpduValue,
-                            aboveLatencyAmpduValue,
-                            number_of_APs * numberAPsSamePlace);
+      kpiScheduler.AddConsumer ("adjustAMPDU", std::bind (&adjustAMPDU,
+                                                          myAllTheFlowStatistics,
+                                                          myparam,
+                                                          belowLatencyAmpduValue,
+                                                          aboveLatencyAmpduValue,
+                                                          number_of_APs * numberAPsSamePlace));
     }
+
+    // measure the load of the APs for the load-aware load balancing
+    if (algorithm_load_balancing && loadAwareLoadBalancing)
+      kpiScheduler.AddConsumer ("measureAPload", std::bind (&measureAPload, latencyBudget, timeMonitorKPIs, verboseLevel));
+
+    // the first statistics are obtained at INITIALTIMEINTERVAL, and the consumers are called from the next interval on
+    kpiScheduler.Start (INITIALTIMEINTERVAL);
   }
 
 
@@ -10739,7 +13705,26 @@ int main (int argc, char *argv[]) {
   }
 
   if (printSeconds > 0) {
-    Simulator::Schedule(Seconds(0.0), &printTime, printSeconds, outputFileName, outputFileSurname);
+    // the progress can also be written to a file, to find the slow configurations of a sweep
+    std::ostringstream nameProgressFile;
+    if (saveProgress) {
+      nameProgressFile << outputFileName
+                       << "_"
+                       << outputFileSurname
+                       << "_progress.txt";
+
+      TraceWriter* writerProgress = traceWriters.Open (nameProgressFile.str(), "progress");
+      writerProgress->AddColumn ("simulation time [s]", 'd');
+      writerProgress->AddColumn ("wall time [s]", 'd');
+      writerProgress->AddColumn ("events", 'i');
+      writerProgress->AddColumn ("events per wall second", 'd');
+      writerProgress->AddColumn ("simulated seconds per wall second", 'd');
+      writerProgress->AddColumn ("peak RSS of the process [kB]", 'i');
+      writerProgress->AddColumn ("ETA [s]", 'd');
+    }
+
+    progressMonitor.Init (outputFileName + "_" + outputFileSurname, simulationTime + INITIALTIMEINTERVAL, nameProgressFile.str());
+    Simulator::Schedule(Seconds(0.0), &printTime, printSeconds);
   }
 
   // Start ARP trial (Failure so far)
@@ -10859,6 +13844,13 @@ int main (int argc, char *argv[]) {
   coverage.coverage_5GHz = coverage_5GHz;
   // run the load balancing algorithm
   if(algorithm_load_balancing==true) {
+    loadBalancerState.SetMultiSwap (multiSwapLoadBalancing, maxChannelSwitchesLoadBalancing);
+    loadBalancerState.SetLoadAware (loadAwareLoadBalancing);
+    apLoadMonitor.SetSaturationThroughput (saturationThroughputLoadBalancing * 1000000.0);
+
+    // calculate the coverage of each STA pair, and schedule the next change
+    coverageTracker.Init (apNodes, staNodes, coverage, verboseLevel);
+
     Simulator::Schedule(Seconds(periodLoadBalancing),
                         &algorithmLoadBalancing,
                         periodLoadBalancing,
@@ -10871,14 +13863,120 @@ int main (int argc, char *argv[]) {
                         verboseLevel);
   }
 
+  // with a shorter initial interval, the STAs may not have time to associate
+  if ((verboseLevel > 0) || (initialTimeInterval < INITIALTIMEINTERVALDEFAULT))
+    Simulator::Schedule (Seconds (0.0), &checkAssociationsBeforeStart, WARMSTART_CHECK_PERIOD, verboseLevel);
+
   if (verboseLevel > 0) {
     NS_LOG_INFO ("Run Simulation");
     NS_LOG_INFO ("");
   }
 
-  Simulator::Stop (Seconds (simulationTime + INITIALTIMEINTERVAL));
+  // wall-clock time of the simulation, for comparing it with the time of the controller
+  std::chrono::steady_clock::time_point runStart = std::chrono::steady_clock::now ();
+
+  // warm start: simulate the common part once, and then fork a child per variant of the controller
+  bool isWarmStartVariant = false;
+  if (!warmStartVariantList.empty ()) {
+    // the common part finishes before the first call to the controller, so the variants do not differ from a complete run
+    double endOfCommonPart = INITIALTIMEINTERVAL + timeMonitorKPIs;
+    while (!allActiveSTAsAssociated () && (Simulator::Now ().GetSeconds () + WARMSTART_CHECK_PERIOD < endOfCommonPart)) {
+      Simulator::Stop (Seconds (WARMSTART_CHECK_PERIOD));
+      Simulator::Run ();
+    }
+
+    if (verboseLevel > 0)
+      std::cout << Simulator::Now ().GetSeconds()
+                << "\t[warmStart] End of the common part. All the active STAs associated?: " << allActiveSTAsAssociated ()
+                << ". Starting " << warmStartVariantList.size () << " variants\n";
+
+    // the children must not write again what is in the buffers of the parent
+    traceWriters.SyncAll ();
+    std::cout.flush ();
+    fflush (stdout);
+
+    // each variant uses a core: if there are more variants than cores, the next one starts when one finishes
+    long maxRunningVariants = (warmStartJobs > 0) ? warmStartJobs : sysconf (_SC_NPROCESSORS_ONLN);
+    if (maxRunningVariants < 1)
+      maxRunningVariants = 1;
+    long runningVariants = 0;
+    bool variantFailed = false;
+    for (uint32_t i = 0; i < warmStartVariantList.size (); i++) {
+      if (runningVariants == maxRunningVariants) {
+        if (!waitWarmStartVariant ())
+          variantFailed = true;
+        runningVariants--;
+      }
+
+      pid_t pid = fork ();
+      if (pid < 0) {
+        std::cout << "ERROR: the variant " << warmStartVariantList[i].outputFileSurname << " cannot be started\n";
+        variantFailed = true;
+        break;
+      }
+      if (pid > 0) {
+        runningVariants++;
+        continue;
+      }
+
+      // this is the child: the files go on with its surname, and the controller with its parameters
+      isWarmStartVariant = true;
+      std::string oldPrefix = outputFileName + "_" + outputFileSurname + "_";
+      outputFileSurname = warmStartVariantList[i].outputFileSurname;
+      latencyBudget = warmStartVariantList[i].latencyBudget;
+      methodAdjustAmpdu = warmStartVariantList[i].methodAdjustAmpdu;
+      stepAdjustAmpdu = warmStartVariantList[i].stepAdjustAmpdu;
+      latencyPercentileAmpdu = warmStartVariantList[i].latencyPercentileAmpdu;
+      // without its files, the variant is useless: the parent finds the exit status and reports it as failed
+      if (!traceWriters.MoveAll (oldPrefix, outputFileName + "_" + outputFileSurname + "_")) {
+        std::cout << "ERROR: the output files of the variant " << outputFileSurname << " cannot be written\n";
+        std::cout.flush ();
+        exit (1);
+      }
+      progressMonitor.SetRunName (outputFileName + "_" + outputFileSurname);
+
+      if (aggregationDynamicAlgorithm == 1) {
+        myparam.latencyBudget = latencyBudget;
+        myparam.methodAdjustAmpdu = methodAdjustAmpdu;
+        myparam.stepAdjustAmpdu = stepAdjustAmpdu;
+        myparam.latencyPercentile = latencyPercentileAmpdu;
+        kpiScheduler.ReplaceConsumer ("adjustAMPDU", std::bind (&adjustAMPDU,
+                                                                myAllTheFlowStatistics,
+                                                                myparam,
+                                                                belowLatencyAmpduValue,
+                                                                aboveLatencyAmpduValue,
+                                                                number_of_APs * numberAPsSamePlace));
+      }
+      if (algorithm_load_balancing && loadAwareLoadBalancing)
+        kpiScheduler.ReplaceConsumer ("measureAPload", std::bind (&measureAPload, latencyBudget, timeMonitorKPIs, verboseLevel));
+
+      if (verboseLevel > 0)
+        std::cout << Simulator::Now ().GetSeconds()
+                  << "\t[warmStart] Variant " << outputFileSurname
+                  << " (process " << getpid () << "). latencyBudget: " << latencyBudget
+                  << ", methodAdjustAmpdu: " << methodAdjustAmpdu
+                  << ", stepAdjustAmpdu: " << stepAdjustAmpdu
+                  << ", latencyPercentileAmpdu: " << latencyPercentileAmpdu << '\n';
+      break;
+    }
+
+    // the parent waits for the variants. Its files only have the common part, so they are removed
+    if (!isWarmStartVariant) {
+      for (; runningVariants > 0; runningVariants--)
+        if (!waitWarmStartVariant ())
+          variantFailed = true;
+      traceWriters.RemoveAll ();
+      Simulator::Destroy ();
+      return variantFailed ? 1 : 0;
+    }
+  }
+
+  // with a warm start, the simulation goes on from the end of the common part
+  Simulator::Stop (Seconds (simulationTime + INITIALTIMEINTERVAL) - Simulator::Now ());
   Simulator::Run ();
 
+  if (callbackProfiler.IsEnabled ())
+    callbackProfiler.Print (std::chrono::duration<double> (std::chrono::steady_clock::now () - runStart).count ());
 
   //std::cout << "HELLO1 \n";
   //std::cout << "HELLO2. verboseLevel: " << verboseLevel << "\n";
@@ -10931,6 +14029,48 @@ int main (int argc, char *argv[]) {
 
   double total_video_download_throughput = 0.0; // average throughput of all the download video flows
 
+  // with the result store, the statistics of the flows and the histograms are written as tables of the store
+  TraceWriter* writerFlows = NULL;
+  TraceWriter* writerHistograms = NULL;
+  if (traceWriters.IsResultStore ()) {
+    // the parameters of the run, used by the reader to build the line of _average.txt
+    TraceWriter* writerRun = traceWriters.Open ("run", "run");
+    writerRun->AddColumn ("outputFileName", 's');
+    writerRun->AddColumn ("outputFileSurname", 's');
+    writerRun->AddColumn ("Simulation_time_[s]", 'd');
+    writerRun->AddString (outputFileName);
+    writerRun->AddString (outputFileSurname);
+    writerRun->AddDouble (simulationTime);
+    writerRun->EndRow ();
+
+    writerFlows = traceWriters.Open ("flows", "flows");
+    writerFlows->AddColumn ("Flow_ID", 'i');
+    writerFlows->AddColumn ("Protocol", 's');
+    writerFlows->AddColumn ("source_Address", 's');
+    writerFlows->AddColumn ("source_Port", 'i');
+    writerFlows->AddColumn ("destination_Address", 's');
+    writerFlows->AddColumn ("destination_Port", 'i');
+    writerFlows->AddColumn ("Application", 's');
+    writerFlows->AddColumn ("Num_Tx_Packets", 'i');
+    writerFlows->AddColumn ("Num_Tx_Bytes", 'i');
+    writerFlows->AddColumn ("Num_Rx_Packets", 'i');
+    writerFlows->AddColumn ("Num_RX_Bytes", 'i');
+    writerFlows->AddColumn ("Num_lost_packets", 'i');
+    writerFlows->AddColumn ("Delay_sum_[s]", 'd');
+    writerFlows->AddColumn ("Jitter_sum_[s]", 'd');
+    writerFlows->AddColumn ("Times_forwarded", 'i');
+    writerFlows->AddColumn ("Simulation_time_[s]", 'd');
+
+    if (generateHistograms) {
+      writerHistograms = traceWriters.Open ("histograms", "histograms");
+      writerHistograms->AddColumn ("Flow_ID", 'i');
+      writerHistograms->AddColumn ("histogram", 's');
+      writerHistograms->AddColumn ("number", 'i');
+      writerHistograms->AddColumn ("init_interval", 'd');
+      writerHistograms->AddColumn ("end_interval", 'd');
+      writerHistograms->AddColumn ("number_of_samples", 'i');
+    }
+  }
 
 
   // for each flow
@@ -10977,39 +14117,49 @@ int main (int argc, char *argv[]) {
             << t.destinationAddress << "\t"
             << t.destinationPort;
 
+    // the application of the flow. It is empty for the flows of the TCP ACKs
+    std::string application = "";
+
     // UDP upload flows
     if (  (t.destinationPort >= INITIALPORT_VOIP_UPLOAD ) && 
           (t.destinationPort <  INITIALPORT_VOIP_UPLOAD + numberVoIPuploadConnections )) {
-      flowID << "\t VoIP upload";
+      application = "VoIP upload";
     // UDP download flows
     } else if ( (t.destinationPort >= INITIALPORT_VOIP_DOWNLOAD ) && 
                 (t.destinationPort <  INITIALPORT_VOIP_DOWNLOAD + numberVoIPdownloadConnections )) { 
-      flowID << "\t VoIP download";
+      application = "VoIP download";
     // TCP upload flows
     } else if ( (t.destinationPort >= INITIALPORT_TCP_UPLOAD ) && 
                 (t.destinationPort <  INITIALPORT_TCP_UPLOAD + numberTCPuploadConnections )) { 
-      flowID << "\t TCP upload";
+      application = "TCP upload";
     // TCP download flows
     } else if ( (t.destinationPort >= INITIALPORT_TCP_DOWNLOAD ) && 
                 (t.destinationPort <  INITIALPORT_TCP_DOWNLOAD + 2000 + numberTCPdownloadConnections )) {
       // I add '2000' because TCP multi download starts with ports 51000 and 52000
-      flowID << "\t TCP download";
+      application = "TCP download";
     } else if ( (t.destinationPort >= INITIALPORT_VIDEO_DOWNLOAD ) && 
                 (t.destinationPort <  INITIALPORT_VIDEO_DOWNLOAD + numberVideoDownloadConnections )) { 
-      flowID << "\t Video download";
+      application = "Video download";
     } 
 
+    if (application != "")
+      flowID << "\t " << application;
+
 
     // Print the statistics of this flow to an output file and to the screen
+    // With the result store, the output file is not written: the flow is added to the table of the store
     print_stats ( flow->second, 
                   simulationTime, 
                   generateHistograms, 
-                  nameFlowFile.str(), 
+                  (writerFlows == NULL) ? nameFlowFile.str() : "", 
                   surnameFlowFile.str(), 
                   verboseLevel, 
                   flowID.str(), 
                   this_is_the_first_flow );
 
+    if (writerFlows != NULL)
+      storeFlowStats (writerFlows, writerHistograms, flow->first, t, proto, application, flow->second, simulationTime);
+
     // the first time, print_stats will print a line with the title of each column
     // put the flag to 0
     if ( this_is_the_first_flow == 1 )
@@ -11061,6 +14211,10 @@ int main (int argc, char *argv[]) {
     } 
   }
 
+  // write the rows that are still in memory (the periodic files, and the tables of the result store). If a file
+  //is lost, the run is reported as failed
+  bool outputFilesWritten = traceWriters.CloseAll ();
+
   if (verboseLevel > 0) {
     std::cout << "\n" 
               << "The next figures are averaged per packet, not per flow:" << std::endl;
@@ -11117,70 +14271,81 @@ int main (int argc, char *argv[]) {
   }
 
   // save the average values to a file 
-  std::ofstream ofs;
-  ofs.open ( outputFileName + "_average.txt", std::ofstream::out | std::ofstream::app); // with "app", all output operations happen at the end of the file, appending to its existing contents
-  ofs << outputFileSurname << "\t"
-      << "Number VoIP upload flows" << "\t"
-      << number_of_UDP_upload_flows << "\t";
+  // the line is built first, and then written at once
+  std::ostringstream averageLine;
+  averageLine << outputFileSurname << "\t"
+              << "Number VoIP upload flows" << "\t"
+              << number_of_UDP_upload_flows << "\t";
   if ( total_VoIP_upload_rx_packets > 0 ) {
-    ofs << "Average VoIP upload latency [s]" << "\t"
-        << total_VoIP_upload_latency / total_VoIP_upload_rx_packets << "\t"
-        << "Average VoIP upload jitter [s]" << "\t"
-        << total_VoIP_upload_jitter / total_VoIP_upload_rx_packets << "\t";
+    averageLine << "Average VoIP upload latency [s]" << "\t"
+                << total_VoIP_upload_latency / total_VoIP_upload_rx_packets << "\t"
+                << "Average VoIP upload jitter [s]" << "\t"
+                << total_VoIP_upload_jitter / total_VoIP_upload_rx_packets << "\t";
   } else {
-    ofs << "Average VoIP upload latency [s]" << "\t"
-        << "\t"
-        << "Average VoIP upload jitter [s]" << "\t"
-        << "\t";
+    averageLine << "Average VoIP upload latency [s]" << "\t"
+                << "\t"
+                << "Average VoIP upload jitter [s]" << "\t"
+                << "\t";
   }
   if ( total_VoIP_upload_tx_packets > 0 ) {
-    ofs << "Average VoIP upload loss rate" << "\t"
-        << 1.0 - ( double(total_VoIP_upload_rx_packets) / double(total_VoIP_upload_tx_packets) ) << "\t";
+    averageLine << "Average VoIP upload loss rate" << "\t"
+                << 1.0 - ( double(total_VoIP_upload_rx_packets) / double(total_VoIP_upload_tx_packets) ) << "\t";
   } else {
-    ofs << "Average VoIP upload loss rate" << "\t"
-        << "\t";
+    averageLine << "Average VoIP upload loss rate" << "\t"
+                << "\t";
   }
 
-  ofs << "Number VoIP download flows" << "\t"
-      << number_of_UDP_download_flows << "\t";
+  averageLine << "Number VoIP download flows" << "\t"
+              << number_of_UDP_download_flows << "\t";
   if ( total_VoIP_download_rx_packets > 0 ) {
-    ofs << "Average VoIP download latency [s]" << "\t"
-        << total_VoIP_download_latency / total_VoIP_download_rx_packets << "\t"
-        << "Average VoIP download jitter [s]" << "\t"
-        << total_VoIP_download_jitter / total_VoIP_download_rx_packets << "\t";
+    averageLine << "Average VoIP download latency [s]" << "\t"
+                << total_VoIP_download_latency / total_VoIP_download_rx_packets << "\t"
+                << "Average VoIP download jitter [s]" << "\t"
+                << total_VoIP_download_jitter / total_VoIP_download_rx_packets << "\t";
   } else {
-    ofs << "Average VoIP download latency [s]" << "\t"
-        << "\t"
-        << "Average VoIP download jitter [s]" << "\t"
-        << "\t";
+    averageLine << "Average VoIP download latency [s]" << "\t"
+                << "\t"
+                << "Average VoIP download jitter [s]" << "\t"
+                << "\t";
   }
   if ( total_VoIP_download_tx_packets > 0 ) {
-    ofs << "Average VoIP download loss rate" << "\t"
-        << 1.0 - ( double(total_VoIP_download_rx_packets) / double(total_VoIP_download_tx_packets) ) << "\t";
+    averageLine << "Average VoIP download loss rate" << "\t"
+                << 1.0 - ( double(total_VoIP_download_rx_packets) / double(total_VoIP_download_tx_packets) ) << "\t";
   } else {
-    ofs << "Average VoIP download loss rate" << "\t"
-        << "\t";
+    averageLine << "Average VoIP download loss rate" << "\t"
+                << "\t";
   }
 
-  ofs << "Number TCP upload flows" << "\t"
-      << number_of_TCP_upload_flows << "\t"
-      << "Total TCP upload throughput [bps]" << "\t"
-      << total_TCP_upload_throughput << "\t"
+  averageLine << "Number TCP upload flows" << "\t"
+              << number_of_TCP_upload_flows << "\t"
+              << "Total TCP upload throughput [bps]" << "\t"
+              << total_TCP_upload_throughput << "\t"
 
-      << "Number TCP download flows" << "\t"
-      << number_of_TCP_download_flows << "\t"
-      << "Total TCP download throughput [bps]" << "\t"
-      << total_TCP_download_throughput << "\t";
+              << "Number TCP download flows" << "\t"
+              << number_of_TCP_download_flows << "\t"
+              << "Total TCP download throughput [bps]" << "\t"
+              << total_TCP_download_throughput << "\t";
 
-  ofs << "Number video download flows" << "\t"
-      << number_of_video_download_flows << "\t"
-      << "Total video download throughput [bps]" << "\t"
-      << total_video_download_throughput << "\t";
+  averageLine << "Number video download flows" << "\t"
+              << number_of_video_download_flows << "\t"
+              << "Total video download throughput [bps]" << "\t"
+              << total_video_download_throughput << "\t";
 
-  ofs << "Duration of the simulation [s]" << "\t"
-      << simulationTime << "\n";
+  averageLine << "Duration of the simulation [s]" << "\t"
+              << simulationTime << "\n";
 
-  ofs.close();
+  if (averageShardDirectory == "") {
+    std::ofstream ofs;
+    ofs.open ( outputFileName + "_average.txt", std::ofstream::out | std::ofstream::app); // with "app", all output operations happen at the end of the file, appending to its existing contents
+    ofs << averageLine.str();
+    ofs.close();
+  } else if (outputFilesWritten) {
+    // a file for this run. The runs with the same name can be executed in parallel, and merged later. It is
+    //only written if the run has finished correctly, so the sweep runner knows which runs of a batch failed
+    SystemPath::MakeDirectories (averageShardDirectory);
+    if (!writeFileAtomically (averageShardDirectory + "/" + outputFileName + "_" + outputFileSurname + "_average.txt", averageLine.str()))
+      outputFilesWritten = false;
+  }
 
 
   // Cleanup
@@ -11191,5 +14356,80 @@ int main (int argc, char *argv[]) {
   if (verboseLevel > 0)
     NS_LOG_INFO ("Done");
 
+  // a variant of a warm start is a child process: it must not go on with the replications of its parent
+  if (isWarmStartVariant) {
+    std::cout.flush ();
+    exit (outputFilesWritten ? 0 : 1);
+  }
+
+  return outputFilesWritten ? 0 : 1;
+}
+
+
+/*****************************/
+/************ main ***********/
+/*****************************/
+int main (int argc, char *argv[]) {
+
+  std::string replicationsFile = "";
+  std::vector<std::string> commonArguments;   // the parameters of the command line, used in all the replications
+  for (int i = 1; i < argc; i++) {
+    if (std::string (argv[i]).compare (0, 15, "--replications=") == 0)
+      replicationsFile = std::string (argv[i]).substr (15);
+    else
+      commonArguments.push_back (argv[i]);
+  }
+
+  // a single replication
+  if (replicationsFile == "")
+    return runReplication (argc, argv);
+
+  std::ifstream ifs (replicationsFile);
+  if (!ifs.is_open ()) {
+    std::cout << "INPUT PARAMETER ERROR: The file of replications " << replicationsFile << " cannot be opened. Stopping the simulation." << '\n';
+    return 1;
+  }
+
+  ReplicationContext context;
+  uint32_t replicationNumber = 0;
+  uint32_t failedReplications = 0;
+  std::string line;
+  while (std::getline (ifs, line)) {
+    if (line.find ('#') != std::string::npos)
+      line = line.substr (0, line.find ('#'));
+
+    // the parameters of this replication go after the common ones, so they have priority
+    std::vector<std::string> arguments;
+    arguments.push_back (argv[0]);
+    arguments.insert (arguments.end (), commonArguments.begin (), commonArguments.end ());
+    std::istringstream words (line);
+    std::string word;
+    uint32_t numberOfWords = 0;
+    while (words >> word) {
+      arguments.push_back (word);
+      numberOfWords++;
+    }
+    if (numberOfWords == 0)
+      continue;
+
+    std::vector<char*> argumentPointers;
+    for (uint32_t i = 0; i < arguments.size (); i++)
+      argumentPointers.push_back (&arguments[i][0]);
+
+    std::cout << "Replication #" << replicationNumber << ":" << line << '\n';
+    context.Begin (replicationNumber);
+    if (runReplication (argumentPointers.size (), &argumentPointers[0]) != 0) {
+      std::cout << "ERROR: the replication #" << replicationNumber << " has failed\n";
+      failedReplications++;
+    }
+    context.End ();
+    replicationNumber++;
+  }
+
+  // the sweep runner reports the batch as failed
+  if (failedReplications > 0) {
+    std::cout << failedReplications << " of " << replicationNumber << " replications have failed\n";
+    return 1;
+  }
   return 0;
 }
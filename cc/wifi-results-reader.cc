@@ -0,0 +1,642 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * Copyright (c) 2017 Jose Saldana, University of Zaragoza (jsaldana@unizar.es)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation;
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * Reader of the binary files written by wifi-central-controlled-aggregation_v261.cc
+ * (--resultStore=1 or --binaryOutputFiles=1). It does not need ns-3:
+ *
+ *   g++ -O2 -std=c++11 -o wifi-results-reader wifi-results-reader.cc
+ *
+ * Usage:
+ *   ./wifi-results-reader [--average=file] [--dump=table] run1_results.bin run2_results.bin ...
+ *
+ * - By default, for each run it prints the same line that the simulation appends to name_average.txt.
+ *   It is obtained from the tables "run" and "flows" of the result store
+ * - The files ending in .txt are the lines written by each run with --averageShardDirectory. They are
+ *   copied as they are, so the shards of a sweep run in parallel can be merged:
+ *     ./wifi-results-reader --average=name_average.txt shards/name_*_average.txt
+ * - With --average=file, the lines are appended to that file instead of being printed
+ * - With --dump=table, the table is printed as text (tab separated, with the names of the columns in the
+ *   first line), as in the .txt files
+ *
+ * The files are mapped in memory, so only the columns that are used are read from the disk.
+ * The format is described in the class TraceWriter of the simulation file
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <limits>
+#include <algorithm>
+
+#define RESULTS_BINARY_MAGIC "WCCB"
+#define RESULTS_BINARY_VERSION 2
+
+
+// a column of a table. Its values are in a number of chunks of the mapped file (one per block)
+struct ResultColumn
+{
+  std::string name;
+  char type;                                // 'd' double, 'i' int64, 's' string
+  std::vector<const char*> chunks;
+  std::vector<uint64_t> chunkBytes;
+};
+
+struct ResultTable
+{
+  std::string name;
+  uint16_t id;
+  uint64_t numberRows;
+  std::vector<ResultColumn> columns;
+};
+
+// a binary file mapped in memory
+class ResultFile
+{
+  public:
+    ResultFile ();
+    ~ResultFile ();
+    bool Open (std::string fileName);
+    void Close ();
+    const ResultTable* GetTable (std::string tableName) const;
+    int32_t GetColumnIndex (const ResultTable* table, std::string columnName) const;
+    std::vector<double> GetDoubles (const ResultTable* table, std::string columnName) const;
+    std::vector<int64_t> GetIntegers (const ResultTable* table, std::string columnName) const;
+    std::vector<std::string> GetStrings (const ResultTable* table, std::string columnName) const;
+    const std::vector<ResultTable>& GetTables () const;
+  private:
+    bool Parse ();
+    const char* data;
+    size_t size;
+    std::string name;
+    std::vector<ResultTable> tables;
+};
+
+ResultFile::ResultFile ()
+{
+  data = NULL;
+  size = 0;
+}
+
+ResultFile::~ResultFile ()
+{
+  Close ();
+}
+
+bool
+ResultFile::Open (std::string fileName)
+{
+  Close ();
+  name = fileName;
+
+  int fd = open (fileName.c_str (), O_RDONLY);
+  if (fd < 0) {
+    std::cerr << "ERROR: the file " << fileName << " cannot be opened\n";
+    return false;
+  }
+
+  struct stat fileStatus;
+  if ((fstat (fd, &fileStatus) < 0) || (fileStatus.st_size == 0)) {
+    std::cerr << "ERROR: the file " << fileName << " is empty\n";
+    close (fd);
+    return false;
+  }
+  size = fileStatus.st_size;
+
+  void* mapped = mmap (NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close (fd);   // the mapping is kept after closing the descriptor
+  if (mapped == MAP_FAILED) {
+    std::cerr << "ERROR: the file " << fileName << " cannot be mapped\n";
+    size = 0;
+    return false;
+  }
+  data = (const char*) mapped;
+
+  if (!Parse ()) {
+    Close ();
+    return false;
+  }
+  return true;
+}
+
+void
+ResultFile::Close ()
+{
+  if (data != NULL)
+    munmap ((void*) data, size);
+  data = NULL;
+  size = 0;
+  tables.clear ();
+}
+
+// it reads the records and finds the chunks of each column. The values are not read
+bool
+ResultFile::Parse ()
+{
+  size_t position = 0;
+
+  // it copies 'bytes' bytes of the file to 'value', checking the end of the file
+  #define READ_FIELD(value, bytes) \
+    if (position + (bytes) > size) { \
+      std::cerr << "ERROR: the file " << name << " is truncated\n"; \
+      return false; \
+    } \
+    memcpy (value, data + position, bytes); \
+    position += bytes;
+
+  char magic[4];
+  uint32_t version;
+  READ_FIELD (magic, 4);
+  READ_FIELD (&version, sizeof (version));
+  if ((memcmp (magic, RESULTS_BINARY_MAGIC, 4) != 0) || (version != RESULTS_BINARY_VERSION)) {
+    std::cerr << "ERROR: the file " << name << " is not a results file of version " << RESULTS_BINARY_VERSION << "\n";
+    return false;
+  }
+
+  // the tables are stored by their position, and they are found by their id
+  std::vector<int32_t> tableOfId;
+
+  while (position < size) {
+    uint8_t record;
+    uint16_t id;
+    READ_FIELD (&record, sizeof (record));
+    READ_FIELD (&id, sizeof (id));
+
+    if (record == 'T') {
+      ResultTable table;
+      uint16_t nameLength;
+      uint32_t numberColumns;
+      table.id = id;
+      table.numberRows = 0;
+      READ_FIELD (&nameLength, sizeof (nameLength));
+      if (position + nameLength > size) {
+        std::cerr << "ERROR: the file " << name << " is truncated\n";
+        return false;
+      }
+      table.name.assign (data + position, nameLength);
+      position += nameLength;
+      READ_FIELD (&numberColumns, sizeof (numberColumns));
+
+      for (uint32_t i = 0; i < numberColumns; i++) {
+        ResultColumn column;
+        uint8_t type;
+        uint16_t length;
+        READ_FIELD (&type, sizeof (type));
+        READ_FIELD (&length, sizeof (length));
+        if ((type != 'd') && (type != 'i') && (type != 's')) {
+          std::cerr << "ERROR: the file " << name << " has a column of an unknown type\n";
+          return false;
+        }
+        if (position + length > size) {
+          std::cerr << "ERROR: the file " << name << " is truncated\n";
+          return false;
+        }
+        column.type = type;
+        column.name.assign (data + position, length);
+        position += length;
+        table.columns.push_back (column);
+      }
+
+      if (tableOfId.size () <= id)
+        tableOfId.resize (id + 1, -1);
+      tableOfId[id] = tables.size ();
+      tables.push_back (table);
+    }
+    else if (record == 'B') {
+      if ((tableOfId.size () <= id) || (tableOfId[id] < 0)) {
+        std::cerr << "ERROR: the file " << name << " has a block of an unknown table\n";
+        return false;
+      }
+      ResultTable& table = tables[tableOfId[id]];
+      uint32_t numberRows;
+      READ_FIELD (&numberRows, sizeof (numberRows));
+      table.numberRows += numberRows;
+
+      for (uint32_t i = 0; i < table.columns.size (); i++) {
+        uint64_t numberBytes;
+        READ_FIELD (&numberBytes, sizeof (numberBytes));
+        // written in this way, so a huge 'numberBytes' does not overflow
+        if (numberBytes > size - position) {
+          std::cerr << "ERROR: the file " << name << " is truncated\n";
+          return false;
+        }
+
+        // the getters copy the chunks without checking them, so each one must have exactly 'numberRows' values
+        bool rightChunk;
+        if (table.columns[i].type != 's')
+          rightChunk = (numberBytes == (uint64_t) numberRows * 8);
+        else {
+          uint64_t numberStrings = 0;
+          uint64_t offset = 0;
+          while (offset + sizeof (uint16_t) <= numberBytes) {
+            uint16_t length;
+            memcpy (&length, data + position + offset, sizeof (length));
+            offset += sizeof (length) + length;
+            numberStrings++;
+          }
+          rightChunk = (offset == numberBytes) && (numberStrings == numberRows);
+        }
+        if (!rightChunk) {
+          std::cerr << "ERROR: the file " << name << " has a block of the table " << table.name
+                    << " whose column " << table.columns[i].name << " does not have " << numberRows << " values\n";
+          return false;
+        }
+
+        table.columns[i].chunks.push_back (data + position);
+        table.columns[i].chunkBytes.push_back (numberBytes);
+        position += numberBytes;
+      }
+    }
+    else {
+      std::cerr << "ERROR: the file " << name << " has an unknown record\n";
+      return false;
+    }
+  }
+  #undef READ_FIELD
+  return true;
+}
+
+// returns NULL if the file does not have this table
+const ResultTable*
+ResultFile::GetTable (std::string tableName) const
+{
+  for (uint32_t i = 0; i < tables.size (); i++)
+    if (tables[i].name == tableName)
+      return &tables[i];
+  return NULL;
+}
+
+const std::vector<ResultTable>&
+ResultFile::GetTables () const
+{
+  return tables;
+}
+
+// returns -1 if the table does not have this column
+int32_t
+ResultFile::GetColumnIndex (const ResultTable* table, std::string columnName) const
+{
+  for (uint32_t i = 0; i < table->columns.size (); i++)
+    if (table->columns[i].name == columnName)
+      return i;
+  return -1;
+}
+
+std::vector<double>
+ResultFile::GetDoubles (const ResultTable* table, std::string columnName) const
+{
+  std::vector<double> values;
+  int32_t index = GetColumnIndex (table, columnName);
+  if ((index < 0) || (table->columns[index].type != 'd'))
+    return values;
+
+  const ResultColumn& column = table->columns[index];
+  values.resize (table->numberRows);
+  size_t row = 0;
+  for (uint32_t c = 0; c < column.chunks.size (); c++) {
+    memcpy (&values[row], column.chunks[c], column.chunkBytes[c]);
+    row += column.chunkBytes[c] / sizeof (double);
+  }
+  return values;
+}
+
+std::vector<int64_t>
+ResultFile::GetIntegers (const ResultTable* table, std::string columnName) const
+{
+  std::vector<int64_t> values;
+  int32_t index = GetColumnIndex (table, columnName);
+  if ((index < 0) || (table->columns[index].type != 'i'))
+    return values;
+
+  const ResultColumn& column = table->columns[index];
+  values.resize (table->numberRows);
+  size_t row = 0;
+  for (uint32_t c = 0; c < column.chunks.size (); c++) {
+    memcpy (&values[row], column.chunks[c], column.chunkBytes[c]);
+    row += column.chunkBytes[c] / sizeof (int64_t);
+  }
+  return values;
+}
+
+std::vector<std::string>
+ResultFile::GetStrings (const ResultTable* table, std::string columnName) const
+{
+  std::vector<std::string> values;
+  int32_t index = GetColumnIndex (table, columnName);
+  if ((index < 0) || (table->columns[index].type != 's'))
+    return values;
+
+  const ResultColumn& column = table->columns[index];
+  values.reserve (table->numberRows);
+  for (uint32_t c = 0; c < column.chunks.size (); c++) {
+    const char* value = column.chunks[c];
+    const char* end = value + column.chunkBytes[c];
+    while (value < end) {
+      uint16_t length;
+      memcpy (&length, value, sizeof (length));
+      value += sizeof (length);
+      values.push_back (std::string (value, length));
+      value += length;
+    }
+  }
+  return values;
+}
+
+
+// print a table as text, like the .txt files. The empty values (NaN, lowest int64) are left blank
+static bool
+dumpTable (const ResultFile& file, const ResultTable* table, std::ostream& out)
+{
+  std::vector<std::vector<double> > doubles (table->columns.size ());
+  std::vector<std::vector<int64_t> > integers (table->columns.size ());
+  std::vector<std::vector<std::string> > strings (table->columns.size ());
+
+  for (uint32_t i = 0; i < table->columns.size (); i++) {
+    if (table->columns[i].type == 'd')
+      doubles[i] = file.GetDoubles (table, table->columns[i].name);
+    else if (table->columns[i].type == 'i')
+      integers[i] = file.GetIntegers (table, table->columns[i].name);
+    else
+      strings[i] = file.GetStrings (table, table->columns[i].name);
+
+    size_t numberValues = doubles[i].size () + integers[i].size () + strings[i].size ();
+    if (numberValues != table->numberRows) {
+      std::cerr << "ERROR: the column " << table->columns[i].name << " of the table " << table->name
+                << " has " << numberValues << " values instead of " << table->numberRows << "\n";
+      return false;
+    }
+  }
+
+  for (uint32_t i = 0; i < table->columns.size (); i++)
+    out << (i == 0 ? "" : "\t") << table->columns[i].name;
+  out << "\n";
+
+  for (uint64_t row = 0; row < table->numberRows; row++) {
+    for (uint32_t i = 0; i < table->columns.size (); i++) {
+      if (i > 0)
+        out << "\t";
+      if (table->columns[i].type == 'd') {
+        if (!std::isnan (doubles[i][row]))
+          out << doubles[i][row];
+      }
+      else if (table->columns[i].type == 'i') {
+        if (integers[i][row] != std::numeric_limits<int64_t>::min ())
+          out << integers[i][row];
+      }
+      else
+        out << strings[i][row];
+    }
+    out << "\n";
+  }
+  return true;
+}
+
+
+// copy the line of _average.txt written by a run with --averageShardDirectory. The shards that are not complete
+//are never found, because each run renames its shard once it has been written
+static bool
+copyAverageShard (std::string fileName, std::ostream& out)
+{
+  std::ifstream shard (fileName, std::ifstream::in | std::ifstream::binary);
+  if (!shard.is_open ()) {
+    std::cerr << "ERROR: the file " << fileName << " cannot be opened\n";
+    return false;
+  }
+  std::ostringstream content;
+  content << shard.rdbuf ();
+  std::string line = content.str ();
+  if (line.empty () || (line[line.size () - 1] != '\n')) {
+    std::cerr << "ERROR: the file " << fileName << " is not a line of _average.txt\n";
+    return false;
+  }
+  out << line;
+  return true;
+}
+
+
+// obtain the line of _average.txt of a run. It is calculated in the same way as at the end of the simulation:
+//the latency and the jitter of VoIP are averaged per packet, and the throughput of TCP and video is added
+static bool
+writeAverage (const ResultFile& file, std::string fileName, std::ostream& out)
+{
+  const ResultTable* run = file.GetTable ("run");
+  const ResultTable* flows = file.GetTable ("flows");
+  if ((run == NULL) || (flows == NULL) || (run->numberRows == 0)) {
+    std::cerr << "ERROR: the file " << fileName << " does not have the tables 'run' and 'flows'. Was it generated with --resultStore=1?\n";
+    return false;
+  }
+
+  std::vector<std::string> surnames = file.GetStrings (run, "outputFileSurname");
+  std::vector<double> simulationTimes = file.GetDoubles (run, "Simulation_time_[s]");
+
+  std::vector<std::string> application = file.GetStrings (flows, "Application");
+  std::vector<int64_t> txPackets = file.GetIntegers (flows, "Num_Tx_Packets");
+  std::vector<int64_t> rxPackets = file.GetIntegers (flows, "Num_Rx_Packets");
+  std::vector<int64_t> rxBytes = file.GetIntegers (flows, "Num_RX_Bytes");
+  std::vector<double> delaySum = file.GetDoubles (flows, "Delay_sum_[s]");
+  std::vector<double> jitterSum = file.GetDoubles (flows, "Jitter_sum_[s]");
+
+  // a column that does not exist, or has another type, is empty
+  if ((surnames.size () != run->numberRows) || (simulationTimes.size () != run->numberRows)) {
+    std::cerr << "ERROR: the table 'run' of the file " << fileName << " does not have the columns outputFileSurname and Simulation_time_[s]\n";
+    return false;
+  }
+  if ((application.size () != flows->numberRows) || (txPackets.size () != flows->numberRows)
+      || (rxPackets.size () != flows->numberRows) || (rxBytes.size () != flows->numberRows)
+      || (delaySum.size () != flows->numberRows) || (jitterSum.size () != flows->numberRows)) {
+    std::cerr << "ERROR: the table 'flows' of the file " << fileName << " does not have the columns Application, Num_Tx_Packets, "
+              << "Num_Rx_Packets, Num_RX_Bytes, Delay_sum_[s] and Jitter_sum_[s]\n";
+    return false;
+  }
+  std::string outputFileSurname = surnames[0];
+  double simulationTime = simulationTimes[0];
+
+  uint32_t number_of_UDP_upload_flows = 0;
+  uint32_t number_of_UDP_download_flows = 0;
+  uint32_t number_of_TCP_upload_flows = 0;
+  uint32_t number_of_TCP_download_flows = 0;
+  uint32_t number_of_video_download_flows = 0;
+
+  uint64_t total_VoIP_upload_tx_packets = 0;
+  uint64_t total_VoIP_upload_rx_packets = 0;
+  double total_VoIP_upload_latency = 0.0;
+  double total_VoIP_upload_jitter = 0.0;
+
+  uint64_t total_VoIP_download_tx_packets = 0;
+  uint64_t total_VoIP_download_rx_packets = 0;
+  double total_VoIP_download_latency = 0.0;
+  double total_VoIP_download_jitter = 0.0;
+
+  double total_TCP_upload_throughput = 0.0;
+  double total_TCP_download_throughput = 0.0;
+  double total_video_download_throughput = 0.0;
+
+  // the rows are in the same order as the flows at the end of the simulation, so the sums are the same
+  for (uint64_t i = 0; i < flows->numberRows; i++) {
+    if (application[i] == "VoIP upload") {
+      total_VoIP_upload_tx_packets += txPackets[i];
+      total_VoIP_upload_rx_packets += rxPackets[i];
+      total_VoIP_upload_latency = total_VoIP_upload_latency + delaySum[i];
+      total_VoIP_upload_jitter = total_VoIP_upload_jitter + jitterSum[i];
+      number_of_UDP_upload_flows ++;
+    } else if (application[i] == "VoIP download") {
+      total_VoIP_download_tx_packets += txPackets[i];
+      total_VoIP_download_rx_packets += rxPackets[i];
+      total_VoIP_download_latency = total_VoIP_download_latency + delaySum[i];
+      total_VoIP_download_jitter = total_VoIP_download_jitter + jitterSum[i];
+      number_of_UDP_download_flows ++;
+    } else if (application[i] == "TCP upload") {
+      total_TCP_upload_throughput = total_TCP_upload_throughput + ( rxBytes[i] * 8.0 / simulationTime );
+      number_of_TCP_upload_flows ++;
+    } else if (application[i] == "TCP download") {
+      total_TCP_download_throughput = total_TCP_download_throughput + ( rxBytes[i] * 8.0 / simulationTime );
+      number_of_TCP_download_flows ++;
+    } else if (application[i] == "Video download") {
+      total_video_download_throughput = total_video_download_throughput + ( rxBytes[i] * 8.0 / simulationTime );
+      number_of_video_download_flows ++;
+    }
+  }
+
+  out << outputFileSurname << "\t"
+      << "Number VoIP upload flows" << "\t"
+      << number_of_UDP_upload_flows << "\t";
+  out << "Average VoIP upload latency [s]" << "\t";
+  if ( total_VoIP_upload_rx_packets > 0 )
+    out << total_VoIP_upload_latency / total_VoIP_upload_rx_packets;
+  out << "\t" << "Average VoIP upload jitter [s]" << "\t";
+  if ( total_VoIP_upload_rx_packets > 0 )
+    out << total_VoIP_upload_jitter / total_VoIP_upload_rx_packets;
+  out << "\t" << "Average VoIP upload loss rate" << "\t";
+  if ( total_VoIP_upload_tx_packets > 0 )
+    out << 1.0 - ( double(total_VoIP_upload_rx_packets) / double(total_VoIP_upload_tx_packets) );
+  out << "\t";
+
+  out << "Number VoIP download flows" << "\t"
+      << number_of_UDP_download_flows << "\t";
+  out << "Average VoIP download latency [s]" << "\t";
+  if ( total_VoIP_download_rx_packets > 0 )
+    out << total_VoIP_download_latency / total_VoIP_download_rx_packets;
+  out << "\t" << "Average VoIP download jitter [s]" << "\t";
+  if ( total_VoIP_download_rx_packets > 0 )
+    out << total_VoIP_download_jitter / total_VoIP_download_rx_packets;
+  out << "\t" << "Average VoIP download loss rate" << "\t";
+  if ( total_VoIP_download_tx_packets > 0 )
+    out << 1.0 - ( double(total_VoIP_download_rx_packets) / double(total_VoIP_download_tx_packets) );
+  out << "\t";
+
+  out << "Number TCP upload flows" << "\t"
+      << number_of_TCP_upload_flows << "\t"
+      << "Total TCP upload throughput [bps]" << "\t"
+      << total_TCP_upload_throughput << "\t"
+
+      << "Number TCP download flows" << "\t"
+      << number_of_TCP_download_flows << "\t"
+      << "Total TCP download throughput [bps]" << "\t"
+      << total_TCP_download_throughput << "\t";
+
+  out << "Number video download flows" << "\t"
+      << number_of_video_download_flows << "\t"
+      << "Total video download throughput [bps]" << "\t"
+      << total_video_download_throughput << "\t";
+
+  out << "Duration of the simulation [s]" << "\t"
+      << simulationTime << "\n";
+
+  return true;
+}
+
+
+int
+main (int argc, char *argv[])
+{
+  std::string averageFileName = "";   // if empty, the lines are printed by the screen
+  std::string dumpTableName = "";
+  std::vector<std::string> fileNames;
+
+  for (int i = 1; i < argc; i++) {
+    std::string argument = argv[i];
+    if (argument.compare (0, 10, "--average=") == 0)
+      averageFileName = argument.substr (10);
+    else if (argument.compare (0, 7, "--dump=") == 0)
+      dumpTableName = argument.substr (7);
+    else if ((argument == "-h") || (argument == "--help")) {
+      std::cout << "Usage: " << argv[0] << " [--average=file] [--dump=table] file1.bin file2.bin ...\n";
+      return 0;
+    }
+    else
+      fileNames.push_back (argument);
+  }
+
+  if (fileNames.empty ()) {
+    std::cerr << "Usage: " << argv[0] << " [--average=file] [--dump=table] file1.bin file2.bin ...\n";
+    return 1;
+  }
+
+  std::ofstream averageFile;
+  if (averageFileName != "") {
+    // with "app", all output operations happen at the end of the file, appending to its existing contents
+    averageFile.open (averageFileName, std::ofstream::out | std::ofstream::app);
+    if (!averageFile.is_open ()) {
+      std::cerr << "ERROR: the file " << averageFileName << " cannot be opened\n";
+      return 1;
+    }
+  }
+  std::ostream& out = (averageFileName != "") ? (std::ostream&) averageFile : std::cout;
+
+  // the lines are written in the order of the names of the files, whatever the order in which the runs finished
+  std::sort (fileNames.begin (), fileNames.end ());
+
+  int errors = 0;
+  for (uint32_t i = 0; i < fileNames.size (); i++) {
+    if ((dumpTableName == "") && (fileNames[i].size () > 4) && (fileNames[i].compare (fileNames[i].size () - 4, 4, ".txt") == 0)) {
+      if (!copyAverageShard (fileNames[i], out))
+        errors++;
+      continue;
+    }
+
+    ResultFile file;
+    if (!file.Open (fileNames[i])) {
+      errors++;
+      continue;
+    }
+
+    if (dumpTableName != "") {
+      const ResultTable* table = file.GetTable (dumpTableName);
+      if (table == NULL) {
+        std::cerr << "ERROR: the file " << fileNames[i] << " does not have the table " << dumpTableName << "\n";
+        errors++;
+        continue;
+      }
+      if (!dumpTable (file, table, std::cout)) {
+        std::cerr << "ERROR: the file " << fileNames[i] << " cannot be dumped\n";
+        errors++;
+      }
+    }
+    else if (!writeAverage (file, fileNames[i], out))
+      errors++;
+  }
+
+  return (errors == 0) ? 0 : 1;
+}
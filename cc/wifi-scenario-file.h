@@ -0,0 +1,257 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * Copyright (c) 2017 Jose Saldana, University of Zaragoza (jsaldana@unizar.es)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation;
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * Scenario files, read by wifi-central-controlled-aggregation_v261.cc (--scenarioFile=file) and by
+ * wifi-sweep-runner.cc (--scenario=file). It does not need ns-3, and it has to be in the same directory
+ * as the .cc files (e.g. ns-3.30.1/scratch).
+ *
+ * Each line of the file is one of these (the text after '#' is a comment):
+ *
+ *   name = value              a parameter of the simulation, with the same name as in the command line
+ *                             (e.g. numberTCPdownload = 3, APsActive = 010111, RngRun = 5)
+ *   include other.scenario    the lines of another file. The path is relative to this file
+ *   sweep name = values       a parameter with a number of values. 'values' is a list (1,2,4) or a
+ *                             range (start:end:step). The sweep runner runs all the combinations.
+ *                             'sweep RngRun = 1:40' are the seeds
+ *   runner name = value       an option of the sweep runner (program, surname, jobs, shards)
+ *
+ * If a parameter is set more than once (e.g. in an included file and after the include), the last value
+ * is used. The sweep runner writes a file of this kind for each run, with the values of that run, so a run
+ * can be reproduced with that file alone
+ */
+
+#ifndef WIFI_SCENARIO_FILE_H
+#define WIFI_SCENARIO_FILE_H
+
+#include <stdint.h>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <utility>
+
+#define SCENARIO_MAX_INCLUDE_DEPTH 16   // avoids a loop if a file includes itself
+
+
+// a list "1,2,4" or a range "start:end:step" (the step is 1 if it is not set)
+inline bool
+parseScenarioValues (std::string text, std::vector<std::string>& values)
+{
+  if (text.find (':') == std::string::npos) {
+    std::istringstream list (text);
+    std::string value;
+    while (std::getline (list, value, ',')) {
+      size_t first = value.find_first_not_of (" \t");
+      size_t last = value.find_last_not_of (" \t");
+      if (first != std::string::npos)
+        values.push_back (value.substr (first, last - first + 1));
+    }
+    return !values.empty ();
+  }
+
+  double start, end, step = 1.0;
+  char separator;
+  std::istringstream range (text);
+  range >> start >> separator >> end;
+  if (range.fail ())
+    return false;
+  if (range >> separator)
+    range >> step;
+  if (step <= 0.0)
+    return false;
+
+  // 'step / 1000' avoids losing the last value due to the rounding
+  for (double value = start; value <= end + step / 1000.0; value += step) {
+    std::ostringstream valueText;
+    valueText << value;
+    values.push_back (valueText.str ());
+  }
+  return !values.empty ();
+}
+
+
+class ScenarioFile
+{
+  public:
+    typedef std::vector<std::pair<std::string, std::string> > Entries;   // in the order of the file
+
+    bool Load (std::string fileName);
+    bool Write (std::string fileName) const;
+    void Set (std::string name, std::string value);
+    std::string Get (std::string name) const;
+    bool Has (std::string name) const;
+
+    Entries parameters;
+    Entries sweeps;           // the values are not parsed yet (see parseScenarioValues)
+    Entries runnerOptions;
+    std::string error;        // the reason why Load failed
+
+  private:
+    bool LoadFile (std::string fileName, uint32_t depth);
+    static void SetEntry (Entries& entries, std::string name, std::string value);
+};
+
+// the entries are added to the ones already loaded
+inline bool
+ScenarioFile::Load (std::string fileName)
+{
+  error = "";
+  return LoadFile (fileName, 0);
+}
+
+inline bool
+ScenarioFile::LoadFile (std::string fileName, uint32_t depth)
+{
+  if (depth > SCENARIO_MAX_INCLUDE_DEPTH) {
+    error = fileName + ": too many nested includes";
+    return false;
+  }
+
+  std::ifstream ifs (fileName);
+  if (!ifs.is_open ()) {
+    error = fileName + ": the file cannot be opened";
+    return false;
+  }
+
+  // the included files are found from the directory of this one
+  std::string directory = "";
+  if (fileName.find ('/') != std::string::npos)
+    directory = fileName.substr (0, fileName.rfind ('/') + 1);
+
+  std::string line;
+  uint32_t lineNumber = 0;
+  while (std::getline (ifs, line)) {
+    lineNumber++;
+    std::ostringstream where;
+    where << fileName << ":" << lineNumber << ": ";
+
+    if (line.find ('#') != std::string::npos)
+      line = line.substr (0, line.find ('#'));
+    size_t first = line.find_first_not_of (" \t\r");
+    if (first == std::string::npos)
+      continue;
+    line = line.substr (first, line.find_last_not_of (" \t\r") - first + 1);
+
+    // the first word may be a keyword
+    size_t endOfWord = line.find_first_of (" \t=");
+    std::string keyword = line.substr (0, endOfWord);
+    if (((keyword == "include") || (keyword == "sweep") || (keyword == "runner"))
+        && ((endOfWord == std::string::npos) || (line.find_first_not_of (" \t", endOfWord) == std::string::npos))) {
+      error = where.str () + "nothing after '" + keyword + "'";
+      return false;
+    }
+
+    if (keyword == "include") {
+      std::string includedFile = line.substr (line.find_first_not_of (" \t", endOfWord));
+      if ((includedFile[0] != '/') && (directory != ""))
+        includedFile = directory + includedFile;
+      if (!LoadFile (includedFile, depth + 1))
+        return false;
+      continue;
+    }
+
+    Entries* entries = &parameters;
+    if ((keyword == "sweep") || (keyword == "runner")) {
+      entries = (keyword == "sweep") ? &sweeps : &runnerOptions;
+      line = line.substr (line.find_first_not_of (" \t", endOfWord));
+    }
+
+    size_t equal = line.find ('=');
+    if (equal == std::string::npos) {
+      error = where.str () + "'name = value' expected";
+      return false;
+    }
+    std::string name = line.substr (0, line.find_last_not_of (" \t", equal - 1) + 1);
+    std::string value = line.substr (equal + 1);
+    size_t firstOfValue = value.find_first_not_of (" \t");
+    value = (firstOfValue == std::string::npos) ? "" : value.substr (firstOfValue);
+    if ((equal == 0) || (name.find_first_of (" \t") != std::string::npos)) {
+      error = where.str () + "wrong name of parameter";
+      return false;
+    }
+
+    if (entries == &sweeps) {
+      std::vector<std::string> values;
+      if (!parseScenarioValues (value, values)) {
+        error = where.str () + "wrong values of the sweep of " + name;
+        return false;
+      }
+    }
+    SetEntry (*entries, name, value);
+  }
+  return true;
+}
+
+// if the entry exists, its value is replaced. Otherwise, it is added at the end
+inline void
+ScenarioFile::SetEntry (Entries& entries, std::string name, std::string value)
+{
+  for (uint32_t i = 0; i < entries.size (); i++)
+    if (entries[i].first == name) {
+      entries[i].second = value;
+      return;
+    }
+  entries.push_back (std::make_pair (name, value));
+}
+
+// set a parameter of the simulation. If it had a sweep, the sweep is removed
+inline void
+ScenarioFile::Set (std::string name, std::string value)
+{
+  for (Entries::iterator i = sweeps.begin (); i != sweeps.end (); ++i)
+    if (i->first == name) {
+      sweeps.erase (i);
+      break;
+    }
+  SetEntry (parameters, name, value);
+}
+
+// empty if the parameter is not set
+inline std::string
+ScenarioFile::Get (std::string name) const
+{
+  for (uint32_t i = 0; i < parameters.size (); i++)
+    if (parameters[i].first == name)
+      return parameters[i].second;
+  return "";
+}
+
+inline bool
+ScenarioFile::Has (std::string name) const
+{
+  for (uint32_t i = 0; i < parameters.size (); i++)
+    if (parameters[i].first == name)
+      return true;
+  return false;
+}
+
+// the file has all the entries, without includes
+inline bool
+ScenarioFile::Write (std::string fileName) const
+{
+  std::ofstream ofs (fileName, std::ofstream::out | std::ofstream::trunc);
+  for (uint32_t i = 0; i < parameters.size (); i++)
+    ofs << parameters[i].first << " = " << parameters[i].second << "\n";
+  for (uint32_t i = 0; i < sweeps.size (); i++)
+    ofs << "sweep " << sweeps[i].first << " = " << sweeps[i].second << "\n";
+  for (uint32_t i = 0; i < runnerOptions.size (); i++)
+    ofs << "runner " << runnerOptions[i].first << " = " << runnerOptions[i].second << "\n";
+  ofs.close ();
+  return !ofs.fail ();
+}
+
+#endif /* WIFI_SCENARIO_FILE_H */
@@ -0,0 +1,575 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * Copyright (c) 2017 Jose Saldana, University of Zaragoza (jsaldana@unizar.es)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation;
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * Runs the tests of a figure (a grid of parameters x a range of seeds) in parallel, instead of the loops
+ * of the .sh files. Each run is a separate process of the ns-3 program, so they do not share anything.
+ * It does not need ns-3, but wifi-scenario-file.h has to be in the same directory:
+ *
+ *   g++ -O2 -std=c++11 -o wifi-sweep-runner wifi-sweep-runner.cc
+ *
+ * The ns-3 program has to be built before (./waf -d optimized build). It is run directly, so waf does not
+ * check the build again for each run. From the ns-3.30.1 directory:
+ *
+ *   LD_LIBRARY_PATH=build/lib ./wifi-sweep-runner \
+ *     --program=build/scratch/wifi-central-controlled-aggregation_v261 \
+ *     --outputFileName=test_lvap_016 \
+ *     --grid=numberTCPdownload=1:6:1 --seeds=1:40 \
+ *     --surname=TcpDownUsers-{numberTCPdownload}_seed-{seed} \
+ *     -- --simulationTime=120.0001 --numberVoIPupload=0 ... (the rest of the parameters of the .sh file)
+ *
+ * or, with all the parameters, the sweeps and the options of the runner in a scenario file (see the format in
+ * wifi-scenario-file.h):
+ *
+ *   LD_LIBRARY_PATH=build/lib ./wifi-sweep-runner --scenario=test_lvap_016.scenario
+ *
+ * Options (they have priority over the ones of the scenario file):
+ *   --scenario=file         the scenario file. 'sweep' lines are parameters of the grid ('sweep RngRun' are
+ *                           the seeds), and 'runner' lines are options of the runner (program, surname, jobs, shards)
+ *   --program=path          the ns-3 program
+ *   --outputFileName=name   passed to each run. The lines of all the runs are added to name_average.txt
+ *   --grid=param=values     a parameter of the grid. 'values' is a list (1,2,4) or a range (start:end:step).
+ *                           It can be used a number of times: all the combinations are run
+ *   --seeds=first:last      the seeds (RngRun) of each combination, as a range or a list (1,5,9). Default 1
+ *   --surname=template      the outputFileSurname of each run. {param} is replaced by the value of a parameter
+ *                           of the grid, and {seed} by the seed. Default: param-value_..._seed-N. The surnames of
+ *                           the runs have to be different
+ *   --jobs=N                number of runs at the same time. Default: the number of cores
+ *   --batch=N               number of runs done one after the other by each process (--replications of the
+ *                           ns-3 program), so the start of the process is paid once. Default 1
+ *   --shards=dir            directory of the files of each run. Default: name_shards
+ *   --dryRun                print the commands, but do not run them
+ *   --                      the rest of the parameters are passed to all the runs
+ *
+ * The runs that are expected to be longer are started first, so the last ones do not leave the cores idle.
+ * The length is estimated as simulationTime x (1 + number of users), with the parameters numberVoIPupload,
+ * numberVoIPdownload, numberTCPupload, numberTCPdownload and numberVideoDownload.
+ *
+ * All the parameters of each run (including its seed) are written to shards/name_surname.scenario, and the
+ * run is started with --scenarioFile=that file, so it can be repeated exactly with that file alone.
+ * Each run writes its line of _average.txt to the shards directory (--averageShardDirectory), and its
+ * output to shards/name_surname.log (shards/name_batch-N.log with --batch). A run only writes its averages if
+ * it finishes correctly, so the runs of a batch that failed are the ones without averages. When all the runs have finished,
+ * the lines are appended to
+ * name_average.txt, in the order of the grid and the seeds.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <algorithm>
+#include "wifi-scenario-file.h"
+
+// a parameter of the grid, with all its values
+struct GridParameter
+{
+  std::string name;
+  std::vector<std::string> values;
+};
+
+// a run of the ns-3 program
+struct Run
+{
+  uint32_t order;                         // position in the grid. The averages are written in this order
+  ScenarioFile scenario;                  // all the parameters of the run
+  std::string scenarioFileName;
+  uint32_t seed;
+  std::string surname;
+  double estimatedCost;
+  int status;
+};
+
+// the runs done by a process: one, or a number of them with --batch
+struct Job
+{
+  std::vector<uint32_t> runs;
+  std::string name;
+  std::string argument;                   // --scenarioFile=file, or --replications=file
+  std::string logFileName;
+  double startTime;
+};
+
+
+static double
+wallClock ()
+{
+  struct timeval now;
+  gettimeofday (&now, NULL);
+  return now.tv_sec + now.tv_usec / 1000000.0;
+}
+
+// the runs with more simulated time and more users are expected to be longer
+static double
+estimateCost (const ScenarioFile& scenario)
+{
+  const char* users[] = { "numberVoIPupload", "numberVoIPdownload", "numberTCPupload", "numberTCPdownload", "numberVideoDownload" };
+
+  std::string simulationTime = scenario.Get ("simulationTime");
+  double cost = (simulationTime != "") ? atof (simulationTime.c_str ()) : 10.0;
+
+  double numberUsers = 0.0;
+  for (uint32_t i = 0; i < sizeof (users) / sizeof (users[0]); i++)
+    numberUsers += atof (scenario.Get (users[i]).c_str ());
+  return cost * (1.0 + numberUsers);
+}
+
+static std::string
+buildSurname (std::string surnameTemplate,
+              const std::vector<GridParameter>& grid,
+              const std::vector<uint32_t>& valueIndex,
+              uint32_t seed)
+{
+  std::ostringstream seedText;
+  seedText << seed;
+
+  if (surnameTemplate == "") {
+    std::string surname = "";
+    for (uint32_t p = 0; p < grid.size (); p++)
+      surname += grid[p].name + "-" + grid[p].values[valueIndex[p]] + "_";
+    return surname + "seed-" + seedText.str ();
+  }
+
+  std::string surname = surnameTemplate;
+  for (uint32_t p = 0; p <= grid.size (); p++) {
+    std::string key = (p < grid.size ()) ? "{" + grid[p].name + "}" : "{seed}";
+    std::string value = (p < grid.size ()) ? grid[p].values[valueIndex[p]] : seedText.str ();
+    size_t position;
+    while ((position = surname.find (key)) != std::string::npos)
+      surname.replace (position, key.size (), value);
+  }
+  return surname;
+}
+
+// start a job in a new process. All the parameters are in 'argument' (a scenario file, or a file of replications,
+//each one with its scenario file). Its output is written to 'logFileName'
+static pid_t
+startJob (std::string program, std::string argument, std::string logFileName)
+{
+  pid_t pid = fork ();
+  if (pid != 0)
+    return pid;   // the parent (or -1 if the process could not be created)
+
+  // the child
+  int log = open (logFileName.c_str (), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (log >= 0) {
+    dup2 (log, STDOUT_FILENO);
+    dup2 (log, STDERR_FILENO);
+    close (log);
+  }
+
+  // the seed is in the scenario file (RngRun), so it is set by the command line parser of ns-3
+  std::vector<char*> argv;
+  argv.push_back ((char*) program.c_str ());
+  argv.push_back ((char*) argument.c_str ());
+  argv.push_back (NULL);
+
+  execv (program.c_str (), &argv[0]);
+  std::cerr << "ERROR: " << program << " cannot be run: " << strerror (errno) << "\n";
+  _exit (127);
+}
+
+static void
+printUsage (const char* name)
+{
+  std::cerr << "Usage: " << name << " [--scenario=file] --program=path --outputFileName=name [--grid=param=values ...]\n"
+            << "       [--seeds=first:last|s1,s2,...] [--surname=template] [--jobs=N] [--batch=N] [--shards=dir] [--dryRun]\n"
+            << "       [-- parameters of all the runs]\n";
+}
+
+
+int
+main (int argc, char *argv[])
+{
+  // the empty values are taken from the scenario file, or from the defaults
+  std::string scenarioFileName = "";
+  std::string program = "";
+  std::string outputFileName = "";
+  std::string surnameTemplate = "";
+  std::string shardDirectory = "";
+  std::string seeds = "";
+  uint32_t jobs = 0;
+  uint32_t batch = 1;
+  bool dryRun = false;
+  std::vector<GridParameter> grid;
+  std::vector<std::string> fixedArguments;
+
+  for (int i = 1; i < argc; i++) {
+    std::string argument = argv[i];
+    if (argument == "--") {
+      for (i++; i < argc; i++)
+        fixedArguments.push_back (argv[i]);
+    }
+    else if (argument.compare (0, 11, "--scenario=") == 0)
+      scenarioFileName = argument.substr (11);
+    else if (argument.compare (0, 10, "--program=") == 0)
+      program = argument.substr (10);
+    else if (argument.compare (0, 17, "--outputFileName=") == 0)
+      outputFileName = argument.substr (17);
+    else if (argument.compare (0, 10, "--surname=") == 0)
+      surnameTemplate = argument.substr (10);
+    else if (argument.compare (0, 9, "--shards=") == 0)
+      shardDirectory = argument.substr (9);
+    else if (argument.compare (0, 7, "--jobs=") == 0)
+      jobs = atoi (argument.substr (7).c_str ());
+    else if (argument.compare (0, 8, "--batch=") == 0)
+      batch = atoi (argument.substr (8).c_str ());
+    else if (argument == "--dryRun")
+      dryRun = true;
+    else if (argument.compare (0, 8, "--seeds=") == 0)
+      seeds = argument.substr (8);
+    else if (argument.compare (0, 7, "--grid=") == 0) {
+      GridParameter parameter;
+      size_t equal = argument.find ('=', 7);
+      if (equal != std::string::npos) {
+        parameter.name = argument.substr (7, equal - 7);
+        parseScenarioValues (argument.substr (equal + 1), parameter.values);
+      }
+      if ((parameter.name == "") || parameter.values.empty ()) {
+        std::cerr << "ERROR: wrong parameter of the grid " << argument << "\n";
+        return 1;
+      }
+      grid.push_back (parameter);
+    }
+    else {
+      std::cerr << "ERROR: unknown option " << argument << "\n";
+      printUsage (argv[0]);
+      return 1;
+    }
+  }
+
+  // the parameters that are the same in all the runs
+  ScenarioFile baseScenario;
+  if ((scenarioFileName != "") && !baseScenario.Load (scenarioFileName)) {
+    std::cerr << "ERROR: " << baseScenario.error << "\n";
+    return 1;
+  }
+
+  for (uint32_t i = 0; i < baseScenario.runnerOptions.size (); i++) {
+    std::string name = baseScenario.runnerOptions[i].first;
+    std::string value = baseScenario.runnerOptions[i].second;
+    if ((name == "program") && (program == ""))
+      program = value;
+    else if ((name == "surname") && (surnameTemplate == ""))
+      surnameTemplate = value;
+    else if ((name == "shards") && (shardDirectory == ""))
+      shardDirectory = value;
+    else if ((name == "jobs") && (jobs == 0))
+      jobs = atoi (value.c_str ());
+    else if ((name != "program") && (name != "surname") && (name != "shards") && (name != "jobs")) {
+      std::cerr << "ERROR: unknown option of the runner " << name << " in " << scenarioFileName << "\n";
+      return 1;
+    }
+  }
+
+  // the sweeps of the file are parameters of the grid, unless the command line also has them. RngRun are the seeds
+  for (uint32_t i = 0; i < baseScenario.sweeps.size (); i++) {
+    std::string name = baseScenario.sweeps[i].first;
+    if (name == "RngRun") {
+      if (seeds == "")
+        seeds = baseScenario.sweeps[i].second;
+      continue;
+    }
+    bool inCommandLine = false;
+    for (uint32_t p = 0; p < grid.size (); p++)
+      if (grid[p].name == name)
+        inCommandLine = true;
+    if (inCommandLine)
+      continue;
+    GridParameter parameter;
+    parameter.name = name;
+    parseScenarioValues (baseScenario.sweeps[i].second, parameter.values);
+    grid.push_back (parameter);
+  }
+
+  // the parameters after '--' have priority over the ones of the file
+  for (uint32_t i = 0; i < fixedArguments.size (); i++) {
+    std::string argument = fixedArguments[i];
+    if (argument.compare (0, 2, "--") != 0) {
+      std::cerr << "ERROR: wrong parameter " << argument << ". It should be --name=value\n";
+      return 1;
+    }
+    size_t equal = argument.find ('=');
+    if (equal == std::string::npos)
+      baseScenario.Set (argument.substr (2), "true");
+    else
+      baseScenario.Set (argument.substr (2, equal - 2), argument.substr (equal + 1));
+  }
+
+  if (outputFileName == "")
+    outputFileName = baseScenario.Get ("outputFileName");
+  if (jobs == 0)
+    jobs = sysconf (_SC_NPROCESSORS_ONLN);
+  if (seeds == "")
+    seeds = "1";
+  std::vector<std::string> seedValues;
+  if (!parseScenarioValues (seeds, seedValues)) {
+    std::cerr << "ERROR: wrong seeds " << seeds << "\n";
+    return 1;
+  }
+  // a list (1,5,9) is not a range, so each value is used as it is
+  std::vector<uint32_t> seedList;
+  for (uint32_t i = 0; i < seedValues.size (); i++) {
+    char* end;
+    unsigned long seed = strtoul (seedValues[i].c_str (), &end, 10);
+    if ((*end != '\0') || (seed == 0)) {
+      std::cerr << "ERROR: wrong seed " << seedValues[i] << " in " << seeds << "\n";
+      return 1;
+    }
+    seedList.push_back (seed);
+  }
+
+  if ((program == "") || (outputFileName == "") || (jobs == 0) || (batch == 0)) {
+    printUsage (argv[0]);
+    return 1;
+  }
+  if (shardDirectory == "")
+    shardDirectory = outputFileName + "_shards";
+
+
+  // all the combinations of the grid, and all the seeds of each one
+  std::vector<Run> runs;
+  std::vector<uint32_t> valueIndex (grid.size (), 0);
+  bool moreCombinations = true;
+  while (moreCombinations) {
+    for (uint32_t s = 0; s < seedList.size (); s++) {
+      uint32_t seed = seedList[s];
+      Run run;
+      run.order = runs.size ();
+      run.seed = seed;
+      run.surname = buildSurname (surnameTemplate, grid, valueIndex, seed);
+
+      // 'Set' removes the sweep of the parameter, so the file of the run has no sweeps
+      std::ostringstream seedText;
+      seedText << seed;
+      run.scenario = baseScenario;
+      for (uint32_t p = 0; p < grid.size (); p++)
+        run.scenario.Set (grid[p].name, grid[p].values[valueIndex[p]]);
+      run.scenario.Set ("RngRun", seedText.str ());
+      run.scenario.Set ("outputFileName", outputFileName);
+      run.scenario.Set ("outputFileSurname", run.surname);
+      run.scenario.Set ("averageShardDirectory", shardDirectory);
+      run.scenario.runnerOptions.clear ();
+      run.scenarioFileName = shardDirectory + "/" + outputFileName + "_" + run.surname + ".scenario";
+      run.estimatedCost = estimateCost (run.scenario);
+      run.status = -1;
+      runs.push_back (run);
+    }
+
+    // next combination. The last parameter changes first
+    moreCombinations = false;
+    for (int32_t p = grid.size () - 1; p >= 0; p--) {
+      if (++valueIndex[p] < grid[p].values.size ()) {
+        moreCombinations = true;
+        break;
+      }
+      valueIndex[p] = 0;
+    }
+  }
+
+  // two runs with the same surname would overwrite the files of each other
+  std::map<std::string, uint32_t> surnames;
+  for (uint32_t i = 0; i < runs.size (); i++) {
+    std::map<std::string, uint32_t>::iterator found = surnames.find (runs[i].surname);
+    if (found != surnames.end ()) {
+      std::cerr << "ERROR: the runs " << found->second << " and " << i << " have the same surname " << runs[i].surname
+                << ". The surname has to include {seed} and the parameters of the grid\n";
+      return 1;
+    }
+    surnames[runs[i].surname] = i;
+  }
+
+  // the longest runs first. For the same cost, the order of the grid
+  std::vector<uint32_t> pending;
+  for (uint32_t i = 0; i < runs.size (); i++)
+    pending.push_back (i);
+  std::stable_sort (pending.begin (), pending.end (),
+                    [&runs] (uint32_t a, uint32_t b) { return runs[a].estimatedCost > runs[b].estimatedCost; });
+
+  // the runs are grouped in this order, so the longest jobs are also the first ones
+  std::vector<Job> jobList;
+  for (uint32_t i = 0; i < pending.size (); i += batch) {
+    Job job;
+    for (uint32_t j = i; (j < i + batch) && (j < pending.size ()); j++)
+      job.runs.push_back (pending[j]);
+    if (batch == 1) {
+      job.name = runs[job.runs[0]].surname;
+      job.argument = "--scenarioFile=" + runs[job.runs[0]].scenarioFileName;
+    }
+    else {
+      std::ostringstream name;
+      name << "batch-" << jobList.size ();
+      job.name = name.str ();
+      job.argument = "--replications=" + shardDirectory + "/" + outputFileName + "_" + job.name + ".replications";
+    }
+    job.logFileName = shardDirectory + "/" + outputFileName + "_" + job.name + ".log";
+    job.startTime = 0.0;
+    jobList.push_back (job);
+  }
+
+  if (dryRun) {
+    for (uint32_t i = 0; i < jobList.size (); i++) {
+      std::cout << program << " " << jobList[i].argument << "\n";
+      for (uint32_t r = 0; r < jobList[i].runs.size (); r++) {
+        const Run& run = runs[jobList[i].runs[r]];
+        std::cout << "\t" << run.scenarioFileName << ":";
+        for (uint32_t p = 0; p < run.scenario.parameters.size (); p++)
+          std::cout << " --" << run.scenario.parameters[p].first << "=" << run.scenario.parameters[p].second;
+        std::cout << "\n";
+      }
+    }
+    return 0;
+  }
+
+  mkdir (shardDirectory.c_str (), 0755);
+
+  std::cout << runs.size () << " runs of " << program << " in " << jobs << " processes";
+  if (batch > 1)
+    std::cout << ", " << batch << " runs per process";
+  std::cout << std::endl;
+
+  // start the jobs, and wait for them to finish
+  std::map<pid_t, uint32_t> running;
+  uint32_t next = 0;
+  uint32_t finished = 0;
+  uint32_t failed = 0;
+  double sweepStartTime = wallClock ();
+
+  while ((next < jobList.size ()) || !running.empty ()) {
+    while ((next < jobList.size ()) && (running.size () < jobs)) {
+      Job& job = jobList[next++];
+
+      // the files of the runs of the job
+      bool written = true;
+      std::ofstream replications;
+      if (batch > 1)
+        replications.open (job.argument.substr (15));
+      for (uint32_t r = 0; r < job.runs.size (); r++) {
+        const Run& run = runs[job.runs[r]];
+        // the averages of a previous sweep with the same name must not be taken as the ones of this run
+        unlink ((shardDirectory + "/" + outputFileName + "_" + run.surname + "_average.txt").c_str ());
+        written = written && run.scenario.Write (run.scenarioFileName);
+        if (batch > 1)
+          replications << "--scenarioFile=" << run.scenarioFileName << "\n";
+      }
+      if (batch > 1) {
+        replications.close ();
+        written = written && !replications.fail ();
+      }
+
+      pid_t pid = -1;
+      if (!written)
+        std::cerr << "ERROR: the files of " << job.name << " cannot be written in " << shardDirectory << "\n";
+      else {
+        job.startTime = wallClock ();
+        pid = startJob (program, job.argument, job.logFileName);
+        if (pid < 0)
+          std::cerr << "ERROR: the process of " << job.name << " cannot be created: " << strerror (errno) << "\n";
+      }
+      if (pid < 0) {
+        for (uint32_t r = 0; r < job.runs.size (); r++)
+          runs[job.runs[r]].status = 127;
+        failed += job.runs.size ();
+        finished += job.runs.size ();
+        continue;
+      }
+      running[pid] = next - 1;
+    }
+
+    if (running.empty ())
+      continue;
+
+    int status;
+    pid_t pid = waitpid (-1, &status, 0);
+    if (pid < 0) {
+      if (errno == EINTR)
+        continue;
+      std::cerr << "ERROR: waitpid: " << strerror (errno) << "\n";
+      return 1;
+    }
+    std::map<pid_t, uint32_t>::iterator found = running.find (pid);
+    if (found == running.end ())
+      continue;
+
+    Job& job = jobList[found->second];
+    running.erase (found);
+    int jobStatus = WIFEXITED (status) ? WEXITSTATUS (status) : 128 + WTERMSIG (status);
+    // in a batch, a replication that fails does not stop the rest. A replication only writes its averages if it
+    //has finished correctly, so they tell which ones failed
+    std::set<uint32_t> failedRuns;
+    for (uint32_t r = 0; r < job.runs.size (); r++) {
+      Run& run = runs[job.runs[r]];
+      run.status = jobStatus;
+      if (batch > 1) {
+        bool averagesWritten = (access ((shardDirectory + "/" + outputFileName + "_" + run.surname + "_average.txt").c_str (), F_OK) == 0);
+        if (averagesWritten)
+          run.status = 0;
+        else if (jobStatus == 0)
+          run.status = 1;
+      }
+      if (run.status != 0)
+        failedRuns.insert (job.runs[r]);
+    }
+    finished += job.runs.size ();
+    failed += failedRuns.size ();
+
+    std::cout << "[" << finished << "/" << runs.size () << "] "
+              << job.name
+              << (failedRuns.empty () ? " finished" : " FAILED")
+              << " in " << wallClock () - job.startTime << " s"
+              << " (total " << wallClock () - sweepStartTime << " s)";
+    if (jobStatus != 0)
+      std::cout << ". Exit status " << jobStatus;
+    if (!failedRuns.empty ())
+      std::cout << ". See " << job.logFileName;
+    std::cout << std::endl;
+    if (batch > 1)
+      for (std::set<uint32_t>::iterator r = failedRuns.begin (); r != failedRuns.end (); ++r)
+        std::cout << "\t" << runs[*r].surname << " FAILED" << std::endl;
+  }
+
+
+  // add the lines of the runs to _average.txt, in the order of the grid
+  std::ofstream average;
+  average.open (outputFileName + "_average.txt", std::ofstream::out | std::ofstream::app); // with "app", all output operations happen at the end of the file, appending to its existing contents
+  for (uint32_t i = 0; i < runs.size (); i++) {
+    std::ifstream shard (shardDirectory + "/" + outputFileName + "_" + runs[i].surname + "_average.txt");
+    if (!shard.is_open ()) {
+      if (runs[i].status == 0)
+        std::cerr << "ERROR: the run " << runs[i].surname << " did not write its averages\n";
+      continue;
+    }
+    average << shard.rdbuf ();
+  }
+  average.close ();
+
+  std::cout << runs.size () - failed << " runs finished correctly, " << failed << " failed. "
+            << "Averages added to " << outputFileName << "_average.txt" << std::endl;
+
+  return (failed == 0) ? 0 : 1;
+}